@@ -34,6 +34,9 @@ namespace keyleds {
  * Holds compiled information about all recognised keys on an active device.
  * It guarantees iterators and pointers to individual keys will remain valid
  * throughout its lifetime.
+ *
+ * Lookups by key code and by name run in constant time, using indexes built
+ * once at construction.
  */
 class KeyDatabase final
 {
@@ -61,6 +64,7 @@ private:
 
     using key_list = std::vector<Key>;
     using relation_list = std::vector<Relation>;
+    using index_list = std::vector<Key::index_type>;
 public:
     using value_type = key_list::value_type;
     using const_reference = key_list::const_reference;
@@ -70,7 +74,11 @@ public:
 public:
                     KeyDatabase() = default;
     explicit        KeyDatabase(key_list keys);
+                    KeyDatabase(const KeyDatabase &) = default;
+                    KeyDatabase(KeyDatabase &&) noexcept = default;
                     ~KeyDatabase();
+    KeyDatabase &   operator=(const KeyDatabase &) = default;
+    KeyDatabase &   operator=(KeyDatabase &&) noexcept = default;
 
     const_iterator  findKeyCode(int keyCode) const;
     const_iterator  findName(const char * name) const;
@@ -92,11 +100,15 @@ public:
 
 private:
     static relation_list computeRelations(const key_list &);
+    static index_list    buildCodeIndex(const key_list &);
+    static index_list    buildNameIndex(const key_list &);
 
 private:
     key_list        m_keys;         ///< Vector of all keys known for a device
     Rect            m_bounds;       ///< Bounds of m_keys' positions
     relation_list   m_relations;    ///< Pre-computed relation array
+    index_list      m_codeIndex;    ///< Key index for each key code, direct mapping
+    index_list      m_nameIndex;    ///< Open-addressing hash table of key indices, by name
 };
 
 /****************************************************************************/
@@ -32,7 +32,7 @@ namespace keyleds {
  *
  * Holds RGBA color entries for all keys of a device. All key blocks are in the
  * same memory area. Each block is contiguous, but padding keys may be inserted
- * in between blocks so blocks are SSE2-aligned. The buffers is addressed through
+ * in between blocks so blocks are SIMD-aligned. The buffers is addressed through
  * a 2-tuple containing the block index and key index within block. No ordering
  * is enforce on blocks or keys, but the for_device static method uses the same
  * order that is detected on the device by the keyleds::Device object.
@@ -87,6 +87,8 @@ private:
 void swap(RenderTarget &, RenderTarget &) noexcept;
 void blend(RenderTarget &, const RenderTarget &) noexcept;
 void multiply(RenderTarget &, const RenderTarget &) noexcept;
+void diff(uint8_t * changes, const RenderTarget &, const RenderTarget &) noexcept;
+inline std::size_t diffBitmapSize(const RenderTarget & target) { return target.capacity() / 8; }
 
 /****************************************************************************/
 
@@ -147,6 +149,25 @@ inline void multiply(RenderTarget & lhs, const RenderTarget & rhs) noexcept
                 reinterpret_cast<const uint8_t*>(rhs.data()), rhs.capacity());
 }
 
+/** Compares two targets
+ * @param[out] changes Bitmap of entries that differ, at least diffBitmapSize() bytes long.
+ *                     Bits past the size of targets are undefined.
+ */
+inline void diff(uint8_t * changes, const RenderTarget & lhs, const RenderTarget & rhs) noexcept
+{
+    assert(lhs.capacity() == rhs.capacity());
+    tools::diff(changes, reinterpret_cast<const uint8_t*>(lhs.data()),
+                reinterpret_cast<const uint8_t*>(rhs.data()), rhs.capacity());
+}
+
+template <typename A>
+inline void diff(uint8_t * changes, const RenderTarget & lhs, const RenderTarget & rhs) noexcept
+{
+    assert(lhs.capacity() == rhs.capacity());
+    A::diff(changes, reinterpret_cast<const uint8_t*>(lhs.data()),
+            reinterpret_cast<const uint8_t*>(rhs.data()), rhs.capacity());
+}
+
 } // keyleds
 
 #endif
@@ -0,0 +1,157 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_COMPILEDLAYOUT_H_6A0D93E2
+#define KEYLEDSD_COMPILEDLAYOUT_H_6A0D93E2
+#ifndef KEYLEDSD_INTERNAL
+#   error "Internal header - must not be pulled into plugins"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace keyleds::device {
+
+struct LayoutDescription;
+
+/****************************************************************************/
+
+/** Compiled keyboard layout
+ *
+ * Binary form of a LayoutDescription, meant to be mapped in memory and used in
+ * place. Keys are sorted by block and code, so lookups are binary searches, and
+ * key names live in a trailing string table.
+ *
+ * Compiled layouts record the modification time and size of the file they
+ * were built from, so stale ones can be detected. The format is native-endian
+ * and versioned: files from another version or architecture are rejected.
+ */
+class CompiledLayout final
+{
+public:
+    using block_type = std::uint32_t;
+    using code_type = std::uint32_t;
+
+    /// Identifies the layout file a compiled layout was built from
+    struct Source final
+    {
+        std::int64_t    mtime;          ///< Modification time, in seconds since epoch
+        std::uint64_t   size;           ///< File size, in bytes
+
+        bool operator==(const Source & other) const
+            { return mtime == other.mtime && size == other.size; }
+        bool operator!=(const Source & other) const { return !(*this == other); }
+    };
+
+    struct Key final
+    {
+        block_type      block;          ///< Block identifier
+        code_type       code;           ///< Key identifier within block
+        std::uint32_t   x0, y0, x1, y1; ///< Physical key bounds
+        std::uint32_t   nameOffset;     ///< Offset of key name in string table
+        std::uint32_t   nameLength;     ///< Length of key name, in bytes
+    };
+
+    struct Position final
+    {
+        block_type      block;
+        code_type       code;
+    };
+
+    /// Contiguous range of items within the layout
+    template <typename T> class range final
+    {
+    public:
+                    range(const T * first, const T * last) : m_first(first), m_last(last) {}
+        const T *   begin() const { return m_first; }
+        const T *   end() const { return m_last; }
+        std::size_t size() const { return static_cast<std::size_t>(m_last - m_first); }
+        bool        empty() const { return m_first == m_last; }
+    private:
+        const T *   m_first;
+        const T *   m_last;
+    };
+
+    class Error : public std::runtime_error { using runtime_error::runtime_error; };
+
+    static constexpr char           fileExtension[] = ".klc";
+    static constexpr std::uint32_t  formatVersion = 1;
+
+public:
+                    CompiledLayout() = default;
+                    CompiledLayout(const CompiledLayout &) = delete;
+                    CompiledLayout(CompiledLayout &&) noexcept = default;
+    CompiledLayout & operator=(const CompiledLayout &) = delete;
+    CompiledLayout & operator=(CompiledLayout &&) noexcept = default;
+
+    /// Builds a compiled layout in memory
+    static CompiledLayout   compile(const LayoutDescription &, Source = {});
+    /// Maps a compiled layout file. Throws if it cannot be read or is not valid.
+    static CompiledLayout   map(const std::string & path);
+    /// Loads a layout from data directories, using an up-to-date compiled version
+    /// if one is found next to it or in the cache, and caching it otherwise.
+    static CompiledLayout   load(const std::string & name);
+    /// Returns source information for given file
+    static Source           sourceOf(const std::string & path);
+
+    /// Writes the compiled layout to a file, replacing it atomically
+    void                    save(const std::string & path) const;
+
+    bool                    empty() const noexcept { return m_data == nullptr; }
+    Source                  source() const noexcept;
+    std::string_view        name() const noexcept;
+    std::string_view        name(const Key &) const noexcept;
+
+    range<Key>              keys() const noexcept;
+    range<Key>              keys(block_type) const noexcept;
+    range<Position>         spurious() const noexcept;
+
+    const Key *             find(block_type, code_type) const noexcept;
+    bool                    isSpurious(block_type, code_type) const noexcept;
+
+private:
+    struct Header;
+
+    /// Releases layout data, unmapping it if it was mapped, freeing it otherwise
+    class Deleter final
+    {
+    public:
+                    Deleter() noexcept : m_mappedSize(0) {}
+        explicit    Deleter(std::size_t mappedSize) noexcept : m_mappedSize(mappedSize) {}
+        void        operator()(const char *) const noexcept;
+    private:
+        std::size_t m_mappedSize;       ///< Size of the mapping, zero if data was allocated
+    };
+    using data_ptr = std::unique_ptr<const char[], Deleter>;
+
+                            CompiledLayout(data_ptr data, std::size_t size);
+    const Header &          header() const noexcept;
+    void                    validate() const;
+
+private:
+    data_ptr                m_data;     ///< Layout data, either mapped or allocated
+    std::size_t             m_size = 0; ///< Size of layout data, in bytes
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::device
+
+#endif
@@ -23,6 +23,7 @@
 #include "keyledsd/colors.h"
 #include "keyledsd/device/Device.h"
 #include "keyledsd/tools/DeviceWatcher.h"
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <stdexcept>
@@ -74,8 +75,24 @@ public:
     Logitech &      operator=(const Logitech &) = delete;
     Logitech &      operator=(Logitech &&) = default;
 
-    // Factory method
-    static std::unique_ptr<Device> open(const std::string & path);
+    /// Time spent in each step of opening a device
+    struct OpenTimings final
+    {
+        std::chrono::microseconds   open{};     ///< Opening device node and checking protocol
+        std::chrono::microseconds   info{};     ///< Querying type, name and layout
+        std::chrono::microseconds   version{};  ///< Querying and parsing version information
+        std::chrono::microseconds   blocks{};   ///< Querying key blocks and their keys
+
+        std::chrono::microseconds   total() const { return open + info + version + blocks; }
+    };
+
+    // Factory methods
+    /// Opens and probes device at given path. Blocks until the device answered
+    /// all queries, which can take a long time with slow devices.
+    static std::unique_ptr<Device> open(const std::string & path, OpenTimings * = nullptr);
+    /// Probes an already-opened device, taking ownership of the handle.
+    static std::unique_ptr<Device> open(struct keyleds_device *, std::string path,
+                                        OpenTimings * = nullptr);
 
     // Virtual method implementation
     bool            hasLayout() const override;
@@ -18,8 +18,13 @@
 #define LOGGING_H_2BAC1A63
 
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 /****************************************************************************/
@@ -58,8 +63,8 @@ using debug = level<7u>;
 /** Logging configuration singleton
  *
  * Tracks all Logger instances and provides a way to set logging policy based
- * on logger name. Not thread-safe, which means threads may not instantiate
- * loggers or call setPolicy.
+ * on logger name. Policies are changed and resolved under a lock, so loggers
+ * running on other threads pick up changes consistently.
  */
 class Configuration final
 {
@@ -78,11 +83,19 @@ public:
 
     const Policy &  policyFor(const char * name) const;
 
+    /// Incremented whenever policies change, so loggers know to resolve theirs again
+    unsigned        generation() const noexcept { return m_generation.load(std::memory_order_acquire); }
+
 private:
     static const Policy & defaultPolicy();      ///< Used when setPolicy(nullptr) is invoked.
+    const Policy &  findPolicy(const char * name) const;    ///< Requires m_mutex
 private:
+    mutable std::mutex          m_mutex;        ///< Protects policies and loggers' caches
     std::atomic<const Policy *> m_globalPolicy; ///< Used by loggers with no policy. Never null.
     std::vector<std::pair<std::string, const Policy *>> m_policies;
+    std::atomic<unsigned>       m_generation = 1;   ///< Policy generation, never zero
+
+    friend class Logger;
 };
 
 
@@ -127,6 +140,53 @@ protected:
     level_t         m_minLevel;     ///< Minimum log level to write
 };
 
+/****************************************************************************/
+
+/** Logger policy that defers writing to a background thread
+ *
+ * Entries are pushed into a bounded lock-free ring buffer and written through
+ * the target policy by a dedicated thread, so logging threads never block on
+ * I/O. When the buffer is full, entries are dropped and counted; a notice is
+ * written once the thread catches up. Errors and more severe entries are never
+ * dropped: they are written synchronously instead. Ring slots keep their string buffers,
+ * so steady-state logging does not allocate.
+ *
+ * Once stopped, remaining entries are written and further entries go straight
+ * to the target policy.
+ */
+class AsyncPolicy final : public Policy
+{
+    struct Slot;
+public:
+    explicit        AsyncPolicy(const Policy & target, std::size_t capacity = 1024);
+                    ~AsyncPolicy();
+    bool            canSkip(level_t) const override;
+    void            write(level_t, const std::string &, const std::string &) const override;
+
+    /// Writes pending entries and stops the background thread
+    void            stop();
+    /// Number of entries dropped because the buffer was full
+    std::size_t     dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    bool            writeNext();
+    void            run();
+
+private:
+    const Policy &                  m_target;       ///< Policy entries are eventually written to
+    const std::size_t               m_mask;         ///< Buffer capacity minus one
+    const std::unique_ptr<Slot[]>   m_slots;        ///< Ring buffer
+    alignas(64) mutable std::atomic<std::size_t> m_writePosition = 0;  ///< Next slot to fill
+    alignas(64) std::size_t         m_readPosition = 0; ///< Next slot to drain, background
+                                                        ///  thread only
+    mutable std::atomic<std::size_t> m_dropped = 0; ///< Entries dropped because of overflow
+    std::size_t                     m_reported = 0; ///< Dropped entries already reported
+    std::atomic<bool>               m_running = true;   ///< Cleared by stop()
+    mutable std::mutex              m_mutex;        ///< Protects m_cond
+    mutable std::condition_variable m_cond;         ///< Wakes background thread up
+    std::thread                     m_thread;       ///< Background thread
+};
+
 /*****************************************************************************
 * Logger
 *****************************************************************************/
@@ -136,6 +196,10 @@ protected:
  * Tracks current module configuration and registers it to the global
  * configuration holder. Typically, one static Logger instance is created using
  * LOGGING macro at the top of each compilation unit.
+ *
+ * The policy is resolved once and cached until the configuration changes.
+ * Resolution stores the policy, then its generation, under the configuration
+ * lock, so a logger that sees the current generation also sees its policy.
  */
 class Logger final
 {
@@ -143,12 +207,21 @@ public:
     explicit constexpr Logger(const char * name) noexcept : m_name(name) {}
     constexpr const char * name() const { return m_name; }
 
-    auto & policy() const
-        { return Configuration::instance().policyFor(m_name); }
+    const Policy & policy() const
+    {
+        if (m_generation.load(std::memory_order_acquire) != Configuration::instance().generation()) {
+            resolvePolicy();
+        }
+        return *m_policy.load(std::memory_order_acquire);
+    }
     void    print(level_t level, const std::string & msg) const
         { policy().write(level, m_name, msg); }
+private:
+    void            resolvePolicy() const;
 private:
     const char *    m_name;             ///< Module name (for prefixing log entries)
+    mutable std::atomic<const Policy *> m_policy = nullptr; ///< Cached policy
+    mutable std::atomic<unsigned>       m_generation = 0;   ///< Configuration generation of m_policy
 };
 
 /*****************************************************************************
@@ -172,7 +245,7 @@ template <> template<typename...Args> void debug::print(const Logger &, Args &&.
 /****************************************************************************/
 // Module interface
 
-#define LOGGING(name) static constexpr auto l_logger = keyleds::logging::Logger(name)
+#define LOGGING(name) [[maybe_unused]] static auto l_logger = keyleds::logging::Logger(name)
 
 #define CRITICAL(...)   keyleds::logging::critical::print(l_logger, __VA_ARGS__)
 #define ERROR(...)      keyleds::logging::error::print(l_logger, __VA_ARGS__)
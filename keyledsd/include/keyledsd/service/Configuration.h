@@ -21,6 +21,7 @@
 #endif
 
 #include "keyledsd/colors.h"
+#include <chrono>
 #include <iosfwd>
 #include <regex>
 #include <string>
@@ -50,6 +51,7 @@ struct Configuration final
     using path_list = std::vector<std::string>;
     using color_map = std::vector<std::pair<std::string, RGBAColor>>;
     using device_map = std::vector<std::pair<std::string, std::string>>;
+    using frame_rate_map = std::vector<std::pair<std::string, unsigned>>;
     using key_group_list = std::vector<KeyGroup>;
     using effect_group_list = std::vector<EffectGroup>;
     using profile_list = std::vector<Profile>;
@@ -62,12 +64,23 @@ struct Configuration final
     path_list           pluginPaths;    ///< List of directories to search for plugins
     color_map           customColors;   ///< Map of color names to RGBA values
     device_map          devices;        ///< Map of device serials to device names
+    unsigned            frameRate = 0;  ///< Default frame rate, 0 for built-in default
+    frame_rate_map      frameRates;     ///< Map of device names or serials to frame rates
+    bool                adaptiveFrameRate = false;  ///< Lower frame rate of idle devices
+    unsigned            renderThreads = 0;  ///< Shared render threads, 0 for one per device
+    bool                skipMissedFrames = true;    ///< Drop missed frames instead of restarting the frame grid
+    unsigned            renderPriority = 0; ///< SCHED_FIFO priority of device threads, 0 for default
+    int                 renderNiceness = 0; ///< Niceness of device threads
     key_group_list      keyGroups;      ///< Map of key group names to lists of key names
     effect_group_list   effectGroups;   ///< Map of effect group names to configurations
     profile_list        profiles;       ///< List of profile configurations
 };
 
 std::string getDeviceName(const Configuration & config, const std::string & serial);
+unsigned getFrameRate(const Configuration & config, const std::string & name,
+                      const std::string & serial);
+/// Render time allowed to an effect per frame, zero if unlimited or invalid
+std::chrono::microseconds getRenderBudget(const Configuration::Effect & effect);
 
 /****************************************************************************/
 
@@ -155,6 +168,25 @@ struct Configuration::Effect final
 
 /****************************************************************************/
 
+// Comparisons, used to find out which effects a configuration reload affects
+
+inline bool operator==(const Configuration::KeyGroup & lhs, const Configuration::KeyGroup & rhs)
+    { return lhs.name == rhs.name && lhs.keys == rhs.keys; }
+inline bool operator!=(const Configuration::KeyGroup & lhs, const Configuration::KeyGroup & rhs)
+    { return !(lhs == rhs); }
+
+inline bool operator==(const Configuration::Effect & lhs, const Configuration::Effect & rhs)
+    { return lhs.name == rhs.name && lhs.items == rhs.items; }
+inline bool operator!=(const Configuration::Effect & lhs, const Configuration::Effect & rhs)
+    { return !(lhs == rhs); }
+
+inline bool operator==(const Configuration::EffectGroup & lhs, const Configuration::EffectGroup & rhs)
+    { return lhs.name == rhs.name && lhs.keyGroups == rhs.keyGroups && lhs.effects == rhs.effects; }
+inline bool operator!=(const Configuration::EffectGroup & lhs, const Configuration::EffectGroup & rhs)
+    { return !(lhs == rhs); }
+
+/****************************************************************************/
+
 } // namespace keyleds::service
 
 #endif
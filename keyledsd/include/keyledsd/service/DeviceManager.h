@@ -22,15 +22,19 @@
 
 #include "keyledsd/service/Configuration.h"
 #include "keyledsd/service/EffectManager.h"
+#include "keyledsd/service/MonitoredEffect.h"
 #include "keyledsd/service/RenderLoop.h"
+#include "keyledsd/service/RenderTargetPool.h"
 #include "keyledsd/tools/FileWatcher.h"
 #include "keyledsd/KeyDatabase.h"
+#include <list>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 namespace keyleds::device { class Device; }
+namespace keyleds::tools { class AnimationExecutor; }
 namespace keyleds::tools::device { class Description; }
 
 namespace keyleds::service {
@@ -41,8 +45,38 @@ namespace detail {
     /// An effect group, fully loaded with effects
     struct EffectGroup final
     {
-        std::string                             name;
+        Configuration::EffectGroup              configuration;  ///< Definition effects were built from
         std::vector<EffectManager::effect_ptr>  effects;
+        std::vector<std::unique_ptr<MonitoredEffect>> monitors; ///< One per effect, in same order
+    };
+
+    /// Remembers effect groups selected for the most recently resolved contexts
+    class ResolvedContextCache final
+    {
+    public:
+        using string_map = std::vector<std::pair<std::string, std::string>>;
+        using group_list = std::vector<const Configuration::EffectGroup *>;
+    public:
+        explicit                ResolvedContextCache(std::size_t capacity) : m_capacity(capacity) {}
+
+        /// Returns effect groups of given context and marks it most recent, nullptr if unknown
+        const group_list *      find(const string_map & context);
+        /// Adds a context as most recent, evicting the least recently used if full
+        const group_list &      insert(string_map context, group_list effectGroups);
+        void                    clear() noexcept { m_entries.clear(); }
+
+        std::size_t             size() const noexcept { return m_entries.size(); }
+        std::size_t             capacity() const noexcept { return m_capacity; }
+
+    private:
+        struct Entry final
+        {
+            string_map  context;
+            group_list  effectGroups;
+        };
+    private:
+        const std::size_t   m_capacity;     ///< Maximum number of remembered contexts
+        std::list<Entry>    m_entries;      ///< Most recent first
     };
 }
 
@@ -53,6 +87,12 @@ namespace detail {
  * It is given a device instance to manage and a reference to current
  * configuration at creation time, and coordinates feature detection,
  * layout management, and related objects' life cycle.
+ *
+ * On configuration reload, effect groups whose definition did not change are
+ * kept, along with their effects' state. Others are rebuilt when next used.
+ *
+ * The device is rendered on its own thread, or on a shared executor if one
+ * is given at creation time.
  */
 class DeviceManager final
 {
@@ -65,7 +105,16 @@ public:
                             DeviceManager(EffectManager &, FileWatcher &,
                                           const tools::device::Description &,
                                           std::unique_ptr<device::Device>,
-                                          const Configuration *);
+                                          KeyDatabase,
+                                          const Configuration *,
+                                          tools::AnimationExecutor * = nullptr);
+                            /// Manages a device whose system information is already known
+                            DeviceManager(EffectManager &, FileWatcher &,
+                                          std::string sysPath, std::string serial, dev_list eventDevices,
+                                          std::unique_ptr<device::Device>,
+                                          KeyDatabase,
+                                          const Configuration *,
+                                          tools::AnimationExecutor * = nullptr);
                             ~DeviceManager();
 
     const std::string &     sysPath() const noexcept { return m_sysPath; }
@@ -76,6 +125,14 @@ public:
     const KeyDatabase &     keyDB() const { return m_keyDB; }
 
           bool              paused() const { return m_renderLoop.paused(); }
+    /// Frame pacing and render time counters
+    RenderLoop::Statistics  renderStatistics() const { return m_renderLoop.statistics(); }
+    /// Render target allocation counters, for all effects of the device
+    RenderTargetPool::Statistics renderTargetStatistics() const { return m_renderTargetPool.statistics(); }
+    /// Loaded effect groups, with render time counters of their effects
+    const std::vector<detail::EffectGroup> & effectGroups() const { return m_effectGroups; }
+    /// Profile resolutions remembered for recent contexts
+    const detail::ResolvedContextCache & resolvedContexts() const { return m_resolvedContexts; }
 
 public:
     void                    setConfiguration(const Configuration *);
@@ -89,6 +146,8 @@ public:
 private:
     /// Loads the list of effects to activate for the given context
     std::vector<Effect *>   loadEffects(const string_map & context);
+    /// Matches profiles against given context and returns effect groups to activate
+    std::vector<const Configuration::EffectGroup *> resolveEffectGroups(const string_map & context) const;
 
     /// Instanciates an effect, combining its configuration with this device's info
     const detail::EffectGroup & getEffectGroup(const Configuration::EffectGroup &);
@@ -106,7 +165,13 @@ private:
     FileWatcher::subscription m_fileWatcherSub; ///< Ensures we get notifications for devnode events
     const KeyDatabase       m_keyDB;            ///< Fully loaded key descriptions
 
+    RenderTargetPool        m_renderTargetPool; ///< Recycles render targets of effects, must
+                                                ///  outlive them
     std::vector<detail::EffectGroup> m_effectGroups;    ///< Loaded effect group instances
+    Configuration::color_map m_effectColors;    ///< Custom colors effects were built with
+    Configuration::key_group_list m_effectKeyGroups;    ///< Global key groups effects were built with
+    detail::ResolvedContextCache m_resolvedContexts;    ///< Recently resolved contexts, cleared
+                                                ///  on configuration change
     RenderLoop              m_renderLoop;       ///< The RenderLoop in charge of the device
     std::vector<Effect *>   m_activeEffects;    ///< Effects currently active on m_renderLoop
 };
@@ -25,14 +25,14 @@
 
 namespace keyleds { class KeyDatabase; }
 namespace keyleds::device {
+    class CompiledLayout;
     class Device;
-    struct LayoutDescription;
 }
 namespace keyleds::tools::device { class Description; }
 
 namespace keyleds::service {
 
-device::LayoutDescription loadLayout(const device::Device & device);
+device::CompiledLayout loadLayout(const device::Device & device);
 std::vector<std::string> findEventDevices(const tools::device::Description & description);
 std::string getSerial(const tools::device::Description & description);
 KeyDatabase setupKeyDatabase(device::Device & device);
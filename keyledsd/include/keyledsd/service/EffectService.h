@@ -22,6 +22,7 @@
 
 #include "keyledsd/plugin/interfaces.h"
 #include "keyledsd/service/Configuration.h"
+#include "keyledsd/service/RenderTargetPool.h"
 #include "keyledsd/KeyDatabase.h"
 #include <memory>
 #include <vector>
@@ -33,11 +34,16 @@ class DeviceManager;
 
 /****************************************************************************/
 
+/** Service given to an effect
+ *
+ * Render targets are taken from the device's pool, and returned to it when
+ * the effect destroys them or is itself destroyed.
+ */
 class EffectService final : public plugin::EffectService
 {
     using KeyGroup = KeyDatabase::KeyGroup;
 public:
-    EffectService(const DeviceManager &, const Configuration &,
+    EffectService(const DeviceManager &, RenderTargetPool &, const Configuration &,
                   const Configuration::Effect &, std::vector<KeyGroup>);
     ~EffectService() override;
 
@@ -60,8 +66,10 @@ public:
 
 private:
     const DeviceManager &                       m_manager;
+    RenderTargetPool &                          m_renderTargetPool;
     const Configuration &                       m_configuration;
-    const Configuration::Effect &               m_effectConfiguration;
+    const Configuration::Effect                 m_effectConfiguration;  ///< Copied, effects can
+                                                                        ///  outlive a reload
     const std::vector<KeyGroup>                 m_keyGroups;
     std::vector<std::unique_ptr<RenderTarget>>  m_renderTargets;
     std::string                                 m_fileData;
@@ -0,0 +1,108 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_MONITORED_EFFECT_H_2F6B90D4
+#define KEYLEDSD_MONITORED_EFFECT_H_2F6B90D4
+#ifndef KEYLEDSD_INTERNAL
+#   error "Internal header - must not be pulled into plugins"
+#endif
+
+#include "keyledsd/plugin/interfaces.h"
+#include "keyledsd/service/RenderTargetPool.h"
+#include "keyledsd/RenderTarget.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace keyleds::service {
+
+/****************************************************************************/
+
+/** Effect render time monitor
+ *
+ * Wraps an effect, timing each of its render calls. Times of recent frames are
+ * kept in a ring, from which percentiles are computed when statistics are read.
+ * Counters are updated by the render thread and can be read from any thread.
+ *
+ * An effect can be given a render budget. A frame that takes longer throttles
+ * the effect: it then skips one frame per budget its render time spanned, up to
+ * maxSkippedFrames, and is given the time elapsed over all of them on its next
+ * run. Such an effect still draws in place, but the keys it changed are recorded
+ * on a layer taken from the pool, which is blended onto the target on skipped
+ * frames. Held keys keep the color the effect left them with, without following
+ * what is drawn below it, and keys it left unchanged are not held.
+ *
+ * The wrapped effect is not owned, and must outlive the monitor.
+ */
+class MonitoredEffect final : public plugin::Effect
+{
+public:
+    using microseconds = std::chrono::microseconds;
+    static constexpr std::size_t sampleCount = 256;
+    static constexpr unsigned maxSkippedFrames = 15;
+
+    /// Render time counters
+    struct Statistics {
+        unsigned long   frames;         ///< Number of frames the effect rendered
+        unsigned long   throttled;      ///< Number of frames skipped because of the budget
+        microseconds    lastRenderTime; ///< Time spent rendering last frame
+        microseconds    meanRenderTime; ///< Average time spent rendering a frame
+        microseconds    p99RenderTime;  ///< 99th percentile of time spent rendering recent frames
+    };
+
+public:
+                    MonitoredEffect(std::string name, plugin::Effect &, RenderTargetPool &,
+                                    microseconds budget = microseconds::zero());
+                    MonitoredEffect(const MonitoredEffect &) = delete;
+    MonitoredEffect & operator=(const MonitoredEffect &) = delete;
+                    ~MonitoredEffect();
+
+    const std::string & name() const noexcept { return m_name; }
+    microseconds    budget() const noexcept { return m_budget; }
+    Statistics      statistics() const;
+
+    void            render(milliseconds, RenderTarget &) override;
+    void            handleContextChange(const string_map &) override;
+    void            handleGenericEvent(const string_map &) override;
+    void            handleKeyEvent(const KeyDatabase::Key &, bool press) override;
+
+private:
+    const std::string   m_name;             ///< Effect name, from configuration
+    plugin::Effect &    m_effect;           ///< Wrapped effect (unowned)
+    const microseconds  m_budget;           ///< Render time allowed per frame, zero if unlimited
+
+    RenderTargetPool &  m_pool;             ///< Where m_layer comes from
+    RenderTargetPool::target_ptr m_layer;   ///< Keys changed by last render, if it has a budget
+    unsigned            m_skipFrames = 0;   ///< Number of frames left to skip
+    milliseconds        m_skippedTime;      ///< Time elapsed over skipped frames
+
+    std::atomic<unsigned long> m_frames;    ///< See Statistics
+    std::atomic<unsigned long> m_throttled; ///< See Statistics
+    std::atomic<microseconds::rep> m_lastRenderTime;    ///< See Statistics
+    std::atomic<microseconds::rep> m_totalRenderTime;   ///< Time spent rendering all frames
+    std::array<std::atomic<std::uint32_t>, sampleCount> m_samples;
+                                            ///< Render times of recent frames, in microseconds,
+                                            ///  indexed by frame number
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::service
+
+#endif
@@ -21,11 +21,18 @@
 #endif
 
 #include "keyledsd/device/Device.h"
+#include "keyledsd/plugin/interfaces.h"
 #include "keyledsd/tools/AnimationLoop.h"
+#include "keyledsd/tools/SPSCQueue.h"
+#include "keyledsd/KeyDatabase.h"
 #include "keyledsd/RenderTarget.h"
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace keyleds::service {
@@ -34,49 +41,126 @@ namespace keyleds::service {
 
 /** Device render loop
  *
- * An AnimationLoop that runs a set of Renderers and sends the resulting
+ * An AnimationLoop that runs a set of Effects and sends the resulting
  * RenderTarget state to a Device. It assumes entire control of the device.
  * That is, no other thread is allowed to call Device's manipulation methods
  * while a RenderLoop for it exists.
+ *
+ * The effect list is published as an immutable snapshot, swapped atomically,
+ * so the main thread never waits for a frame to complete. The render thread
+ * flags the snapshot it runs effects from, and replaced snapshots are freed
+ * once it no longer does. Only synchronize() waits for it, and only until it
+ * is done running effects, never while it talks to the device.
+ *
+ * Events are queued and delivered to effects by the render thread at the start
+ * of next frame, which makes the render thread the only one to ever call into
+ * effects.
+ *
+ * In adaptive mode, the loop goes idle after a number of frames that did not
+ * change any light, and returns to full frame rate as soon as one does.
  */
 class RenderLoop final : public tools::AnimationLoop
 {
-    using renderer_list = std::vector<Renderer *>;
+public:
+    using effect_list = std::vector<plugin::Effect *>;
+    using string_map = std::vector<std::pair<std::string, std::string>>;
+    static constexpr std::size_t keyEventCapacity = 256;
 public:
     RenderLoop(device::Device &, unsigned fps);
     ~RenderLoop() override;
 
-    void                forceRefresh() { m_forceRefresh.store(true, std::memory_order_relaxed); }
+    void                forceRefresh() { m_forceRefresh.store(true, std::memory_order_relaxed); wake(); }
+    void                setAdaptive(bool value) { m_adaptive.store(value, std::memory_order_relaxed); }
 
-    /// Returns a lock that bars the render loop from using renderers while it is held
-    /// Holding it is mandatory for modifying any renderer or the list itself
-    std::unique_lock<std::mutex>    lock();
+    /// Number of blocks sent as a single fill, because all their keys had the same color
+    unsigned long       blockFills() const { return m_fills.load(std::memory_order_relaxed); }
+    /// Number of blocks sent key by key
+    unsigned long       blockUpdates() const { return m_updates.load(std::memory_order_relaxed); }
 
-    /// Renderer list accessor. When using it to modify renderers, a lock must be held.
-    /// The list only holds pointers, which must be valid as long as they remain
-    /// in the list. RenderLoop will not destroy them or interact in any way but
-    /// calling their render method.
-    renderer_list &     renderers() { return m_renderers; }
+    /// Number of key events discarded because the queue was full
+    unsigned long       droppedKeyEvents() const { return m_droppedKeyEvents.load(std::memory_order_relaxed); }
 
-private:
+    /// Publishes a new effect list, with the context effects must be notified of.
+    /// The render thread picks it up at its next frame. Pointed-to effects are not
+    /// owned, and must remain valid until a later synchronize() call returns.
+    void                setEffects(effect_list, string_map context);
+    /// Blocks until the render thread no longer uses any effect list published
+    /// before the last setEffects() call. Returns immediately if it does not.
+    void                synchronize();
+    /// Queues a key event for current effects. Never blocks. Must always be
+    /// called from the same thread.
+    void                postKeyEvent(const KeyDatabase::Key &, bool press);
+    /// Queues a generic event for current effects
+    void                postGenericEvent(string_map);
+
+    /// Renders a single frame and sends it to the device, recovering from device
+    /// errors. Normally invoked by the animation thread or executor; may be called
+    /// directly while the loop is not started.
     bool                render(milliseconds) override;
-    void                run() override;
+
+private:
+    struct Snapshot final
+    {
+        effect_list     effects;                ///< Active effects (unowned)
+        string_map      context;                ///< Context to deliver on first use
+        unsigned long   generation = 0;         ///< Incremented on every setEffects() call
+    };
+    class SnapshotReference;
+    struct KeyEvent final
+    {
+        const KeyDatabase::Key * key;
+        bool            press;
+    };
+
+    /// Runs effects and sends changes to the device, throws on device errors
+    void                update(milliseconds);
+    /// Attempts to resync the device after an error, returns whether it succeeded
+    bool                recover(const device::Device::error &);
+
+    /// Frees replaced snapshots the render thread does not use, main thread only
+    void                reclaimSnapshots();
+    /// Delivers context change and queued events to snapshot's effects
+    void                dispatchEvents(const Snapshot &);
 
     /// Reads current device led state into the render target
     void                getDeviceState(RenderTarget & state);
+    /// Whether keys in given range of m_buffer all have the same color
+    bool                isUniform(std::size_t begin, std::size_t end) const;
 
 private:
     device::Device &    m_device;               ///< The device to render to
-    renderer_list       m_renderers;            ///< Current list of renderers (unowned)
-    std::mutex          m_mRenderers;           ///< Controls access to m_renderers
+    std::unique_ptr<const Snapshot> m_current;  ///< Current effect list, main thread only
+    std::atomic<const Snapshot *> m_snapshot;   ///< Current effect list, as seen by render thread
+    std::atomic<const Snapshot *> m_inUse;      ///< Snapshot render thread runs effects from
+    std::vector<std::unique_ptr<const Snapshot>> m_retired;
+                                                ///< Replaced snapshots, see reclaimSnapshots()
+    std::atomic<bool>   m_syncWaiting;          ///< Whether synchronize() waits on m_syncCond
+    std::mutex          m_mSync;                ///< Protects m_syncCond waits
+    std::condition_variable m_syncCond;         ///< Signalled when render thread releases m_inUse
+    unsigned long       m_generation;           ///< Generation of last published snapshot
+    unsigned long       m_seenGeneration;       ///< Generation of last snapshot used by render thread
+
+    tools::SPSCQueue<KeyEvent, keyEventCapacity> m_keyEvents;   ///< Pending key events
+    std::atomic<unsigned long> m_droppedKeyEvents;  ///< See droppedKeyEvents()
+    std::vector<string_map> m_genericEvents;    ///< Pending generic events
+    std::vector<string_map> m_genericEventsBuffer;  ///< Events being delivered, avoids reallocating
+    std::atomic<bool>   m_hasGenericEvents;     ///< Whether m_genericEvents is not empty
+    std::mutex          m_mGenericEvents;       ///< Controls access to m_genericEvents
 
     clock::time_point   m_lastErrorTime;        ///< When did last I/O error occur?
     std::chrono::microseconds   m_commitDelay;  ///< Wait that amount between sending and committing
     std::atomic<bool>   m_forceRefresh;         ///< Force one-time full refresh at next render
+    std::atomic<bool>   m_adaptive;             ///< Go idle when nothing changes
+    unsigned            m_unchangedFrames;      ///< Number of consecutive frames without changes
+    std::atomic<unsigned long> m_fills;         ///< See blockFills()
+    std::atomic<unsigned long> m_updates;       ///< See blockUpdates()
 
+    bool                m_hasState;             ///< Whether m_state was read from the device
     RenderTarget        m_state;                ///< Current state of the device
     RenderTarget        m_buffer;               ///< Buffer to render into, avoids re-creating it
                                                 ///  on every render
+    std::vector<uint8_t> m_changes;             ///< Bitmap of keys that differ between m_state
+                                                ///  and m_buffer
     std::vector<device::Device::ColorDirective> m_directives;
                                                 ///< Buffer of directives, avoids new/delete on
                                                 ///< every render
@@ -0,0 +1,87 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_RENDER_TARGET_POOL_H_41C7A2E5
+#define KEYLEDSD_RENDER_TARGET_POOL_H_41C7A2E5
+#ifndef KEYLEDSD_INTERNAL
+#   error "Internal header - must not be pulled into plugins"
+#endif
+
+#include "keyledsd/RenderTarget.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace keyleds::service {
+
+/****************************************************************************/
+
+/** Pool of render targets
+ *
+ * Keeps render targets of a single size, for all effects of a device. Targets
+ * released by effects, notably when they are destroyed on configuration reload,
+ * are kept and handed out again instead of being freed, so reloading does not
+ * churn the heap. Recycled targets are cleared to transparent black.
+ *
+ * At most maxFree released targets are kept, others are freed. Thread-safe,
+ * as effects may create targets while rendering.
+ */
+class RenderTargetPool final
+{
+public:
+    using target_ptr = std::unique_ptr<RenderTarget>;
+    static constexpr std::size_t defaultMaxFree = 64;
+
+    /// Allocation counters
+    struct Statistics {
+        unsigned long   allocations;    ///< Number of targets actually allocated
+        unsigned long   reuses;         ///< Number of targets handed out from the pool
+        unsigned long   discards;       ///< Number of released targets freed because the pool was full
+        std::size_t     inUse;          ///< Number of targets currently handed out
+        std::size_t     free;           ///< Number of targets currently in the pool
+    };
+
+public:
+    explicit        RenderTargetPool(RenderTarget::size_type, std::size_t maxFree = defaultMaxFree);
+                    RenderTargetPool(const RenderTargetPool &) = delete;
+    RenderTargetPool & operator=(const RenderTargetPool &) = delete;
+                    ~RenderTargetPool();
+
+    RenderTarget::size_type targetSize() const { return m_targetSize; }
+    Statistics      statistics() const;
+
+    /// Returns a target from the pool, or a new one if it is empty
+    target_ptr      acquire();
+    /// Gives a target back to the pool
+    void            release(target_ptr);
+
+private:
+    const RenderTarget::size_type   m_targetSize;   ///< Size of all targets
+    const std::size_t               m_maxFree;      ///< Maximum size of m_free
+    mutable std::mutex              m_mutex;        ///< Controls access to everything below
+    std::vector<target_ptr>         m_free;         ///< Released targets
+    unsigned long                   m_allocations = 0;  ///< See Statistics
+    unsigned long                   m_reuses = 0;       ///< See Statistics
+    unsigned long                   m_discards = 0;     ///< See Statistics
+    std::size_t                     m_inUse = 0;        ///< See Statistics
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::service
+
+#endif
@@ -30,6 +30,7 @@
 #include <string>
 #include <vector>
 
+namespace keyleds::tools { class AnimationExecutor; }
 namespace keyleds::tools::xlib { class Display; }
 
 namespace keyleds::service {
@@ -45,6 +46,14 @@ class EffectManager;
  * Only one instance typically exists per run. It ties all other objects
  * together, notably managing event watchers and device managers, and
  * passing messages around.
+ *
+ * Devices are probed on libuv's worker threads, so a slow device does not
+ * freeze the main loop. Several devices may be probed at the same time.
+ * Probes still running when the service is destroyed cannot be cancelled:
+ * the destructor runs the loop until they complete, discarding their result.
+ *
+ * When configured with render threads, all devices are rendered on a shared
+ * executor instead of one thread each.
  */
 class Service final
 {
@@ -54,6 +63,9 @@ class Service final
 
     using device_list = std::vector<std::unique_ptr<DeviceManager>>;
     using display_list = std::vector<std::unique_ptr<DisplayManager>>;
+
+    struct Probe;
+    using probe_list = std::vector<std::unique_ptr<Probe>>;
 public:
                         Service(EffectManager &, FileWatcher &,
                                 Configuration, uv_loop_t & loop);
@@ -87,6 +99,7 @@ private:
     void                onConfigurationFileChanged(FileWatcher::Event);
     void                onDeviceAdded(const tools::device::Description &);
     void                onDeviceRemoved(const tools::device::Description &);
+    void                onDeviceProbed(Probe &);
 private:
     EffectManager &     m_effectManager;    ///< Controls lifecycle of effects (injected)
     FileWatcher &       m_fileWatcher;      ///< Connection to inotify
@@ -95,7 +108,9 @@ private:
     bool                m_autoQuit = false; ///< Quit when last device is removed?
 
     string_map          m_context;          ///< Current context. Used when instanciating new managers
+    std::unique_ptr<tools::AnimationExecutor> m_renderExecutor; ///< Shared render threads, if enabled
     device_list         m_devices;          ///< Map of serial number to DeviceManager instances
+    probe_list          m_probes;           ///< Devices being opened on worker threads
     display_list        m_displays;         ///< Connections to X displays
 
     DeviceWatcher       m_deviceWatcher;    ///< Connection to libudev
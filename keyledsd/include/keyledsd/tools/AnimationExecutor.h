@@ -0,0 +1,94 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_ANIM_EXECUTOR_H_5B7E21C9
+#define TOOLS_ANIM_EXECUTOR_H_5B7E21C9
+
+#include "keyledsd/tools/Sleeper.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace keyleds::tools {
+
+class AnimationLoop;
+
+/****************************************************************************/
+
+/** Shared animation executor
+ *
+ * Renders any number of animation loops from a fixed set of worker threads.
+ * Workers always pick the runnable loop with the earliest deadline.
+ *
+ * Frame deadlines are rounded up to a grid shared by all loops, starting when
+ * the executor is created. Loops running at the same frame rate thus render
+ * their frames on the same wakeup, whenever they were started or resumed.
+ *
+ * A loop is never rendered by two workers at once. A loop that stalls, for
+ * instance because its device stops responding, only holds one worker; other
+ * loops keep running on remaining workers, and the stalled loop resumes its
+ * frame grid, skipping missed frames, once the render call returns.
+ *
+ * One idle worker at a time sleeps until the earliest deadline, on a Sleeper,
+ * while others wait for loops to change state.
+ *
+ * The executor must outlive all loops started on it.
+ */
+class AnimationExecutor final
+{
+    using clock = std::chrono::steady_clock;
+public:
+    explicit            AnimationExecutor(unsigned threads);
+                        AnimationExecutor(const AnimationExecutor &) = delete;
+    AnimationExecutor & operator=(const AnimationExecutor &) = delete;
+                        ~AnimationExecutor();
+
+    unsigned            threads() const { return unsigned(m_workers.size()); }
+
+    /// Rounds a time point up to the frame grid for given period
+    clock::time_point   align(clock::time_point, clock::duration period) const;
+
+private:
+    // Loops manage their own attachment in start() and stop()
+    void                attach(AnimationLoop &);
+    void                detach(AnimationLoop &);
+    /// Wakes up workers so they re-examine loops, thread-safe
+    void                notify();
+    /// Wakes up workers, including the sleeping one, m_mutex must be held
+    void                wakeAll();
+    /// Worker thread body
+    void                run();
+
+    friend class AnimationLoop;
+
+private:
+    const clock::time_point     m_epoch;    ///< Origin of the shared frame grid
+    std::mutex                  m_mutex;    ///< Controls access to everything below
+    std::condition_variable     m_cond;     ///< Signalled when a loop changes state
+    std::vector<AnimationLoop *> m_loops;   ///< Attached loops
+    Sleeper                     m_sleeper;  ///< Waits for the earliest deadline
+    bool                        m_sleeping = false; ///< Whether a worker is using m_sleeper
+    bool                        m_abort = false; ///< If set, workers exit
+    std::vector<std::thread>    m_workers;  ///< Worker threads
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::tools
+
+#endif
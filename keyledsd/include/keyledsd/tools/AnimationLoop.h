@@ -17,6 +17,9 @@
 #ifndef TOOLS_ANIM_LOOP_H_A32C4648
 #define TOOLS_ANIM_LOOP_H_A32C4648
 
+#include "keyledsd/tools/Sleeper.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
@@ -24,6 +27,8 @@
 
 namespace keyleds::tools {
 
+class AnimationExecutor;
+
 /****************************************************************************/
 
 
@@ -35,6 +40,18 @@ namespace keyleds::tools {
  * The loop starts in paused state. That is, the run method starts immediately
  * but goes into sleep without calling render until setPaused(false) is called.
  *
+ * Frames are scheduled on absolute deadlines of the monotonic clock, so wakeup
+ * latency does not accumulate into drift. When the loop falls behind by a whole
+ * frame or more, the skip policy decides how it catches up.
+ *
+ * Subclasses may flag the loop as idle, which lowers the frame rate to a fixed
+ * minimum until the flag is cleared. Calling wake() renders a frame immediately
+ * when idle, so reactions to external events are not delayed.
+ *
+ * By default, the loop runs on its own thread. It can run on a shared
+ * AnimationExecutor instead, which renders it from a pool of worker threads
+ * alongside other loops.
+ *
  * The loop must be stopped before the object is deleted.
  */
 class AnimationLoop
@@ -43,15 +60,49 @@ protected:
     using clock = std::chrono::steady_clock;
     using milliseconds = std::chrono::duration<unsigned, std::milli>;
 public:
-    explicit        AnimationLoop(unsigned fps);
+    /// Behavior when one or more frame deadlines were missed entirely
+    enum class SkipPolicy {
+        Skip,           ///< Drop missed frames, stay on the frame grid, render with the total elapsed time
+        Restart         ///< Restart the frame grid from now, animations slow down by missed time
+    };
+
+    /// Frame pacing counters
+    struct Statistics {
+        unsigned long   frames;         ///< Number of frames rendered
+        unsigned long   missed;         ///< Number of times the loop fell behind by a frame or more
+        unsigned long   skipped;        ///< Number of frames dropped to catch up
+        std::chrono::microseconds maxLateness;  ///< Worst delay between a deadline and its frame
+        std::chrono::microseconds lastFrameTime;    ///< Time spent rendering last frame
+        std::chrono::microseconds maxFrameTime;     ///< Longest time spent rendering a frame
+        std::chrono::microseconds totalFrameTime;   ///< Time spent rendering all frames
+    };
+
+public:
+    explicit        AnimationLoop(unsigned fps, unsigned idleFps = 1);
                     AnimationLoop(const AnimationLoop &) = delete;
     AnimationLoop & operator=(const AnimationLoop &) = delete;
     virtual         ~AnimationLoop();
 
     bool            paused() const { return m_paused; }
     int             error() const { return m_error; }
+    unsigned        frameRate() const { return m_fps.load(std::memory_order_relaxed); }
+    bool            idle() const { return m_idle.load(std::memory_order_relaxed); }
+    Statistics      statistics() const;
 
-    void            start();
+    /// Changes the frame rate, thread-safe. Takes effect on next frame. At least 1.
+    void            setFrameRate(unsigned fps)
+                    { m_fps.store(std::max(fps, 1u), std::memory_order_relaxed); }
+    /// Renders next frame immediately if the loop is idle, thread-safe
+    void            wake();
+
+    /// Scheduling settings, taking effect on next start(). Priority and niceness
+    /// only apply to loops running on their own thread.
+    void            setSkipPolicy(SkipPolicy policy) { m_skipPolicy = policy; }
+    void            setRealtimePriority(int priority) { m_priority = priority; } ///< SCHED_FIFO, 0 to disable
+    void            setNiceness(int niceness) { m_niceness = niceness; }
+
+    /// Starts the loop on its own thread, or on given executor
+    void            start(AnimationExecutor * = nullptr);
     void            setPaused(bool);
     void            stop();
 
@@ -59,19 +110,68 @@ protected:
     virtual void    run();
     virtual bool    render(milliseconds) = 0;
 
+    /// Sets idle mode, to be called from the animation thread
+    void            setIdle(bool idle) { m_idle.store(idle, std::memory_order_relaxed); }
+
 private:
+    /// Current frame period, depending on frame rate and idle mode
+    clock::duration period() const;
+    /// Rounds a deadline up to the executor's frame grid, if any
+    clock::time_point aligned(clock::time_point) const;
+    /// Starts a new frame grid, with first deadline at now
+    void            resetSchedule(clock::time_point now);
+    /// Moves the frame grid so next deadline is now, without skipping animation time
+    void            realign(clock::time_point now);
+    /// Renders the frame due at current deadline and schedules next one
+    bool            renderFrame(clock::time_point now);
+    /// Checks whether an executor may render the loop, updating deadline on resume or wake
+    bool            schedulable(clock::time_point now);
+    /// Interrupts sleep of the loop thread, or wakes up executor
+    void            signal();
+    /// Applies scheduling settings to the calling thread
+    void            applyScheduling() const;
     /// Simply calls the animation loop's run method
     static void     threadEntry(AnimationLoop &);
+    /// Logs statistics when the loop ends
+    void            logStatistics() const;
+
+    friend class AnimationExecutor;
 
 private:
     std::mutex      m_mRunStatus;           ///< Controls access to m_cRunStats, m_paused and m_abort
     std::condition_variable m_cRunStatus;   ///< Used to wait on m_paused and m_abort changes
 
-    milliseconds    m_period;               ///< Animation period
+    Sleeper         m_sleeper;              ///< Used for sleeping until next frame
+    std::atomic<unsigned> m_fps;            ///< Frame rate when active
+    const unsigned  m_idleFps;              ///< Frame rate when idle
+    std::atomic<bool> m_idle;               ///< Whether the loop runs at m_idleFps
+    SkipPolicy      m_skipPolicy = SkipPolicy::Skip;
+    int             m_priority = 0;         ///< SCHED_FIFO priority, 0 for default scheduling
+    int             m_niceness = 0;         ///< Thread niceness, applied if non-zero
     bool            m_paused = true;        ///< If set, the animation loop thread goes into sleep
     bool            m_abort = false;        ///< If set, the animation loop thread exits
     int             m_error = 0;            ///< Error code from animation loop thread, errno-style
 
+    std::atomic<unsigned long>  m_frames;   ///< See Statistics
+    std::atomic<unsigned long>  m_missed;   ///< See Statistics
+    std::atomic<unsigned long>  m_skipped;  ///< See Statistics
+    std::atomic<std::chrono::microseconds::rep> m_maxLateness; ///< See Statistics
+    std::atomic<std::chrono::microseconds::rep> m_lastFrameTime;  ///< See Statistics
+    std::atomic<std::chrono::microseconds::rep> m_maxFrameTime;   ///< See Statistics
+    std::atomic<std::chrono::microseconds::rep> m_totalFrameTime; ///< See Statistics
+
+    // Frame grid, only used from the thread currently rendering the loop
+    clock::time_point m_deadline;           ///< When next frame should be rendered
+    clock::time_point m_origin;             ///< Reference point of the frame grid
+    milliseconds    m_reported;             ///< Animation time already given to render
+    clock::duration m_framePeriod;          ///< Period used to compute current deadline
+
+    AnimationExecutor * m_executor = nullptr;   ///< Executor running the loop, if any
+    std::atomic<bool> m_woken;              ///< Set by wake(), for executor
+    bool            m_busy = false;         ///< Being rendered by a worker, guarded by executor
+    bool            m_finished = false;     ///< Render returned false, guarded by executor
+    bool            m_wasPaused = true;     ///< Paused when last checked, guarded by executor
+
     std::thread     m_thread;               ///< Actual thread instance
 };
 
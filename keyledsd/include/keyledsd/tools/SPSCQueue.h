@@ -0,0 +1,87 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_SPSC_QUEUE_H_8E1F0B27
+#define TOOLS_SPSC_QUEUE_H_8E1F0B27
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+namespace keyleds::tools {
+
+/****************************************************************************/
+
+/** Single-producer, single-consumer bounded queue
+ *
+ * Lock-free ring buffer for passing small items from one thread to another.
+ * Exactly one thread may push and exactly one thread may pop at any time.
+ * Neither operation blocks: push fails when the queue is full, pop fails
+ * when it is empty.
+ */
+template <typename T, std::size_t Capacity>
+class SPSCQueue final
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSCQueue capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "SPSCQueue only holds trivially copyable items");
+    static constexpr std::size_t mask = Capacity - 1;
+public:
+    static constexpr std::size_t capacity() { return Capacity; }
+
+    /// Appends an item. Producer side only.
+    /// @return `false` if the queue was full, in which case the item is discarded.
+    bool push(const T & item) noexcept
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity) { return false; }
+        m_items[tail & mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Removes the oldest item. Consumer side only.
+    /// @return `false` if the queue was empty, in which case item is left untouched.
+    bool pop(T & item) noexcept
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) { return false; }
+        item = m_items[head & mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Whether the queue is empty. Only a hint when called from the producer.
+    bool empty() const noexcept
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    // Indices grow forever and wrap around naturally, masking gives the slot.
+    // Each is written by one side only, keep them on separate cache lines.
+    alignas(64) std::atomic<std::size_t> m_head = 0;    ///< Next slot to pop, written by consumer
+    alignas(64) std::atomic<std::size_t> m_tail = 0;    ///< Next slot to push, written by producer
+    alignas(64) std::array<T, Capacity>  m_items;       ///< Ring storage
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::tools
+
+#endif
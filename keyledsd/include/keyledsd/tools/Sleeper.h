@@ -0,0 +1,57 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_SLEEPER_H_8E4F27A1
+#define TOOLS_SLEEPER_H_8E4F27A1
+
+#include <chrono>
+
+namespace keyleds::tools {
+
+/****************************************************************************/
+
+/** Interruptible sleep on the monotonic clock
+ *
+ * Sleeps on a timerfd armed with an absolute deadline, so neither time spent
+ * before going to sleep nor changes to system time delay wakeup. This is
+ * unlike condition_variable::wait_until, which some libstdc++ versions run
+ * against the system clock (https://gcc.gnu.org/bugzilla/show_bug.cgi?id=41861).
+ */
+class Sleeper final
+{
+public:
+    using clock = std::chrono::steady_clock;
+public:
+                Sleeper();
+                Sleeper(const Sleeper &) = delete;
+    Sleeper &   operator=(const Sleeper &) = delete;
+                ~Sleeper();
+
+    /// Sleeps until deadline, returns true if interrupted. One thread may sleep at a time.
+    bool        sleepUntil(clock::time_point deadline);
+    /// Interrupts current sleep, or next one if none is in progress. Thread-safe.
+    void        interrupt();
+
+private:
+    int         m_timerFd;          ///< Timer used for sleeping until deadline
+    int         m_eventFd;          ///< Signalled to interrupt sleep
+};
+
+/****************************************************************************/
+
+} // namespace keyleds::tools
+
+#endif
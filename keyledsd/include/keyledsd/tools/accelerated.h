@@ -38,11 +38,11 @@ extern "C" {
  * \end{align*}
  * The value of a's alpha channel after the blending is undefined.
  *
- * The blending operation uses SSE2 or MMX if available.
+ * The blending operation uses SSE2, AVX2, AVX-512 or NEON if available.
  *
- * @param[in|out] a An array of colors used as a destination. Must be 16-byte aligned.
- * @param b An array of colors used as a source. Must be 16-byte aligned.
- * @param length The number of colors in the arrays. Must be a multiple of 4.
+ * @param[in|out] a An array of colors used as a destination. Must be 64-byte aligned.
+ * @param b An array of colors used as a source. Must be 64-byte aligned.
+ * @param length The number of colors in the arrays. Must be a multiple of 16.
  * @note Arrays must not overlap.
  */
 void blend(uint8_t * a, const uint8_t * b, size_t length);
@@ -53,24 +53,48 @@ void blend(uint8_t * a, const uint8_t * b, size_t length);
  * \f$\begin{align*}
  * \end{align*}
  *
- * The product operation uses SSE2 or MMX if available.
+ * The product operation uses SSE2, AVX2, AVX-512 or NEON if available.
  *
- * @param[in|out] a An array of colors used as a destination. Must be 16-byte aligned.
- * @param b An array of colors used as a source. Must be 16-byte aligned.
- * @param length The number of colors in the arrays. Must be a multiple of 4.
+ * @param[in|out] a An array of colors used as a destination. Must be 64-byte aligned.
+ * @param b An array of colors used as a source. Must be 64-byte aligned.
+ * @param length The number of colors in the arrays. Must be a multiple of 16.
  * @note Arrays must not overlap.
  */
 void multiply(uint8_t * a, const uint8_t * b, size_t length);
 
+/** Compare two R8G8B8A8 color streams
+ *
+ * Builds a bitmap of entries whose color differs between both streams. Bit n
+ * of the bitmap, that is bit (n % 8) of byte (n / 8), is set if entry n differs.
+ * Alpha channel is ignored.
+ *
+ * The comparison uses SSE2, AVX2, AVX-512 or NEON if available.
+ *
+ * @param[out] changes The bitmap, must hold length / 8 bytes.
+ * @param a An array of colors. Must be 64-byte aligned.
+ * @param b An array of colors. Must be 64-byte aligned.
+ * @param length The number of colors in the arrays. Must be a multiple of 16.
+ */
+void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
+
 #ifdef __cplusplus
     namespace detail {  // exposed for testing purposes
 #endif
         void blend_plain(uint8_t * a, const uint8_t * b, size_t length);
         void blend_sse2(uint8_t * a, const uint8_t * b, size_t length);
         void blend_avx2(uint8_t * a, const uint8_t * b, size_t length);
+        void blend_avx512(uint8_t * a, const uint8_t * b, size_t length);
+        void blend_neon(uint8_t * a, const uint8_t * b, size_t length);
         void multiply_plain(uint8_t * a, const uint8_t * b, size_t length);
         void multiply_sse2(uint8_t * a, const uint8_t * b, size_t length);
         void multiply_avx2(uint8_t * a, const uint8_t * b, size_t length);
+        void multiply_avx512(uint8_t * a, const uint8_t * b, size_t length);
+        void multiply_neon(uint8_t * a, const uint8_t * b, size_t length);
+        void diff_plain(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
+        void diff_sse2(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
+        void diff_avx2(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
+        void diff_avx512(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
+        void diff_neon(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length);
 #ifdef __cplusplus
     } // namespace detail
 
@@ -80,18 +104,40 @@ void multiply(uint8_t * a, const uint8_t * b, size_t length);
                 { detail::blend_plain(a, b, length); }
             static inline void multiply(uint8_t * a, const uint8_t * b, size_t length)
                 { detail::multiply_plain(a, b, length); }
+            static inline void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length)
+                { detail::diff_plain(changes, a, b, length); }
         };
         struct sse2 {
             static inline void blend(uint8_t * a, const uint8_t * b, size_t length)
                 { detail::blend_sse2(a, b, length); }
             static inline void multiply(uint8_t * a, const uint8_t * b, size_t length)
                 { detail::multiply_sse2(a, b, length); }
+            static inline void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length)
+                { detail::diff_sse2(changes, a, b, length); }
         };
         struct avx2 {
             static inline void blend(uint8_t * a, const uint8_t * b, size_t length)
                 { detail::blend_avx2(a, b, length); }
             static inline void multiply(uint8_t * a, const uint8_t * b, size_t length)
                 { detail::multiply_avx2(a, b, length); }
+            static inline void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length)
+                { detail::diff_avx2(changes, a, b, length); }
+        };
+        struct avx512 {
+            static inline void blend(uint8_t * a, const uint8_t * b, size_t length)
+                { detail::blend_avx512(a, b, length); }
+            static inline void multiply(uint8_t * a, const uint8_t * b, size_t length)
+                { detail::multiply_avx512(a, b, length); }
+            static inline void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length)
+                { detail::diff_avx512(changes, a, b, length); }
+        };
+        struct neon {
+            static inline void blend(uint8_t * a, const uint8_t * b, size_t length)
+                { detail::blend_neon(a, b, length); }
+            static inline void multiply(uint8_t * a, const uint8_t * b, size_t length)
+                { detail::multiply_neon(a, b, length); }
+            static inline void diff(uint8_t * changes, const uint8_t * a, const uint8_t * b, size_t length)
+                { detail::diff_neon(changes, a, b, length); }
         };
     } // namespace architecture
 
@@ -54,6 +54,10 @@ public:
 
         virtual int             createThread(lua_State * lua, int nargs) = 0;
         virtual void            destroyThread(lua_State * lua, Thread &) = 0;
+        virtual void            pauseThread(lua_State * lua, Thread &) = 0;
+        virtual void            resumeThread(lua_State * lua, Thread &) = 0;
+
+        virtual InterpolatorSet & interpolators() = 0;
     protected:
         ~Controller() {}
     };
@@ -64,9 +68,6 @@ public:
     void            openKeyleds(Controller *);
     Controller *    controller() const;
 
-    void            stepInterpolators(Interpolator::milliseconds elapsed)
-        { Interpolator::stepAll(m_lua, elapsed); }
-
     static const void * const waitToken;
 private:
     lua_State *     m_lua;
@@ -17,10 +17,14 @@
 #ifndef KEYLEDS_PLUGINS_LUA_LUAEFFECT_H_F038C73D
 #define KEYLEDS_PLUGINS_LUA_LUAEFFECT_H_F038C73D
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <vector>
 #include "keyledsd/PluginHelper.h"
 #include "lua/Environment.h"
 
+struct lua_Debug;
 struct lua_State;
 
 
@@ -28,10 +32,29 @@ namespace keyleds::plugin::lua {
 
 /****************************************************************************/
 
+/** Lua scripted effect
+ *
+ * When the effect is given a render budget, a render call running longer than
+ * watchdogFactor times the budget is aborted from an instruction count hook,
+ * which disables the effect, or terminates the thread that was running. This
+ * is a best-effort check on LuaJIT: compiled code does not run hooks, so a loop
+ * the compiler picked up is not interrupted.
+ */
 class LuaEffect final : public SimpleEffect, public keyleds::lua::Environment::Controller
 {
+    using clock = std::chrono::steady_clock;
     struct lua_state_deleter { void operator()(lua_State *) const; };
     using state_ptr = std::unique_ptr<lua_State, lua_state_deleter>;
+    /// Pending wake-up of a thread
+    struct ScheduleEntry
+    {
+        Thread::timestamp   wakeTime;   ///< When to resume the thread
+        std::uint64_t       ticket;     ///< Must match thread's, otherwise entry is stale
+        int                 id;         ///< Thread reference in thread list
+    };
+public:
+    static constexpr unsigned watchdogFactor = 4;
+    static constexpr int watchdogInstructions = 1000;   ///< Instructions between deadline checks
 public:
                     LuaEffect(std::string name, EffectService &, state_ptr);
                     LuaEffect(const LuaEffect &) = delete;
@@ -55,18 +78,34 @@ public: // Environment::Controller interface for lua
     void            destroyRenderTarget(RenderTarget *) override;
     int             createThread(lua_State * lua, int nargs) override;
     void            destroyThread(lua_State * lua, Thread &) override;
+    void            pauseThread(lua_State * lua, Thread &) override;
+    void            resumeThread(lua_State * lua, Thread &) override;
+    keyleds::lua::InterpolatorSet & interpolators() override { return m_interpolators; }
 
 private:
            void     setupState();
            void     stepThreads(milliseconds);
            void     runThread(Thread &, lua_State * thread, int nargs);
+           void     scheduleThread(Thread &);
     static bool     pushHook(lua_State *, const char *);
     static bool     handleError(lua_State *, EffectService &, int code);
+    static void     watchdogHook(lua_State *, lua_Debug *);
 private:
     std::string     m_name;         ///< Name of the effect, from config file
     EffectService & m_service;      ///< For communicating with keyleds
+    keyleds::lua::InterpolatorSet m_interpolators;  ///< Running fades, must outlive m_state
     state_ptr       m_state;        ///< Lua container this effect's scripts runs in
     bool            m_enabled;      ///< Should render/event handlers be run?
+    bool            m_debug = false;///< Publish scheduling counters to scripts
+    std::chrono::microseconds m_renderLimit{0}; ///< Render call duration before it is
+                                    ///  aborted, zero if unlimited
+    clock::time_point m_deadline;   ///< When current render call gets aborted
+
+    Thread::timestamp m_now = {};   ///< Time elapsed since effect creation
+    std::vector<ScheduleEntry> m_schedule;  ///< Min-heap of pending wake-ups, stale
+                                            ///  entries are skipped when popped
+    std::uint64_t   m_lastTicket = 0;       ///< Last schedule ticket given out
+    unsigned        m_resumedThreads = 0;   ///< Threads resumed during last frame
 };
 
 /****************************************************************************/
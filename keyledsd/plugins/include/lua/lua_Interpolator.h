@@ -18,6 +18,10 @@
 #define KEYLEDS_PLUGINS_LUA_LUA_INTERPOLATOR_H_BCD195FC
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 #include "lua/lua_types.h"
 #include "keyledsd/PluginHelper.h"
 
@@ -25,29 +29,84 @@ namespace keyleds::lua {
 
 /****************************************************************************/
 
+/** Running color interpolations of an effect.
+ *
+ * Holds all running interpolations in a structure of arrays, stepped in a
+ * single loop every frame. At most one interpolation runs on a given key of a
+ * given render target, starting another one replaces it in constant time.
+ */
+class InterpolatorSet final
+{
+public:
+    using milliseconds = std::chrono::duration<unsigned, std::milli>;
+
+    /// Identifies a running interpolation, remains safe to use after it ends
+    struct Handle
+    {
+        std::uint64_t       id;         ///< Unique identifier, 0 if none
+        const RenderTarget * target;    ///< Render target the interpolation runs on
+        unsigned            index;      ///< Key index within render target
+    };
+
+public:
+    /// Starts interpolating a key, replacing any running interpolation on it
+    Handle          start(RenderTarget &, unsigned index, milliseconds duration,
+                          RGBAColor startValue, RGBAColor finishValue);
+    bool            active(const Handle &) const;
+    void            stop(const Handle &);
+    /// Stops all interpolations on target, must be called before it is destroyed
+    void            erase(const RenderTarget *);
+    /// Advances all interpolations, writing colors into their targets
+    void            step(milliseconds elapsed);
+
+    std::size_t     size() const noexcept { return m_ids.size(); }
+
+private:
+    struct Key
+    {
+        const RenderTarget * target;
+        unsigned            index;
+        bool operator==(const Key & other) const
+            { return target == other.target && index == other.index; }
+    };
+    struct KeyHash { std::size_t operator()(const Key &) const noexcept; };
+
+    void            remove(std::size_t);
+
+private:
+    std::vector<std::uint64_t>  m_ids;          ///< Unique identifier of each interpolation
+    std::vector<RenderTarget *> m_targets;      ///< Render target of each interpolation
+    std::vector<unsigned>       m_indices;      ///< Key index within render target
+    std::vector<unsigned>       m_elapsed;      ///< Elapsed time in ms
+    std::vector<unsigned>       m_durations;    ///< Animation duration in ms
+    std::vector<RGBAColor>      m_startValues;  ///< Color when elapsed == 0
+    std::vector<RGBAColor>      m_finishValues; ///< Color when elapsed >= duration
+    std::unordered_map<Key, std::size_t, KeyHash> m_positions; ///< Maps keys to array positions
+    std::uint64_t               m_lastId = 0;   ///< Last identifier given out
+};
+
+/****************************************************************************/
+
 /** Color interpolator for animating keys.
- * This is a lua userdata-based object created using `fade()` from lua.
+ * This is a lua userdata-based object created using `fade()` from lua. It only
+ * describes the interpolation, which runs in the effect's InterpolatorSet once
+ * assigned to a key.
  */
 struct Interpolator
 {
     enum {
         hasStartValueFlag = (1 << 1)
     };
-    using milliseconds = std::chrono::duration<unsigned, std::milli>;
+    using milliseconds = InterpolatorSet::milliseconds;
 
-    int             id;             ///< luaL_ref id in registry
     unsigned        flags;          ///< See flags_type above
-    unsigned        index;          ///< Key index withing render target
     milliseconds    duration;       ///< Animation duration in ms
-    milliseconds    elapsed;        ///< Elapsed time in ms
     RGBAColor       startValue;     ///< Color when elapsed == 0
     RGBAColor       finishValue;    ///< Color when elapsed >= duration
+    InterpolatorSet::Handle handle; ///< Running instance, if any
 
     static void start(lua_State *, unsigned keyIndex); // on stack: (interpolator, rendertarget) [-2, 0]
     static void stop(lua_State *);                     // on stack: (interpolator) [-1, 0]
-    static void stepAll(lua_State *, milliseconds);
-
-    RGBAColor   value() const;
 };
 
 int luaNewInterpolator(lua_State *);
@@ -30,6 +30,11 @@ template <> struct metatable<RenderTarget *>
     { static const char * const name; static const struct luaL_Reg methods[];
       static const struct luaL_Reg meta_methods[]; struct weak_table : std::false_type{}; };
 
+/// Loads support for RenderTarget:pixels(), if lua engine is LuaJIT
+void openPixelViews(lua_State *);
+/// Marks RenderTarget at given index as gone, releasing its pixel views
+void lua_releaseRenderTarget(lua_State *, int index);
+
 /****************************************************************************/
 
 } // namespace keyleds::lua
@@ -18,6 +18,7 @@
 #define KEYLEDS_PLUGINS_LUA_LUA_THREAD_H_761E3512
 
 #include <chrono>
+#include <cstdint>
 #include "lua/lua_types.h"
 
 namespace keyleds::lua {
@@ -25,14 +26,20 @@ namespace keyleds::lua {
 /****************************************************************************/
 
 /** Lua coroutine-based thread.
+ *
+ * Threads are scheduled by the controller, which only resumes them once their
+ * wake-up time is reached.
  */
 struct Thread
 {
     using milliseconds = std::chrono::duration<unsigned, std::milli>;
+    using timestamp = std::chrono::duration<std::uint64_t, std::milli>;  ///< Since effect creation
 
-    int             id;         ///< unique identifier
+    int             id;         ///< unique identifier, LUA_NOREF once stopped
     bool            running;    ///< whether the thread is currently running (schedulable)
-    milliseconds    sleepTime;  ///< time until thread should be awoken
+    std::uint64_t   ticket;     ///< identifies the thread's current entry in the schedule
+    timestamp       wakeTime;   ///< time at which thread should be awoken, or time left
+                                ///  until then while paused
 };
 
 int luaNewThread(lua_State *);
@@ -127,6 +127,7 @@ void Environment::openKeyleds(Controller * controller)
     registerType<RenderTarget *>(m_lua);
     registerType<RGBAColor>(m_lua);
     registerType<Thread>(m_lua);
+    openPixelViews(m_lua);
 
     // Register globals
     lua_pushvalue(m_lua, LUA_GLOBALSINDEX);
@@ -31,11 +31,20 @@ using namespace keyleds::lua;
 // Constants defining LUA environment
 
 // LUA libraries to load
+#ifdef LUAJIT_VERSION
+// The jit library is what turns the compiler on; its global is removed below
+static constexpr std::array<lua_CFunction, 5> loadModules = {{
+    luaopen_base, luaopen_math, luaopen_string, luaopen_table, luaopen_jit,
+}};
+static_assert(loadModules.back() == luaopen_jit,
+              "unexpected last element, is size correct?");
+#else
 static constexpr std::array<lua_CFunction, 4> loadModules = {{
     luaopen_base, luaopen_math, luaopen_string, luaopen_table,
 }};
 static_assert(loadModules.back() == luaopen_table,
               "unexpected last element, is size correct?");
+#endif
 
 // Symbols not in this list get removed once libraries are loaded
 static constexpr std::array<const char *, 25> globalWhitelist = {{
@@ -59,6 +68,10 @@ static void * const threadToken = const_cast<void **>(&threadToken);
 static int luaPanicHandler(lua_State *);
 static int luaErrorHandler(lua_State *);
 
+/// Heap ordering for the thread schedule, so earliest wake-up comes first
+template <typename T> static bool wakesLater(const T & a, const T & b)
+    { return a.wakeTime > b.wakeTime; }
+
 /****************************************************************************/
 // Lifecycle management
 
@@ -137,8 +150,13 @@ void LuaEffect::setupState()
     if (getConfig<bool>(m_service, "debug").value_or(false)) {
         lua_pushcfunction(lua, luaopen_debug);
         lua_call(lua, 0, 0);
+        m_debug = true;
     }
 
+    // Render calls running far past their budget are aborted
+    auto budget = getConfig<std::chrono::microseconds>(m_service, "render-budget");
+    if (budget) { m_renderLimit = *budget * watchdogFactor; }
+
     // Insert thread list
     lua_pushlightuserdata(lua, threadToken);
     lua_newtable(lua);
@@ -219,7 +237,12 @@ void LuaEffect::render(milliseconds elapsed, RenderTarget & target)
     if (!m_enabled) { return; }
     auto lua = m_state.get();
 
-    Environment(lua).stepInterpolators(elapsed);
+    if (m_renderLimit.count() > 0) {
+        m_deadline = clock::now() + m_renderLimit;
+        lua_sethook(lua, watchdogHook, LUA_MASKCOUNT, watchdogInstructions);
+    }
+
+    m_interpolators.step(elapsed);
     stepThreads(elapsed);
 
     SAVE_TOP(lua);
@@ -237,8 +260,10 @@ void LuaEffect::render(milliseconds elapsed, RenderTarget & target)
         lua_pop(lua, 1);                            // pop(errhandler)
     }
 
-    lua_to<RenderTarget *>(lua, -1) = nullptr;      // mark target as gone
+    lua_releaseRenderTarget(lua, -1);               // mark target as gone
     lua_pop(lua, 1);
+    m_interpolators.erase(&target);                 // drop fades the hook started on it
+    if (m_renderLimit.count() > 0) { lua_sethook(lua, nullptr, 0, 0); }
     CHECK_TOP(lua, 0);
 }
 
@@ -329,6 +354,7 @@ keyleds::RenderTarget * LuaEffect::createRenderTarget()
 
 void LuaEffect::destroyRenderTarget(RenderTarget * target)
 {
+    m_interpolators.erase(target);
     m_service.destroyRenderTarget(target);
 }
 
@@ -336,7 +362,7 @@ void LuaEffect::destroyRenderTarget(RenderTarget * target)
 int LuaEffect::createThread(lua_State * lua, int nargs)
 {
     SAVE_TOP(lua);
-    lua_push(lua, Thread{0, true, Thread::milliseconds::zero()});   // push(thread)
+    lua_push(lua, Thread{0, true, 0, m_now});      // push(thread)
 
     lua_createtable(lua, 0, 1);                     // push(fenv)
     auto * thread = lua_newthread(m_state.get());   // push(thread)
@@ -353,7 +379,9 @@ int LuaEffect::createThread(lua_State * lua, int nargs)
     int itemsToMove = 1 + nargs;
     lua_insert(lua, -1 - itemsToMove);              // pop(thread) => (thread, args...)
     lua_xmove(lua, thread, itemsToMove);            // pop(args...)
-    runThread(lua_to<Thread>(lua, -1), thread, nargs);
+    auto & threadInfo = lua_to<Thread>(lua, -1);
+    runThread(threadInfo, thread, nargs);
+    if (threadInfo.running) { scheduleThread(threadInfo); }
 
     CHECK_TOP(lua, -1 - nargs + 1);
     return 1;
@@ -367,49 +395,87 @@ void LuaEffect::destroyThread(lua_State * lua, Thread & thread)
 
     luaL_unref(lua, -1, thread.id);
     lua_pop(lua, 1);
+    thread.id = LUA_NOREF;
     thread.running = false;
     CHECK_TOP(lua, 0);
 }
 
-void LuaEffect::stepThreads(milliseconds elapsed)
+void LuaEffect::pauseThread(lua_State *, Thread & thread)
 {
-    auto * lua = m_state.get();
-    SAVE_TOP(lua);
-    lua_pushlightuserdata(lua, threadToken);
-    lua_rawget(lua, LUA_REGISTRYINDEX);
-
-    auto size = lua_objlen(lua, -1);
-    assert(size <= std::numeric_limits<int>::max());
-    for (int index = 1; index <= int(size); ++index) {
-        lua_rawgeti(lua, -1, index);                    // push(threadInfo)
-        if (!lua_is<Thread>(lua, -1)) {
-            lua_pop(lua, 1);                            // (pop(threadInfo))
-            continue;
-        }
+    if (!thread.running) { return; }
+    thread.running = false;         // scheduled entry is now stale
+    thread.wakeTime = thread.wakeTime > m_now ? thread.wakeTime - m_now : Thread::timestamp::zero();
+}
 
-        auto & threadInfo = lua_to<Thread>(lua, -1);
+void LuaEffect::resumeThread(lua_State *, Thread & thread)
+{
+    if (thread.running || thread.id == LUA_NOREF) { return; }
+    thread.running = true;
+    thread.wakeTime += m_now;
+    scheduleThread(thread);
+}
 
-        if (threadInfo.running) {
-            if (threadInfo.sleepTime <= elapsed) {
-                lua_getfenv(lua, -1);                   // push(fenv)
-                lua_getfield(lua, -1, "thread");        // push(thread)
-                auto * thread = static_cast<lua_State *>(const_cast<void *>(lua_topointer(lua, -1)));
+/// Adds a wake-up entry for the thread, invalidating any previous one
+void LuaEffect::scheduleThread(Thread & thread)
+{
+    thread.ticket = ++m_lastTicket;
+    m_schedule.push_back({thread.wakeTime, thread.ticket, thread.id});
+    std::push_heap(m_schedule.begin(), m_schedule.end(), wakesLater<ScheduleEntry>);
+}
 
-                while (threadInfo.running && threadInfo.sleepTime <= elapsed) {
-                    runThread(threadInfo, thread, 0);
-                }
+/* Only threads whose wake-up time is reached are looked up and resumed, so
+ * sleeping threads cost nothing until then. A thread resumed late runs again
+ * within the same frame until it catches up, as wait() durations accumulate
+ * from the scheduled wake-up time rather than from the actual one.
+ */
+void LuaEffect::stepThreads(milliseconds elapsed)
+{
+    auto * lua = m_state.get();
+    SAVE_TOP(lua);
 
-                lua_pop(lua, 2);                        // pop(fenv, thread)
+    m_now += elapsed;
+    m_resumedThreads = 0;
+    if (!m_schedule.empty() && m_schedule.front().wakeTime <= m_now) {
+        lua_pushlightuserdata(lua, threadToken);
+        lua_rawget(lua, LUA_REGISTRYINDEX);             // push(threadlist)
+
+        while (!m_schedule.empty() && m_schedule.front().wakeTime <= m_now) {
+            std::pop_heap(m_schedule.begin(), m_schedule.end(), wakesLater<ScheduleEntry>);
+            const auto entry = m_schedule.back();
+            m_schedule.pop_back();
+
+            lua_rawgeti(lua, -1, entry.id);             // push(threadInfo)
+            if (!lua_is<Thread>(lua, -1)) {
+                lua_pop(lua, 1);                        // pop(threadInfo)
+                continue;
             }
-            if (threadInfo.sleepTime > elapsed) {
-                threadInfo.sleepTime -= elapsed;
-            } else {
-                threadInfo.sleepTime = Thread::milliseconds::zero();
+            auto & threadInfo = lua_to<Thread>(lua, -1);
+            if (!threadInfo.running || threadInfo.ticket != entry.ticket) {
+                lua_pop(lua, 1);                        // pop(threadInfo)
+                continue;
             }
+
+            lua_getfenv(lua, -1);                       // push(fenv)
+            lua_getfield(lua, -1, "thread");            // push(thread)
+            auto * thread = static_cast<lua_State *>(const_cast<void *>(lua_topointer(lua, -1)));
+            runThread(threadInfo, thread, 0);
+            ++m_resumedThreads;
+            if (threadInfo.running) { scheduleThread(threadInfo); }
+            lua_pop(lua, 3);                            // pop(threadInfo, fenv, thread)
         }
-        lua_pop(lua, 1);                                // pop(threadInfo)
+        lua_pop(lua, 1);                                // pop(threadlist)
+    }
+
+    if (m_debug) {
+        lua_getglobal(lua, "keyleds");                  // push(keyleds)
+        if (lua_istable(lua, -1)) {
+            lua_pushinteger(lua, lua_Integer(m_resumedThreads));
+            lua_setfield(lua, -2, "resumedThreads");
+            lua_pushinteger(lua, lua_Integer(m_schedule.size()));
+            lua_setfield(lua, -2, "scheduledThreads");
+        }
+        lua_pop(lua, 1);                                // pop(keyleds)
     }
-    lua_pop(lua, 1);                                    // pop(animlist)
     CHECK_TOP(lua, 0);
 }
 
@@ -418,6 +484,11 @@ void LuaEffect::runThread(Thread & threadInfo, lua_State * thread, int nargs)
     auto * lua = m_state.get();
     SAVE_TOP(lua);
 
+    // Each coroutine has its own hook in Lua 5.1, give it the watchdog if set
+    if (m_renderLimit.count() > 0) {
+        lua_sethook(thread, lua_gethook(lua), lua_gethookmask(lua), lua_gethookcount(lua));
+    }
+
     bool terminate = true;
     switch (lua_resume(thread, nargs)) {
         case 0:
@@ -429,7 +500,7 @@ void LuaEffect::runThread(Thread & threadInfo, lua_State * thread, int nargs)
                 lua_pop(lua, 1);
                 break;
             }
-            threadInfo.sleepTime += Thread::milliseconds(unsigned(1000.0 * lua_tonumber(thread, 2)));
+            threadInfo.wakeTime += Thread::milliseconds(unsigned(1000.0 * lua_tonumber(thread, 2)));
             terminate = false;
             break;
         case LUA_ERRRUN:
@@ -488,6 +559,16 @@ bool LuaEffect::handleError(lua_State * lua, EffectService & service, int code)
     return ok;
 }
 
+/// Aborts running call once render deadline is past, see m_renderLimit
+void LuaEffect::watchdogHook(lua_State * lua, lua_Debug *)
+{
+    auto * effect = static_cast<LuaEffect *>(Environment(lua).controller());
+    if (effect != nullptr && clock::now() > effect->m_deadline) {
+        luaL_error(lua, "render time limit of %d us exceeded",
+                   static_cast<int>(effect->m_renderLimit.count()));
+    }
+}
+
 void LuaEffect::lua_state_deleter::operator()(lua_State *p) const { lua_close(p); }
 
 /****************************************************************************/
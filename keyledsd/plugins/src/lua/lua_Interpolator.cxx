@@ -19,7 +19,7 @@
 #include "lua/Environment.h"
 #include "lua/lua_common.h"
 #include <cassert>
-#include <limits>
+#include <functional>
 #include <lua.hpp>
 
 using namespace std::chrono_literals;
@@ -30,26 +30,6 @@ using milliseconds = Interpolator::milliseconds;
 
 static constexpr milliseconds maximumDuration = 1h;  // One hour
 
-static void * const interpolatorToken = const_cast<void **>(&interpolatorToken);
-static const char targetLink[] = "target";
-
-/****************************************************************************/
-
-static void pushRegistry(lua_State * lua)
-{
-    SAVE_TOP(lua);
-    lua_pushlightuserdata(lua, interpolatorToken);
-    lua_rawget(lua, LUA_REGISTRYINDEX);
-    if (!lua_istable(lua, -1)) {
-        lua_pop(lua, 1);
-        lua_createtable(lua, 1, 1);
-        lua_pushlightuserdata(lua, interpolatorToken);
-        lua_pushvalue(lua, -2);
-        lua_rawset(lua, LUA_REGISTRYINDEX);
-    }
-    CHECK_TOP(lua, +1);
-}
-
 /****************************************************************************/
 
 int luaNewInterpolator(lua_State * lua)
@@ -75,14 +55,11 @@ int luaNewInterpolator(lua_State * lua)
 
     // Create object
     lua_push(lua, Interpolator{
-        LUA_NOREF, flags, 0,
+        flags,
         std::chrono::duration_cast<Interpolator::milliseconds>(duration),
-        Interpolator::milliseconds::zero(),
-        startValue, finishValue
+        startValue, finishValue,
+        { 0, nullptr, 0 }
     });                                                         // push(interpol)
-    lua_createtable(lua, 0, 1);                                 // push(fenv)
-    lua_setfenv(lua, -2);                                       // pop(fenv)
-
     return 1;
 }
 
@@ -116,131 +93,150 @@ void Interpolator::start(lua_State * lua, unsigned keyIndex)
 
     auto & interpolator = lua_to<Interpolator>(lua, -2);
     auto * target = lua_to<RenderTarget *>(lua, -1);
-
-    if (interpolator.id != LUA_NOREF) {
-        luaL_error(lua, "interpolator already active");
+    auto * controller = Environment(lua).controller();
+    if (!controller) {
+        luaL_error(lua, noEffectTokenErrorMessage);
         // does not return
     }
 
-    SAVE_TOP(lua);
-    pushRegistry(lua);                                              // push(registry)
-
-    // see whether another interpolator already runs on this key
-    auto size = lua_objlen(lua, -1);
-    assert(size <= std::numeric_limits<int>::max());
-    for (decltype(size) index = 1; index <= size; ++index) {
-        lua_rawgeti(lua, -1, static_cast<int>(index));              // push(otherinter)
-        if (lua_isuserdata(lua, -1)) {      // any user data is an Interpolator
-            auto & other = lua_to<Interpolator>(lua, -1);
-            if (other.index == keyIndex) {
-                lua_getfenv(lua, -1);                               // push(otherfenv)
-                lua_getfield(lua, -1, targetLink);                  // push(othertarget)
-                auto * otherTarget = lua_to<RenderTarget *>(lua, -1);
-                lua_pop(lua, 2);                                    // pop(otherfenv, othertarget)
-                if (otherTarget == target) {
-                    Interpolator::stop(lua);    // (pop(otherinter))
-                    continue;
-                }
-            }
-        }
-        lua_pop(lua, 1);                                            // pop(otherinter)
+    auto & interpolators = controller->interpolators();
+    if (interpolators.active(interpolator.handle)) {
+        luaL_error(lua, "interpolator already active");
+        // does not return
     }
 
-    lua_pushvalue(lua, -3);                                         // push(interpolator)
-    interpolator.id = luaL_ref(lua, -2);                            // pop(interpolator)
-
-    // fill in missing values
-    interpolator.index = keyIndex;
-    interpolator.elapsed = Interpolator::milliseconds::zero();
+    auto startValue = interpolator.startValue;
     if ((interpolator.flags & Interpolator::hasStartValueFlag) == 0) {
-        interpolator.startValue = (*lua_to<RenderTarget *>(lua, -2))[keyIndex];
+        startValue = (*target)[keyIndex];
     } else {
-        (*target)[keyIndex] = interpolator.startValue;
+        (*target)[keyIndex] = startValue;
     }
-
-    // create a reference to the render target
-    lua_getfenv(lua, -3);                                           // push(fenv)
-    lua_pushvalue(lua, -3);                                         // push(target)
-    lua_setfield(lua, -2, targetLink);                              // pop(target)
-
-    lua_pop(lua, 4);                                                // pop(arg1, arg2, registry, fenv)
-    CHECK_TOP(lua, -2);
+    interpolator.handle = interpolators.start(*target, keyIndex, interpolator.duration,
+                                              startValue, interpolator.finishValue);
+    lua_pop(lua, 2);                                                // pop(interpolator, target)
 }
 
 void Interpolator::stop(lua_State * lua)
 {
-    SAVE_TOP(lua);
     assert(lua_gettop(lua) >= 1);
     assert(lua_is<Interpolator>(lua, -1));
 
     auto & interpolator = lua_to<Interpolator>(lua, -1);
+    auto * controller = Environment(lua).controller();
+    if (controller) { controller->interpolators().stop(interpolator.handle); }
+    interpolator.handle = { 0, nullptr, 0 };
+    lua_pop(lua, 1);                                                // pop(interpolator)
+}
 
-    lua_getfenv(lua, -1);                                   // push(fenv)
-    pushRegistry(lua);                                      // push(registry)
+/****************************************************************************/
 
-    // unregister interpolator from running list
-    luaL_unref(lua, -1, interpolator.id);
-    interpolator.id = LUA_NOREF;
+std::size_t InterpolatorSet::KeyHash::operator()(const Key & key) const noexcept
+{
+    return std::hash<const void *>()(key.target) ^ (std::size_t(key.index) * 0x9e3779b9u);
+}
 
-    // remove reference to the render target
-    lua_pushnil(lua);                                       // push(nil)
-    lua_setfield(lua, -3, targetLink);                      // pop(nil)
+InterpolatorSet::Handle InterpolatorSet::start(RenderTarget & target, unsigned index,
+                                               milliseconds duration,
+                                               RGBAColor startValue, RGBAColor finishValue)
+{
+    auto id = ++m_lastId;
+    auto [it, inserted] = m_positions.try_emplace(Key{&target, index}, m_ids.size());
+    if (inserted) {
+        m_ids.push_back(id);
+        m_targets.push_back(&target);
+        m_indices.push_back(index);
+        m_elapsed.push_back(0);
+        m_durations.push_back(duration.count());
+        m_startValues.push_back(startValue);
+        m_finishValues.push_back(finishValue);
+    } else {
+        // Replace interpolation running on that key
+        auto position = it->second;
+        m_ids[position] = id;
+        m_elapsed[position] = 0;
+        m_durations[position] = duration.count();
+        m_startValues[position] = startValue;
+        m_finishValues[position] = finishValue;
+    }
+    return { id, &target, index };
+}
+
+bool InterpolatorSet::active(const Handle & handle) const
+{
+    if (handle.id == 0) { return false; }
+    auto it = m_positions.find(Key{handle.target, handle.index});
+    return it != m_positions.end() && m_ids[it->second] == handle.id;
+}
 
-    lua_pop(lua, 3);                                        // pop(interpolator, fenv, registry)
-    CHECK_TOP(lua, -1);
+void InterpolatorSet::stop(const Handle & handle)
+{
+    if (!active(handle)) { return; }
+    remove(m_positions.find(Key{handle.target, handle.index})->second);
 }
 
-void Interpolator::stepAll(lua_State * lua, milliseconds elapsed)
+void InterpolatorSet::erase(const RenderTarget * target)
 {
-    SAVE_TOP(lua);
-    pushRegistry(lua);                                              // push(registry)
-
-    auto size = lua_objlen(lua, -1);
-    assert(size <= std::numeric_limits<int>::max());
-    for (decltype(size) index = 1; index <= size; ++index) {
-        lua_rawgeti(lua, -1, static_cast<int>(index));              // push(interpolator)
-        if (lua_isuserdata(lua, -1)) {      // any user data is an Interpolator
-            auto & interpolator = lua_to<Interpolator>(lua, -1);
-
-            lua_getfenv(lua, -1);                                   // push(fenv)
-            lua_getfield(lua, -1, targetLink);                      // push(target)
-            auto * target = lua_to<RenderTarget *>(lua, -1);
-            assert(target);
-            lua_pop(lua, 2);                                        // pop(fenv, target)
-
-            interpolator.elapsed += elapsed;
-            if (interpolator.elapsed >= interpolator.duration) {
-                (*target)[interpolator.index] = interpolator.finishValue;
-                Interpolator::stop(lua);                            // pop(interpolator)
-                continue;
-            }
-
-            (*target)[interpolator.index] = interpolator.value();
+    for (auto position = m_targets.size(); position-- > 0; ) {
+        if (m_targets[position] == target) { remove(position); }
+    }
+}
+
+void InterpolatorSet::step(milliseconds elapsed)
+{
+    using ct = RGBAColor::channel_type;
+    const auto count = m_ids.size();
+    const auto delta = elapsed.count();
+
+    for (std::size_t position = 0; position < count; ++position) {
+        m_elapsed[position] += delta;
+    }
+
+    for (std::size_t position = 0; position < count; ++position) {
+        auto & color = (*m_targets[position])[m_indices[position]];
+        const auto & from = m_startValues[position];
+        const auto & to = m_finishValues[position];
+        const int done = int(m_elapsed[position]);
+        const int total = int(m_durations[position]);
+        if (done >= total) {
+            color = to;
+            continue;
         }
-        lua_pop(lua, 1);                                            // pop(interpolator)
+        color = {
+            ct(int(from.red) + (int(to.red) - int(from.red)) * done / total),
+            ct(int(from.green) + (int(to.green) - int(from.green)) * done / total),
+            ct(int(from.blue) + (int(to.blue) - int(from.blue)) * done / total),
+            ct(int(from.alpha) + (int(to.alpha) - int(from.alpha)) * done / total)
+        };
     }
 
-    lua_pop(lua, 1);                                                // pop(registry)
-    CHECK_TOP(lua, 0);
+    // Drop finished interpolations, backwards so entries moved by remove() are already checked
+    for (auto position = count; position-- > 0; ) {
+        if (m_elapsed[position] >= m_durations[position]) { remove(position); }
+    }
 }
 
-RGBAColor Interpolator::value() const
+/// Removes entry at given position, moving the last entry in its place
+void InterpolatorSet::remove(std::size_t position)
 {
-    using ct = RGBAColor::channel_type;
-    return {
-        ct(int(startValue.red) +
-           (int(finishValue.red) - int(startValue.red))
-           * int(elapsed.count()) / int(duration.count())),
-        ct(int(startValue.green) +
-           (int(finishValue.green) - int(startValue.green))
-           * int(elapsed.count()) / int(duration.count())),
-        ct(int(startValue.blue) +
-           (int(finishValue.blue) - int(startValue.blue))
-           * int(elapsed.count()) / int(duration.count())),
-        ct(int(startValue.alpha) +
-           (int(finishValue.alpha) - int(startValue.alpha))
-           * int(elapsed.count()) / int(duration.count()))
-    };
+    const auto last = m_ids.size() - 1;
+    m_positions.erase(Key{m_targets[position], m_indices[position]});
+    if (position != last) {
+        m_ids[position] = m_ids[last];
+        m_targets[position] = m_targets[last];
+        m_indices[position] = m_indices[last];
+        m_elapsed[position] = m_elapsed[last];
+        m_durations[position] = m_durations[last];
+        m_startValues[position] = m_startValues[last];
+        m_finishValues[position] = m_finishValues[last];
+        m_positions[Key{m_targets[position], m_indices[position]}] = position;
+    }
+    m_ids.pop_back();
+    m_targets.pop_back();
+    m_indices.pop_back();
+    m_elapsed.pop_back();
+    m_durations.pop_back();
+    m_startValues.pop_back();
+    m_finishValues.pop_back();
 }
 
 /****************************************************************************/
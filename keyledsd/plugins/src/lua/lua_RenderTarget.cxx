@@ -21,6 +21,8 @@
 #include "lua/lua_common.h"
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
 #include <lua.hpp>
 
 using keyleds::KeyDatabase;
@@ -30,6 +32,19 @@ namespace keyleds::lua {
 
 /****************************************************************************/
 
+static const KeyDatabase * toDatabase(lua_State * lua)
+{
+    lua_getglobal(lua, "keyleds");
+    lua_getfield(lua, -1, "db");
+    if (!lua_is<const KeyDatabase *>(lua, -1)) {
+        luaL_error(lua, "keyleds.db is not a valid database");
+        // does not return
+    }
+    auto * db = lua_to<const KeyDatabase *>(lua, -1);
+    lua_pop(lua, 2);
+    return db;
+}
+
 static int toTargetIndex(lua_State * lua, int idx) // 0-based
 {
     if (lua_is<const KeyDatabase::Key *>(lua, idx)) {
@@ -39,17 +54,8 @@ static int toTargetIndex(lua_State * lua, int idx) // 0-based
         return static_cast<int>(lua_tointeger(lua, idx) - 1);
     }
     if (lua_isstring(lua, idx)) {
-        size_t size;
-        const char * keyName = lua_tolstring(lua, idx, &size);
-
-        lua_getglobal(lua, "keyleds");
-        lua_getfield(lua, -1, "db");
-        if (!lua_is<const KeyDatabase *>(lua, -1)) {
-            return luaL_error(lua, "keyleds.db is not a valid database");
-        }
-
-        auto * db = lua_to<const KeyDatabase *>(lua, -1);
-        lua_pop(lua, 2);
+        const char * keyName = lua_tostring(lua, idx);
+        const auto * db = toDatabase(lua);
 
         auto it = db->findName(keyName);
         if (it != db->end()) {
@@ -60,6 +66,66 @@ static int toTargetIndex(lua_State * lua, int idx) // 0-based
     return luaL_argerror(lua, idx, badTypeErrorMessage);
 }
 
+/// Number of entries in the key list at given stack index, see forEachKey.
+static std::size_t keyCount(lua_State * lua, int idx)
+{
+    if (lua_is<const KeyDatabase::KeyGroup *>(lua, idx)) {
+        return lua_to<const KeyDatabase::KeyGroup *>(lua, idx)->size();
+    }
+    if (lua_is<const KeyDatabase *>(lua, idx)) {
+        return lua_to<const KeyDatabase *>(lua, idx)->size();
+    }
+    luaL_checktype(lua, idx, LUA_TTABLE);
+    return lua_objlen(lua, idx);
+}
+
+/// Invokes fn(position, index) for each key in the list at given stack index.
+/// The list may be a KeyGroup, the KeyDatabase, or a table of keys, key names
+/// and indices. Keys that cannot be found are skipped, but still use up their
+/// position, so positions always match the list.
+template <typename Function>
+static void forEachKey(lua_State * lua, int idx, const RenderTarget & target, Function && fn)
+{
+    auto visit = [&](std::size_t position, int index) {
+        if (index >= 0 && static_cast<std::size_t>(index) < target.size()) {
+            fn(position, static_cast<std::size_t>(index));
+        }
+    };
+
+    if (lua_is<const KeyDatabase::KeyGroup *>(lua, idx)) {
+        std::size_t position = 0;
+        for (const auto & key : *lua_to<const KeyDatabase::KeyGroup *>(lua, idx)) {
+            visit(position++, static_cast<int>(key.index));
+        }
+    } else if (lua_is<const KeyDatabase *>(lua, idx)) {
+        std::size_t position = 0;
+        for (const auto & key : *lua_to<const KeyDatabase *>(lua, idx)) {
+            visit(position++, static_cast<int>(key.index));
+        }
+    } else {
+        luaL_checktype(lua, idx, LUA_TTABLE);
+        const auto size = lua_objlen(lua, idx);
+        for (std::size_t position = 0; position < size; ++position) {
+            lua_rawgeti(lua, idx, static_cast<int>(position + 1));
+            if (!lua_is<const KeyDatabase::Key *>(lua, -1) && !lua_isnumber(lua, -1) &&
+                !lua_isstring(lua, -1)) {
+                luaL_argerror(lua, idx, lua_pushfstring(lua, "%s at position %d", badTypeErrorMessage,
+                                                        static_cast<int>(position + 1)));
+                // does not return
+            }
+            const int index = toTargetIndex(lua, -1);
+            lua_pop(lua, 1);
+            visit(position, index);
+        }
+    }
+}
+
+static RGBAColor::channel_type toChannel(lua_Number value)
+{
+    static constexpr lua_Number channel_max = std::numeric_limits<RGBAColor::channel_type>::max();
+    return RGBAColor::channel_type(std::clamp(256.0 * value, 0.0, channel_max));
+}
+
 /****************************************************************************/
 
 static int blend(lua_State * lua)
@@ -108,6 +174,133 @@ static int multiply(lua_State * lua)
     return 0;
 }
 
+static int get(lua_State * lua)     // (target, keys) => (packed colors)
+{
+    auto * target = lua_check<RenderTarget *>(lua, 1);
+    if (!target) { return luaL_argerror(lua, 1, noLongerExistsErrorMessage); }
+
+    const auto count = static_cast<int>(keyCount(lua, 2));
+    lua_createtable(lua, 4 * count, 0);
+    int last = 0;
+    forEachKey(lua, 2, *target, [&](std::size_t position, std::size_t index) {
+        const auto & color = (*target)[index];
+        const auto base = static_cast<int>(4 * position);
+        for (; last < base; ++last) {           // keys that were skipped read as zeroes
+            lua_pushnumber(lua, 0.0);
+            lua_rawseti(lua, -2, last + 1);
+        }
+        lua_pushnumber(lua, lua_Number(color.red) / 255.0);
+        lua_rawseti(lua, -2, base + 1);
+        lua_pushnumber(lua, lua_Number(color.green) / 255.0);
+        lua_rawseti(lua, -2, base + 2);
+        lua_pushnumber(lua, lua_Number(color.blue) / 255.0);
+        lua_rawseti(lua, -2, base + 3);
+        lua_pushnumber(lua, lua_Number(color.alpha) / 255.0);
+        lua_rawseti(lua, -2, base + 4);
+        last = base + 4;
+    });
+    for (; last < 4 * count; ++last) {          // so do keys skipped at the end
+        lua_pushnumber(lua, 0.0);
+        lua_rawseti(lua, -2, last + 1);
+    }
+    return 1;
+}
+
+static int gradient(lua_State * lua)    // (target, keys, axis, from, to)
+{
+    auto * target = lua_check<RenderTarget *>(lua, 1);
+    if (!target) { return luaL_argerror(lua, 1, noLongerExistsErrorMessage); }
+    const auto * axis = luaL_checkstring(lua, 3);
+    const bool horizontal = std::strcmp(axis, "x") == 0;
+    if (!horizontal && std::strcmp(axis, "y") != 0) {
+        return luaL_argerror(lua, 3, "axis must be 'x' or 'y'");
+    }
+    const auto from = lua_checkcolor(lua, 4);
+    const auto to = lua_checkcolor(lua, 5);
+    const auto * db = toDatabase(lua);
+
+    // Work on doubled coordinates, so key centers are integers
+    const auto bounds = db->bounds();
+    const int low = 2 * int(horizontal ? bounds.x0 : bounds.y0);
+    const int total = std::max(1, 2 * int(horizontal ? bounds.x1 : bounds.y1) - low);
+
+    using ct = RGBAColor::channel_type;
+    forEachKey(lua, 2, *target, [&](std::size_t, std::size_t index) {
+        if (index >= db->size()) { return; }
+        const auto & rect = (*db)[index].position;
+        const int center = int(horizontal ? rect.x0 + rect.x1 : rect.y0 + rect.y1);
+        const int done = std::clamp(center - low, 0, total);
+        (*target)[index] = {
+            ct(int(from.red) + (int(to.red) - int(from.red)) * done / total),
+            ct(int(from.green) + (int(to.green) - int(from.green)) * done / total),
+            ct(int(from.blue) + (int(to.blue) - int(from.blue)) * done / total),
+            ct(int(from.alpha) + (int(to.alpha) - int(from.alpha)) * done / total)
+        };
+    });
+    return 0;
+}
+
+static int scaleAlpha(lua_State * lua)  // (target, keys, factor)
+{
+    auto * target = lua_check<RenderTarget *>(lua, 1);
+    if (!target) { return luaL_argerror(lua, 1, noLongerExistsErrorMessage); }
+    static constexpr lua_Number channel_max = std::numeric_limits<RGBAColor::channel_type>::max();
+    const auto factor = std::max(lua_Number(0.0), luaL_checknumber(lua, 3));
+
+    forEachKey(lua, 2, *target, [&](std::size_t, std::size_t index) {
+        auto & alpha = (*target)[index].alpha;
+        alpha = RGBAColor::channel_type(std::min(channel_max, lua_Number(alpha) * factor));
+    });
+    return 0;
+}
+
+static int set(lua_State * lua)         // (target, keys, color | colors | packed colors)
+{
+    auto * target = lua_check<RenderTarget *>(lua, 1);
+    if (!target) { return luaL_argerror(lua, 1, noLongerExistsErrorMessage); }
+
+    // Single color for all keys
+    if (lua_is<RGBAColor>(lua, 3)) {
+        const auto color = lua_tocolor(lua, 3);
+        forEachKey(lua, 2, *target, [&](std::size_t, std::size_t index) {
+            (*target)[index] = color;
+        });
+        return 0;
+    }
+
+    // One color per key, either as color objects or packed as returned by get()
+    luaL_checktype(lua, 3, LUA_TTABLE);
+    lua_rawgeti(lua, 3, 1);
+    const bool packed = lua_isnumber(lua, -1);
+    lua_pop(lua, 1);
+
+    if (packed) {
+        forEachKey(lua, 2, *target, [&](std::size_t position, std::size_t index) {
+            const auto base = static_cast<int>(4 * position);
+            lua_rawgeti(lua, 3, base + 1);
+            lua_rawgeti(lua, 3, base + 2);
+            lua_rawgeti(lua, 3, base + 3);
+            lua_rawgeti(lua, 3, base + 4);
+            if (lua_isnumber(lua, -4)) {        // missing entries leave key untouched
+                (*target)[index] = RGBAColor(
+                    toChannel(lua_tonumber(lua, -4)), toChannel(lua_tonumber(lua, -3)),
+                    toChannel(lua_tonumber(lua, -2)), toChannel(lua_tonumber(lua, -1))
+                );
+            }
+            lua_pop(lua, 4);
+        });
+    } else {
+        forEachKey(lua, 2, *target, [&](std::size_t position, std::size_t index) {
+            lua_rawgeti(lua, 3, static_cast<int>(position + 1));
+            if (!lua_isnil(lua, -1)) {          // missing entries leave key untouched
+                (*target)[index] = lua_checkcolor(lua, lua_gettop(lua));
+            }
+            lua_pop(lua, 1);
+        });
+    }
+    return 0;
+}
+
 static int create(lua_State * lua)
 {
     auto * controller = Environment(lua).controller();
@@ -120,6 +313,164 @@ static int create(lua_State * lua)
     return 1;
 }
 
+/****************************************************************************/
+// Pixel views
+
+#ifdef LUAJIT_VERSION
+/* Pixel views give LuaJIT scripts direct access to the color buffer of a render
+ * target. A view is an FFI structure holding only its size, so loops over its
+ * pixels compile to plain memory accesses.
+ *
+ * The ffi module is only visible to the chunk below. Buffer addresses are kept
+ * in a table private to it, keyed by view, as scripts can read all fields of
+ * FFI structures. Every access goes through its metamethods, which check
+ * indices, and no pointer is ever handed to scripts. Views are released along
+ * with their render target, after which they have a size of zero and accesses
+ * are ignored.
+ */
+static_assert(sizeof(RGBAColor) == 4, "pixel views expect packed colors");
+
+static const char pixelViewSource[] = R"lua(
+local ffi, colorMetatable = ...
+local error, setmetatable, tostring, type = error, setmetatable, tostring, type
+local max, min = math.max, math.min
+
+ffi.cdef[[
+struct keyleds_rgba { uint8_t red, green, blue, alpha; };
+struct keyleds_pixels { const int32_t size; };
+struct keyleds_pixels_rw { int32_t size; };
+]]
+local rgbaPtr = ffi.typeof('struct keyleds_rgba *')
+local rwPtr = ffi.typeof('struct keyleds_pixels_rw *')
+
+-- Same conversion as lua_tocolor
+local function channel(value) return min(255, max(0, value * 256)) end
+
+-- Color buffers of live views, by view
+local buffers = setmetatable({}, { __mode = 'k' })
+
+-- Bounds-checked, 1-based pixel lookup; pointers never leave this chunk.
+-- NaN fails all comparisons, so it is rejected as well.
+local function pixel(view, idx)
+    if idx >= 1 and idx <= view.size and idx % 1 == 0 then
+        return buffers[view] + (idx - 1)
+    end
+    return nil
+end
+
+local methods = {}
+function methods.get(view, idx)
+    local item = pixel(view, idx)
+    if item then
+        return item.red / 255, item.green / 255, item.blue / 255, item.alpha / 255
+    end
+    return nil
+end
+function methods.set(view, idx, red, green, blue, alpha)
+    local item = pixel(view, idx)
+    if item then
+        item.red, item.green, item.blue = channel(red), channel(green), channel(blue)
+        item.alpha = channel(alpha or 1)
+    end
+end
+
+local View = ffi.metatype('struct keyleds_pixels', {
+    __index = function(view, key)
+        if type(key) ~= 'number' then return methods[key] end
+        local item = pixel(view, key)
+        if item then
+            return setmetatable({ item.red / 255, item.green / 255,
+                                  item.blue / 255, item.alpha / 255 }, colorMetatable)
+        end
+        return nil
+    end,
+    __newindex = function(view, key, color)
+        if type(key) ~= 'number' then error('invalid pixel index ' .. tostring(key), 2) end
+        local item = pixel(view, key)
+        if item then
+            item.red, item.green = channel(color[1]), channel(color[2])
+            item.blue, item.alpha = channel(color[3]), channel(color[4])
+        end
+    end,
+    __len = function(view) return view.size end,
+})
+
+local views = setmetatable({}, { __mode = 'k' })
+local function acquire(target, data, size)
+    local view = views[target]
+    if not view then
+        view = View(size)
+        buffers[view] = ffi.cast(rgbaPtr, data)
+        views[target] = view
+    end
+    return view
+end
+local function release(target)
+    local view = views[target]
+    if view then
+        ffi.cast(rwPtr, view).size = 0
+        buffers[view] = nil
+        views[target] = nil
+    end
+end
+return acquire, release
+)lua";
+
+static void * const acquirePixelsToken = const_cast<void **>(&acquirePixelsToken);
+static void * const releasePixelsToken = const_cast<void **>(&releasePixelsToken);
+
+static int pixels(lua_State * lua)
+{
+    auto * target = lua_check<RenderTarget *>(lua, 1);
+    if (!target) { return luaL_argerror(lua, 1, noLongerExistsErrorMessage); }
+
+    lua_pushlightuserdata(lua, acquirePixelsToken);
+    lua_rawget(lua, LUA_REGISTRYINDEX);
+    lua_pushvalue(lua, 1);
+    lua_pushlightuserdata(lua, static_cast<void *>(target->data()));
+    lua_pushinteger(lua, static_cast<lua_Integer>(target->size()));
+    lua_call(lua, 3, 1);
+    return 1;
+}
+#endif
+
+void openPixelViews(lua_State * lua)
+{
+#ifdef LUAJIT_VERSION
+    SAVE_TOP(lua);
+    if (luaL_loadbuffer(lua, pixelViewSource, sizeof(pixelViewSource) - 1,
+                        "=pixels") != 0) {          // push(chunk)
+        lua_error(lua);
+    }
+    lua_pushcfunction(lua, luaopen_ffi);            // push(luaopen_ffi)
+    lua_call(lua, 0, 1);                            // pop(luaopen_ffi), push(ffi)
+    luaL_getmetatable(lua, metatable<RGBAColor>::name); // push(metatable)
+    lua_call(lua, 2, 2);                            // pop(chunk, ffi, metatable), push(acquire, release)
+
+    lua_pushlightuserdata(lua, releasePixelsToken);
+    lua_insert(lua, -2);
+    lua_rawset(lua, LUA_REGISTRYINDEX);             // pop(release)
+    lua_pushlightuserdata(lua, acquirePixelsToken);
+    lua_insert(lua, -2);
+    lua_rawset(lua, LUA_REGISTRYINDEX);             // pop(acquire)
+    CHECK_TOP(lua, 0);
+#else
+    static_cast<void>(lua);
+#endif
+}
+
+void lua_releaseRenderTarget(lua_State * lua, int index)
+{
+    lua_to<RenderTarget *>(lua, index) = nullptr;   // mark object as gone
+#ifdef LUAJIT_VERSION
+    if (index < 0) { --index; }
+    lua_pushlightuserdata(lua, releasePixelsToken);
+    lua_rawget(lua, LUA_REGISTRYINDEX);
+    lua_pushvalue(lua, index);
+    lua_call(lua, 1, 0);
+#endif
+}
+
 /****************************************************************************/
 
 static int destroy(lua_State * lua)
@@ -131,8 +482,7 @@ static int destroy(lua_State * lua)
     assert(controller);
 
     controller->destroyRenderTarget(target);
-
-    lua_to<RenderTarget *>(lua, 1) = nullptr;   // mark object as gone
+    lua_releaseRenderTarget(lua, 1);
     return 0;
 }
 
@@ -192,8 +542,15 @@ const struct luaL_Reg metatable<RenderTarget *>::methods[] = {
     { "blend",      blend },
     { "copy",       copy },
     { "fill",       fill },
+    { "get",        get },
+    { "gradient",   gradient },
     { "multiply",   multiply },
     { "new",        create },
+#ifdef LUAJIT_VERSION
+    { "pixels",     pixels },
+#endif
+    { "scaleAlpha", scaleAlpha },
+    { "set",        set },
     { nullptr,      nullptr }
 };
 const struct luaL_Reg metatable<RenderTarget *>::meta_methods[] = {
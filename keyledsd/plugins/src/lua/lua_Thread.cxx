@@ -33,13 +33,13 @@ int luaNewThread(lua_State * lua)
 
 static int pause(lua_State * lua)
 {
-    lua_check<Thread>(lua, 1).running = false;
+    Environment(lua).controller()->pauseThread(lua, lua_check<Thread>(lua, 1));
     return 0;
 }
 
 static int resume(lua_State * lua)
 {
-    lua_check<Thread>(lua, 1).running = true;
+    Environment(lua).controller()->resumeThread(lua, lua_check<Thread>(lua, 1));
     return 0;
 }
 
@@ -0,0 +1,122 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/lua_Interpolator.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <vector>
+
+using keyleds::RGBAColor;
+using keyleds::RenderTarget;
+using keyleds::lua::InterpolatorSet;
+using namespace std::literals::chrono_literals;
+
+namespace {
+
+constexpr RGBAColor black = {0, 0, 0, 0};
+constexpr RGBAColor red = {200, 0, 0, 255};
+constexpr RGBAColor blue = {0, 0, 200, 255};
+
+}
+
+TEST(InterpolatorSetTest, step) {
+    auto target = RenderTarget(8);
+    auto set = InterpolatorSet();
+    auto handle = set.start(target, 2, 100ms, black, red);
+    EXPECT_TRUE(set.active(handle));
+
+    set.step(50ms);
+    EXPECT_EQ((RGBAColor{100, 0, 0, 127}), target[2]);
+    EXPECT_EQ(black, target[1]);
+
+    set.step(60ms);
+    EXPECT_EQ(red, target[2]);
+    EXPECT_EQ(0u, set.size());
+    EXPECT_FALSE(set.active(handle));
+}
+
+TEST(InterpolatorSetTest, replace) {
+    auto target = RenderTarget(8);
+    auto set = InterpolatorSet();
+    auto first = set.start(target, 3, 100ms, black, red);
+    set.step(50ms);
+
+    // Starting on the same key replaces the running fade, restarting the clock
+    auto second = set.start(target, 3, 200ms, red, blue);
+    EXPECT_EQ(1u, set.size());
+    EXPECT_FALSE(set.active(first));
+    EXPECT_TRUE(set.active(second));
+    set.stop(first);                    // stale handle, no effect
+    EXPECT_TRUE(set.active(second));
+
+    set.step(100ms);
+    EXPECT_EQ((RGBAColor{100, 0, 100, 255}), target[3]);
+    set.step(100ms);
+    EXPECT_EQ(blue, target[3]);
+    EXPECT_EQ(0u, set.size());
+}
+
+TEST(InterpolatorSetTest, removeDuringStep) {
+    auto target = RenderTarget(8);
+    auto set = InterpolatorSet();
+    auto handles = std::vector<InterpolatorSet::Handle>{
+        set.start(target, 0, 100ms, black, red),
+        set.start(target, 1, 50ms, black, red),
+        set.start(target, 2, 200ms, black, red),
+        set.start(target, 3, 50ms, black, red),
+    };
+
+    // Finished fades are swapped with the last one, which must still be stepped
+    set.step(50ms);
+    EXPECT_EQ(2u, set.size());
+    EXPECT_EQ(red, target[1]);
+    EXPECT_EQ(red, target[3]);
+    EXPECT_TRUE(set.active(handles[0]));
+    EXPECT_FALSE(set.active(handles[1]));
+    EXPECT_TRUE(set.active(handles[2]));
+    EXPECT_FALSE(set.active(handles[3]));
+
+    set.step(50ms);
+    EXPECT_EQ(red, target[0]);
+    EXPECT_EQ((RGBAColor{100, 0, 0, 127}), target[2]);
+    EXPECT_EQ(1u, set.size());
+
+    // Moved entry can still be found and stopped
+    set.stop(handles[2]);
+    EXPECT_EQ(0u, set.size());
+    set.step(100ms);
+    EXPECT_EQ((RGBAColor{100, 0, 0, 127}), target[2]);
+}
+
+TEST(InterpolatorSetTest, eraseTarget) {
+    auto targetA = RenderTarget(8);
+    auto targetB = RenderTarget(8);
+    auto set = InterpolatorSet();
+    auto handleA = set.start(targetA, 1, 100ms, black, red);
+    set.start(targetA, 2, 100ms, black, red);
+    auto handleB = set.start(targetB, 1, 100ms, black, blue);
+
+    set.erase(&targetA);
+    EXPECT_EQ(1u, set.size());
+    EXPECT_FALSE(set.active(handleA));
+    EXPECT_TRUE(set.active(handleB));
+
+    set.step(100ms);
+    EXPECT_EQ(black, targetA[1]);
+    EXPECT_EQ(black, targetA[2]);
+    EXPECT_EQ(blue, targetB[1]);
+}
@@ -0,0 +1,96 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/LuaEffect.h"
+
+#include "TestEffectService.h"
+#include <gtest/gtest.h>
+#include <chrono>
+
+using keyleds::RenderTarget;
+using keyleds::plugin::lua::LuaEffect;
+using keyleds::test::TestEffectService;
+using namespace std::literals::chrono_literals;
+
+namespace {
+
+// Counts ticks every 100ms, and prints the count every frame
+const char tickScript[] = R"(
+ticks = 0
+local worker = thread(function()
+    while true do
+        wait(0.1)
+        ticks = ticks + 1
+    end
+end)
+
+function onGenericEvent(data)
+    if data.action == 'pause' then worker:pause() else worker:resume() end
+end
+
+function render(ms, target)
+    print(ticks)
+end
+)";
+
+}
+
+TEST(LuaEffectTest, threadCatchUp) {
+    auto service = TestEffectService();
+    auto effect = LuaEffect::create("test", service, tickScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = RenderTarget(0);
+
+    effect->render(50ms, target);
+    EXPECT_EQ("0", service.lastLog());
+    effect->render(50ms, target);
+    EXPECT_EQ("1", service.lastLog());
+
+    // A late thread runs several times within the frame, waits add up from schedule
+    effect->render(350ms, target);
+    EXPECT_EQ("4", service.lastLog());
+    effect->render(40ms, target);
+    EXPECT_EQ("4", service.lastLog());
+    effect->render(10ms, target);
+    EXPECT_EQ("5", service.lastLog());
+}
+
+TEST(LuaEffectTest, threadPauseResume) {
+    auto service = TestEffectService();
+    auto effect = LuaEffect::create("test", service, tickScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = RenderTarget(0);
+
+    effect->render(250ms, target);
+    EXPECT_EQ("2", service.lastLog());
+
+    // Paused 50ms before its wake-up, thread keeps those 50ms once resumed
+    effect->handleGenericEvent({{"action", "pause"}});
+    effect->render(1000ms, target);
+    EXPECT_EQ("2", service.lastLog());
+    effect->handleGenericEvent({{"action", "resume"}});
+    effect->render(40ms, target);
+    EXPECT_EQ("2", service.lastLog());
+    effect->render(10ms, target);
+    EXPECT_EQ("3", service.lastLog());
+    effect->render(100ms, target);
+    EXPECT_EQ("4", service.lastLog());
+
+    // Resuming a running thread does not schedule it twice
+    effect->handleGenericEvent({{"action", "resume"}});
+    effect->render(100ms, target);
+    EXPECT_EQ("5", service.lastLog());
+}
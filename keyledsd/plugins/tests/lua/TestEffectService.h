@@ -0,0 +1,86 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDS_PLUGINS_TESTS_LUA_TESTEFFECTSERVICE_H_D81C4A36
+#define KEYLEDS_PLUGINS_TESTS_LUA_TESTEFFECTSERVICE_H_D81C4A36
+
+#include "keyledsd/plugin/interfaces.h"
+#include "keyledsd/KeyDatabase.h"
+#include "keyledsd/RenderTarget.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace keyleds::test {
+
+/// Effect service recording log entries, with a single row of keys named
+/// key0, key1... Each key is 10 units wide, starting at x = 0.
+class TestEffectService final : public plugin::EffectService
+{
+public:
+    explicit TestEffectService(unsigned keys = 0) : m_keyDB(makeKeys(keys)) {}
+
+    const std::string & deviceName() const override { return m_name; }
+    const std::string & deviceModel() const override { return m_name; }
+    const std::string & deviceSerial() const override { return m_name; }
+    const KeyDatabase & keyDB() const override { return m_keyDB; }
+    const std::vector<KeyDatabase::KeyGroup> & keyGroups() const override { return m_keyGroups; }
+    const color_map &   colors() const override { return m_colors; }
+    const config_map &  configuration() const override { return m_configuration; }
+
+    RenderTarget *      createRenderTarget() override
+    {
+        m_targets.push_back(std::make_unique<RenderTarget>(m_keyDB.size()));
+        return m_targets.back().get();
+    }
+    void                destroyRenderTarget(RenderTarget * target) override
+    {
+        m_targets.erase(std::find_if(m_targets.begin(), m_targets.end(),
+                                     [target](const auto & item) { return item.get() == target; }));
+    }
+    const std::string & getFile(const std::string &) override { return m_file; }
+    void                log(logging::level_t, const char * msg) override { m_log = msg; }
+
+    std::size_t         renderTargets() const { return m_targets.size(); }
+    const std::string & lastLog() const { return m_log; }
+
+private:
+    static KeyDatabase makeKeys(unsigned count)
+    {
+        if (count == 0) { return KeyDatabase(); }  // bounds of an empty list are undefined
+        std::vector<KeyDatabase::Key> keys;
+        for (unsigned idx = 0; idx < count; ++idx) {
+            const auto x = KeyDatabase::position_type(10 * idx);
+            keys.push_back({idx, int(idx), "key" + std::to_string(idx), {x, 0, x + 10, 10}});
+        }
+        return KeyDatabase(std::move(keys));
+    }
+
+private:
+    const std::string                           m_name = "test";
+    const KeyDatabase                           m_keyDB;
+    const std::vector<KeyDatabase::KeyGroup>    m_keyGroups{};
+    const color_map                             m_colors{};
+    const config_map                            m_configuration{};
+    std::vector<std::unique_ptr<RenderTarget>>  m_targets;
+    const std::string                           m_file{};
+    std::string                                 m_log;
+};
+
+} // namespace keyleds::test
+
+#endif
@@ -0,0 +1,277 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/lua_RenderTarget.h"
+
+#include "lua/LuaEffect.h"
+#include "TestEffectService.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <lua.hpp>
+
+using keyleds::RenderTarget;
+using keyleds::RGBAColor;
+using keyleds::plugin::lua::LuaEffect;
+using keyleds::test::TestEffectService;
+using namespace std::literals::chrono_literals;
+
+/****************************************************************************/
+// Bulk operations
+
+namespace {
+
+/// Target with distinct colors on all keys of a TestEffectService
+RenderTarget makeTarget(std::size_t size)
+{
+    auto target = RenderTarget(size);
+    for (std::size_t idx = 0; idx < size; ++idx) {
+        target[idx] = RGBAColor(RGBAColor::channel_type(50 * idx), 0, 0, 255);
+    }
+    return target;
+}
+
+const char getScript[] = R"(
+function render(ms, target)
+    local colors = target:get({ 'key1', 'missing', 3, 'key9' })
+    assert(#colors == 16, 'result not padded')
+    assert(colors[1] == 50 / 255 and colors[2] == 0 and colors[4] == 1, 'bad color for key1')
+    for idx = 5, 8 do assert(colors[idx] == 0, 'skipped key lost its slot') end
+    assert(colors[9] == 100 / 255 and colors[12] == 1, 'bad color for index 3')
+    for idx = 13, 16 do assert(colors[idx] == 0, 'trailing skipped key lost its slot') end
+
+    local all = target:get(keyleds.db)
+    assert(#all == 16 and all[13] == 150 / 255, 'bad colors for database')
+    assert(#target:get({}) == 0, 'bad colors for empty list')
+    print('ok')
+end
+)";
+
+const char setScript[] = R"(
+function render(ms, target)
+    -- Packed colors, as returned by get()
+    target:set({ 'key0', 'missing', 'key2' }, { 0.5, 0, 0, 1,  1, 1, 1, 1,  0, 0.5, 0, 1 })
+    -- Color objects, missing entries leave keys untouched
+    target:set({ 'missing', 'key1', 'key3' }, { tocolor(1, 1, 1, 1), tocolor(0, 0, 1, 1) })
+    -- Packed colors round trip
+    local keys = { 'key0', 'key1', 'key2' }
+    target:set(keys, target:get(keys))
+    -- Single color
+    target:set({ 'key3', 'missing' }, tocolor(0, 1, 0, 0.5))
+    print('ok')
+end
+)";
+
+const char gradientScript[] = R"(
+local frame = 0
+function render(ms, target)
+    frame = frame + 1
+    if frame == 1 then
+        target:gradient({ 'key2' }, 'x', tocolor(0, 0, 0, 1), tocolor(1, 0, 0, 0))
+    elseif frame == 2 then
+        target:gradient(keyleds.db, 'x', tocolor(0, 0, 0, 1), tocolor(1, 0, 0, 1))
+    else
+        target:gradient(keyleds.db, 'y', tocolor(0, 0, 0, 1), tocolor(1, 0, 0, 1))
+        local black = tocolor(0, 0, 0, 1)
+        assert(not pcall(target.gradient, target, keyleds.db, 'z', black, black), 'bad axis accepted')
+    end
+    print('ok')
+end
+)";
+
+const char scaleAlphaScript[] = R"(
+function render(ms, target)
+    target:scaleAlpha({ 'key0', 'missing', 'key1' }, 2)
+    target:scaleAlpha({ 'key2' }, 0.5)
+    target:scaleAlpha({ 'key3' }, -1)
+    print('ok')
+end
+)";
+
+}
+
+TEST(LuaRenderTargetTest, bulkGet) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, getScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = makeTarget(4);
+
+    effect->render(16ms, target);
+    EXPECT_EQ("ok", service.lastLog());
+}
+
+TEST(LuaRenderTargetTest, bulkSet) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, setScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = RenderTarget(4);
+    std::fill(target.begin(), target.end(), RGBAColor(0, 0, 0, 0));
+
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(128, 0, 0, 255), target[0]);
+    EXPECT_EQ(RGBAColor(0, 0, 255, 255), target[1]);
+    EXPECT_EQ(RGBAColor(0, 128, 0, 255), target[2]);
+    EXPECT_EQ(RGBAColor(0, 255, 0, 128), target[3]);
+}
+
+TEST(LuaRenderTargetTest, bulkGradient) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, gradientScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+
+    // Gradient spans the whole keyboard, whatever keys it is applied to.
+    // Key centers are at x = 5, 15, 25, 35 and y = 5, keyboard bounds are 0-40 and 0-10.
+    auto target = makeTarget(4);
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(0, 0, 0, 255), target[0]);
+    EXPECT_EQ(RGBAColor(159, 0, 0, 96), target[2]);
+    EXPECT_EQ(RGBAColor(150, 0, 0, 255), target[3]);
+
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(31, 0, 0, 255), target[0]);
+    EXPECT_EQ(RGBAColor(95, 0, 0, 255), target[1]);
+    EXPECT_EQ(RGBAColor(159, 0, 0, 255), target[2]);
+    EXPECT_EQ(RGBAColor(223, 0, 0, 255), target[3]);
+
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    for (const auto & color : target) { EXPECT_EQ(RGBAColor(127, 0, 0, 255), color); }
+}
+
+TEST(LuaRenderTargetTest, bulkScaleAlpha) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, scaleAlphaScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = makeTarget(4);
+    target[1].alpha = 100;
+
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(0, 0, 0, 255), target[0]);      // saturates
+    EXPECT_EQ(RGBAColor(50, 0, 0, 200), target[1]);
+    EXPECT_EQ(RGBAColor(100, 0, 0, 127), target[2]);
+    EXPECT_EQ(RGBAColor(150, 0, 0, 0), target[3]);      // negative factors clear alpha
+}
+
+/****************************************************************************/
+// Pixel views
+
+#ifdef LUAJIT_VERSION
+namespace {
+
+// Checks the view contract on first frame, then the released view on second frame
+const char pixelViewScript[] = R"(
+local function isBlack(view, idx)
+    local r, g, b, a = view:get(idx)
+    return r == 0 and g == 0 and b == 0 and a == 0
+end
+
+function render(ms, target)
+    if saved then
+        assert(#saved == 0 and saved.size == 0, 'view was not released')
+        assert(saved[1] == nil and saved:get(1) == nil, 'released view is readable')
+        saved[1] = tocolor(1, 1, 1, 1)
+        saved:set(2, 1, 1, 1, 1)
+        print('ok')
+        return
+    end
+
+    local view = target:pixels()
+    assert(#view == 4 and view.size == 4, 'bad size')
+    assert(view.address == nil, 'address is visible')
+
+    view:set(1, 1, 0, 0, 1)
+    view[2] = tocolor(0, 1, 0, 0.5)
+    local r, g, b, a = view:get(1)
+    assert(r == 1 and g == 0 and b == 0 and a == 1, 'bad pixel 1')
+    assert(view[2].green == 1, 'bad pixel 2')
+
+    for _, idx in ipairs({ 0, -1, 5, 1.5, 3.999, 0/0, math.huge, -math.huge }) do
+        assert(view[idx] == nil and view:get(idx) == nil, 'read at ' .. tostring(idx))
+        view[idx] = tocolor(1, 1, 1, 1)
+        view:set(idx, 1, 1, 1, 1)
+    end
+    assert(isBlack(view, 3) and isBlack(view, 4), 'write out of range')
+    assert(not pcall(function() view.foo = 1 end), 'named write accepted')
+
+    saved = view
+    print('ok')
+end
+)";
+
+// Drops its only reference to a buffer, then churns memory until it is collected
+const char pixelViewGCScript[] = R"(
+buffer = RenderTarget:new()
+bufferView = buffer:pixels()
+bufferView:set(1, 1, 1, 1, 1)
+
+function render(ms, target)
+    if buffer then
+        buffer = nil
+        print('dropped')
+        return
+    end
+    local garbage = {}
+    for idx = 1, 1000000 do
+        if #bufferView == 0 then break end
+        garbage[idx % 64 + 1] = { idx }
+    end
+    assert(#bufferView == 0 and bufferView[1] == nil, 'view was not released')
+    bufferView:set(1, 1, 1, 1, 1)
+    print('ok')
+end
+)";
+
+}
+
+TEST(LuaRenderTargetTest, pixelView) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, pixelViewScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    auto target = RenderTarget(4);
+    std::fill(target.begin(), target.end(), RGBAColor(0, 0, 0, 0));
+
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(255, 0, 0, 255), target[0]);
+    EXPECT_EQ(RGBAColor(0, 255, 0, 128), target[1]);
+    EXPECT_EQ(RGBAColor(0, 0, 0, 0), target[2]);
+    EXPECT_EQ(RGBAColor(0, 0, 0, 0), target[3]);
+
+    // Target given to render is released at end of frame, writes are ignored
+    auto next = RenderTarget(4);
+    effect->render(16ms, next);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(RGBAColor(255, 0, 0, 255), target[0]);
+    EXPECT_EQ(RGBAColor(0, 255, 0, 128), target[1]);
+}
+
+TEST(LuaRenderTargetTest, pixelViewCollected) {
+    auto service = TestEffectService(4);
+    auto effect = LuaEffect::create("test", service, pixelViewGCScript);
+    ASSERT_TRUE(effect) << service.lastLog();
+    EXPECT_EQ(1u, service.renderTargets());
+    auto target = RenderTarget(4);
+
+    effect->render(16ms, target);
+    ASSERT_EQ("dropped", service.lastLog());
+    effect->render(16ms, target);
+    ASSERT_EQ("ok", service.lastLog());
+    EXPECT_EQ(0u, service.renderTargets());     // buffer was destroyed by collector
+}
+#endif
@@ -20,6 +20,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <ostream>
 
 using keyleds::KeyDatabase;
@@ -28,6 +29,19 @@ using keyleds::KeyDatabase;
 
 template <class T> T abs_difference(T a, T b) { return a > b ? a - b : b - a; }
 
+// Marks empty slots in indexes
+static constexpr KeyDatabase::Key::index_type noIndex = ~KeyDatabase::Key::index_type(0);
+
+// FNV-1a hash of a key name
+static std::size_t hashName(const char * name)
+{
+    std::uint32_t hash = 2166136261u;
+    for (; *name != '\0'; ++name) {
+        hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619u;
+    }
+    return hash;
+}
+
 // Return index in relation table for key pair, given a.index < b.index
 static std::size_t relationIndex(const KeyDatabase::Key & a, const KeyDatabase::Key & b,
                                  KeyDatabase::size_type N)
@@ -42,7 +56,9 @@ static std::size_t relationIndex(const KeyDatabase::Key & a, const KeyDatabase::
 KEYLEDSD_EXPORT KeyDatabase::KeyDatabase(key_list keys)
  : m_keys(std::move(keys)),
    m_bounds(::keyleds::bounds(m_keys.cbegin(), m_keys.cend())),
-   m_relations(computeRelations(m_keys))
+   m_relations(computeRelations(m_keys)),
+   m_codeIndex(buildCodeIndex(m_keys)),
+   m_nameIndex(buildNameIndex(m_keys))
 {
 #ifndef NDEBUG
     for (auto it = m_keys.begin(); it != m_keys.end(); ++it) {
@@ -55,14 +71,20 @@ KEYLEDSD_EXPORT KeyDatabase::~KeyDatabase() = default;
 
 KEYLEDSD_EXPORT KeyDatabase::const_iterator KeyDatabase::findKeyCode(int keyCode) const
 {
-    return std::find_if(m_keys.cbegin(), m_keys.cend(),
-                        [&](const auto & key) { return key.keyCode == keyCode; });
+    if (keyCode < 0 || static_cast<std::size_t>(keyCode) >= m_codeIndex.size()) { return end(); }
+    auto index = m_codeIndex[static_cast<std::size_t>(keyCode)];
+    return index != noIndex ? m_keys.cbegin() + index : end();
 }
 
-KEYLEDSD_EXPORT KEYLEDSD_EXPORT KeyDatabase::const_iterator KeyDatabase::findName(const char * name) const
+KEYLEDSD_EXPORT KeyDatabase::const_iterator KeyDatabase::findName(const char * name) const
 {
-    return std::find_if(m_keys.cbegin(), m_keys.cend(),
-                        [&](const auto & key) { return key.name == name; });
+    if (m_nameIndex.empty()) { return end(); }
+    const auto mask = m_nameIndex.size() - 1;
+    for (auto slot = hashName(name) & mask; m_nameIndex[slot] != noIndex; slot = (slot + 1) & mask) {
+        const auto & key = m_keys[m_nameIndex[slot]];
+        if (key.name == name) { return m_keys.cbegin() + key.index; }
+    }
+    return end();
 }
 
 KEYLEDSD_EXPORT KeyDatabase::position_type
@@ -105,6 +127,43 @@ KeyDatabase::relation_list KeyDatabase::computeRelations(const key_list & keys)
     return result;
 }
 
+/// Builds a table mapping key codes to key indices. Key codes are small integers,
+/// so the table is a plain array indexed by code.
+KeyDatabase::index_list KeyDatabase::buildCodeIndex(const key_list & keys)
+{
+    int maxCode = -1;
+    for (const auto & key : keys) { maxCode = std::max(maxCode, key.keyCode); }
+
+    auto result = index_list(static_cast<std::size_t>(maxCode + 1), noIndex);
+    for (const auto & key : keys) {
+        if (key.keyCode < 0) { continue; }
+        auto & slot = result[static_cast<std::size_t>(key.keyCode)];
+        if (slot == noIndex) { slot = key.index; }      // first key wins, as a linear search would
+    }
+    return result;
+}
+
+/// Builds a hash table of key indices by name, using linear probing. It is sized
+/// to a power of two at least twice the number of keys, to keep probe sequences short.
+KeyDatabase::index_list KeyDatabase::buildNameIndex(const key_list & keys)
+{
+    if (keys.empty()) { return {}; }
+    std::size_t size = 1;
+    while (size < 2 * keys.size()) { size *= 2; }
+    const auto mask = size - 1;
+
+    auto result = index_list(size, noIndex);
+    for (const auto & key : keys) {
+        auto slot = hashName(key.name.c_str()) & mask;
+        bool duplicate = false;
+        for (; result[slot] != noIndex; slot = (slot + 1) & mask) {
+            if (keys[result[slot]].name == key.name) { duplicate = true; break; }
+        }
+        if (!duplicate) { result[slot] = key.index; }   // first key wins, as a linear search would
+    }
+    return result;
+}
+
 /****************************************************************************/
 
 KEYLEDSD_EXPORT KeyDatabase::KeyGroup::KeyGroup(std::string name, key_list keys)
@@ -25,8 +25,8 @@ using keyleds::RenderTarget;
 static_assert(std::is_pod<keyleds::RGBAColor>::value, "RGBAColor must be a POD type");
 static_assert(sizeof(keyleds::RGBAColor) == 4, "RGBAColor must be tightly packed");
 
-// 16 is minimum for SSE2, 32 for AVX2
-static constexpr auto alignBytes = static_cast<std::align_val_t>(32);
+// 16 is minimum for SSE2, 32 for AVX2, 64 for AVX-512 and NEON kernels
+static constexpr auto alignBytes = static_cast<std::align_val_t>(64);
 static constexpr auto alignColors = static_cast<RenderTarget::size_type>(
     static_cast<unsigned>(alignBytes) / sizeof(keyleds::RGBAColor)
 );
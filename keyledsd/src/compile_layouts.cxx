@@ -0,0 +1,66 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** Layout compiler
+ *
+ * Compiles layout description files into their binary form, so the service
+ * can map them directly instead of parsing them. Used at build time to
+ * precompile shipped layouts, which are installed alongside their sources.
+ *
+ * Usage: keyledsd-compile-layouts OUTPUT_DIR LAYOUT_FILE...
+ */
+#include "keyledsd/device/CompiledLayout.h"
+#include "keyledsd/device/LayoutDescription.h"
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using keyleds::device::CompiledLayout;
+using keyleds::device::LayoutDescription;
+
+static std::string outputPath(const std::string & outputDir, const std::string & path)
+{
+    const auto nameStart = path.rfind('/') + 1;             // npos wraps to 0
+    auto name = path.substr(nameStart);
+    name = name.substr(0, name.rfind('.'));
+    return outputDir + '/' + name + CompiledLayout::fileExtension;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2) {
+        std::cerr <<"Usage: " <<argv[0] <<" OUTPUT_DIR LAYOUT_FILE..." <<std::endl;
+        return 2;
+    }
+    const std::string outputDir = argv[1];
+
+    int status = 0;
+    for (int idx = 2; idx < argc; ++idx) {
+        const std::string path = argv[idx];
+        try {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) { throw std::runtime_error("cannot open file"); }
+            const auto source = CompiledLayout::sourceOf(path);
+            CompiledLayout::compile(LayoutDescription::parse(file), source)
+                .save(outputPath(outputDir, path));
+        } catch (std::exception & error) {
+            std::cerr <<path <<": " <<error.what() <<std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
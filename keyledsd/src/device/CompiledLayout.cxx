@@ -0,0 +1,350 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/device/CompiledLayout.h"
+
+#include "config.h"
+#include "keyledsd/device/LayoutDescription.h"
+#include "keyledsd/tools/Paths.h"
+#include "keyledsd/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+LOGGING("layout");
+
+using keyleds::device::CompiledLayout;
+
+static constexpr std::uint32_t layoutMagic = 0x434c4b4b;   // "KKLC" in little endian
+
+/****************************************************************************/
+
+/// File header. All offsets are in bytes from start of file.
+struct CompiledLayout::Header final
+{
+    std::uint32_t   magic;              ///< Always layoutMagic, detects byte order
+    std::uint32_t   version;            ///< Always formatVersion
+    std::int64_t    sourceMtime;        ///< See Source
+    std::uint64_t   sourceSize;         ///< See Source
+    std::uint32_t   totalSize;          ///< Size of whole file
+    std::uint32_t   keyCount;           ///< Number of Key entries, following header
+    std::uint32_t   spuriousCount;      ///< Number of Position entries, following keys
+    std::uint32_t   stringsOffset;      ///< Start of string table
+    std::uint32_t   nameOffset;         ///< Layout name, within string table
+    std::uint32_t   nameLength;         ///< Length of layout name
+};
+static_assert(sizeof(CompiledLayout::Key) % alignof(CompiledLayout::Position) == 0);
+
+namespace keyleds::device {
+static bool operator<(const CompiledLayout::Key & lhs, const CompiledLayout::Key & rhs)
+    { return std::tie(lhs.block, lhs.code) < std::tie(rhs.block, rhs.code); }
+static bool operator<(const CompiledLayout::Position & lhs, const CompiledLayout::Position & rhs)
+    { return std::tie(lhs.block, lhs.code) < std::tie(rhs.block, rhs.code); }
+}
+
+/****************************************************************************/
+
+void CompiledLayout::Deleter::operator()(const char * ptr) const noexcept
+{
+    if (m_mappedSize > 0) {
+        munmap(const_cast<char *>(ptr), m_mappedSize);
+    } else {
+        std::default_delete<const char[]>()(ptr);   // from std::make_unique in compile()
+    }
+}
+
+CompiledLayout::CompiledLayout(data_ptr data, std::size_t size)
+ : m_data(std::move(data)), m_size(size)
+{}
+
+CompiledLayout CompiledLayout::compile(const LayoutDescription & layout, Source source)
+{
+    std::string strings = layout.name;
+
+    std::vector<Key> keys;
+    keys.reserve(layout.keys.size());
+    for (const auto & key : layout.keys) {
+        keys.push_back({
+            key.block, key.code,
+            key.position.x0, key.position.y0, key.position.x1, key.position.y1,
+            static_cast<std::uint32_t>(strings.size()),
+            static_cast<std::uint32_t>(key.name.size())
+        });
+        strings += key.name;
+    }
+    std::stable_sort(keys.begin(), keys.end());  // first key wins on duplicates
+
+    std::vector<Position> spurious;
+    spurious.reserve(layout.spurious.size());
+    for (const auto & pos : layout.spurious) { spurious.push_back({pos.first, pos.second}); }
+    std::sort(spurious.begin(), spurious.end());
+
+    const auto keysOffset = sizeof(Header);
+    const auto spuriousOffset = keysOffset + keys.size() * sizeof(Key);
+    const auto stringsOffset = spuriousOffset + spurious.size() * sizeof(Position);
+    const auto totalSize = stringsOffset + strings.size();
+    if (totalSize > UINT32_MAX) { throw Error("layout too large"); }
+
+    auto buffer = std::make_unique<char[]>(totalSize);
+    const auto header = Header{
+        layoutMagic, formatVersion, source.mtime, source.size,
+        static_cast<std::uint32_t>(totalSize),
+        static_cast<std::uint32_t>(keys.size()),
+        static_cast<std::uint32_t>(spurious.size()),
+        static_cast<std::uint32_t>(stringsOffset),
+        0, static_cast<std::uint32_t>(layout.name.size())
+    };
+    std::memcpy(buffer.get(), &header, sizeof(header));
+    std::memcpy(buffer.get() + keysOffset, keys.data(), keys.size() * sizeof(Key));
+    std::memcpy(buffer.get() + spuriousOffset, spurious.data(), spurious.size() * sizeof(Position));
+    std::memcpy(buffer.get() + stringsOffset, strings.data(), strings.size());
+
+    return CompiledLayout(data_ptr(buffer.release()), totalSize);
+}
+
+CompiledLayout CompiledLayout::map(const std::string & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { throw std::system_error(errno, std::generic_category()); }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category());
+    }
+    const auto size = static_cast<std::size_t>(info.st_size);
+    if (size < sizeof(Header)) {
+        ::close(fd);
+        throw Error("truncated file");
+    }
+
+    void * addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    auto error = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED) { throw std::system_error(error, std::generic_category()); }
+
+    auto layout = CompiledLayout(data_ptr(static_cast<const char *>(addr), Deleter(size)), size);
+    layout.validate();
+    return layout;
+}
+
+/** Check file contents are consistent.
+ * Ensures every offset stays within the file and lookups will work.
+ */
+void CompiledLayout::validate() const
+{
+    const auto & head = header();
+    if (head.magic != layoutMagic) { throw Error("not a compiled layout"); }
+    if (head.version != formatVersion) { throw Error("unsupported format version"); }
+    if (head.totalSize != m_size) { throw Error("invalid file size"); }
+
+    const auto spuriousOffset = sizeof(Header) + std::size_t{head.keyCount} * sizeof(Key);
+    const auto stringsOffset = spuriousOffset + std::size_t{head.spuriousCount} * sizeof(Position);
+    if (stringsOffset != head.stringsOffset || stringsOffset > m_size) {
+        throw Error("invalid table offsets");
+    }
+    const auto stringsSize = m_size - stringsOffset;
+    if (std::size_t{head.nameOffset} + head.nameLength > stringsSize) {
+        throw Error("invalid layout name");
+    }
+
+    const auto allKeys = keys();
+    for (const auto & key : allKeys) {
+        if (std::size_t{key.nameOffset} + key.nameLength > stringsSize) {
+            throw Error("invalid key name");
+        }
+    }
+    if (!std::is_sorted(allKeys.begin(), allKeys.end())) { throw Error("keys are not sorted"); }
+    const auto allSpurious = spurious();
+    if (!std::is_sorted(allSpurious.begin(), allSpurious.end())) {
+        throw Error("spurious keys are not sorted");
+    }
+}
+
+void CompiledLayout::save(const std::string & path) const
+{
+    // Write to a temporary file, then move it over, so readers never see partial files
+    const auto tmpPath = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(m_data.get(), static_cast<std::streamsize>(m_size));
+        if (!file) {
+            auto error = errno;
+            ::unlink(tmpPath.c_str());
+            throw std::system_error(error, std::generic_category());
+        }
+    }
+    if (::rename(tmpPath.c_str(), path.c_str()) < 0) {
+        auto error = errno;
+        ::unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category());
+    }
+}
+
+/****************************************************************************/
+
+CompiledLayout::Source CompiledLayout::sourceOf(const std::string & path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) < 0) { throw std::system_error(errno, std::generic_category()); }
+    // Sub-second precision is not kept by all tools that copy files, notably installers
+    return { std::int64_t{info.st_mtime}, static_cast<std::uint64_t>(info.st_size) };
+}
+
+/// Path of cache entry for given layout file. Entries are keyed by full path
+/// so that layouts with the same name in different data directories do not collide.
+static std::string cachePath(const std::string & path)
+{
+    std::uint64_t hash = 0xcbf29ce484222325;                // 64-bit FNV-1a
+    for (auto c : path) { hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3; }
+
+    const auto nameStart = path.rfind('/') + 1;             // npos wraps to 0
+    const auto nameEnd = path.rfind('.');
+    const auto name = path.substr(nameStart, nameEnd > nameStart ? nameEnd - nameStart
+                                                                 : std::string::npos);
+
+    std::ostringstream result;
+    result <<keyleds::tools::paths::getPaths(keyleds::tools::paths::XDG::Cache, false).front()
+           <<"/" KEYLEDSD_DATA_PREFIX "/layouts/"
+           <<name <<'-' <<std::hex <<std::setfill('0') <<std::setw(16) <<hash
+           <<CompiledLayout::fileExtension;
+    return result.str();
+}
+
+/// Creates parent directories of given file, ignoring already existing ones
+static void makeParentDirectories(const std::string & path)
+{
+    for (auto pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        if (::mkdir(path.substr(0, pos).c_str(), 0755) < 0 && errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category());
+        }
+    }
+}
+
+CompiledLayout CompiledLayout::load(const std::string & name)
+{
+    const auto prefixedPath = KEYLEDSD_DATA_PREFIX "/layouts/" + name;
+    auto file = tools::paths::open<std::ifstream>(
+        tools::paths::XDG::Data, prefixedPath, std::ios::binary
+    );
+    if (!file) { throw std::system_error(errno, std::generic_category()); }
+    const auto source = sourceOf(file->path);
+    const auto cache = cachePath(file->path);
+
+    // Look for a precompiled layout next to the file, then in the cache
+    const auto extPos = file->path.rfind('.');
+    const auto shipped = file->path.substr(0, extPos) + fileExtension;
+    for (const auto & candidate : { shipped, cache }) {
+        try {
+            auto layout = map(candidate);
+            if (layout.source() == source) {
+                DEBUG("using compiled layout ", candidate);
+                return layout;
+            }
+            DEBUG("compiled layout ", candidate, " is out of date");
+        } catch (Error & error) {
+            DEBUG("ignoring compiled layout ", candidate, ": ", error.what());
+        } catch (std::system_error &) {
+            // Not there, this is normal
+        }
+    }
+
+    INFO("loading layout ", file->path);
+    auto layout = compile(LayoutDescription::parse(file->stream), source);
+    try {
+        makeParentDirectories(cache);
+        layout.save(cache);
+    } catch (std::system_error & error) {
+        WARNING("could not cache layout to ", cache, ": ", error.what());
+    }
+    return layout;
+}
+
+/****************************************************************************/
+
+const CompiledLayout::Header & CompiledLayout::header() const noexcept
+{
+    return *reinterpret_cast<const Header *>(m_data.get());
+}
+
+CompiledLayout::Source CompiledLayout::source() const noexcept
+{
+    if (empty()) { return {}; }
+    return { header().sourceMtime, header().sourceSize };
+}
+
+std::string_view CompiledLayout::name() const noexcept
+{
+    if (empty()) { return {}; }
+    return { m_data.get() + header().stringsOffset + header().nameOffset, header().nameLength };
+}
+
+std::string_view CompiledLayout::name(const Key & key) const noexcept
+{
+    return { m_data.get() + header().stringsOffset + key.nameOffset, key.nameLength };
+}
+
+CompiledLayout::range<CompiledLayout::Key> CompiledLayout::keys() const noexcept
+{
+    if (empty()) { return { nullptr, nullptr }; }
+    const auto * first = reinterpret_cast<const Key *>(m_data.get() + sizeof(Header));
+    return { first, first + header().keyCount };
+}
+
+CompiledLayout::range<CompiledLayout::Key> CompiledLayout::keys(block_type block) const noexcept
+{
+    const auto all = keys();
+    const auto first = std::lower_bound(all.begin(), all.end(), block,
+                                        [](const auto & key, auto val) { return key.block < val; });
+    const auto last = std::upper_bound(first, all.end(), block,
+                                       [](auto val, const auto & key) { return val < key.block; });
+    return { first, last };
+}
+
+CompiledLayout::range<CompiledLayout::Position> CompiledLayout::spurious() const noexcept
+{
+    if (empty()) { return { nullptr, nullptr }; }
+    const auto * first = reinterpret_cast<const Position *>(
+        m_data.get() + sizeof(Header) + header().keyCount * sizeof(Key)
+    );
+    return { first, first + header().spuriousCount };
+}
+
+const CompiledLayout::Key * CompiledLayout::find(block_type block, code_type code) const noexcept
+{
+    const auto all = keys();
+    const auto target = Key{ block, code, 0, 0, 0, 0, 0, 0 };
+    const auto it = std::lower_bound(all.begin(), all.end(), target);
+    if (it == all.end() || it->block != block || it->code != code) { return nullptr; }
+    return it;
+}
+
+bool CompiledLayout::isSpurious(block_type block, code_type code) const noexcept
+{
+    const auto all = spurious();
+    return std::binary_search(all.begin(), all.end(), Position{ block, code });
+}
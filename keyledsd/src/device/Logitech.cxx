@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <iomanip>
 #include <memory>
@@ -68,20 +69,54 @@ Logitech::Logitech(device_ptr device,
 
 Logitech::~Logitech() = default;
 
-std::unique_ptr<keyleds::device::Device> Logitech::open(const std::string & path)
+std::unique_ptr<keyleds::device::Device> Logitech::open(const std::string & path,
+                                                        OpenTimings * timings)
 {
-    auto device = device_ptr(keyleds_open(path.c_str(), KEYLEDSD_APP_ID));
+    const auto start = std::chrono::steady_clock::now();
+    auto * device = keyleds_open(path.c_str(), KEYLEDSD_APP_ID);
     if (device == nullptr) { throw error(keyleds_get_error_str(), keyleds_get_errno()); }
+    if (timings) {
+        timings->open = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start
+        );
+    }
+    return open(device, path, timings);
+}
+
+std::unique_ptr<keyleds::device::Device> Logitech::open(struct keyleds_device * handle,
+                                                        std::string path, OpenTimings * timings)
+{
+    auto device = device_ptr(handle);
+    keyleds_set_pipeline_depth(device.get(), KEYLEDSD_PIPELINE_DEPTH);
+    // Device is flushed on every frame, this saves switching modes every time
+    if (!keyleds_set_nonblocking(device.get(), true)) {
+        throw error(keyleds_get_error_str(), keyleds_get_errno());
+    }
+
+    // Record time spent in each phase, measured from the end of previous one
+    auto last = std::chrono::steady_clock::now();
+    auto record = [timings, &last](std::chrono::microseconds OpenTimings::*phase) {
+        const auto now = std::chrono::steady_clock::now();
+        if (timings) {
+            timings->*phase = std::chrono::duration_cast<std::chrono::microseconds>(now - last);
+        }
+        last = now;
+    };
 
     auto type = getType(device.get());
     auto name = getName(device.get());
+    auto layout = keyleds_keyboard_layout(device.get(), KEYLEDS_TARGET_DEFAULT);
+    record(&OpenTimings::info);
+
     std::string model, serial, firmware;
     parseVersion(device.get(), &model, &serial, &firmware);
-    auto layout = keyleds_keyboard_layout(device.get(), KEYLEDS_TARGET_DEFAULT);
+    record(&OpenTimings::version);
+
     auto blocks = getBlocks(device.get());
+    record(&OpenTimings::blocks);
 
     return std::unique_ptr<Logitech>(new Logitech(
-        std::move(device), path,
+        std::move(device), std::move(path),
         type, std::move(name),
         std::move(model), std::move(serial), std::move(firmware),
         layout, std::move(blocks)
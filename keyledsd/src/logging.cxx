@@ -17,16 +17,21 @@
 #include "keyledsd/logging.h"
 #include <algorithm>
 #include <array>
+#include <cassert>
+#include <chrono>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
 #include <unistd.h>
 
+using namespace std::literals::chrono_literals;
 using namespace std::literals::string_view_literals;
 
 using keyleds::logging::Configuration;
+using keyleds::logging::Logger;
 using keyleds::logging::Policy;
 using keyleds::logging::FilePolicy;
+using keyleds::logging::AsyncPolicy;
 
 /****************************************************************************/
 
@@ -42,12 +47,15 @@ Configuration & Configuration::instance()
 
 void Configuration::setPolicy(const Policy * policy)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_globalPolicy = (policy != nullptr ? policy : &defaultPolicy());
+    m_generation.fetch_add(1, std::memory_order_release);
 }
 
 void Configuration::setPolicy(std::string name, const Policy * policy)
 {
     using std::swap;
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto it = std::find_if(m_policies.begin(), m_policies.end(),
                            [&name](const auto & item) { return item.first == name; });
     if (it == m_policies.end()) {
@@ -58,15 +66,20 @@ void Configuration::setPolicy(std::string name, const Policy * policy)
         if (policy) {
             it->second = policy;
         } else {
-            if (it != m_policies.end() - 1) {
-                swap(*it, m_policies.back());
-                m_policies.pop_back();
-            }
+            if (it != m_policies.end() - 1) { swap(*it, m_policies.back()); }
+            m_policies.pop_back();
         }
     }
+    m_generation.fetch_add(1, std::memory_order_release);
 }
 
 const Policy & Configuration::policyFor(const char * name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return findPolicy(name);
+}
+
+const Policy & Configuration::findPolicy(const char * name) const
 {
     auto it = std::find_if(m_policies.begin(), m_policies.end(),
                            [&name](const auto & item) { return item.first == name; });
@@ -84,6 +97,19 @@ const Policy & Configuration::defaultPolicy()
 
 /****************************************************************************/
 
+/// Caches the policy for current generation. Done under the configuration lock,
+/// so concurrent resolutions cannot leave a policy paired with another generation.
+void Logger::resolvePolicy() const
+{
+    auto & config = Configuration::instance();
+    std::lock_guard<std::mutex> lock(config.m_mutex);
+    auto generation = config.m_generation.load(std::memory_order_relaxed);
+    m_policy.store(&config.findPolicy(m_name), std::memory_order_release);
+    m_generation.store(generation, std::memory_order_release);
+}
+
+/****************************************************************************/
+
 Policy::~Policy() = default;
 
 /****************************************************************************/
@@ -151,3 +177,138 @@ void FilePolicy::write(level_t level, const std::string & name, const std::strin
     }
 }
 
+
+/****************************************************************************/
+
+struct AsyncPolicy::Slot
+{
+    std::atomic<std::size_t> sequence;  ///< Ring position slot is ready for, see below
+    level_t         level;
+    std::string     name;
+    std::string     message;
+};
+
+/// Roundup to power of two
+static std::size_t ringCapacity(std::size_t capacity)
+{
+    std::size_t result = 2;
+    while (result < capacity) { result *= 2; }
+    return result;
+}
+
+AsyncPolicy::AsyncPolicy(const Policy & target, std::size_t capacity)
+ : m_target(target),
+   m_mask(ringCapacity(capacity) - 1),
+   m_slots(std::make_unique<Slot[]>(m_mask + 1))
+{
+    for (std::size_t idx = 0; idx <= m_mask; ++idx) {
+        m_slots[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+    m_thread = std::thread(&AsyncPolicy::run, this);
+}
+
+AsyncPolicy::~AsyncPolicy()
+{
+    stop();
+}
+
+bool AsyncPolicy::canSkip(level_t level) const
+{
+    return m_target.canSkip(level);
+}
+
+/* The ring is a bounded queue where each slot carries a sequence number. A slot
+ * whose sequence equals a write position is free for the writer that claims
+ * that position. Once filled, its sequence becomes position + 1, which tells
+ * the reader it can be drained. The reader then sets it to position + capacity,
+ * freeing it for the next round. Writers claim positions with a CAS and never
+ * wait: if the slot is still in use from the previous round, the entry is dropped.
+ */
+void AsyncPolicy::write(level_t level, const std::string & name, const std::string & msg) const
+{
+    if (m_target.canSkip(level)) { return; }
+    if (!m_running.load(std::memory_order_acquire)) {
+        m_target.write(level, name, msg);
+        return;
+    }
+
+    auto position = m_writePosition.load(std::memory_order_relaxed);
+    Slot * slot;
+    for (;;) {
+        slot = &m_slots[position & m_mask];
+        auto sequence = slot->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(sequence - position);
+        if (diff == 0) {
+            if (m_writePosition.compare_exchange_weak(position, position + 1,
+                                                      std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            if (level <= error::value) {    // never lose errors, write them right away
+                m_target.write(level, name, msg);
+            } else {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        } else {
+            position = m_writePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->name.assign(name);
+    slot->message.assign(msg);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    m_cond.notify_one();
+}
+
+void AsyncPolicy::stop()
+{
+    if (!m_running.exchange(false)) { return; }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    m_thread.join();
+
+    // Writers that saw m_running before it was cleared may have filled slots
+    // after the thread's last pass
+    while (writeNext()) { /* empty */ }
+}
+
+/// Writes the oldest entry, if any. Background thread only, or once it is joined.
+bool AsyncPolicy::writeNext()
+{
+    auto & slot = m_slots[m_readPosition & m_mask];
+    if (slot.sequence.load(std::memory_order_acquire) != m_readPosition + 1) { return false; }
+
+    m_target.write(slot.level, slot.name, slot.message);
+    slot.sequence.store(m_readPosition + m_mask + 1, std::memory_order_release);
+    ++m_readPosition;
+    return true;
+}
+
+/* Writers signal the condition without taking the mutex, so a wakeup may be
+ * missed if it happens right before the thread starts waiting. The timeout
+ * bounds how long entries can stay in the buffer in that case.
+ */
+void AsyncPolicy::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        bool running = m_running.load(std::memory_order_acquire);
+        lock.unlock();
+        while (writeNext()) { /* empty */ }
+
+        auto dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != m_reported) {
+            std::ostringstream buffer;
+            buffer <<dropped - m_reported <<" log entries dropped";
+            m_target.write(warning::value, "logging", buffer.str());
+            m_reported = dropped;
+        }
+        lock.lock();
+        if (!running) { break; }
+        m_cond.wait_for(lock, 100ms, [this] { return !m_running.load(std::memory_order_acquire); });
+    }
+}
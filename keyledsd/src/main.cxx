@@ -28,6 +28,7 @@
 #include "keyledsd/tools/XWindow.h"
 #include <clocale>
 #include <csignal>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <fcntl.h>
@@ -49,6 +50,7 @@ LOGGING("main");
 using keyleds::service::Configuration;
 
 static uv_loop_t main_loop;
+static keyleds::logging::AsyncPolicy * asyncLogPolicy;
 
 /****************************************************************************/
 // Command line parsing
@@ -172,9 +174,13 @@ int main(int argc, char * argv[])
     const auto options = Options::parse(argc, argv);
     if (!options) { return 1; }
 
-    // Configure logging - intentionally leak policy in case some destructor logs stuff
+    // Configure logging - intentionally leak policies in case some destructor logs stuff.
+    // Entries are written from a background thread, so render threads never wait on stderr.
+    // On exit, pending entries are flushed and later ones are written synchronously.
     auto logPolicy = new logging::FilePolicy(STDERR_FILENO, options->logLevel);
-    logging::Configuration::instance().setPolicy(logPolicy);
+    asyncLogPolicy = new logging::AsyncPolicy(*logPolicy);
+    std::atexit([] { asyncLogPolicy->stop(); });
+    logging::Configuration::instance().setPolicy(asyncLogPolicy);
 
     INFO("keyledsd v" KEYLEDSD_VERSION_STR " starting up");
 
@@ -263,7 +269,7 @@ int main(int argc, char * argv[])
 
         uv_run(&main_loop, UV_RUN_DEFAULT);
     }
-    uv_run(&main_loop, UV_RUN_NOWAIT);  // let closed handles cleanup
+    uv_run(&main_loop, UV_RUN_DEFAULT); // let closed handles cleanup
     uv_loop_close(&main_loop);
 
 #ifndef NO_DBUS
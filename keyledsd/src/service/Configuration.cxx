@@ -16,8 +16,10 @@
  */
 #include "keyledsd/service/Configuration.h"
 
+#include "config.h"
 #include "keyledsd/tools/Paths.h"
 #include "keyledsd/tools/YAMLParser.h"
+#include "keyledsd/tools/utils.h"
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
@@ -31,9 +33,16 @@ namespace keyleds::service  {
 
 struct Configuration::Profile::Lookup::Entry
 {
+    /// How the value is matched, from cheapest to most expensive
+    enum class Kind { Any, Literal, Prefix, Suffix, Contains, Regex };
+
     std::string key;        ///< context entry key
     std::string value;      ///< string representation of the regex
-    std::regex  regex;      ///< regex to match context entry value against
+    Kind        kind;       ///< matching strategy, determined by regex shape
+    std::vector<std::string> texts; ///< literal strings, unless kind is Regex
+    std::regex  regex;      ///< regex to match context entry value against, if kind is Regex
+
+    bool        match(const std::string &) const;
 };
 
 /****************************************************************************/
@@ -51,6 +60,7 @@ class ConfigurationParser final : public tools::StackYAMLParser
     class StringMappingBuildState;
     class KeyGroupListState;
     class ColorMappingBuildState;
+    class FrameRateMappingBuildState;
     class EffectState;
     class EffectListState;
     class EffectGroupState;
@@ -64,6 +74,12 @@ public:
 
     void addGroupAlias(std::string anchor, Configuration::KeyGroup::key_list);
     const Configuration::KeyGroup::key_list & getGroupAlias(std::string_view anchor);
+    unsigned parseFrameRate(std::string_view value);
+    bool parseBoolean(std::string_view value);
+    unsigned parseThreadCount(std::string_view value);
+    bool parseMissedFrames(std::string_view value);
+    unsigned parseRealtimePriority(std::string_view value);
+    int parseNiceness(std::string_view value);
 
     Configuration & result();
 
@@ -228,6 +244,27 @@ private:
 };
 
 
+/// Configuration builder state: with frame rate mappings
+class ConfigurationParser::FrameRateMappingBuildState : public MappingState
+{
+public:
+    using value_type = Configuration::frame_rate_map;
+public:
+    void print(std::ostream & out) const override { out <<"frame-rate-mapping"; }
+
+    void scalarEntry(StackYAMLParser & parser, std::string_view key,
+                     std::string_view value, std::string_view) override
+    {
+        m_value.emplace_back(key, parser.as<ConfigurationParser>().parseFrameRate(value));
+    }
+
+    value_type &&   result() { return std::move(m_value); }
+
+private:
+    value_type      m_value;
+};
+
+
 /// Configuration builder state: within a plugin configuration
 class ConfigurationParser::EffectState final : public MappingState
 {
@@ -495,7 +532,8 @@ private:
 class ConfigurationParser::RootState final : public MappingState
 {
     enum class SubState {
-        None, Plugins, PluginPaths, CustomColors, Devices, KeyGroups, EffectGroups, Profiles
+        None, Plugins, PluginPaths, CustomColors, Devices, FrameRates, KeyGroups, EffectGroups,
+        Profiles
     };
 public:
     using value_type = Configuration;
@@ -527,6 +565,10 @@ public:
             m_currentSubState = SubState::Devices;
             return std::make_unique<StringMappingBuildState>();
         }
+        if (key == "frame-rate") {
+            m_currentSubState = SubState::FrameRates;
+            return std::make_unique<FrameRateMappingBuildState>();
+        }
         if (key == "groups") {
             m_currentSubState = SubState::KeyGroups;
             return std::make_unique<KeyGroupListState>();
@@ -547,6 +589,18 @@ public:
     {
         if (key == "plugin-path") {
             m_value.pluginPaths = { std::string(value) };
+        } else if (key == "frame-rate") {
+            m_value.frameRate = parser.as<ConfigurationParser>().parseFrameRate(value);
+        } else if (key == "adaptive-frame-rate") {
+            m_value.adaptiveFrameRate = parser.as<ConfigurationParser>().parseBoolean(value);
+        } else if (key == "render-threads") {
+            m_value.renderThreads = parser.as<ConfigurationParser>().parseThreadCount(value);
+        } else if (key == "missed-frames") {
+            m_value.skipMissedFrames = parser.as<ConfigurationParser>().parseMissedFrames(value);
+        } else if (key == "render-priority") {
+            m_value.renderPriority = parser.as<ConfigurationParser>().parseRealtimePriority(value);
+        } else if (key == "render-niceness") {
+            m_value.renderNiceness = parser.as<ConfigurationParser>().parseNiceness(value);
         } else {
             MappingState::scalarEntry(parser, key, value, anchor);
         }
@@ -567,6 +621,9 @@ public:
         case SubState::Devices:
             m_value.devices = state.as<StringMappingBuildState>().result();
             break;
+        case SubState::FrameRates:
+            m_value.frameRates = state.as<FrameRateMappingBuildState>().result();
+            break;
         case SubState::KeyGroups:
             m_value.keyGroups = state.as<KeyGroupListState>().result();
             break;
@@ -635,6 +692,50 @@ const Configuration::KeyGroup::key_list & ConfigurationParser::getGroupAlias(std
     return it->second;
 }
 
+unsigned ConfigurationParser::parseFrameRate(std::string_view value)
+{
+    auto fps = tools::parseNumber(std::string(value));
+    if (!fps || *fps == 0 || *fps > 1000) { throw makeError("invalid frame rate"); }
+    return static_cast<unsigned>(*fps);
+}
+
+unsigned ConfigurationParser::parseThreadCount(std::string_view value)
+{
+    auto count = tools::parseNumber(std::string(value));
+    if (!count || *count > 64) { throw makeError("invalid thread count"); }
+    return static_cast<unsigned>(*count);
+}
+
+bool ConfigurationParser::parseMissedFrames(std::string_view value)
+{
+    if (value == "skip") { return true; }
+    if (value == "restart") { return false; }
+    throw makeError("invalid missed frames policy");
+}
+
+unsigned ConfigurationParser::parseRealtimePriority(std::string_view value)
+{
+    auto priority = tools::parseNumber(std::string(value));
+    if (!priority || *priority > 99) { throw makeError("invalid realtime priority"); }
+    return static_cast<unsigned>(*priority);
+}
+
+int ConfigurationParser::parseNiceness(std::string_view value)
+{
+    auto text = std::string(value);
+    bool negative = !text.empty() && text.front() == '-';
+    auto niceness = tools::parseNumber(negative ? text.substr(1) : text);
+    if (!niceness || *niceness > (negative ? 20u : 19u)) { throw makeError("invalid niceness"); }
+    return negative ? -static_cast<int>(*niceness) : static_cast<int>(*niceness);
+}
+
+bool ConfigurationParser::parseBoolean(std::string_view value)
+{
+    if (value == "yes" || value == "true" || value == "on") { return true; }
+    if (value == "no" || value == "false" || value == "off") { return false; }
+    throw makeError("invalid boolean value");
+}
+
 Configuration & ConfigurationParser::result()
 {
     return finalState<InitialState>().result();
@@ -672,6 +773,26 @@ std::string getDeviceName(const Configuration & config, const std::string & seri
     return dit != config.devices.end() ? dit->first : serial;
 }
 
+unsigned getFrameRate(const Configuration & config, const std::string & name,
+                      const std::string & serial)
+{
+    auto it = std::find_if(config.frameRates.begin(), config.frameRates.end(),
+                           [&](auto & item) { return item.first == name || item.first == serial; });
+    if (it != config.frameRates.end()) { return it->second; }
+    return config.frameRate != 0 ? config.frameRate : KEYLEDSD_RENDER_FPS;
+}
+
+std::chrono::microseconds getRenderBudget(const Configuration::Effect & effect)
+{
+    auto it = std::find_if(effect.items.begin(), effect.items.end(),
+                           [](auto & item) { return item.first == "render-budget"; });
+    if (it == effect.items.end() || !std::holds_alternative<std::string>(it->second)) {
+        return std::chrono::microseconds::zero();
+    }
+    return tools::parseDuration<std::chrono::microseconds>(std::get<std::string>(it->second))
+           .value_or(std::chrono::microseconds::zero());
+}
+
 /****************************************************************************/
 
 Configuration::Profile::Lookup::Lookup(string_map filters)
@@ -682,6 +803,8 @@ Configuration::Profile::Lookup::~Lookup() = default;
 
 bool Configuration::Profile::Lookup::match(const string_map & context) const
 {
+    static const std::string empty;
+
     // Each entry in m_entries must match corresponding item in context
     return std::all_of(
         m_entries.cbegin(), m_entries.cend(),
@@ -690,27 +813,90 @@ bool Configuration::Profile::Lookup::match(const string_map & context) const
                 context.begin(), context.end(),
                 [&entry](const auto & ctxEntry) { return ctxEntry.first == entry.key; }
             );
-            const auto & value = it != context.end() ? it->second : std::string();
-            return std::regex_match(value, entry.regex);
+            return entry.match(it != context.end() ? it->second : empty);
     });
 }
 
+/* Most lookups in practice are plain names, alternatives of names, or a name
+ * surrounded with wildcards. Those are recognized when the lookup is built and
+ * matched with string comparisons, falling back to the regex for everything
+ * else. As in ECMAScript regexes, wildcards do not match line terminators.
+ */
 Configuration::Profile::Lookup::entry_list
 Configuration::Profile::Lookup::buildRegexps(string_map filters)
 {
+    using Kind = Entry::Kind;
+    constexpr char special[] = "\\^$.|?*+()[]{}\r\n";
+    constexpr std::string_view wildcard = ".*";
+    auto isLiteral = [&](std::string_view text) {
+        return text.find_first_of(special) == std::string_view::npos;
+    };
+
     entry_list result;
     result.reserve(filters.size());
-    std::transform(filters.begin(), filters.end(), std::back_inserter(result),
-                   [](auto & entry) {
-                       auto regex = std::regex(entry.second,
-                                               std::regex::nosubs | std::regex::optimize);
-                       return Entry{
-                           std::move(entry.first),
-                           std::move(entry.second),
-                           std::move(regex)
-                       };
-                   });
+    for (auto & filter : filters) {
+        auto entry = Entry{std::move(filter.first), std::move(filter.second), Kind::Regex, {}, {}};
+        auto pattern = std::string_view(entry.value);
+        auto hasPrefix = pattern.size() >= wildcard.size() &&
+                         pattern.substr(0, wildcard.size()) == wildcard;
+        auto hasSuffix = pattern.size() >= wildcard.size() &&
+                         pattern.substr(pattern.size() - wildcard.size()) == wildcard;
+
+        if (pattern == wildcard) {
+            entry.kind = Kind::Any;
+        } else if (hasPrefix || hasSuffix) {
+            auto text = pattern.substr(hasPrefix ? wildcard.size() : 0);
+            if (hasSuffix) { text.remove_suffix(wildcard.size()); }
+            if (isLiteral(text)) {
+                entry.kind = hasPrefix ? (hasSuffix ? Kind::Contains : Kind::Suffix) : Kind::Prefix;
+                entry.texts.emplace_back(text);
+            }
+        } else {
+            // Alternatives of literals, anchors are redundant as the whole value must match
+            entry.kind = Kind::Literal;
+            for (std::size_t begin = 0, end = 0; end != std::string_view::npos; begin = end + 1) {
+                end = pattern.find('|', begin);
+                auto item = pattern.substr(begin, end == std::string_view::npos ? end : end - begin);
+                if (!item.empty() && item.front() == '^') { item.remove_prefix(1); }
+                if (!item.empty() && item.back() == '$') { item.remove_suffix(1); }
+                if (!isLiteral(item)) { entry.kind = Kind::Regex; break; }
+                entry.texts.emplace_back(item);
+            }
+        }
+
+        if (entry.kind == Kind::Regex) {
+            entry.texts.clear();
+            entry.regex = std::regex(entry.value, std::regex::nosubs | std::regex::optimize);
+        }
+        result.push_back(std::move(entry));
+    }
+
+    // Check cheap entries first, so most mismatches never reach a regex
+    std::stable_sort(result.begin(), result.end(),
+                     [](const auto & a, const auto & b) { return a.kind < b.kind; });
     return result;
 }
 
+bool Configuration::Profile::Lookup::Entry::match(const std::string & text) const
+{
+    if (kind == Kind::Literal) {
+        return std::find(texts.begin(), texts.end(), text) != texts.end();
+    }
+    if (kind == Kind::Regex) { return std::regex_match(text, regex); }
+
+    // Literal parts hold no line terminator, so any must be matched by a wildcard
+    if (text.find_first_of("\r\n") != std::string::npos) { return false; }
+    if (kind == Kind::Any) { return true; }
+
+    const auto & part = texts.front();
+    if (text.size() < part.size()) { return false; }
+    switch (kind) {
+    case Kind::Prefix:      return text.compare(0, part.size(), part) == 0;
+    case Kind::Suffix:      return text.compare(text.size() - part.size(), part.size(), part) == 0;
+    case Kind::Contains:    return text.find(part) != std::string::npos;
+    default:                break;
+    }
+    return false;
+}
+
 } // namespace keyleds::service
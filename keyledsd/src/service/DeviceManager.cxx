@@ -20,13 +20,18 @@
 #include "config.h"
 #include "keyledsd/logging.h"
 #include "keyledsd/service/EffectService.h"
+#include "keyledsd/tools/AnimationExecutor.h"
 #include "keyledsd/tools/DeviceWatcher.h"
 #include <algorithm>
 #include <cassert>
+#include <numeric>
 #include <unistd.h>
 
 LOGGING("dev-manager");
 
+/// Number of contexts whose profile resolution is remembered, per device
+static constexpr std::size_t resolvedContextCacheSize = 16;
+
 namespace keyleds::service {
 
 static constexpr char defaultProfileName[] = "__default__";
@@ -37,22 +42,41 @@ static constexpr char overlayProfileName[] = "__overlay__";
 DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWatcher,
                              const tools::device::Description & description,
                              std::unique_ptr<device::Device> device,
-                             const Configuration * conf)
+                             KeyDatabase keyDB,
+                             const Configuration * conf,
+                             tools::AnimationExecutor * executor)
+    : DeviceManager(effectManager, fileWatcher,
+                    description.sysPath(), getSerial(description), findEventDevices(description),
+                    std::move(device), std::move(keyDB), conf, executor)
+{}
+
+DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWatcher,
+                             std::string sysPath, std::string serial, dev_list eventDevices,
+                             std::unique_ptr<device::Device> device,
+                             KeyDatabase keyDB,
+                             const Configuration * conf,
+                             tools::AnimationExecutor * executor)
     : m_effectManager(effectManager),
       m_configuration(nullptr),
-      m_sysPath(description.sysPath()),
-      m_serial(getSerial(description)),
-      m_eventDevices(findEventDevices(description)),
+      m_sysPath(std::move(sysPath)),
+      m_serial(std::move(serial)),
+      m_eventDevices(std::move(eventDevices)),
       m_device(std::move(device)),
-      m_fileWatcherSub(fileWatcher.subscribe(description.devNode(), FileWatcher::Event::Attrib,
+      m_fileWatcherSub(fileWatcher.subscribe(m_device->path(), FileWatcher::Event::Attrib,
                                              std::bind(&DeviceManager::handleFileEvent, this,
                                                        std::placeholders::_1, std::placeholders::_2,
                                                        std::placeholders::_3))),
-      m_keyDB(setupKeyDatabase(*m_device)),
+      m_keyDB(std::move(keyDB)),
+      m_renderTargetPool(m_keyDB.size()),
+      m_resolvedContexts(resolvedContextCacheSize),
       m_renderLoop(*m_device, KEYLEDSD_RENDER_FPS)
 {
     setConfiguration(conf);
-    m_renderLoop.start();
+    m_renderLoop.setSkipPolicy(conf->skipMissedFrames ? RenderLoop::SkipPolicy::Skip
+                                                      : RenderLoop::SkipPolicy::Restart);
+    m_renderLoop.setRealtimePriority(static_cast<int>(conf->renderPriority));
+    m_renderLoop.setNiceness(conf->renderNiceness);
+    m_renderLoop.start(executor);
 }
 
 DeviceManager::~DeviceManager()
@@ -63,14 +87,52 @@ DeviceManager::~DeviceManager()
 void DeviceManager::setConfiguration(const Configuration * conf)
 {
     assert(conf != nullptr);
-    auto lock = m_renderLoop.lock();
+    auto name = getDeviceName(*conf, m_serial);
+
+    // Effects read device name, custom colors and global key groups when they
+    // are created, so none can be kept if any of those changed.
+    const bool canKeep = m_configuration != nullptr && name == m_name &&
+                         conf->customColors == m_effectColors &&
+                         conf->keyGroups == m_effectKeyGroups;
+    auto isUnchanged = [conf](const detail::EffectGroup & group) {
+        auto it = std::find_if(conf->effectGroups.begin(), conf->effectGroups.end(),
+                               [&group](const auto & item) { return item.name == group.configuration.name; });
+        return it != conf->effectGroups.end() && *it == group.configuration;
+    };
+    auto firstChanged = canKeep ? std::stable_partition(m_effectGroups.begin(), m_effectGroups.end(),
+                                                        isUnchanged)
+                                : m_effectGroups.begin();
+
+    auto countEffects = [](auto begin, auto end) {
+        return std::accumulate(begin, end, std::size_t{0},
+                               [](auto val, const auto & group) { return val + group.effects.size(); });
+    };
+    auto kept = countEffects(m_effectGroups.begin(), firstChanged);
+    auto dropped = countEffects(firstChanged, m_effectGroups.end());
+
+    if (firstChanged != m_effectGroups.end()) {
+        // Effects are about to be destroyed, ensure the render thread let go of them
+        m_renderLoop.setEffects({}, {});
+        m_renderLoop.synchronize();
+        m_activeEffects.clear();
+        m_effectGroups.erase(firstChanged, m_effectGroups.end());
+    }
+    if (m_configuration != nullptr) {
+        INFO("configuration reloaded, kept ", kept, " effects, dropped ", dropped);
+    }
+    m_effectColors = conf->customColors;
+    m_effectKeyGroups = conf->keyGroups;
+    m_resolvedContexts.clear();             // they point into previous configuration
 
-    m_renderLoop.renderers().clear();
-    m_effectGroups.clear();
-    m_activeEffects.clear();
+    auto stats = m_renderTargetPool.statistics();
+    DEBUG("render targets: ", stats.allocations, " allocated, ", stats.reuses, " reused, ",
+          stats.free, " pooled, ", stats.discards, " discarded");
 
     m_configuration = conf;
-    m_name = getDeviceName(*conf, m_serial);
+    m_name = std::move(name);
+
+    m_renderLoop.setFrameRate(getFrameRate(*conf, m_name, m_serial));
+    m_renderLoop.setAdaptive(conf->adaptiveFrameRate);
 }
 
 void DeviceManager::setContext(const string_map & context)
@@ -78,16 +140,8 @@ void DeviceManager::setContext(const string_map & context)
     m_activeEffects = loadEffects(context);
     DEBUG("enabling ", m_activeEffects.size(), " effects for loop ", &m_renderLoop);
 
-    // Notify newly-active effects of context change
-    auto lock = m_renderLoop.lock();
-    for (auto * effect : m_activeEffects) {
-        effect->handleContextChange(context);
-    }
-
-    auto & renderers = m_renderLoop.renderers();
-    renderers.clear();
-    renderers.reserve(m_activeEffects.size());
-    std::copy(m_activeEffects.begin(), m_activeEffects.end(), std::back_inserter(renderers));
+    // Render loop notifies newly-active effects of context change
+    m_renderLoop.setEffects(m_activeEffects, context);
 }
 
 void DeviceManager::handleFileEvent(FileWatcher::Event, uint32_t, const std::string &)
@@ -98,8 +152,7 @@ void DeviceManager::handleFileEvent(FileWatcher::Event, uint32_t, const std::str
 
 void DeviceManager::handleGenericEvent(const string_map & context)
 {
-    auto lock = m_renderLoop.lock();
-    for (auto * effect : m_activeEffects) { effect->handleGenericEvent(context); }
+    m_renderLoop.postGenericEvent(context);
 }
 
 void DeviceManager::handleKeyEvent(int keyCode, bool press)
@@ -112,8 +165,7 @@ void DeviceManager::handleKeyEvent(int keyCode, bool press)
     }
 
     // Pass event to active effects
-    auto lock = m_renderLoop.lock();
-    for (const auto & effect : m_activeEffects) { effect->handleKeyEvent(*it, press); }
+    m_renderLoop.postKeyEvent(*it, press);
     DEBUG("key ", it->name, " ", press ? "pressed" : "released", " on device ", m_serial);
 }
 
@@ -122,12 +174,32 @@ void DeviceManager::setPaused(bool val)
     m_renderLoop.setPaused(val);
 }
 
-/// Applies the configuration to a string_map, matching profiles and resolving
-/// effect names. Returns the list of Effect entries in the configuration that
-/// should be loaded for the context. Returned list references Configuration
-/// entries directly, and are therefore invalidated by any operation that
-/// invalidates configuration's iterators.
+/// Returns the effects to activate for the context, instantiating them if needed.
+/// Profile resolution is remembered for the most recent contexts, as users tend
+/// to switch back and forth between a handful of windows.
 std::vector<keyleds::plugin::Effect *> DeviceManager::loadEffects(const string_map & context)
+{
+    const auto * effectGroups = m_resolvedContexts.find(context);
+    if (!effectGroups) {
+        effectGroups = &m_resolvedContexts.insert(context, resolveEffectGroups(context));
+    }
+
+    std::vector<Effect *> effectPtrs;
+    for (const auto & effectGroup : *effectGroups) {
+        const auto & loadedEffectGroup = getEffectGroup(*effectGroup);
+        const auto & effects = loadedEffectGroup.monitors;
+        std::transform(effects.begin(), effects.end(), std::back_inserter(effectPtrs),
+                       [](const auto & ptr) { return ptr.get(); });
+    }
+    return effectPtrs;
+}
+
+/// Applies the configuration to a string_map, matching profiles and resolving
+/// effect group names. Returned list references Configuration entries directly,
+/// and is therefore invalidated by any operation that invalidates configuration's
+/// iterators.
+std::vector<const Configuration::EffectGroup *>
+DeviceManager::resolveEffectGroups(const string_map & context) const
 {
     // Match context against profile lookups
     const Configuration::Profile * profile = nullptr;
@@ -182,21 +254,13 @@ std::vector<keyleds::plugin::Effect *> DeviceManager::loadEffects(const string_m
             effectGroups.push_back(&*eit);
         }
     }
-
-    std::vector<Effect *> effectPtrs;
-    for (const auto & effectGroup : effectGroups) {
-        const auto & loadedEffectGroup = getEffectGroup(*effectGroup);
-        const auto & effects = loadedEffectGroup.effects;
-        std::transform(effects.begin(), effects.end(), std::back_inserter(effectPtrs),
-                       [](const auto & ptr) { return ptr.get(); });
-    }
-    return effectPtrs;
+    return effectGroups;
 }
 
 const detail::EffectGroup & DeviceManager::getEffectGroup(const Configuration::EffectGroup & conf)
 {
     auto eit = std::find_if(m_effectGroups.cbegin(), m_effectGroups.cend(),
-                            [&](const auto & group) { return group.name == conf.name; });
+                            [&](const auto & group) { return group.configuration.name == conf.name; });
     if (eit != m_effectGroups.cend()) { return *eit; }
 
     // Load key groups
@@ -212,10 +276,11 @@ const detail::EffectGroup & DeviceManager::getEffectGroup(const Configuration::E
 
     // Load effects
     std::vector<EffectManager::effect_ptr> effects;
+    std::vector<std::unique_ptr<MonitoredEffect>> monitors;
     for (const auto & effectConf : conf.effects) {
         auto effect = m_effectManager.createEffect(
             effectConf.name, std::make_unique<EffectService>(
-                *this, *m_configuration, effectConf, keyGroups
+                *this, m_renderTargetPool, *m_configuration, effectConf, keyGroups
             )
         );
         if (!effect) {
@@ -223,11 +288,35 @@ const detail::EffectGroup & DeviceManager::getEffectGroup(const Configuration::E
             continue;
         }
         INFO("loaded plugin effect ", effectConf.name);
+        monitors.push_back(std::make_unique<MonitoredEffect>(effectConf.name, *effect,
+                                                             m_renderTargetPool,
+                                                             getRenderBudget(effectConf)));
         effects.emplace_back(std::move(effect));
     }
 
-    m_effectGroups.push_back({conf.name, std::move(effects)});
+    m_effectGroups.push_back({conf, std::move(effects), std::move(monitors)});
     return m_effectGroups.back();
 }
 
+/****************************************************************************/
+
+const detail::ResolvedContextCache::group_list *
+detail::ResolvedContextCache::find(const string_map & context)
+{
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&context](const auto & item) { return item.context == context; });
+    if (it == m_entries.end()) { return nullptr; }
+    m_entries.splice(m_entries.begin(), m_entries, it);
+    return &m_entries.front().effectGroups;
+}
+
+const detail::ResolvedContextCache::group_list &
+detail::ResolvedContextCache::insert(string_map context, group_list effectGroups)
+{
+    assert(m_capacity > 0);
+    if (m_entries.size() >= m_capacity) { m_entries.pop_back(); }
+    m_entries.push_front({std::move(context), std::move(effectGroups)});
+    return m_entries.front().effectGroups;
+}
+
 } // namespace keyleds::service
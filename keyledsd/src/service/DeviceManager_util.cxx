@@ -16,8 +16,8 @@
  */
 #include "keyledsd/service/DeviceManager_util.h"
 
+#include "keyledsd/device/CompiledLayout.h"
 #include "keyledsd/device/Device.h"
-#include "keyledsd/device/LayoutDescription.h"
 #include "keyledsd/KeyDatabase.h"
 #include "keyledsd/logging.h"
 #include "keyledsd/tools/DeviceWatcher.h"
@@ -39,7 +39,7 @@ static std::string layoutName(const std::string & model, int layout)
     return fileNameBuf.str();
 }
 
-device::LayoutDescription loadLayout(const device::Device & device)
+device::CompiledLayout loadLayout(const device::Device & device)
 {
     auto attempts = std::vector<int>{ fallbackLayoutIndex };
     if (device.hasLayout()) { attempts.insert(attempts.begin(), device.layout()); }
@@ -47,7 +47,7 @@ device::LayoutDescription loadLayout(const device::Device & device)
     for (auto layoutId : attempts) {
         auto name = layoutName(device.model(), layoutId);
         try {
-            auto result = device::LayoutDescription::loadFile(name);
+            auto result = device::CompiledLayout::load(name);
             DEBUG("loaded layout <", name, ">");
             return result;
         } catch (std::runtime_error & error) {
@@ -90,7 +90,7 @@ std::string getSerial(const tools::device::Description & description)
     return *serial;
 }
 
-static KeyDatabase buildKeyDatabase(const device::Device & device, const device::LayoutDescription & layout)
+static KeyDatabase buildKeyDatabase(const device::Device & device, const device::CompiledLayout & layout)
 {
     std::vector<KeyDatabase::Key> db;
     KeyDatabase::Key::index_type keyIndex = 0;
@@ -100,25 +100,19 @@ static KeyDatabase buildKeyDatabase(const device::Device & device, const device:
             std::string name;
             auto position = KeyDatabase::Rect{0, 0, 0, 0};
 
-            bool spurious = std::any_of(
-                layout.spurious.cbegin(), layout.spurious.cend(),
-                [&](const auto & pos) { return pos.first == block.id() && pos.second == keyId; }
-            );
+            bool spurious = layout.isSpurious(block.id(), keyId);
             if (spurious) {
                 DEBUG("marking <", int(block.id()), ", ", int(keyId), "> as spurious");
             }
 
-            for (const auto & key : layout.keys) {
-                if (key.block == block.id() && key.code == keyId) {
-                    name = key.name;
-                    position = {
-                        KeyDatabase::position_type(key.position.x0),
-                        KeyDatabase::position_type(key.position.y0),
-                        KeyDatabase::position_type(key.position.x1),
-                        KeyDatabase::position_type(key.position.y1)
-                    };
-                    break;
-                }
+            if (const auto * key = layout.find(block.id(), keyId); key) {
+                name = layout.name(*key);
+                position = {
+                    KeyDatabase::position_type(key->x0),
+                    KeyDatabase::position_type(key->y0),
+                    KeyDatabase::position_type(key->x1),
+                    KeyDatabase::position_type(key->y1)
+                };
             }
             if (name.empty()) { name = device.resolveKey(block.id(), keyId); }
 
@@ -143,13 +137,14 @@ KeyDatabase setupKeyDatabase(device::Device & device)
     for (const auto & block : device.blocks()) {
         std::vector<device::Device::key_id_type> keyIds;
 
-        for (const auto & key : layout.keys) {
-            if (key.block != block.id()) { continue; }
+        auto known = block.keys();
+        std::sort(known.begin(), known.end());
+        for (const auto & key : layout.keys(block.id())) {
             if (key.code > std::numeric_limits<device::Device::key_id_type>::max()) {
                 WARNING("invalid key code ", key.code, " in layout");
                 continue;
             }
-            if (std::find(block.keys().begin(), block.keys().end(), key.code) == block.keys().end()) {
+            if (!std::binary_search(known.begin(), known.end(), key.code)) {
                 keyIds.push_back(static_cast<device::Device::key_id_type>(key.code));
             }
         }
@@ -32,16 +32,21 @@ using keyleds::service::EffectService;
 /****************************************************************************/
 
 EffectService::EffectService(const DeviceManager & manager,
+                             RenderTargetPool & renderTargetPool,
                              const Configuration & configuration,
                              const Configuration::Effect & effectConfiguration,
                              std::vector<KeyGroup> keyGroups)
  : m_manager(manager),
+   m_renderTargetPool(renderTargetPool),
    m_configuration(configuration),
    m_effectConfiguration(effectConfiguration),
    m_keyGroups(std::move(keyGroups))
 {}
 
-EffectService::~EffectService() = default;
+EffectService::~EffectService()
+{
+    for (auto & target : m_renderTargets) { m_renderTargetPool.release(std::move(target)); }
+}
 
 const std::string & EffectService::deviceName() const
     { return m_manager.name(); }
@@ -66,9 +71,7 @@ const EffectService::config_map & EffectService::configuration() const
 
 keyleds::RenderTarget * EffectService::createRenderTarget()
 {
-    m_renderTargets.push_back(
-        std::make_unique<RenderTarget>(m_manager.keyDB().size())
-    );
+    m_renderTargets.push_back(m_renderTargetPool.acquire());
     DEBUG("created RenderTarget(", m_renderTargets.back().get(), ")");
     return m_renderTargets.back().get();
 }
@@ -79,6 +82,7 @@ void EffectService::destroyRenderTarget(RenderTarget * ptr)
                            [ptr](const auto & item) { return item.get() == ptr; });
     assert(it != m_renderTargets.end());
 
+    m_renderTargetPool.release(std::move(*it));
     if (it != m_renderTargets.end() - 1) { *it = std::move(m_renderTargets.back()); }
     m_renderTargets.pop_back();
 }
@@ -0,0 +1,134 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/MonitoredEffect.h"
+
+#include <algorithm>
+#include <limits>
+
+using keyleds::service::MonitoredEffect;
+
+/****************************************************************************/
+
+MonitoredEffect::MonitoredEffect(std::string name, plugin::Effect & effect,
+                                 RenderTargetPool & pool, microseconds budget)
+ : m_name(std::move(name)),
+   m_effect(effect),
+   m_budget(budget),
+   m_pool(pool),
+   m_layer(budget > microseconds::zero() ? pool.acquire() : nullptr),
+   m_skippedTime(0),
+   m_frames(0),
+   m_throttled(0),
+   m_lastRenderTime(0),
+   m_totalRenderTime(0)
+{
+    for (auto & sample : m_samples) { sample.store(0, std::memory_order_relaxed); }
+}
+
+MonitoredEffect::~MonitoredEffect()
+{
+    if (m_layer) { m_pool.release(std::move(m_layer)); }
+}
+
+/* Percentile is computed on a copy of the ring, so the render thread never
+ * waits. Samples being written while the copy is made may be missed, which
+ * only shifts the window by a frame.
+ */
+MonitoredEffect::Statistics MonitoredEffect::statistics() const
+{
+    auto frames = m_frames.load(std::memory_order_relaxed);
+    auto total = m_totalRenderTime.load(std::memory_order_relaxed);
+
+    std::array<std::uint32_t, sampleCount> samples;
+    auto count = std::min<std::size_t>(frames, sampleCount);
+    for (std::size_t idx = 0; idx < count; ++idx) {
+        samples[idx] = m_samples[idx].load(std::memory_order_relaxed);
+    }
+    microseconds p99(0);
+    if (count > 0) {
+        auto rank = samples.begin() + (count * 99 + 99) / 100 - 1;
+        std::nth_element(samples.begin(), rank, samples.begin() + count);
+        p99 = microseconds(*rank);
+    }
+
+    return {
+        frames,
+        m_throttled.load(std::memory_order_relaxed),
+        microseconds(m_lastRenderTime.load(std::memory_order_relaxed)),
+        microseconds(frames > 0 ? total / static_cast<microseconds::rep>(frames) : 0),
+        p99
+    };
+}
+
+void MonitoredEffect::render(milliseconds elapsed, RenderTarget & target)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (m_skipFrames > 0) {
+        --m_skipFrames;
+        m_skippedTime += elapsed;
+        blend(target, *m_layer);
+        m_throttled.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (m_layer) { std::copy(target.begin(), target.end(), m_layer->begin()); }
+
+    const auto startTime = clock::now();
+    m_effect.render(elapsed + m_skippedTime, target);
+    const auto renderTime = std::chrono::duration_cast<microseconds>(clock::now() - startTime);
+    m_skippedTime = milliseconds::zero();
+
+    if (m_layer) {
+        // Keep changed keys, made opaque so blending them restores the effect's output
+        std::transform(target.begin(), target.end(), m_layer->begin(), m_layer->begin(),
+                       [](RGBAColor output, RGBAColor before) {
+                           return output == before ? RGBAColor{0, 0, 0, 0}
+                                                   : RGBAColor{output.red, output.green, output.blue, 255};
+                       });
+        if (renderTime > m_budget) {
+            m_skipFrames = static_cast<unsigned>(std::min<microseconds::rep>(
+                renderTime / m_budget, maxSkippedFrames
+            ));
+        }
+    }
+
+    const auto renderTimeUs = renderTime.count();
+    const auto frame = m_frames.load(std::memory_order_relaxed);
+    m_samples[frame % sampleCount].store(
+        static_cast<std::uint32_t>(std::min<microseconds::rep>(
+            renderTimeUs, std::numeric_limits<std::uint32_t>::max()
+        )), std::memory_order_relaxed);
+    m_lastRenderTime.store(renderTimeUs, std::memory_order_relaxed);
+    m_totalRenderTime.fetch_add(renderTimeUs, std::memory_order_relaxed);
+    m_frames.store(frame + 1, std::memory_order_relaxed);
+}
+
+void MonitoredEffect::handleContextChange(const string_map & context)
+{
+    m_effect.handleContextChange(context);
+}
+
+void MonitoredEffect::handleGenericEvent(const string_map & data)
+{
+    m_effect.handleGenericEvent(data);
+}
+
+void MonitoredEffect::handleKeyEvent(const KeyDatabase::Key & key, bool press)
+{
+    m_effect.handleKeyEvent(key, press);
+}
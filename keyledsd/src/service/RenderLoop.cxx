@@ -16,6 +16,7 @@
  */
 #include "keyledsd/service/RenderLoop.h"
 
+#include "config.h"
 #include "keyledsd/device/Device.h"
 #include "keyledsd/logging.h"
 #include <algorithm>
@@ -40,16 +41,68 @@ struct commitDelay {    // Delay between sending color data and commit command.
 
 /****************************************************************************/
 
+/** Scoped use of current snapshot by the render thread
+ * Announces the snapshot in m_inUse, then checks it is still current, so the
+ * main thread either sees it there or never retires it before we read it.
+ */
+class RenderLoop::SnapshotReference final
+{
+public:
+    explicit SnapshotReference(RenderLoop & loop)
+     : m_loop(loop), m_snapshot(loop.m_snapshot.load())
+    {
+        for (;;) {
+            m_loop.m_inUse.store(m_snapshot);
+            auto * current = m_loop.m_snapshot.load();
+            if (current == m_snapshot) { break; }
+            m_snapshot = current;
+        }
+    }
+    ~SnapshotReference()
+    {
+        m_loop.m_inUse.store(nullptr);
+        if (m_loop.m_syncWaiting.load()) {
+            std::lock_guard<std::mutex> lock(m_loop.m_mSync);
+            m_loop.m_syncCond.notify_all();
+        }
+    }
+    SnapshotReference(const SnapshotReference &) = delete;
+    SnapshotReference & operator=(const SnapshotReference &) = delete;
+
+    const Snapshot & operator*() const { return *m_snapshot; }
+    const Snapshot * operator->() const { return m_snapshot; }
+
+private:
+    RenderLoop &        m_loop;
+    const Snapshot *    m_snapshot;
+};
+
+/****************************************************************************/
+
 RenderLoop::RenderLoop(device::Device & device, unsigned fps)
-    : AnimationLoop(fps),
+    : AnimationLoop(fps, KEYLEDSD_IDLE_FPS),
       m_device(device),
+      m_current(std::make_unique<const Snapshot>()),
+      m_snapshot(m_current.get()),
+      m_inUse(nullptr),
+      m_syncWaiting(false),
+      m_generation(0),
+      m_seenGeneration(0),
+      m_droppedKeyEvents(0),
+      m_hasGenericEvents(false),
       m_commitDelay(commitDelay::initial),
-      m_forceRefresh(false)
+      m_forceRefresh(false),
+      m_adaptive(false),
+      m_unchangedFrames(0),
+      m_fills(0),
+      m_updates(0),
+      m_hasState(false)
 {
     auto nb = std::accumulate(m_device.blocks().begin(), m_device.blocks().end(), std::size_t{0},
                               [](auto val, auto & block) { return val + block.keys().size(); });
     m_state = RenderTarget(nb);
     m_buffer = RenderTarget(nb);
+    m_changes.resize(diffBitmapSize(m_state));
 
     // Ensure no allocation happens in render()
     auto max = std::accumulate(m_device.blocks().begin(), m_device.blocks().end(), std::size_t{0},
@@ -59,30 +112,160 @@ RenderLoop::RenderLoop(device::Device & device, unsigned fps)
 
 RenderLoop::~RenderLoop() = default;
 
-/** Lock render loop, to synchronize renderer list access.
- * @return Mutex lock preventing the animation from using renderers until it is destroyed.
+/** Publish a new effect list.
+ * Effects will be notified of the context change by the render thread, before
+ * they render for the first time from this list. Previous list is retired, but
+ * its effects might still be in use until synchronize() returns. Retired lists
+ * the render thread is done with are freed on the way.
+ * @param effects List of effects to render, in order.
+ * @param context Context passed to effects' handleContextChange.
  */
-std::unique_lock<std::mutex> RenderLoop::lock()
+void RenderLoop::setEffects(effect_list effects, string_map context)
 {
-    return std::unique_lock<std::mutex>(m_mRenderers);
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->effects = std::move(effects);
+    snapshot->context = std::move(context);
+    snapshot->generation = ++m_generation;
+
+    m_snapshot.store(snapshot.get());
+    m_retired.push_back(std::move(m_current));
+    m_current = std::move(snapshot);
+    reclaimSnapshots();
+    wake();
+}
+
+/** Wait for the render thread to release retired effect lists.
+ * Once a snapshot is retired, the render thread can no longer pick it up, so
+ * it is released for good when the render thread is done running its effects.
+ */
+void RenderLoop::synchronize()
+{
+    reclaimSnapshots();
+    if (m_retired.empty()) { return; }
+
+    std::unique_lock<std::mutex> lock(m_mSync);
+    m_syncWaiting.store(true);
+    m_syncCond.wait(lock, [this] { reclaimSnapshots(); return m_retired.empty(); });
+    m_syncWaiting.store(false);
+}
+
+/** Free retired snapshots the render thread does not use.
+ * At most one of them can be in use, as the render thread only ever flags the
+ * current one, see SnapshotReference.
+ */
+void RenderLoop::reclaimSnapshots()
+{
+    const auto * inUse = m_inUse.load();
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                   [inUse](const auto & item) { return item.get() != inUse; }),
+                    m_retired.end());
+}
+
+/** Queue a key event for delivery at next frame.
+ * If the queue is full, the event is dropped rather than blocking the caller.
+ */
+void RenderLoop::postKeyEvent(const KeyDatabase::Key & key, bool press)
+{
+    if (!m_keyEvents.push({&key, press})) {
+        m_droppedKeyEvents.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake();
+}
+
+/** Queue a generic event for delivery at next frame.
+ * The lock is only ever held to append or swap the list, never while effects run.
+ */
+void RenderLoop::postGenericEvent(string_map event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mGenericEvents);
+        m_genericEvents.push_back(std::move(event));
+        m_hasGenericEvents.store(true, std::memory_order_release);
+    }
+    wake();
+}
+
+/** Deliver pending notifications to effects.
+ * Invoked by the render thread before rendering a frame.
+ * @param snapshot Effect list the frame will be rendered from.
+ */
+void RenderLoop::dispatchEvents(const Snapshot & snapshot)
+{
+    if (snapshot.generation != m_seenGeneration) {
+        m_seenGeneration = snapshot.generation;
+        for (auto * effect : snapshot.effects) { effect->handleContextChange(snapshot.context); }
+    }
+
+    if (m_hasGenericEvents.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(m_mGenericEvents);
+            std::swap(m_genericEvents, m_genericEventsBuffer);
+            m_hasGenericEvents.store(false, std::memory_order_relaxed);
+        }
+        for (const auto & event : m_genericEventsBuffer) {
+            for (auto * effect : snapshot.effects) { effect->handleGenericEvent(event); }
+        }
+        m_genericEventsBuffer.clear();
+    }
+
+    KeyEvent event;
+    while (m_keyEvents.pop(event)) {
+        for (auto * effect : snapshot.effects) { effect->handleKeyEvent(*event.key, event.press); }
+    }
 }
 
 /** Rendering method
- * Invoked on a regular basis as long as the animation is not paused.
+ * Invoked on a regular basis as long as the animation is not paused. Reads
+ * device state on first invocation, and handles error recovery around update().
  * @param elapsed Time since last invocation.
  * @return `true` if animation should be continued, else `false`.
  */
 bool RenderLoop::render(milliseconds elapsed)
 {
-    // Run all renderers
+    if (!m_hasState) {
+        try {
+            getDeviceState(m_state);
+        } catch (device::Device::error & error) {
+            ERROR("device error: ", error.what());
+            return false;
+        }
+        std::copy(m_state.cbegin(), m_state.cend(), m_buffer.begin());
+        m_hasState = true;
+    }
+
+    try {
+        try {
+            update(elapsed);
+        } catch (device::Device::error & error) {
+            // Something went wrong, we will attempt to recover
+            if (!error.recoverable() || !recover(error)) { throw; }
+        }
+    } catch (device::Device::error & error) {
+        if (!error.expected()) { ERROR("device error: ", error.what(), ", stopping animation"); }
+        return false;
+    } catch (std::exception & error) {
+        ERROR(error.what());
+        return false;
+    }
+    return true;
+}
+
+/** Run effects and send resulting changes to the device
+ * @param elapsed Time since last invocation.
+ */
+void RenderLoop::update(milliseconds elapsed)
+{
+    // Run all effects, they are kept alive while the reference exists, see synchronize()
     bool hasRenderers;
     {
-        std::lock_guard<std::mutex> lock(m_mRenderers);
-        hasRenderers = !m_renderers.empty();
-        for (const auto & effect : m_renderers) {
+        const SnapshotReference snapshot(*this);
+        dispatchEvents(*snapshot);
+        hasRenderers = !snapshot->effects.empty();
+        for (auto * effect : snapshot->effects) {
             effect->render(elapsed, m_buffer);
         }
     }
+    bool hasChanges = false;
 
     if (hasRenderers) {
         m_device.flush();   // Ensure another program using the device did not fill
@@ -90,31 +273,49 @@ bool RenderLoop::render(milliseconds elapsed)
 
         // Compute diff between old LED state and new LED state
         bool forceRefresh = m_forceRefresh.exchange(false, std::memory_order_relaxed);
-        bool hasChanges = false;
-        auto oldKeyIt = m_state.cbegin();
-        auto newKeyIt = m_buffer.cbegin();
+        if (forceRefresh) {
+            std::fill(m_changes.begin(), m_changes.end(), 0xff);
+        } else {
+            diff(m_changes.data(), m_state, m_buffer);
+        }
 
+        std::size_t blockStart = 0;
         for (const auto & block : m_device.blocks()) {
+            const std::size_t blockEnd = blockStart + block.keys().size();
 
-            // Look for changed lights within current block
-            const size_t numBlockKeys = block.keys().size();
+            // Look for changed lights within current block, skipping unchanged bytes of bitmap
             m_directives.clear();
-            for (size_t kIdx = 0; kIdx < numBlockKeys; ++kIdx) {
-                if (forceRefresh || *oldKeyIt != *newKeyIt) {
-                    m_directives.push_back({
-                        block.keys()[kIdx], newKeyIt->red, newKeyIt->green, newKeyIt->blue
-                    });
+            for (std::size_t idx = blockStart; idx < blockEnd;) {
+                unsigned bits = m_changes[idx / 8] >> (idx % 8);
+                if (bits == 0) {
+                    idx = (idx / 8 + 1) * 8;
+                    continue;
                 }
-                ++oldKeyIt;
-                ++newKeyIt;
+                idx += static_cast<std::size_t>(__builtin_ctz(bits));
+                if (idx >= blockEnd) { break; }
+
+                const auto & color = m_buffer[idx];
+                m_directives.push_back({
+                    block.keys()[idx - blockStart], color.red, color.green, color.blue
+                });
+                ++idx;
             }
 
-            // If some lights have changed within current block, send directives to device
-            if (!m_directives.empty()) {
+            // If some lights have changed within current block, send directives to device.
+            // When the whole block has the same color, a single fill is cheaper than
+            // sending keys, which need several reports as soon as there are a few.
+            if (m_directives.size() > 1 && isUniform(blockStart, blockEnd)) {
+                const auto & color = m_buffer[blockStart];
+                m_device.fillColor(block, RGBColor{color.red, color.green, color.blue});
+                m_fills.fetch_add(1, std::memory_order_relaxed);
+                hasChanges = true;
+            } else if (!m_directives.empty()) {
                 m_device.setColors(block, m_directives.data(),
                                    static_cast<device::Device::size_type>(m_directives.size()));
+                m_updates.fetch_add(1, std::memory_order_relaxed);
                 hasChanges = true;
             }
+            blockStart = blockEnd;
         }
 
         // Commit color changes, if any
@@ -127,57 +328,57 @@ bool RenderLoop::render(milliseconds elapsed)
         swap(m_state, m_buffer);
     }
 
-    return true;
+    // Adapt frame rate to activity
+    if (hasChanges || !m_adaptive.load(std::memory_order_relaxed)) {
+        m_unchangedFrames = 0;
+        setIdle(false);
+    } else if (m_unchangedFrames < KEYLEDSD_IDLE_FRAMES && ++m_unchangedFrames == KEYLEDSD_IDLE_FRAMES) {
+        setIdle(true);
+    }
 }
 
-/** Main render loop loop.
- * Handle error recovery around AnimationLoop::run().
+/** Checks whether all keys in a range of the render buffer have the same color
+ * @param begin Index of first key.
+ * @param end Index past last key.
+ * @return `true` if red, green and blue channels are identical on all keys.
  */
-void RenderLoop::run()
+bool RenderLoop::isUniform(std::size_t begin, std::size_t end) const
 {
-    try {
-        getDeviceState(m_state);
-    } catch (device::Device::error & error) {
-        ERROR("device error: ", error.what());
-        return;
-    }
-    std::copy(m_state.cbegin(), m_state.cend(), m_buffer.begin());
+    const auto & first = m_buffer[begin];
+    return std::all_of(m_buffer.begin() + begin + 1, m_buffer.begin() + end,
+                       [first](const auto & color) {
+                           return color.red == first.red && color.green == first.green &&
+                                  color.blue == first.blue;
+                       });
+}
 
-    try {
-        for (;;) {
-            try {
-                AnimationLoop::run();
-                break;
-            } catch (device::Device::error & error) {
-                // Something went wrong, we will attempt to recover
-                if (!error.recoverable()) { throw; }
-                ERROR("error on device: ", error.what(), ", re-syncing device");
-
-                // If errors happen in succession, increase commit delay.
-                // Some devices are slow and need significant time before commit.
-                auto now = clock::now();
-                if (now - m_lastErrorTime < errorGracePeriod && m_commitDelay < commitDelay::max)
-                {
-                    m_commitDelay += commitDelay::increment;
-                    WARNING("increased commit delay to ", m_commitDelay.count(), "us");
-                }
-                m_lastErrorTime = now;
+/** Recover from a device error
+ * Runs on the render thread, so the frame grid resumes once the device is back,
+ * skipping frames missed in the meantime.
+ * @param error The error that occurred.
+ * @return `true` if the device was resynchronized.
+ */
+bool RenderLoop::recover(const device::Device::error & error)
+{
+    ERROR("error on device: ", error.what(), ", re-syncing device");
 
-                // Recover from error, giving some delay to the device
-                bool success = false;
-                for (unsigned attempt = 0; !success && attempt < 5; ++attempt) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(attempt * 100));
-                    success = m_device.resync();
-                }
+    // If errors happen in succession, increase commit delay.
+    // Some devices are slow and need significant time before commit.
+    auto now = clock::now();
+    if (now - m_lastErrorTime < errorGracePeriod && m_commitDelay < commitDelay::max)
+    {
+        m_commitDelay += commitDelay::increment;
+        WARNING("increased commit delay to ", m_commitDelay.count(), "us");
+    }
+    m_lastErrorTime = now;
 
-                if (!success) { throw; }
-            }
-        }
-    } catch (device::Device::error & error) {
-        if (!error.expected()) { ERROR("device error: ", error.what(), ", stopping animation"); }
-    } catch (std::exception & error) {
-        ERROR(error.what());
+    // Recover from error, giving some delay to the device
+    bool success = false;
+    for (unsigned attempt = 0; !success && attempt < 5; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(attempt * 100));
+        success = m_device.resync();
     }
+    return success;
 }
 
 /** Read current state of all device lights
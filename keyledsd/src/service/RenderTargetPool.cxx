@@ -0,0 +1,83 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/RenderTargetPool.h"
+
+#include "keyledsd/logging.h"
+#include <algorithm>
+#include <cassert>
+
+LOGGING("target-pool");
+
+using keyleds::service::RenderTargetPool;
+
+/****************************************************************************/
+
+RenderTargetPool::RenderTargetPool(RenderTarget::size_type size, std::size_t maxFree)
+ : m_targetSize(size),
+   m_maxFree(maxFree)
+{
+    m_free.reserve(m_maxFree);
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+    assert(m_inUse == 0);
+    DEBUG("RenderTargetPool(", this, ") allocated ", m_allocations, " targets, reused ",
+          m_reuses, " times, discarded ", m_discards);
+}
+
+RenderTargetPool::Statistics RenderTargetPool::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return { m_allocations, m_reuses, m_discards, m_inUse, m_free.size() };
+}
+
+RenderTargetPool::target_ptr RenderTargetPool::acquire()
+{
+    target_ptr target;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_inUse;
+        if (!m_free.empty()) {
+            target = std::move(m_free.back());
+            m_free.pop_back();
+            ++m_reuses;
+        } else {
+            ++m_allocations;
+        }
+    }
+    // Clearing and allocating are done outside the lock
+    if (target) {
+        std::fill(target->begin(), target->end(), RGBAColor{0, 0, 0, 0});
+    } else {
+        target = std::make_unique<RenderTarget>(m_targetSize);
+    }
+    return target;
+}
+
+void RenderTargetPool::release(target_ptr target)
+{
+    assert(target && target->size() == m_targetSize);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_inUse > 0);
+    --m_inUse;
+    if (m_free.size() < m_maxFree) {
+        m_free.push_back(std::move(target));
+    } else {
+        ++m_discards;   // parameter is destroyed by the caller, after the lock is released
+    }
+}
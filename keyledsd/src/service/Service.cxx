@@ -21,9 +21,14 @@
 #include "keyledsd/logging.h"
 #include "keyledsd/service/Configuration.h"
 #include "keyledsd/service/DeviceManager.h"
+#include "keyledsd/service/DeviceManager_util.h"
 #include "keyledsd/service/DisplayManager.h"
+#include "keyledsd/tools/AnimationExecutor.h"
 #include "keyledsd/tools/XWindow.h"
+#include "keyledsd/KeyDatabase.h"
 #include <cassert>
+#include <chrono>
+#include <exception>
 #include <functional>
 #include <optional>
 #include <sstream>
@@ -35,6 +40,28 @@ using keyleds::service::Service;
 
 /****************************************************************************/
 
+/// A device being opened on a worker thread
+struct Service::Probe final
+{
+    Probe(Service & owner, const tools::device::Description & desc)
+     : service(owner), description(desc), devNode(desc.devNode())
+    { request.data = this; }
+
+    uv_work_t                       request;        ///< Libuv work request, data points to this
+    Service &                       service;        ///< Service that owns the probe
+    bool                            discard = false;///< Device was removed while probing
+    tools::device::Description      description;    ///< Main thread only, udev is not thread-safe
+    const std::string               devNode;        ///< Device node to open
+
+    // Filled in by worker thread
+    std::unique_ptr<device::Device> device;         ///< Opened device, null on error
+    KeyDatabase                     keyDB;          ///< Key database built from device's layout
+    device::Logitech::OpenTimings   timings;        ///< Time spent in device queries
+    std::chrono::microseconds       layoutTime{};   ///< Time spent loading layout
+    std::string                     error;          ///< Error message if device is null
+    bool                            errorExpected = false;  ///< Error is a normal outcome
+};
+
 static void merge(std::vector<std::pair<std::string, std::string>> & lhs,
                   const std::vector<std::pair<std::string, std::string>> & rhs)
 {
@@ -85,6 +112,9 @@ Service::Service(EffectManager & effectManager, tools::FileWatcher & fileWatcher
       m_deviceWatcher(loop)
 {
     using namespace std::placeholders;
+    if (m_configuration.renderThreads > 0) {
+        m_renderExecutor = std::make_unique<tools::AnimationExecutor>(m_configuration.renderThreads);
+    }
     connect(m_deviceWatcher.deviceAdded, this, std::bind(&Service::onDeviceAdded, this, _1));
     connect(m_deviceWatcher.deviceRemoved, this, std::bind(&Service::onDeviceRemoved, this, _1));
     m_fileWatcherSub = m_fileWatcher.subscribe(
@@ -94,7 +124,16 @@ Service::Service(EffectManager & effectManager, tools::FileWatcher & fileWatcher
     DEBUG("created");
 }
 
-Service::~Service() = default;
+Service::~Service()
+{
+    // Probes reference their Service and are owned by it, make them discard their
+    // result. Those already running cannot be cancelled, wait for them to complete.
+    for (auto & probe : m_probes) {
+        probe->discard = true;
+        uv_cancel(reinterpret_cast<uv_req_t *>(&probe->request));
+    }
+    while (!m_probes.empty()) { uv_run(&m_loop, UV_RUN_ONCE); }
+}
 
 /****************************************************************************/
 
@@ -117,14 +156,27 @@ void Service::addDisplay(std::unique_ptr<tools::xlib::Display> display)
 void Service::setConfiguration(Configuration config)
 {
     using std::swap;
+    auto start = std::chrono::steady_clock::now();
     m_fileWatcherSub = FileWatcher::subscription(); // destroy it so it isn't reused
 
+    if (config.renderThreads != m_configuration.renderThreads) {
+        NOTICE("render thread setting changes take effect on restart");
+    }
+    if (config.skipMissedFrames != m_configuration.skipMissedFrames ||
+        config.renderPriority != m_configuration.renderPriority ||
+        config.renderNiceness != m_configuration.renderNiceness) {
+        NOTICE("render scheduling changes take effect when devices are reconnected");
+    }
+
     // old configuration must not be destroyed until propagation is complete
     swap(m_configuration, config);
 
     // Propagate configuration
     for (auto & device : m_devices) { device->setConfiguration(&m_configuration); }
     setContext({}); // force context reloading without changing it
+    INFO("configuration applied in ", std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count(), "us");
 
     // Setup configuration file watch
     if (!m_configuration.path.empty()) {
@@ -198,17 +250,72 @@ void Service::onConfigurationFileChanged(FileWatcher::Event event)
 void Service::onDeviceAdded(const tools::device::Description & description)
 {
     INFO("device added: ", description.devNode());
+
+    auto probe = std::make_unique<Probe>(*this, description);
+    int err = uv_queue_work(&m_loop, &probe->request, [](uv_work_t * request) {
+        // Worker thread: talk to the device and load its layout
+        auto & job = *static_cast<Probe *>(request->data);
+        try {
+            job.device = device::Logitech::open(job.devNode, &job.timings);
+            const auto start = std::chrono::steady_clock::now();
+            job.keyDB = setupKeyDatabase(*job.device);
+            job.layoutTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start
+            );
+        } catch (device::Device::error & error) {
+            job.device.reset();
+            job.error = error.what();
+            job.errorExpected = error.expected();
+        } catch (std::exception & error) {
+            job.device.reset();
+            job.error = error.what();
+        }
+    }, [](uv_work_t * request, int status) {
+        // Main thread: hand over the device, unless it was removed meanwhile
+        auto * job = static_cast<Probe *>(request->data);
+        auto & probes = job->service.m_probes;
+        auto it = std::find_if(probes.begin(), probes.end(),
+                               [job](const auto & item) { return item.get() == job; });
+        auto finished = std::move(*it);     // keep it alive until we are done with it
+        probes.erase(it);
+        if (status != 0 || finished->discard) { return; }
+        finished->service.onDeviceProbed(*finished);
+    });
+    if (err != 0) {
+        ERROR("not opening device ", description.devNode(), ": ", uv_strerror(err));
+        return;
+    }
+    m_probes.push_back(std::move(probe));
+}
+
+void Service::onDeviceProbed(Probe & probe)
+{
+    if (!probe.device) {
+        if (probe.errorExpected) {
+            INFO("not opening device ", probe.devNode, ": ", probe.error);
+        } else {
+            ERROR("not opening device ", probe.devNode, ": ", probe.error);
+        }
+        return;
+    }
+
+    const auto & timings = probe.timings;
+    INFO("probed device ", probe.devNode, " in ", (timings.total() + probe.layoutTime).count(), "us",
+         " (open ", timings.open.count(), "us, info ", timings.info.count(), "us",
+         ", version ", timings.version.count(), "us, blocks ", timings.blocks.count(), "us",
+         ", layout ", probe.layoutTime.count(), "us)");
+
     try {
-        auto device = device::Logitech::open(description.devNode());
         auto manager = std::make_unique<DeviceManager>(
             m_effectManager, m_fileWatcher,
-            description, std::move(device), &m_configuration
+            probe.description, std::move(probe.device), std::move(probe.keyDB), &m_configuration,
+            m_renderExecutor.get()
         );
         manager->setContext(m_context);
 
         deviceManagerAdded.emit(*manager);
 
-        NOTICE("opened device ", description.devNode(),
+        NOTICE("opened device ", probe.devNode,
                " [", manager->name(), ']',
                ", model ", manager->device().model(),
                " firmware ", manager->device().firmware(),
@@ -219,15 +326,27 @@ void Service::onDeviceAdded(const tools::device::Description & description)
 
     } catch (device::Device::error & error) {
         if (error.expected()) {
-            INFO("not opening device ", description.devNode(), ": ", error.what());
+            INFO("not opening device ", probe.devNode, ": ", error.what());
         } else {
-            ERROR("not opening device ", description.devNode(), ": ", error.what());
+            ERROR("not opening device ", probe.devNode, ": ", error.what());
         }
     }
 }
 
 void Service::onDeviceRemoved(const tools::device::Description & description)
 {
+    // Device might be still opening, in which case we discard it once done
+    auto pit = std::find_if(m_probes.begin(), m_probes.end(),
+                            [&description](const auto & probe) {
+                                return !probe->discard &&
+                                       probe->description.sysPath() == description.sysPath();
+                            });
+    if (pit != m_probes.end()) {
+        INFO("device removed while opening: ", (*pit)->devNode);
+        (*pit)->discard = true;
+        return;
+    }
+
     auto it = std::find_if(m_devices.begin(), m_devices.end(),
                            [&description](const auto & device) {
                                return device->sysPath() == description.sysPath();
@@ -125,6 +125,53 @@ static int setPaused(sd_bus *, const char *, const char *, const char *,
     return 0;
 }
 
+static int getFrameTimes(sd_bus *, const char *, const char *, const char *,
+                         sd_bus_message * reply, void * userdata, sd_bus_error *)
+{
+    auto adapter = static_cast<DeviceManagerAdapter *>(userdata);
+    auto stats = adapter->device().renderStatistics();
+    auto average = stats.frames > 0 ? stats.totalFrameTime.count() / static_cast<long>(stats.frames) : 0;
+    return sd_bus_message_append(reply, "(ttt)",
+                                 uint64_t(stats.lastFrameTime.count()),
+                                 uint64_t(average),
+                                 uint64_t(stats.maxFrameTime.count()));
+}
+
+static int getRenderTargets(sd_bus *, const char *, const char *, const char *,
+                            sd_bus_message * reply, void * userdata, sd_bus_error *)
+{
+    auto adapter = static_cast<DeviceManagerAdapter *>(userdata);
+    auto stats = adapter->device().renderTargetStatistics();
+    return sd_bus_message_append(reply, "(tttt)",
+                                 uint64_t(stats.allocations), uint64_t(stats.reuses),
+                                 uint64_t(stats.inUse), uint64_t(stats.free));
+}
+
+static int getEffectTimes(sd_bus *, const char *, const char *, const char *,
+                          sd_bus_message * reply, void * userdata, sd_bus_error *)
+{
+    int ret;
+    auto adapter = static_cast<DeviceManagerAdapter *>(userdata);
+
+    ret = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(ssttttt)");
+    if (ret < 0) { return ret; }
+    for (const auto & group : adapter->device().effectGroups()) {
+        for (const auto & effect : group.monitors) {
+            auto stats = effect->statistics();
+            ret = sd_bus_message_append(reply, "(ssttttt)",
+                group.configuration.name.c_str(),
+                effect->name().c_str(),
+                uint64_t(stats.frames), uint64_t(stats.throttled),
+                uint64_t(stats.lastRenderTime.count()),
+                uint64_t(stats.meanRenderTime.count()),
+                uint64_t(stats.p99RenderTime.count())
+            );
+            if (ret < 0) { return ret; }
+        }
+    }
+    return sd_bus_message_close_container(reply);
+}
+
 static constexpr sd_bus_vtable interfaceVtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_PROPERTY("sysPath", "s", getSysPath, 0, 0),
@@ -136,6 +183,9 @@ static constexpr sd_bus_vtable interfaceVtable[] = {
     SD_BUS_PROPERTY("firmware", "s", getFirmware, 0, 0),
     SD_BUS_PROPERTY("keys", "a(qs(qqqq))", getKeys, 0, 0),
     SD_BUS_WRITABLE_PROPERTY("paused", "b", getPaused, setPaused, 0, 0),
+    SD_BUS_PROPERTY("frameTimes", "(ttt)", getFrameTimes, 0, 0),
+    SD_BUS_PROPERTY("renderTargets", "(tttt)", getRenderTargets, 0, 0),
+    SD_BUS_PROPERTY("effectTimes", "a(ssttttt)", getEffectTimes, 0, 0),
     SD_BUS_VTABLE_END
 };
 
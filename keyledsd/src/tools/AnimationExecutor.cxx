@@ -0,0 +1,149 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/tools/AnimationExecutor.h"
+
+#include "keyledsd/logging.h"
+#include "keyledsd/tools/AnimationLoop.h"
+#include <algorithm>
+#include <cassert>
+#include <exception>
+
+LOGGING("anim-exec");
+
+using keyleds::tools::AnimationExecutor;
+
+/****************************************************************************/
+
+AnimationExecutor::AnimationExecutor(unsigned threads)
+    : m_epoch(clock::now())
+{
+    assert(threads > 0);
+    m_workers.reserve(threads);
+    for (unsigned idx = 0; idx < threads; ++idx) {
+        m_workers.emplace_back(&AnimationExecutor::run, this);
+    }
+    DEBUG("started ", threads, " render threads");
+}
+
+AnimationExecutor::~AnimationExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_loops.empty());
+        m_abort = true;
+        wakeAll();
+    }
+    for (auto & worker : m_workers) { worker.join(); }
+}
+
+AnimationExecutor::clock::time_point
+AnimationExecutor::align(clock::time_point time, clock::duration period) const
+{
+    if (time <= m_epoch) { return m_epoch; }
+    auto periods = (time - m_epoch + period - clock::duration(1)) / period;
+    return m_epoch + periods * period;
+}
+
+void AnimationExecutor::attach(AnimationLoop & loop)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    loop.resetSchedule(clock::now());
+    loop.m_busy = false;
+    loop.m_finished = false;
+    loop.m_wasPaused = true;
+    m_loops.push_back(&loop);
+    wakeAll();
+}
+
+void AnimationExecutor::detach(AnimationLoop & loop)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&loop] { return !loop.m_busy; });
+        m_loops.erase(std::remove(m_loops.begin(), m_loops.end(), &loop), m_loops.end());
+    }
+    loop.logStatistics();
+}
+
+void AnimationExecutor::notify()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    wakeAll();
+}
+
+void AnimationExecutor::wakeAll()
+{
+    m_cond.notify_all();
+    if (m_sleeping) { m_sleeper.interrupt(); }
+}
+
+/* Workers share a single list of loops. Each iteration picks the loop with
+ * the earliest deadline among those that are not paused, finished or already
+ * being rendered by another worker. The loop is flagged busy and rendered with
+ * the lock released, so a slow render only delays the loop it belongs to.
+ *
+ * Timed waits go through m_sleeper rather than the condition variable, as
+ * some libstdc++ versions wait for steady_clock deadlines on the system clock,
+ * which would stall all loops when system time changes. Only one worker sleeps
+ * at a time, others wait until it wakes up.
+ */
+void AnimationExecutor::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_abort) {
+        auto now = clock::now();
+        AnimationLoop * next = nullptr;
+        for (auto * loop : m_loops) {
+            if (loop->m_busy || loop->m_finished || !loop->schedulable(now)) { continue; }
+            if (!next || loop->m_deadline < next->m_deadline) { next = loop; }
+        }
+        if (!next) {
+            m_cond.wait(lock);
+            continue;
+        }
+        if (now < next->m_deadline) {
+            if (m_sleeping) {
+                m_cond.wait(lock);
+                continue;
+            }
+            m_sleeping = true;
+            const auto deadline = next->m_deadline;
+            lock.unlock();
+            m_sleeper.sleepUntil(deadline);
+            lock.lock();
+            m_sleeping = false;
+            m_cond.notify_all();            // let another worker sleep if this one renders
+            continue;
+        }
+
+        next->m_busy = true;
+        lock.unlock();
+        bool keepGoing = false;
+        try {
+            keepGoing = next->renderFrame(now);
+        } catch (std::exception & error) {
+            ERROR("AnimationLoop(", next, ") failed: ", error.what());
+        }
+        lock.lock();
+        next->m_busy = false;
+        if (!keepGoing) {
+            DEBUG("AnimationLoop(", next, ") exiting");
+            next->m_finished = true;
+        }
+        wakeAll();
+    }
+}
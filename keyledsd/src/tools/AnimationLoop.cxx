@@ -17,9 +17,17 @@
 #include "keyledsd/tools/AnimationLoop.h"
 
 #include "keyledsd/logging.h"
+#include "keyledsd/tools/AnimationExecutor.h"
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <functional>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 LOGGING("anim-loop");
 
@@ -27,16 +35,23 @@ using keyleds::tools::AnimationLoop;
 
 /****************************************************************************/
 
-AnimationLoop::AnimationLoop(unsigned fps)
-    : m_period(1000 / fps)
-{
-}
+AnimationLoop::AnimationLoop(unsigned fps, unsigned idleFps)
+    : m_fps(std::max(fps, 1u)), m_idleFps(std::max(idleFps, 1u)), m_idle(false),
+      m_frames(0), m_missed(0), m_skipped(0), m_maxLateness(0),
+      m_lastFrameTime(0), m_maxFrameTime(0), m_totalFrameTime(0),
+      m_woken(false)
+{}
 
 AnimationLoop::~AnimationLoop() = default;
 
-void AnimationLoop::start()
+void AnimationLoop::start(AnimationExecutor * executor)
 {
-    m_thread = std::thread(threadEntry, std::ref(*this));
+    m_executor = executor;
+    if (m_executor) {
+        m_executor->attach(*this);
+    } else {
+        m_thread = std::thread(threadEntry, std::ref(*this));
+    }
 }
 
 void AnimationLoop::stop()
@@ -49,8 +64,14 @@ void AnimationLoop::stop()
         m_abort = true;
         m_cRunStatus.notify_one();
     }
+    signal();
 
-    m_thread.join();
+    if (m_executor) {
+        m_executor->detach(*this);
+        m_executor = nullptr;
+    } else {
+        m_thread.join();
+    }
 #ifndef NDEBUG
     DEBUG("stop request fulfilled in ",
           std::chrono::duration_cast<std::chrono::microseconds>(
@@ -59,6 +80,19 @@ void AnimationLoop::stop()
 #endif
 }
 
+AnimationLoop::Statistics AnimationLoop::statistics() const
+{
+    return {
+        m_frames.load(std::memory_order_relaxed),
+        m_missed.load(std::memory_order_relaxed),
+        m_skipped.load(std::memory_order_relaxed),
+        std::chrono::microseconds(m_maxLateness.load(std::memory_order_relaxed)),
+        std::chrono::microseconds(m_lastFrameTime.load(std::memory_order_relaxed)),
+        std::chrono::microseconds(m_maxFrameTime.load(std::memory_order_relaxed)),
+        std::chrono::microseconds(m_totalFrameTime.load(std::memory_order_relaxed))
+    };
+}
+
 void AnimationLoop::setPaused(bool paused)
 {
     if (paused != m_paused) {
@@ -66,6 +100,52 @@ void AnimationLoop::setPaused(bool paused)
         m_paused = paused;
         m_cRunStatus.notify_one();
     }
+    signal();
+}
+
+void AnimationLoop::wake()
+{
+    if (m_idle.load(std::memory_order_relaxed)) {
+        m_woken.store(true, std::memory_order_relaxed);
+        signal();
+    }
+}
+
+void AnimationLoop::signal()
+{
+    if (m_executor) {
+        m_executor->notify();
+        return;
+    }
+    m_sleeper.interrupt();
+}
+
+AnimationLoop::clock::duration AnimationLoop::period() const
+{
+    auto fps = m_idle.load(std::memory_order_relaxed) ? m_idleFps : m_fps.load(std::memory_order_relaxed);
+    return std::chrono::duration_cast<clock::duration>(std::chrono::seconds(1)) / fps;
+}
+
+AnimationLoop::clock::time_point AnimationLoop::aligned(clock::time_point time) const
+{
+    return m_executor ? m_executor->align(time, m_framePeriod) : time;
+}
+
+void AnimationLoop::resetSchedule(clock::time_point now)
+{
+    m_framePeriod = period();
+    m_deadline = aligned(now);
+    m_origin = m_deadline - m_framePeriod;
+    m_reported = milliseconds(0);
+}
+
+void AnimationLoop::realign(clock::time_point now)
+{
+    if (m_deadline < now) {
+        auto target = aligned(now);
+        m_origin += target - m_deadline;
+        m_deadline = target;
+    }
 }
 
 /* Some assumptions are made in this loop regarding runstatus:
@@ -78,11 +158,11 @@ void AnimationLoop::run()
 {
     DEBUG("AnimationLoop(", this, ") started");
     auto now = clock::now();
-    auto nextDraw = now;
+    resetSchedule(now);
 
     std::unique_lock<std::mutex> lock(m_mRunStatus);
     for (;;) {
-        while (m_paused || now < nextDraw) {
+        while (m_paused || now < m_deadline) {
             if (m_abort) {
                 DEBUG("AnimationLoop(", this, ") stopped");
                 return;
@@ -91,29 +171,132 @@ void AnimationLoop::run()
                 DEBUG("AnimationLoop(", this, ") paused");
                 m_cRunStatus.wait(lock);
                 DEBUG("AnimationLoop(", this, ") resumed");
+                now = clock::now();
+                realign(now);
             } else {
-                // Work around libstdc++ bug:
-                //    https://gcc.gnu.org/bugzilla/show_bug.cgi?id=41861
-                // Actual intention here would be:
-                //     m_cRunStatus.wait_until(lock, nextDraw);
+                // Pause and abort requests interrupt the sleep too, so they
+                // are handled immediately.
                 lock.unlock();
-                std::this_thread::sleep_for(nextDraw - clock::now());
+                bool interrupted = m_sleeper.sleepUntil(m_deadline);
                 lock.lock();
+                now = clock::now();
+                if (interrupted && idle()) { m_deadline = std::min(m_deadline, now); }
             }
-            now = clock::now();
         }
-
         lock.unlock();
-        if (!render(m_period)) { break; }
-        lock.lock();
 
-        nextDraw += m_period;
-        if (nextDraw <= now) { nextDraw = now + m_period; }
+        if (!renderFrame(now)) { break; }
+
+        lock.lock();
     }
     DEBUG("AnimationLoop(", this, ") exiting");
 }
 
+/* Frames are placed on a grid starting at m_origin. The time passed to render is
+ * the difference between successive deadlines, rounded through their offset from
+ * origin so that sub-millisecond remainders of the period are not lost. It relies
+ * on unsigned wraparound, so it stays correct after 49 days.
+ */
+bool AnimationLoop::renderFrame(clock::time_point now)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto lateness = now - m_deadline;
+    if (lateness >= m_framePeriod) {
+        auto missed = static_cast<unsigned long>(lateness / m_framePeriod);
+        m_missed.fetch_add(1, std::memory_order_relaxed);
+        switch (m_skipPolicy) {
+        case SkipPolicy::Skip:
+            m_deadline += static_cast<clock::duration::rep>(missed) * m_framePeriod;
+            m_skipped.fetch_add(missed, std::memory_order_relaxed);
+            break;
+        case SkipPolicy::Restart:
+            realign(now);
+            break;
+        }
+    }
+    auto latenessUs = duration_cast<microseconds>(lateness).count();
+    if (latenessUs > m_maxLateness.load(std::memory_order_relaxed)) {
+        m_maxLateness.store(latenessUs, std::memory_order_relaxed);
+    }
+
+    auto total = duration_cast<milliseconds>(m_deadline - m_origin);
+    auto elapsed = total - m_reported;
+    m_reported = total;
+
+    auto renderStart = clock::now();
+    bool keepGoing = render(elapsed);
+    auto frameTimeUs = duration_cast<microseconds>(clock::now() - renderStart).count();
+    m_lastFrameTime.store(frameTimeUs, std::memory_order_relaxed);
+    m_totalFrameTime.fetch_add(frameTimeUs, std::memory_order_relaxed);
+    if (frameTimeUs > m_maxFrameTime.load(std::memory_order_relaxed)) {
+        m_maxFrameTime.store(frameTimeUs, std::memory_order_relaxed);
+    }
+    if (!keepGoing) { return false; }
+
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+    m_framePeriod = period();               // frame rate or idle mode may have changed
+    m_deadline = aligned(m_deadline + m_framePeriod);
+    return true;
+}
+
+/** Check whether the loop can be rendered by an executor
+ * Called by executor workers with the executor lock held, while the loop
+ * is not being rendered, so frame grid can be updated.
+ */
+bool AnimationLoop::schedulable(clock::time_point now)
+{
+    bool paused;
+    {
+        std::lock_guard<std::mutex> lock(m_mRunStatus);
+        paused = m_paused || m_abort;
+    }
+    if (paused) {
+        m_wasPaused = true;
+        return false;
+    }
+    if (m_wasPaused) {
+        m_wasPaused = false;
+        realign(now);
+    }
+    if (m_woken.exchange(false, std::memory_order_relaxed) && idle()) {
+        m_deadline = std::min(m_deadline, now);
+    }
+    return true;
+}
+
+void AnimationLoop::applyScheduling() const
+{
+    if (m_priority > 0) {
+        struct sched_param param = {};
+        param.sched_priority = m_priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            WARNING("could not set realtime priority ", m_priority, ": ", strerror(err));
+        }
+    }
+    if (m_niceness != 0) {
+        // On Linux, niceness is a per-thread attribute when given a thread id
+        auto tid = static_cast<id_t>(syscall(SYS_gettid));
+        if (setpriority(PRIO_PROCESS, tid, m_niceness) < 0) {
+            WARNING("could not set niceness ", m_niceness, ": ", strerror(errno));
+        }
+    }
+}
+
 void AnimationLoop::threadEntry(AnimationLoop & loop)
 {
+    loop.applyScheduling();
     loop.run();
+    loop.logStatistics();
+}
+
+void AnimationLoop::logStatistics() const
+{
+    auto stats = statistics();
+    auto average = stats.frames > 0 ? stats.totalFrameTime.count() / static_cast<long>(stats.frames) : 0;
+    DEBUG("AnimationLoop(", this, ") rendered ", stats.frames, " frames, missed ", stats.missed,
+          " deadlines, skipped ", stats.skipped, " frames, max lateness ", stats.maxLateness.count(), "us",
+          ", frame time ", average, "us average, ", stats.maxFrameTime.count(), "us max");
 }
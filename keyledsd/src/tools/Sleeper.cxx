@@ -0,0 +1,91 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/tools/Sleeper.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <system_error>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using keyleds::tools::Sleeper;
+
+/****************************************************************************/
+
+Sleeper::Sleeper()
+    : m_timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (m_timerFd < 0 || m_eventFd < 0) {
+        auto error = std::system_error(errno, std::generic_category());
+        if (m_timerFd >= 0) { close(m_timerFd); }
+        if (m_eventFd >= 0) { close(m_eventFd); }
+        throw error;
+    }
+}
+
+Sleeper::~Sleeper()
+{
+    close(m_eventFd);
+    close(m_timerFd);
+}
+
+/** Sleep until given deadline
+ * Libstdc++ implements steady_clock on top of CLOCK_MONOTONIC, so time points
+ * map directly to timer values.
+ * @param deadline When to wake up.
+ * @return `true` if sleep was interrupted before the deadline.
+ */
+bool Sleeper::sleepUntil(clock::time_point deadline)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::seconds;
+
+    auto sinceEpoch = deadline.time_since_epoch();
+    auto secs = duration_cast<seconds>(sinceEpoch);
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = static_cast<time_t>(secs.count());
+    spec.it_value.tv_nsec = static_cast<long>(duration_cast<nanoseconds>(sinceEpoch - secs).count());
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) { spec.it_value.tv_nsec = 1; }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+    struct pollfd fds[] = { { m_timerFd, POLLIN, 0 }, { m_eventFd, POLLIN, 0 } };
+    while (poll(fds, 2, -1) < 0 && errno == EINTR) {}
+
+    uint64_t value;
+    if ((fds[0].revents & POLLIN) != 0) {
+        if (read(m_timerFd, &value, sizeof(value)) < 0) { /* raced with re-arming */ }
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+        if (read(m_eventFd, &value, sizeof(value)) < 0) { /* consumed already */ }
+        return true;
+    }
+    return false;
+}
+
+void Sleeper::interrupt()
+{
+    uint64_t value = 1;
+    if (write(m_eventFd, &value, sizeof(value)) < 0) {
+        assert(errno == EAGAIN);    // counter saturated, sleep is interrupted anyway
+    }
+}
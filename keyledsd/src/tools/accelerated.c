@@ -17,26 +17,65 @@
 #include <stdint.h>
 #include "keyledsd/tools/accelerated.h"
 #include "config.h"
+#if defined KEYLEDSD_USE_NEON && defined __arm__
+#  include <asm/hwcap.h>
+#  include <sys/auxv.h>
+#endif
+
+/* Resolvers run at load time with ifunc. On ARM, NEON detection goes through
+ * getauxval, which is not safe to call before relocations are done, so
+ * resolution is deferred to first call instead.
+ */
+#if defined HAVE_BUILTIN_CPU_SUPPORTS || defined KEYLEDSD_USE_NEON
+#  define HAVE_RUNTIME_DISPATCH
+#  if defined HAVE_IFUNC_ATTRIBUTE && !defined KEYLEDSD_USE_NEON
+#    define USE_IFUNC
+#  endif
+#endif
+
+#ifdef HAVE_RUNTIME_DISPATCH
+static void cpu_init(void)
+{
+#  if defined HAVE_BUILTIN_CPU_SUPPORTS && defined __GNUC__ && !defined __clang__
+    __builtin_cpu_init();
+#  endif
+}
+#endif
+
+#ifdef KEYLEDSD_USE_NEON
+static int cpu_has_neon(void)
+{
+#  ifdef __arm__
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#  else
+    return 1;   /* mandatory on aarch64 */
+#  endif
+}
+#endif
 
 /****************************************************************************/
 /* blend */
 
-#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+#ifdef HAVE_RUNTIME_DISPATCH
 static USED void (*resolve_blend(void))(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
 {
-#  if defined __GNUC__ && !defined __clang__
-    __builtin_cpu_init();
+    cpu_init();
+#  ifdef KEYLEDSD_USE_AVX512
+    if (__builtin_cpu_supports("avx512bw")) { return blend_avx512; }
 #  endif
 #  ifdef KEYLEDSD_USE_AVX2
     if (__builtin_cpu_supports("avx2")) { return blend_avx2; }
 #  endif
 #  ifdef KEYLEDSD_USE_SSE2
     if (__builtin_cpu_supports("sse2")) { return blend_sse2; }
+#  endif
+#  ifdef KEYLEDSD_USE_NEON
+    if (cpu_has_neon()) { return blend_neon; }
 #  endif
     return blend_plain;
 }
 
-#  ifdef HAVE_IFUNC_ATTRIBUTE
+#  ifdef USE_IFUNC
 KEYLEDSD_EXPORT void blend(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
     __attribute__((ifunc("resolve_blend")));
 #  else
@@ -55,22 +94,26 @@ KEYLEDSD_EXPORT void blend(uint8_t * restrict dst, const uint8_t * restrict src,
 /****************************************************************************/
 /* multiply */
 
-#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+#ifdef HAVE_RUNTIME_DISPATCH
 static USED void (*resolve_multiply(void))(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
 {
-#  if defined __GNUC__ && !defined __clang__
-    __builtin_cpu_init();
+    cpu_init();
+#  ifdef KEYLEDSD_USE_AVX512
+    if (__builtin_cpu_supports("avx512bw")) { return multiply_avx512; }
 #  endif
 #  ifdef KEYLEDSD_USE_AVX2
     if (__builtin_cpu_supports("avx2")) { return multiply_avx2; }
 #  endif
 #  ifdef KEYLEDSD_USE_SSE2
     if (__builtin_cpu_supports("sse2")) { return multiply_sse2; }
+#  endif
+#  ifdef KEYLEDSD_USE_NEON
+    if (cpu_has_neon()) { return multiply_neon; }
 #  endif
     return multiply_plain;
 }
 
-#  ifdef HAVE_IFUNC_ATTRIBUTE
+#  ifdef USE_IFUNC
 KEYLEDSD_EXPORT void multiply(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
     __attribute__((ifunc("resolve_multiply")));
 #  else
@@ -85,3 +128,46 @@ KEYLEDSD_EXPORT void multiply(uint8_t * restrict dst, const uint8_t * restrict s
 KEYLEDSD_EXPORT void multiply(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
     { multiply_plain(dst, src, length); }
 #endif
+
+/****************************************************************************/
+/* diff */
+
+#ifdef HAVE_RUNTIME_DISPATCH
+static USED void (*resolve_diff(void))(uint8_t * restrict changes, const uint8_t * restrict a,
+                                       const uint8_t * restrict b, size_t length)
+{
+    cpu_init();
+#  ifdef KEYLEDSD_USE_AVX512
+    if (__builtin_cpu_supports("avx512bw")) { return diff_avx512; }
+#  endif
+#  ifdef KEYLEDSD_USE_AVX2
+    if (__builtin_cpu_supports("avx2")) { return diff_avx2; }
+#  endif
+#  ifdef KEYLEDSD_USE_SSE2
+    if (__builtin_cpu_supports("sse2")) { return diff_sse2; }
+#  endif
+#  ifdef KEYLEDSD_USE_NEON
+    if (cpu_has_neon()) { return diff_neon; }
+#  endif
+    return diff_plain;
+}
+
+#  ifdef USE_IFUNC
+KEYLEDSD_EXPORT void diff(uint8_t * restrict changes, const uint8_t * restrict a,
+                          const uint8_t * restrict b, size_t length)
+    __attribute__((ifunc("resolve_diff")));
+#  else
+static void (*resolved_diff)(uint8_t * restrict changes, const uint8_t * restrict a,
+                             const uint8_t * restrict b, size_t length);
+KEYLEDSD_EXPORT void diff(uint8_t * restrict changes, const uint8_t * restrict a,
+                          const uint8_t * restrict b, size_t length)
+{
+    if (resolved_diff == 0) { resolved_diff = resolve_diff(); }
+    (*resolved_diff)(changes, a, b, length);
+}
+#  endif
+#else
+KEYLEDSD_EXPORT void diff(uint8_t * restrict changes, const uint8_t * restrict a,
+                          const uint8_t * restrict b, size_t length)
+    { diff_plain(changes, a, b, length); }
+#endif
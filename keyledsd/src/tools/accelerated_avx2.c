@@ -94,8 +94,8 @@ KEYLEDSD_EXPORT void multiply_avx2(uint8_t * restrict dst, const uint8_t * restr
         __m256i src0 = _mm256_unpacklo_epi8(packed_src, zero); /* A3B3G3R3A2B2G2R2A1B1G1R1A0B0G0R0 */
         __m256i src1 = _mm256_unpackhi_epi8(packed_src, zero); /* A7B7G7R7A6B6G6R6A5B5G5R5A4B4G4R4 */
 
-        dst0 = _mm256_mullo_epi16(src0, _mm256_add_epi16(dst0, one));
-        dst1 = _mm256_mullo_epi16(src1, _mm256_add_epi16(dst1, one));
+        dst0 = _mm256_mullo_epi16(dst0, _mm256_add_epi16(src0, one));
+        dst1 = _mm256_mullo_epi16(dst1, _mm256_add_epi16(src1, one));
 
         dst0 = _mm256_srli_epi16(dst0, 8);
         dst1 = _mm256_srli_epi16(dst1, 8);
@@ -105,3 +105,32 @@ KEYLEDSD_EXPORT void multiply_avx2(uint8_t * restrict dst, const uint8_t * restr
         dstv += 1;
     } while (--length > 0);
 }
+
+KEYLEDSD_EXPORT void diff_avx2(uint8_t * restrict changes, const uint8_t * restrict a,
+                               const uint8_t * restrict b, size_t length)
+{
+    assert((uintptr_t)a % 32 == 0);     // AVX2 requires 32-bytes aligned data
+    assert((uintptr_t)b % 32 == 0);     // AVX2 requires 32-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 8 == 0);            // we'll process entries 8 by 8 and don't want to be
+                                        // slowed by boundary checks
+
+    const __m256i * restrict av = (const __m256i *)__builtin_assume_aligned(a, 32);
+    const __m256i * restrict bv = (const __m256i *)__builtin_assume_aligned(b, 32);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff); /* little endian: alpha is high byte */
+
+    length /= 8;
+
+    do {
+        __m256i delta = _mm256_and_si256(_mm256_xor_si256(_mm256_load_si256(av),
+                                                          _mm256_load_si256(bv)), rgb);
+        int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(delta, zero)));
+
+        *changes++ = (uint8_t)~same;
+        av += 1;
+        bv += 1;
+    } while (--length > 0);
+}
@@ -0,0 +1,135 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "keyledsd/tools/accelerated.h"
+#include "config.h"
+
+
+KEYLEDSD_EXPORT void blend_avx512(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
+{
+    assert((uintptr_t)dst % 64 == 0);   // AVX-512 is fastest with 64-bytes aligned data
+    assert((uintptr_t)src % 64 == 0);   // AVX-512 is fastest with 64-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 16 == 0);           // we'll process entries 16 by 16 and don't want to be
+                                        // slowed by boundary checks
+
+    __m512i * restrict dstv = (__m512i *)__builtin_assume_aligned(dst, 64);
+    const __m512i * restrict srcv = (const __m512i *)__builtin_assume_aligned(src, 64);
+
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi16(1);
+    const __m512i max = _mm512_set1_epi16(256);
+
+    length /= 16;
+
+    do {
+        __m512i packed_dst = _mm512_load_si512(dstv);
+        __m512i packed_src = _mm512_load_si512(srcv);
+
+        // Unpacking works within 128-bit lanes, each half gets two entries of every lane
+        __m512i dst0 = _mm512_unpacklo_epi8(packed_dst, zero);
+        __m512i dst1 = _mm512_unpackhi_epi8(packed_dst, zero);
+        __m512i src0 = _mm512_unpacklo_epi8(packed_src, zero);
+        __m512i src1 = _mm512_unpackhi_epi8(packed_src, zero);
+
+        // Broadcast alpha to all channels, then add one where it is not zero
+        __m512i alpha0 = _mm512_shufflelo_epi16(_mm512_shufflehi_epi16(src0, 0xff), 0xff);
+        alpha0 = _mm512_mask_add_epi16(alpha0, _mm512_test_epi16_mask(alpha0, alpha0), alpha0, one);
+        __m512i alpha1 = _mm512_shufflelo_epi16(_mm512_shufflehi_epi16(src1, 0xff), 0xff);
+        alpha1 = _mm512_mask_add_epi16(alpha1, _mm512_test_epi16_mask(alpha1, alpha1), alpha1, one);
+
+        __m512i weighted_dst0 = _mm512_mullo_epi16(dst0, _mm512_sub_epi16(max, alpha0));
+        __m512i weighted_dst1 = _mm512_mullo_epi16(dst1, _mm512_sub_epi16(max, alpha1));
+        __m512i weighted_src0 = _mm512_mullo_epi16(src0, alpha0);
+        __m512i weighted_src1 = _mm512_mullo_epi16(src1, alpha1);
+
+        __m512i final_dst0 = _mm512_srli_epi16(_mm512_add_epi16(weighted_dst0, weighted_src0), 8);
+        __m512i final_dst1 = _mm512_srli_epi16(_mm512_add_epi16(weighted_dst1, weighted_src1), 8);
+
+        _mm512_store_si512(dstv, _mm512_packus_epi16(final_dst0, final_dst1));
+        srcv += 1;
+        dstv += 1;
+    } while (--length > 0);
+}
+
+KEYLEDSD_EXPORT void multiply_avx512(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
+{
+    assert((uintptr_t)dst % 64 == 0);   // AVX-512 is fastest with 64-bytes aligned data
+    assert((uintptr_t)src % 64 == 0);   // AVX-512 is fastest with 64-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 16 == 0);           // we'll process entries 16 by 16 and don't want to be
+                                        // slowed by boundary checks
+
+    __m512i * restrict dstv = (__m512i *)__builtin_assume_aligned(dst, 64);
+    const __m512i * restrict srcv = (const __m512i *)__builtin_assume_aligned(src, 64);
+
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi16(1);
+
+    length /= 16;
+
+    do {
+        __m512i packed_dst = _mm512_load_si512(dstv);
+        __m512i packed_src = _mm512_load_si512(srcv);
+
+        __m512i dst0 = _mm512_unpacklo_epi8(packed_dst, zero);
+        __m512i dst1 = _mm512_unpackhi_epi8(packed_dst, zero);
+        __m512i src0 = _mm512_unpacklo_epi8(packed_src, zero);
+        __m512i src1 = _mm512_unpackhi_epi8(packed_src, zero);
+
+        dst0 = _mm512_mullo_epi16(dst0, _mm512_add_epi16(src0, one));
+        dst1 = _mm512_mullo_epi16(dst1, _mm512_add_epi16(src1, one));
+
+        dst0 = _mm512_srli_epi16(dst0, 8);
+        dst1 = _mm512_srli_epi16(dst1, 8);
+
+        _mm512_store_si512(dstv, _mm512_packus_epi16(dst0, dst1));
+        srcv += 1;
+        dstv += 1;
+    } while (--length > 0);
+}
+
+KEYLEDSD_EXPORT void diff_avx512(uint8_t * restrict changes, const uint8_t * restrict a,
+                                 const uint8_t * restrict b, size_t length)
+{
+    assert((uintptr_t)a % 64 == 0);     // AVX-512 is fastest with 64-bytes aligned data
+    assert((uintptr_t)b % 64 == 0);     // AVX-512 is fastest with 64-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 16 == 0);           // we'll process entries 16 by 16 to fill two whole
+                                        // bytes of the bitmap per iteration
+
+    const __m512i * restrict av = (const __m512i *)__builtin_assume_aligned(a, 64);
+    const __m512i * restrict bv = (const __m512i *)__builtin_assume_aligned(b, 64);
+
+    const __m512i rgb = _mm512_set1_epi32(0x00ffffff); /* little endian: alpha is high byte */
+
+    length /= 16;
+
+    do {
+        __mmask16 changed = _mm512_test_epi32_mask(_mm512_xor_si512(_mm512_load_si512(av),
+                                                                    _mm512_load_si512(bv)), rgb);
+        *changes++ = (uint8_t)changed;
+        *changes++ = (uint8_t)(changed >> 8);
+        av += 1;
+        bv += 1;
+    } while (--length > 0);
+}
@@ -0,0 +1,143 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <arm_neon.h>
+#include "keyledsd/tools/accelerated.h"
+#include "config.h"
+
+/* Only intrinsics common to ARMv7 and AArch64 are used, so the same code
+ * builds for both. NEON has no alignment requirement, but loads of aligned
+ * data are faster on some ARMv7 cores.
+ */
+
+/** Blend 8 values of one channel, weights are in 16-bit lanes */
+static inline uint8x8_t blend_channel(uint8x8_t dst, uint8x8_t src, uint16x8_t alpha, uint16x8_t inv_alpha)
+{
+    uint16x8_t value = vmulq_u16(vmovl_u8(dst), inv_alpha);
+    value = vmlaq_u16(value, vmovl_u8(src), alpha);
+    return vshrn_n_u16(value, 8);
+}
+
+KEYLEDSD_EXPORT void blend_neon(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
+{
+    assert((uintptr_t)dst % 16 == 0);   // Not a requirement, but faster loads
+    assert((uintptr_t)src % 16 == 0);   // Not a requirement, but faster loads
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 16 == 0);           // we'll process entries 16 by 16 and don't want to be
+                                        // slowed by boundary checks
+
+    dst = (uint8_t * restrict)__builtin_assume_aligned(dst, 16);
+    src = (const uint8_t * restrict)__builtin_assume_aligned(src, 16);
+
+    const uint16x8_t max = vdupq_n_u16(256);
+
+    length /= 16;
+
+    do {
+        // De-interleave 16 entries into one vector per channel
+        uint8x16x4_t packed_dst = vld4q_u8(dst);
+        uint8x16x4_t packed_src = vld4q_u8(src);
+
+        // Add one to alpha where it is not zero
+        uint8x16_t alpha_bump = vshrq_n_u8(vtstq_u8(packed_src.val[3], packed_src.val[3]), 7);
+        uint16x8_t alpha0 = vaddl_u8(vget_low_u8(packed_src.val[3]), vget_low_u8(alpha_bump));
+        uint16x8_t alpha1 = vaddl_u8(vget_high_u8(packed_src.val[3]), vget_high_u8(alpha_bump));
+        uint16x8_t inv_alpha0 = vsubq_u16(max, alpha0);
+        uint16x8_t inv_alpha1 = vsubq_u16(max, alpha1);
+
+        for (unsigned channel = 0; channel < 4; ++channel) {
+            packed_dst.val[channel] = vcombine_u8(
+                blend_channel(vget_low_u8(packed_dst.val[channel]),
+                              vget_low_u8(packed_src.val[channel]), alpha0, inv_alpha0),
+                blend_channel(vget_high_u8(packed_dst.val[channel]),
+                              vget_high_u8(packed_src.val[channel]), alpha1, inv_alpha1)
+            );
+        }
+
+        vst4q_u8(dst, packed_dst);
+        src += 64;
+        dst += 64;
+    } while (--length > 0);
+}
+
+KEYLEDSD_EXPORT void multiply_neon(uint8_t * restrict dst, const uint8_t * restrict src, size_t length)
+{
+    assert((uintptr_t)dst % 16 == 0);   // Not a requirement, but faster loads
+    assert((uintptr_t)src % 16 == 0);   // Not a requirement, but faster loads
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 4 == 0);            // we'll process entries 4 by 4 and don't want to be
+                                        // slowed by boundary checks
+
+    dst = (uint8_t * restrict)__builtin_assume_aligned(dst, 16);
+    src = (const uint8_t * restrict)__builtin_assume_aligned(src, 16);
+
+    length /= 4;
+
+    do {
+        uint8x16_t packed_dst = vld1q_u8(dst);
+        uint8x16_t packed_src = vld1q_u8(src);
+
+        // dst * (src + 1), computed as dst * src + dst in 16 bits
+        uint16x8_t dst0 = vaddw_u8(vmull_u8(vget_low_u8(packed_dst), vget_low_u8(packed_src)),
+                                   vget_low_u8(packed_dst));
+        uint16x8_t dst1 = vaddw_u8(vmull_u8(vget_high_u8(packed_dst), vget_high_u8(packed_src)),
+                                   vget_high_u8(packed_dst));
+
+        vst1q_u8(dst, vcombine_u8(vshrn_n_u16(dst0, 8), vshrn_n_u16(dst1, 8)));
+        src += 16;
+        dst += 16;
+    } while (--length > 0);
+}
+
+KEYLEDSD_EXPORT void diff_neon(uint8_t * restrict changes, const uint8_t * restrict a,
+                               const uint8_t * restrict b, size_t length)
+{
+    assert((uintptr_t)a % 16 == 0);     // Not a requirement, but faster loads
+    assert((uintptr_t)b % 16 == 0);     // Not a requirement, but faster loads
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 8 == 0);            // we'll process entries 8 by 8 to fill a whole byte
+                                        // of the bitmap per iteration
+
+    const uint32_t * restrict av = (const uint32_t *)__builtin_assume_aligned(a, 16);
+    const uint32_t * restrict bv = (const uint32_t *)__builtin_assume_aligned(b, 16);
+
+    const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);     /* little endian: alpha is high byte */
+    const uint8x8_t weights = vcreate_u8(0x8040201008040201ull);    /* bit n in lane n */
+
+    length /= 8;
+
+    do {
+        // All ones in entries whose color differs
+        uint32x4_t changed0 = vtstq_u32(veorq_u32(vld1q_u32(av), vld1q_u32(bv)), rgb);
+        uint32x4_t changed1 = vtstq_u32(veorq_u32(vld1q_u32(av + 4), vld1q_u32(bv + 4)), rgb);
+
+        // Narrow to one byte per entry, keep its bit and sum all lanes
+        uint8x8_t bits = vmovn_u16(vcombine_u16(vmovn_u32(changed0), vmovn_u32(changed1)));
+        bits = vand_u8(bits, weights);
+        bits = vpadd_u8(bits, bits);
+        bits = vpadd_u8(bits, bits);
+        bits = vpadd_u8(bits, bits);
+
+        *changes++ = vget_lane_u8(bits, 0);
+        av += 8;
+        bv += 8;
+    } while (--length > 0);
+}
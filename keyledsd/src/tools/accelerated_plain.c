@@ -59,3 +59,28 @@ KEYLEDSD_EXPORT void multiply_plain(uint8_t * restrict a, const uint8_t * restri
         b += 4;
     } while (--length > 0);
 }
+
+KEYLEDSD_EXPORT void diff_plain(uint8_t * restrict changes, const uint8_t * restrict a,
+                                const uint8_t * restrict b, size_t length)
+{
+    assert((uintptr_t)a % 8 == 0);    // Not a requirement, but lets compiler optimize stuff
+    assert((uintptr_t)b % 8 == 0);    // Not a requirement, but lets compiler optimize stuff
+    assert(length != 0);              // allows inverting loop condition
+    assert(length % 8 == 0);          // each iteration fills one byte of the bitmap
+
+    a = (const uint8_t * restrict)__builtin_assume_aligned(a, 8);
+    b = (const uint8_t * restrict)__builtin_assume_aligned(b, 8);
+
+    length /= 8;
+
+    do {
+        unsigned bits = 0;
+        for (unsigned idx = 0; idx < 8; ++idx) {
+            unsigned delta = (unsigned)(a[0] ^ b[0]) | (unsigned)(a[1] ^ b[1]) | (unsigned)(a[2] ^ b[2]);
+            bits |= (unsigned)(delta != 0) << idx;
+            a += 4;
+            b += 4;
+        }
+        *changes++ = (uint8_t)bits;
+    } while (--length > 0);
+}
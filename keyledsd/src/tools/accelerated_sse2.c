@@ -94,8 +94,8 @@ KEYLEDSD_EXPORT void multiply_sse2(uint8_t * restrict dst, const uint8_t * restr
         __m128i src0 = _mm_unpacklo_epi8(packed_src, zero); /* A1B1G1R1A0B0G0R0 */
         __m128i src1 = _mm_unpackhi_epi8(packed_src, zero); /* A3B3G3R3A2B2G2R2 */
 
-        dst0 = _mm_mullo_epi16(src0, _mm_add_epi16(dst0, one));
-        dst1 = _mm_mullo_epi16(src1, _mm_add_epi16(dst1, one));
+        dst0 = _mm_mullo_epi16(dst0, _mm_add_epi16(src0, one));
+        dst1 = _mm_mullo_epi16(dst1, _mm_add_epi16(src1, one));
 
         dst0 = _mm_srli_epi16(dst0, 8);
         dst1 = _mm_srli_epi16(dst1, 8);
@@ -105,3 +105,34 @@ KEYLEDSD_EXPORT void multiply_sse2(uint8_t * restrict dst, const uint8_t * restr
         dstv += 1;
     } while (--length > 0);
 }
+
+KEYLEDSD_EXPORT void diff_sse2(uint8_t * restrict changes, const uint8_t * restrict a,
+                               const uint8_t * restrict b, size_t length)
+{
+    assert((uintptr_t)a % 16 == 0);     // SSE2 requires 16-bytes aligned data
+    assert((uintptr_t)b % 16 == 0);     // SSE2 requires 16-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition, makes gcc generate
+                                        // better loop code
+    assert(length % 8 == 0);            // we'll process entries 8 by 8 to fill a whole byte
+                                        // of the bitmap per iteration
+
+    const __m128i * restrict av = (const __m128i *)__builtin_assume_aligned(a, 16);
+    const __m128i * restrict bv = (const __m128i *)__builtin_assume_aligned(b, 16);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);    /* little endian: alpha is high byte */
+
+    length /= 8;
+
+    do {
+        __m128i delta0 = _mm_and_si128(_mm_xor_si128(_mm_load_si128(av), _mm_load_si128(bv)), rgb);
+        __m128i delta1 = _mm_and_si128(_mm_xor_si128(_mm_load_si128(av + 1), _mm_load_si128(bv + 1)), rgb);
+
+        int same0 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(delta0, zero)));
+        int same1 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(delta1, zero)));
+
+        *changes++ = (uint8_t)~(same0 | (same1 << 4));
+        av += 2;
+        bv += 2;
+    } while (--length > 0);
+}
@@ -95,6 +95,8 @@ TEST_F(KeyDatabaseTest, iterator) {
 TEST_F(KeyDatabaseTest, findKeyCode) {
     EXPECT_EQ(m_db.begin() + 1, m_db.findKeyCode(11));
     EXPECT_EQ(m_db.end(), m_db.findKeyCode(42));
+    EXPECT_EQ(m_db.end(), m_db.findKeyCode(0));
+    EXPECT_EQ(m_db.end(), m_db.findKeyCode(-1));
 }
 
 TEST_F(KeyDatabaseTest, findName) {
@@ -103,6 +105,22 @@ TEST_F(KeyDatabaseTest, findName) {
     EXPECT_EQ(m_db.end(), m_db.findName("foobar"));
 }
 
+TEST(KeyDatabaseIndexTest, duplicates) {
+    const auto db = KeyDatabase({
+        {0, 10, "A"s, {0, 0, 1, 1}},
+        {1, 10, "B"s, {0, 0, 1, 1}},
+        {2, 11, "A"s, {0, 0, 1, 1}},
+    });
+    EXPECT_EQ(db.begin(), db.findKeyCode(10));
+    EXPECT_EQ(db.begin() + 2, db.findKeyCode(11));
+    EXPECT_EQ(db.begin(), db.findName("A"));
+    EXPECT_EQ(db.begin() + 1, db.findName("B"));
+
+    const auto empty = KeyDatabase();
+    EXPECT_EQ(empty.end(), empty.findKeyCode(10));
+    EXPECT_EQ(empty.end(), empty.findName("A"));
+}
+
 TEST_F(KeyDatabaseTest, distance) {
     EXPECT_EQ((KeyDatabase::Rect{10, 10, 90, 90}), m_db.bounds());
     EXPECT_EQ(0, m_db.distance(m_db[0], m_db[0]));
@@ -0,0 +1,99 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/KeyDatabase.h"
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using keyleds::KeyDatabase;
+
+
+// A database the size of a full keyboard, with key codes spread like linux input codes
+static KeyDatabase makeDatabase(std::size_t size)
+{
+    std::vector<KeyDatabase::Key> keys;
+    for (std::size_t idx = 0; idx < size; ++idx) {
+        auto position = KeyDatabase::position_type(idx);
+        keys.push_back({
+            KeyDatabase::Key::index_type(idx), int(1 + idx * 3 % 250), "KEY_" + std::to_string(idx),
+            { position, 0, position + 1, 1 }
+        });
+    }
+    return KeyDatabase(std::move(keys));
+}
+
+static std::vector<std::string> makeNames(const KeyDatabase & db)
+{
+    std::vector<std::string> names;
+    std::transform(db.begin(), db.end(), std::back_inserter(names),
+                   [](const auto & key) { return key.name; });
+    return names;
+}
+
+/****************************************************************************/
+// Each iteration looks up every key of the database once
+
+static void BM_findKeyCode(benchmark::State & state)
+{
+    const auto db = makeDatabase(std::size_t(state.range(0)));
+    for (auto _ : state) {
+        for (const auto & key : db) { benchmark::DoNotOptimize(db.findKeyCode(key.keyCode)); }
+    }
+}
+BENCHMARK(BM_findKeyCode)->Arg(16)->Arg(110)->Arg(150);
+
+static void BM_findKeyCode_linear(benchmark::State & state)
+{
+    const auto db = makeDatabase(std::size_t(state.range(0)));
+    for (auto _ : state) {
+        for (const auto & key : db) {
+            benchmark::DoNotOptimize(std::find_if(db.begin(), db.end(), [&](const auto & item) {
+                return item.keyCode == key.keyCode;
+            }));
+        }
+    }
+}
+BENCHMARK(BM_findKeyCode_linear)->Arg(16)->Arg(110)->Arg(150);
+
+static void BM_findName(benchmark::State & state)
+{
+    const auto db = makeDatabase(std::size_t(state.range(0)));
+    const auto names = makeNames(db);
+    for (auto _ : state) {
+        for (const auto & name : names) { benchmark::DoNotOptimize(db.findName(name.c_str())); }
+    }
+}
+BENCHMARK(BM_findName)->Arg(16)->Arg(110)->Arg(150);
+
+static void BM_findName_linear(benchmark::State & state)
+{
+    const auto db = makeDatabase(std::size_t(state.range(0)));
+    const auto names = makeNames(db);
+    for (auto _ : state) {
+        for (const auto & name : names) {
+            const char * cname = name.c_str();
+            benchmark::DoNotOptimize(std::find_if(db.begin(), db.end(), [&](const auto & item) {
+                return item.name == cname;
+            }));
+        }
+    }
+}
+BENCHMARK(BM_findName_linear)->Arg(16)->Arg(110)->Arg(150);
+
+BENCHMARK_MAIN();
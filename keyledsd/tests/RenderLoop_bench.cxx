@@ -0,0 +1,475 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/RenderLoop.h"
+
+#include "config.h"
+#include "keyledsd/device/Device.h"
+#include "keyledsd/device/LayoutDescription.h"
+#include "keyledsd/plugin/interfaces.h"
+#include "keyledsd/service/EffectManager.h"
+#include "keyledsd/KeyDatabase.h"
+#include "keyledsd/logging.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using keyleds::KeyDatabase;
+using keyleds::RenderTarget;
+using keyleds::device::Device;
+using keyleds::device::LayoutDescription;
+using keyleds::service::EffectManager;
+using keyleds::service::RenderLoop;
+using namespace std::literals::string_literals;
+
+static constexpr auto framePeriod = std::chrono::duration<unsigned, std::milli>(1000 / KEYLEDSD_RENDER_FPS);
+static const std::vector<std::string> layoutFiles = {
+    "c33000000000_0002.yaml",   // G410
+    "c33100000000_0002.yaml",   // G810
+    "c33c00000000_0002.yaml",   // G513
+};
+
+/****************************************************************************/
+// Device that records what the render loop sends to it
+
+class BenchDevice final : public Device
+{
+public:
+    explicit BenchDevice(block_list blocks)
+     : Device("/dev/null", Type::Keyboard, "bench", "c33000000000", "0", "0", 2, std::move(blocks))
+    {}
+
+    bool        hasLayout() const override { return true; }
+    std::string resolveKey(key_block_id_type, key_id_type) const override { return {}; }
+    int         decodeKeyId(key_block_id_type, key_id_type id) const override { return id; }
+
+    void        setTimeout(unsigned) override {}
+    void        flush() override {}
+    bool        resync() noexcept override { return true; }
+    void        fillColor(const KeyBlock &, const keyleds::RGBColor) override { ++fillCalls; }
+    void        setColors(const KeyBlock &, const ColorDirective[], size_type size) override
+    {
+        ++setColorsCalls;
+        directives += size;
+    }
+    void        getColors(const KeyBlock & block, ColorDirective colors[]) override
+    {
+        std::fill(colors, colors + block.keys().size(), ColorDirective{0, 0, 0, 0});
+    }
+    void        commitColors() override { ++commits; }
+
+public:
+    std::size_t fillCalls = 0;
+    std::size_t setColorsCalls = 0;
+    std::size_t directives = 0;
+    std::size_t commits = 0;
+};
+
+/****************************************************************************/
+// Minimal effect service, reading effect files from the source tree
+
+class BenchEffectService final : public keyleds::plugin::EffectService
+{
+public:
+    BenchEffectService(const KeyDatabase & db, config_map config)
+     : m_keyDB(db), m_configuration(std::move(config)) {}
+
+    const std::string & deviceName() const override { return m_name; }
+    const std::string & deviceModel() const override { return m_name; }
+    const std::string & deviceSerial() const override { return m_name; }
+    const KeyDatabase & keyDB() const override { return m_keyDB; }
+    const std::vector<KeyDatabase::KeyGroup> & keyGroups() const override { return m_keyGroups; }
+    const color_map &   colors() const override { return m_colors; }
+    const config_map &  configuration() const override { return m_configuration; }
+
+    RenderTarget *      createRenderTarget() override
+    {
+        m_targets.push_back(std::make_unique<RenderTarget>(m_keyDB.size()));
+        return m_targets.back().get();
+    }
+    void                destroyRenderTarget(RenderTarget * target) override
+    {
+        m_targets.erase(std::remove_if(m_targets.begin(), m_targets.end(),
+                                       [target](const auto & ptr) { return ptr.get() == target; }),
+                        m_targets.end());
+    }
+
+    const std::string & getFile(const std::string & name) override
+    {
+        m_fileData.clear();
+        if (!name.empty()) {
+            // Look up shipped files first, then benchmark-only ones
+            std::ifstream file(KEYLEDSD_BENCH_DATA_PATH "/" + name, std::ios::binary);
+            if (!file) { file.open(KEYLEDSD_BENCH_DATA_PATH "/tests/" + name, std::ios::binary); }
+            m_fileData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        return m_fileData;
+    }
+
+    void                log(keyleds::logging::level_t, const char *) override {}
+
+private:
+    const std::string                           m_name = "bench";
+    const KeyDatabase &                         m_keyDB;
+    const std::vector<KeyDatabase::KeyGroup>    m_keyGroups;
+    const color_map                             m_colors;
+    const config_map                            m_configuration;
+    std::vector<std::unique_ptr<RenderTarget>>  m_targets;
+    std::string                                 m_fileData;
+};
+
+/****************************************************************************/
+// Device, key database and render loop built from a real layout file
+
+class Pipeline final
+{
+    using config_map = BenchEffectService::config_map;
+public:
+    explicit Pipeline(const std::string & layoutFile)
+     : m_layout(loadLayout(layoutFile)),
+       m_device(makeBlocks(m_layout)),
+       m_keyDB(makeKeyDatabase(m_device, m_layout)),
+       m_loop(m_device, KEYLEDSD_RENDER_FPS)
+    {
+        m_effects.searchPaths().push_back(KEYLEDSD_BENCH_MODULE_PATH);
+    }
+
+    ~Pipeline() { clear(); }
+
+    bool loadPlugin(const std::string & name) { return m_effects.load(name, nullptr); }
+
+    bool addEffect(const std::string & name, config_map config = {})
+    {
+        auto effect = m_effects.createEffect(
+            name, std::make_unique<BenchEffectService>(m_keyDB, std::move(config))
+        );
+        if (!effect) { return false; }
+        m_active.push_back(std::move(effect));
+
+        RenderLoop::effect_list effects;
+        for (const auto & active : m_active) { effects.push_back(active.get()); }
+        m_loop.setEffects(std::move(effects), {});
+        return true;
+    }
+
+    void pressRandomKey(std::minstd_rand & random)
+    {
+        auto dist = std::uniform_int_distribution<KeyDatabase::size_type>(0, m_keyDB.size() - 1);
+        const auto & key = m_keyDB[dist(random)];
+        m_loop.postKeyEvent(key, true);
+    }
+
+    void clear()
+    {
+        m_loop.setEffects({}, {});
+        m_loop.synchronize();
+        m_active.clear();
+    }
+
+    BenchDevice &       device() { return m_device; }
+    const KeyDatabase & keyDB() const { return m_keyDB; }
+    RenderLoop &        loop() { return m_loop; }
+
+private:
+    static LayoutDescription loadLayout(const std::string & layoutFile)
+    {
+        std::ifstream file(KEYLEDSD_BENCH_DATA_PATH "/layouts/" + layoutFile);
+        return LayoutDescription::parse(file);
+    }
+
+    static std::vector<Device::KeyBlock> makeBlocks(const LayoutDescription & layout)
+    {
+        std::map<LayoutDescription::block_type, std::vector<Device::key_id_type>> keys;
+        for (const auto & key : layout.keys) {
+            keys[key.block].push_back(static_cast<Device::key_id_type>(key.code));
+        }
+        std::vector<Device::KeyBlock> blocks;
+        for (auto & entry : keys) {
+            blocks.emplace_back(static_cast<Device::key_block_id_type>(entry.first),
+                                "block" + std::to_string(entry.first), std::move(entry.second),
+                                keyleds::RGBColor{255, 255, 255});
+        }
+        return blocks;
+    }
+
+    static KeyDatabase makeKeyDatabase(const Device & device, const LayoutDescription & layout)
+    {
+        std::vector<KeyDatabase::Key> keys;
+        for (const auto & block : device.blocks()) {
+            for (auto keyId : block.keys()) {
+                auto it = std::find_if(layout.keys.begin(), layout.keys.end(), [&](const auto & key) {
+                    return key.block == block.id() && key.code == keyId;
+                });
+                keys.push_back({
+                    KeyDatabase::Key::index_type(keys.size()), keyId, it->name,
+                    { it->position.x0, it->position.y0, it->position.x1, it->position.y1 }
+                });
+            }
+        }
+        return KeyDatabase(std::move(keys));
+    }
+
+private:
+    LayoutDescription                       m_layout;
+    BenchDevice                             m_device;
+    KeyDatabase                             m_keyDB;
+    EffectManager                           m_effects;
+    RenderLoop                              m_loop;
+    std::vector<EffectManager::effect_ptr>  m_active;
+};
+
+/****************************************************************************/
+// Benchmarks
+//
+// Each iteration renders one frame through RenderLoop::render. Counters report
+// averages per frame: number of setColors calls, number of keys sent (diff size),
+// number of block fills and number of commits.
+
+struct EffectSetup
+{
+    std::string                         name;
+    BenchEffectService::config_map      config;
+    unsigned                            keyPressPeriod;     ///< frames between key presses, 0 = none
+};
+
+static void runPipeline(benchmark::State & state, const std::vector<EffectSetup> & effects,
+                        const std::vector<std::string> & plugins = {})
+{
+    Pipeline pipeline(layoutFiles.at(std::size_t(state.range(0))));
+    for (const auto & plugin : plugins) {
+        if (!pipeline.loadPlugin(plugin)) {
+            state.SkipWithError(("could not load plugin " + plugin).c_str());
+            return;
+        }
+    }
+    for (const auto & effect : effects) {
+        if (!pipeline.addEffect(effect.name, effect.config)) {
+            state.SkipWithError(("could not load effect " + effect.name).c_str());
+            return;
+        }
+    }
+    const auto keyPressPeriod = effects.back().keyPressPeriod;
+
+    std::minstd_rand random;
+    unsigned frame = 0;
+    for (auto _ : state) {
+        if (keyPressPeriod > 0 && frame % keyPressPeriod == 0) { pipeline.pressRandomKey(random); }
+        pipeline.loop().render(framePeriod);
+        ++frame;
+    }
+
+    const auto & device = pipeline.device();
+    state.counters["keys"] = double(pipeline.keyDB().size());
+    state.counters["setColors"] = benchmark::Counter(double(device.setColorsCalls),
+                                                     benchmark::Counter::kAvgIterations);
+    state.counters["diff"] = benchmark::Counter(double(device.directives),
+                                                benchmark::Counter::kAvgIterations);
+    state.counters["fills"] = benchmark::Counter(double(device.fillCalls),
+                                                 benchmark::Counter::kAvgIterations);
+    state.counters["commits"] = benchmark::Counter(double(device.commits),
+                                                   benchmark::Counter::kAvgIterations);
+    state.SetLabel(layoutFiles.at(std::size_t(state.range(0))));
+}
+
+static void BM_wave(benchmark::State & state)
+{
+    runPipeline(state, {{ "wave", {
+        { "period", "3000"s },
+        { "length", "1000"s },
+        { "colors", std::vector<std::string>{"red", "green", "blue", "red"} }
+    }, 0 }});
+}
+
+static void BM_stars(benchmark::State & state)
+{
+    runPipeline(state, {{ "stars", {
+        { "duration", "2000"s },
+        { "number", "12"s },
+        { "colors", std::vector<std::string>{"white", "yellow", "cyan"} }
+    }, 0 }});
+}
+
+static void BM_breathe(benchmark::State & state)
+{
+    runPipeline(state, {{ "breathe", { { "color", "blue"s }, { "period", "5000"s } }, 0 }});
+}
+
+static void BM_feedback(benchmark::State & state)
+{
+    runPipeline(state, {{ "feedback", { { "color", "yellow"s } }, 4 }});
+}
+
+static void BM_lua(benchmark::State & state)
+{
+    runPipeline(state, {{ "reactive-hlines", {}, 4 }}, { "lua" });
+}
+
+static void BM_luaFades(benchmark::State & state)
+{
+    runPipeline(state, {{ "fades", { { "fades", std::to_string(state.range(1)) } }, 0 }}, { "lua" });
+    state.counters["fades"] = double(state.range(1));
+}
+
+static void BM_luaGradient(benchmark::State & state)
+{
+    static const std::array<std::string, 3> modes = {{ "index", "pixels", "bulk" }};
+    const auto & mode = modes.at(std::size_t(state.range(1)));
+    runPipeline(state, {{ "gradient", { { "mode", mode } }, 0 }}, { "lua" });
+    state.SetLabel(mode);
+}
+
+static void BM_layered(benchmark::State & state)
+{
+    runPipeline(state, {
+        { "breathe", { { "color", "blue"s }, { "period", "5000"s } }, 0 },
+        { "stars", { { "number", "8"s } }, 0 },
+        { "feedback", { { "color", "yellow"s } }, 4 },
+    });
+}
+
+/****************************************************************************/
+// Contention between the main thread and a running render thread
+//
+// The render thread runs an effect that takes a fixed time to render, standing
+// for an expensive script. The main thread posts key events at a fixed rate,
+// which must not have to wait for frames to complete. Events are delivered once
+// per frame, so rates above keyEventCapacity per frame drop events.
+
+/// Post times of accepted key events, indexed by acceptance order. Large enough
+/// that a slot is not reused while its event can still be in the queue.
+using post_time_ring = std::array<std::chrono::steady_clock::time_point, 4 * RenderLoop::keyEventCapacity>;
+
+class SlowEffect final : public keyleds::plugin::Effect
+{
+public:
+    SlowEffect(std::chrono::microseconds cost, const post_time_ring & postTimes)
+     : m_cost(cost), m_postTimes(postTimes) {}
+    ~SlowEffect() = default;
+
+    void    render(milliseconds, RenderTarget &) override
+    {
+        const auto end = std::chrono::steady_clock::now() + m_cost;
+        while (std::chrono::steady_clock::now() < end) {}
+        ++frames;
+    }
+    void    handleContextChange(const string_map &) override {}
+    void    handleGenericEvent(const string_map &) override {}
+    void    handleKeyEvent(const KeyDatabase::Key &, bool) override
+    {
+        // Events are delivered in order, so the nth delivered event is the nth accepted one
+        const auto latency = std::chrono::steady_clock::now() - m_postTimes[delivered % m_postTimes.size()];
+        totalLatency += latency;
+        maxLatency = std::max(maxLatency, latency);
+        ++delivered;
+    }
+
+public:
+    std::atomic<unsigned long>  frames = 0;
+    std::atomic<unsigned long>  delivered = 0;
+    std::chrono::steady_clock::duration totalLatency{};
+    std::chrono::steady_clock::duration maxLatency{};
+private:
+    const std::chrono::microseconds m_cost;
+    const post_time_ring &          m_postTimes;
+};
+
+/// Arguments: render time of the effect in microseconds, key events per second or
+/// zero to post them back to back
+static void BM_keyEventContention(benchmark::State & state)
+{
+    Pipeline pipeline(layoutFiles.front());
+    post_time_ring postTimes;
+    SlowEffect effect{std::chrono::microseconds(state.range(0)), postTimes};
+    auto & loop = pipeline.loop();
+    const auto & key = pipeline.keyDB()[0];
+    const auto interval = state.range(1) > 0 ? std::chrono::nanoseconds(1000000000 / state.range(1))
+                                             : std::chrono::nanoseconds(0);
+    unsigned long accepted = 0;
+
+    loop.setEffects({ &effect }, {});
+    loop.start();
+    loop.setPaused(false);
+    auto next = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        // We are the only producer, so a change in drop count means our event was dropped
+        const auto dropped = loop.droppedKeyEvents();
+        postTimes[accepted % postTimes.size()] = std::chrono::steady_clock::now();
+        loop.postKeyEvent(key, true);
+        if (loop.droppedKeyEvents() == dropped) { ++accepted; }
+
+        if (interval.count() > 0) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+    }
+    for (int frame = 0; frame < 10 && effect.delivered.load() < accepted; ++frame) {
+        std::this_thread::sleep_for(framePeriod);       // let queued events be delivered
+    }
+    loop.stop();
+    loop.setEffects({}, {});
+    loop.synchronize();
+
+    using microseconds = std::chrono::duration<double, std::micro>;
+    state.counters["frames"] = double(effect.frames.load());
+    state.counters["delivered"] = double(effect.delivered.load());
+    state.counters["dropped"] = double(loop.droppedKeyEvents());
+    state.counters["latency_us"] = effect.delivered > 0
+        ? microseconds(effect.totalLatency).count() / double(effect.delivered) : 0.0;
+    state.counters["max_latency_us"] = microseconds(effect.maxLatency).count();
+}
+
+BENCHMARK(BM_keyEventContention)
+    ->Args({0, 1000})->Args({2000, 1000})->Args({10000, 1000})
+    ->Args({10000, 0})
+    ->UseRealTime();
+
+/****************************************************************************/
+
+static void layoutArgs(benchmark::internal::Benchmark * bench)
+{
+    for (std::size_t idx = 0; idx < layoutFiles.size(); ++idx) { bench->Arg(int64_t(idx)); }
+}
+
+BENCHMARK(BM_wave)->Apply(layoutArgs);
+BENCHMARK(BM_stars)->Apply(layoutArgs);
+BENCHMARK(BM_breathe)->Apply(layoutArgs);
+BENCHMARK(BM_feedback)->Apply(layoutArgs);
+BENCHMARK(BM_lua)->Apply(layoutArgs);
+BENCHMARK(BM_luaFades)->Args({1, 100})->Args({1, 1000});
+BENCHMARK(BM_luaGradient)->Args({1, 0})->Args({1, 1})->Args({1, 2});
+BENCHMARK(BM_layered)->Apply(layoutArgs);
+
+int main(int argc, char * argv[])
+{
+    // Plugin loading is logged at info level for every run, keep output readable
+    static const auto logPolicy = keyleds::logging::FilePolicy(STDERR_FILENO, keyleds::logging::warning::value);
+    keyleds::logging::Configuration::instance().setPolicy(&logPolicy);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) { return 1; }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -16,9 +16,13 @@
  */
 #include "keyledsd/RenderTarget.h"
 
+#include "config.h"
 #include "keyledsd/tools/accelerated.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
 #include <type_traits>
+#include <vector>
 
 using keyleds::RenderTarget;
 using keyleds::RGBColor;
@@ -129,6 +133,13 @@ public:
     static constexpr RenderTarget::size_type size = 101;
     using architecture = T;
 
+    void SetUp() override
+    {
+        if (!isSupported()) { GTEST_SKIP() << "instruction set not supported by this CPU"; }
+    }
+
+    static bool isSupported();
+
     RenderTargetAccelerationTest()
      : translucentWhite(size),
        opaqueWhite(size)
@@ -145,14 +156,37 @@ public:
     RenderTarget    opaqueWhite;
 };
 
+template <typename T> bool RenderTargetAccelerationTest<T>::isSupported() { return true; }
+#ifdef KEYLEDSD_USE_AVX2
+template <> bool RenderTargetAccelerationTest<architecture::avx2>::isSupported()
+    { return __builtin_cpu_supports("avx2"); }
+#endif
+#ifdef KEYLEDSD_USE_AVX512
+template <> bool RenderTargetAccelerationTest<architecture::avx512>::isSupported()
+    { return __builtin_cpu_supports("avx512bw"); }
+#endif
+
 namespace testing::internal {   // dirty hack to have type names despite -fno-rtti
     template <> std::string GetTypeName<architecture::plain>() { return "plain"; }
     template <> std::string GetTypeName<architecture::sse2>() { return "sse2"; }
     template <> std::string GetTypeName<architecture::avx2>() { return "avx2"; }
+    template <> std::string GetTypeName<architecture::avx512>() { return "avx512"; }
+    template <> std::string GetTypeName<architecture::neon>() { return "neon"; }
 }
-using Architectures = ::testing::Types<architecture::plain,
-                                       architecture::sse2,
-                                       architecture::avx2>;
+using Architectures = ::testing::Types<architecture::plain
+#ifdef KEYLEDSD_USE_SSE2
+                                       , architecture::sse2
+#endif
+#ifdef KEYLEDSD_USE_AVX2
+                                       , architecture::avx2
+#endif
+#ifdef KEYLEDSD_USE_AVX512
+                                       , architecture::avx512
+#endif
+#ifdef KEYLEDSD_USE_NEON
+                                       , architecture::neon
+#endif
+                                       >;
 TYPED_TEST_SUITE(RenderTargetAccelerationTest, Architectures);
 
 
@@ -177,3 +211,58 @@ TYPED_TEST(RenderTargetAccelerationTest, multiply) {
     EXPECT_TRUE(std::all_of(target.begin(), target.end(),
                 [](auto item) { return item == RGBAColor{0xff, 0x80, 0x00, 0x3f}; }));
 }
+
+TYPED_TEST(RenderTargetAccelerationTest, diff) {
+    auto target = RenderTarget(TestFixture::size);
+    std::copy(TestFixture::opaqueWhite.begin(), TestFixture::opaqueWhite.end(), target.begin());
+    target[0] = RGBAColor{0xfe, 0xff, 0xff, 0xff};
+    target[9] = RGBAColor{0xff, 0xff, 0x00, 0xff};
+    target[10] = RGBAColor{0xff, 0xff, 0xff, 0x00};      // alpha is ignored
+    target[100] = RGBAColor{0xff, 0x00, 0xff, 0xff};
+
+    auto changes = std::vector<uint8_t>(keyleds::diffBitmapSize(target), 0xaa);
+    keyleds::diff<typename TestFixture::architecture>(changes.data(), target, TestFixture::opaqueWhite);
+    for (RenderTarget::size_type idx = 0; idx < TestFixture::size; ++idx) {
+        bool changed = (changes[idx / 8] & (1u << (idx % 8))) != 0;
+        EXPECT_EQ(idx == 0 || idx == 9 || idx == 100, changed) << "at index " << idx;
+    }
+}
+
+TYPED_TEST(RenderTargetAccelerationTest, matchesPlain) {
+    constexpr RenderTarget::size_type count = 1000;
+    auto generator = std::mt19937(42);
+    auto randomByte = [&generator] { return static_cast<uint8_t>(generator() & 0xff); };
+    auto randomFill = [&](RenderTarget & target) {
+        for (auto & color : target) {
+            color = RGBAColor{randomByte(), randomByte(), randomByte(), randomByte()};
+        }
+    };
+
+    auto source = RenderTarget(count);
+    auto expected = RenderTarget(count);
+    auto target = RenderTarget(count);
+    for (unsigned round = 0; round < 10; ++round) {
+        randomFill(source);
+        randomFill(expected);
+        // Cover edge cases: transparent, opaque and unchanged entries
+        for (RenderTarget::size_type idx = 0; idx < count; idx += 7) { source[idx].alpha = 0; }
+        for (RenderTarget::size_type idx = 3; idx < count; idx += 7) { source[idx].alpha = 255; }
+        for (RenderTarget::size_type idx = 5; idx < count; idx += 7) { source[idx] = expected[idx]; }
+
+        std::copy(expected.begin(), expected.end(), target.begin());
+        keyleds::blend<architecture::plain>(expected, source);
+        keyleds::blend<typename TestFixture::architecture>(target, source);
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), target.begin())) << "blend";
+
+        std::copy(expected.begin(), expected.end(), target.begin());
+        keyleds::multiply<architecture::plain>(expected, source);
+        keyleds::multiply<typename TestFixture::architecture>(target, source);
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), target.begin())) << "multiply";
+
+        auto expectedChanges = std::vector<uint8_t>(keyleds::diffBitmapSize(target));
+        auto changes = std::vector<uint8_t>(keyleds::diffBitmapSize(target));
+        keyleds::diff<architecture::plain>(expectedChanges.data(), expected, source);
+        keyleds::diff<typename TestFixture::architecture>(changes.data(), target, source);
+        EXPECT_EQ(expectedChanges, changes);
+    }
+}
@@ -16,8 +16,10 @@
  */
 #include "keyledsd/RenderTarget.h"
 
+#include "config.h"
 #include "keyledsd/tools/accelerated.h"
 #include <benchmark/benchmark.h>
+#include <vector>
 
 using keyleds::RenderTarget;
 using keyleds::RGBColor;
@@ -37,8 +39,18 @@ template <typename Architecture> static void BM_blend(benchmark::State & state)
     }
 }
 BENCHMARK_TEMPLATE(BM_blend, architecture::plain)->RangeMultiplier(2)->Range(32, 2<<16);
+#ifdef KEYLEDSD_USE_SSE2
 BENCHMARK_TEMPLATE(BM_blend, architecture::sse2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX2
 BENCHMARK_TEMPLATE(BM_blend, architecture::avx2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX512
+BENCHMARK_TEMPLATE(BM_blend, architecture::avx512)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_NEON
+BENCHMARK_TEMPLATE(BM_blend, architecture::neon)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
 
 template <typename Architecture> static void BM_multiply(benchmark::State & state)
 {
@@ -52,7 +64,45 @@ template <typename Architecture> static void BM_multiply(benchmark::State & stat
     }
 }
 BENCHMARK_TEMPLATE(BM_multiply, architecture::plain)->RangeMultiplier(2)->Range(32, 2<<16);
+#ifdef KEYLEDSD_USE_SSE2
 BENCHMARK_TEMPLATE(BM_multiply, architecture::sse2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX2
 BENCHMARK_TEMPLATE(BM_multiply, architecture::avx2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX512
+BENCHMARK_TEMPLATE(BM_multiply, architecture::avx512)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_NEON
+BENCHMARK_TEMPLATE(BM_multiply, architecture::neon)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+
+template <typename Architecture> static void BM_diff(benchmark::State & state)
+{
+    auto target = RenderTarget(RenderTarget::size_type(state.range(0)));
+    auto source = RenderTarget(RenderTarget::size_type(state.range(0)));
+    auto changes = std::vector<uint8_t>(keyleds::diffBitmapSize(target));
+    std::fill(target.begin(), target.end(), RGBAColor{0, 0, 0, 255});
+    std::fill(source.begin(), source.end(), RGBAColor{0, 0, 0, 255});
+    for (std::size_t idx = 0; idx < source.size(); idx += 3) { source[idx].red = 255; }
+
+    for (auto _ : state) {
+        keyleds::diff<Architecture>(changes.data(), target, source);
+        benchmark::DoNotOptimize(changes.data());
+    }
+}
+BENCHMARK_TEMPLATE(BM_diff, architecture::plain)->RangeMultiplier(2)->Range(32, 2<<16);
+#ifdef KEYLEDSD_USE_SSE2
+BENCHMARK_TEMPLATE(BM_diff, architecture::sse2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX2
+BENCHMARK_TEMPLATE(BM_diff, architecture::avx2)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_AVX512
+BENCHMARK_TEMPLATE(BM_diff, architecture::avx512)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
+#ifdef KEYLEDSD_USE_NEON
+BENCHMARK_TEMPLATE(BM_diff, architecture::neon)->RangeMultiplier(2)->Range(32, 2<<16);
+#endif
 
 BENCHMARK_MAIN();
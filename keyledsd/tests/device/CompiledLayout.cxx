@@ -0,0 +1,156 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/device/CompiledLayout.h"
+
+#include "keyledsd/device/LayoutDescription.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+
+using keyleds::device::CompiledLayout;
+using keyleds::device::LayoutDescription;
+
+static const char layoutYAML[] = R"(
+layout: INTL
+spurious:
+    - {zone: 1, code: 0x31}
+keyboards:
+    - zone: 64
+      keys:
+        - {code: 0x02, x: 802, y: 23, width: 48, height: 28, glyph: 'Game'}
+        - {code: 0x01, x: 898, y: 23, width: 48, height: 28, glyph: 'Light'}
+    - keys:
+        - {code: 0x29, x: 70, y: 65, width: 49, height: 50, glyph: 'ESC'}
+        - {code: 0x3a, x: 155, y: 65, width: 47, height: 50}
+)";
+
+class CompiledLayoutTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        std::istringstream stream(layoutYAML);
+        m_description = LayoutDescription::parse(stream);
+
+        char path[] = "/tmp/keyledsd-layout-XXXXXX";
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        m_path = path;
+    }
+
+    void TearDown() override { std::remove(m_path.c_str()); }
+
+    void corrupt(std::size_t offset, char value)
+    {
+        std::fstream file(m_path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.put(value);
+    }
+
+protected:
+    LayoutDescription   m_description;
+    std::string         m_path;
+};
+
+
+TEST_F(CompiledLayoutTest, compile) {
+    auto layout = CompiledLayout::compile(m_description, {1234, 5678});
+    EXPECT_FALSE(layout.empty());
+    EXPECT_EQ("INTL", layout.name());
+    EXPECT_EQ((CompiledLayout::Source{1234, 5678}), layout.source());
+    ASSERT_EQ(4u, layout.keys().size());
+
+    const auto * key = layout.find(64, 0x02);
+    ASSERT_NE(nullptr, key);
+    EXPECT_EQ("GAME", layout.name(*key));
+    EXPECT_EQ(802u, key->x0);
+    EXPECT_EQ(23u, key->y0);
+    EXPECT_EQ(nullptr, layout.find(64, 0x03));
+    EXPECT_EQ(nullptr, layout.find(1, 0x02));
+    EXPECT_NE(nullptr, layout.find(1, 0x29));       // default block
+
+    auto block = layout.keys(64);
+    ASSERT_EQ(2u, block.size());
+    EXPECT_EQ(0x01u, block.begin()[0].code);    // sorted by code
+    EXPECT_EQ(0x02u, block.begin()[1].code);
+    EXPECT_TRUE(layout.keys(2).empty());
+
+    EXPECT_TRUE(layout.isSpurious(1, 0x31));
+    EXPECT_FALSE(layout.isSpurious(64, 0x31));
+}
+
+TEST_F(CompiledLayoutTest, empty) {
+    CompiledLayout layout;
+    EXPECT_TRUE(layout.empty());
+    EXPECT_TRUE(layout.keys().empty());
+    EXPECT_TRUE(layout.spurious().empty());
+    EXPECT_EQ(nullptr, layout.find(1, 0x29));
+    EXPECT_EQ("", layout.name());
+}
+
+TEST_F(CompiledLayoutTest, saveAndMap) {
+    CompiledLayout::compile(m_description, {1234, 5678}).save(m_path);
+
+    auto layout = CompiledLayout::map(m_path);
+    EXPECT_EQ("INTL", layout.name());
+    EXPECT_EQ((CompiledLayout::Source{1234, 5678}), layout.source());
+    ASSERT_EQ(4u, layout.keys().size());
+    const auto * key = layout.find(1, 0x29);
+    ASSERT_NE(nullptr, key);
+    EXPECT_EQ("ESC", layout.name(*key));
+    EXPECT_EQ(1u, layout.spurious().size());
+}
+
+TEST_F(CompiledLayoutTest, move) {
+    static_assert(!std::is_copy_constructible_v<CompiledLayout>);
+    CompiledLayout::compile(m_description).save(m_path);
+
+    auto compiled = CompiledLayout::compile(m_description);
+    auto mapped = CompiledLayout::map(m_path);
+    CompiledLayout layout = std::move(compiled);
+    EXPECT_TRUE(compiled.empty());
+    EXPECT_EQ("INTL", layout.name());
+
+    layout = std::move(mapped);                     // releases allocated data
+    EXPECT_TRUE(mapped.empty());
+    EXPECT_EQ("INTL", layout.name());
+    EXPECT_EQ(4u, layout.keys().size());
+}
+
+TEST_F(CompiledLayoutTest, rejectInvalid) {
+    EXPECT_THROW(CompiledLayout::map(m_path), CompiledLayout::Error);  // empty file
+
+    CompiledLayout::compile(m_description).save(m_path);
+    corrupt(0, 'X');
+    EXPECT_THROW(CompiledLayout::map(m_path), CompiledLayout::Error);   // bad magic
+
+    CompiledLayout::compile(m_description).save(m_path);
+    corrupt(4, char(CompiledLayout::formatVersion + 1));
+    EXPECT_THROW(CompiledLayout::map(m_path), CompiledLayout::Error);   // bad version
+
+    CompiledLayout::compile(m_description).save(m_path);
+    { std::ofstream(m_path, std::ios::binary | std::ios::app) <<"trailing"; }
+    EXPECT_THROW(CompiledLayout::map(m_path), CompiledLayout::Error);   // bad size
+
+    EXPECT_THROW(CompiledLayout::map(m_path + ".missing"), std::system_error);
+}
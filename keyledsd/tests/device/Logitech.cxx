@@ -0,0 +1,145 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/device/Logitech.h"
+
+#include "config.h"
+#include "keyleds.h"
+#include "simulator.h"
+#include <gtest/gtest.h>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <uv.h>
+
+using keyleds::device::Device;
+using keyleds::device::Logitech;
+
+static constexpr unsigned slowLatency = 1000;   // microseconds per report
+
+static KeyledsSim * makeSimulator(unsigned latency = 0)
+{
+    keyleds_sim_config config = {};
+    config.name = "G410 Simulated Keyboard";
+    config.layout = KEYLEDS_KEYBOARD_LAYOUT_FRA;
+    auto * sim = keyleds_sim_new(&config);
+    if (sim) { keyleds_sim_set_latency(sim, latency); }
+    return sim;
+}
+
+
+TEST(LogitechTest, open) {
+    auto * sim = makeSimulator(slowLatency);
+    ASSERT_NE(nullptr, sim);
+    auto * handle = keyleds_sim_open(sim, KEYLEDSD_APP_ID);
+    ASSERT_NE(nullptr, handle);
+
+    Logitech::OpenTimings timings;
+    auto device = Logitech::open(handle, "/dev/simulated", &timings);
+    ASSERT_NE(nullptr, device);
+    EXPECT_EQ("/dev/simulated", device->path());
+    EXPECT_EQ("G410 Simulated Keyboard", device->name());
+    EXPECT_EQ(Device::Type::Keyboard, device->type());
+    ASSERT_EQ(3u, device->blocks().size());
+    EXPECT_EQ(106u, device->blocks()[0].keys().size());
+
+    // Every phase talks to the device, so it must have waited at least once
+    EXPECT_GE(timings.info.count(), slowLatency);
+    EXPECT_GE(timings.version.count(), slowLatency);
+    EXPECT_GE(timings.blocks.count(), slowLatency);
+    EXPECT_EQ(timings.info + timings.version + timings.blocks, timings.total());
+
+    device.reset();
+    keyleds_sim_free(sim);
+}
+
+TEST(LogitechTest, openError) {
+    auto * sim = makeSimulator();
+    ASSERT_NE(nullptr, sim);
+    auto * handle = keyleds_sim_open(sim, KEYLEDSD_APP_ID);
+    ASSERT_NE(nullptr, handle);
+    keyleds_sim_free(sim);
+
+    EXPECT_THROW(Logitech::open(handle, "/dev/simulated"), Device::error);
+}
+
+TEST(LogitechTest, concurrentProbes) {
+    // Probe several slow devices on libuv's worker pool, as the service does,
+    // while a timer checks the loop keeps running.
+    struct Probe {
+        uv_work_t                   request;
+        unsigned *                  pending = nullptr;
+        uv_timer_t *                timer = nullptr;
+        KeyledsSim *                sim = nullptr;
+        std::unique_ptr<Device>     device;
+        Logitech::OpenTimings       timings;
+    };
+    struct Context {
+        std::array<Probe, 3>        probes;
+        unsigned                    pending = 0;
+        unsigned                    ticks = 0;
+        uv_timer_t                  timer;
+    } context;
+
+    uv_loop_t loop;
+    ASSERT_EQ(0, uv_loop_init(&loop));
+    uv_timer_init(&loop, &context.timer);
+    context.timer.data = &context;
+    uv_timer_start(&context.timer, [](uv_timer_t * timer) {
+        static_cast<Context *>(timer->data)->ticks += 1;
+    }, 1, 1);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (auto & probe : context.probes) {
+        probe.sim = makeSimulator(slowLatency);
+        ASSERT_NE(nullptr, probe.sim);
+        probe.request.data = &probe;
+        probe.pending = &context.pending;
+        probe.timer = &context.timer;
+        ASSERT_EQ(0, uv_queue_work(&loop, &probe.request, [](uv_work_t * request) {
+            auto & job = *static_cast<Probe *>(request->data);
+            const auto openStart = std::chrono::steady_clock::now();
+            auto * handle = keyleds_sim_open(job.sim, KEYLEDSD_APP_ID);
+            if (handle == nullptr) { return; }
+            job.timings.open = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - openStart
+            );
+            try {
+                job.device = Logitech::open(handle, "/dev/simulated", &job.timings);
+            } catch (Device::error &) {}
+        }, [](uv_work_t * request, int) {
+            auto & job = *static_cast<Probe *>(request->data);
+            if (--*job.pending == 0) {
+                uv_close(reinterpret_cast<uv_handle_t *>(job.timer), nullptr);
+            }
+        }));
+        context.pending += 1;
+    }
+    uv_run(&loop, UV_RUN_DEFAULT);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(0, uv_loop_close(&loop));
+
+    std::chrono::microseconds serial{};
+    for (auto & probe : context.probes) {
+        EXPECT_NE(nullptr, probe.device);
+        serial += probe.timings.total();
+        probe.device.reset();
+        keyleds_sim_free(probe.sim);
+    }
+    EXPECT_LT(elapsed, serial);         // probes overlapped
+    EXPECT_GT(context.ticks, 5u);       // main loop was not blocked meanwhile
+}
@@ -0,0 +1,34 @@
+-- Benchmark effect: keeps a large number of fades running at once
+--
+-- Fades are spread over as many buffers as needed, and restarted before they
+-- end, so every frame steps the same number of them.
+
+local count = tonumber(keyleds.config.fades) or 1000
+local keys = #keyleds.db
+local colors = { tocolor('red'), tocolor('blue') }
+
+local buffers = {}
+for idx = 1, math.ceil(count / keys) do buffers[idx] = RenderTarget:new() end
+
+function restart(flip)
+    local started = 0
+    for _, buffer in ipairs(buffers) do
+        for key = 1, keys do
+            if started == count then return end
+            buffer[key] = fade(2, colors[flip], colors[3 - flip])
+            started = started + 1
+        end
+    end
+end
+
+function animate()
+    local flip = 1
+    while true do
+        restart(flip)
+        flip = 3 - flip
+        wait(1)
+    end
+end
+
+thread(animate)
+function render(ms, target) target:blend(buffers[1]) end
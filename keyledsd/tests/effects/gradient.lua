@@ -0,0 +1,31 @@
+-- Benchmark effect: writes a moving gradient over the whole keyboard
+--
+-- With mode 'pixels', keys are written through a pixel view, which only
+-- exists on LuaJIT. With mode 'bulk', the gradient is a single native call.
+-- Otherwise, keys are written through target indexing.
+
+local mode = keyleds.config.mode or 'index'
+if mode == 'pixels' and not RenderTarget.pixels then error('pixel views require LuaJIT') end
+local time = 0
+
+function render(ms, target)
+    time = time + ms
+    local shift = (time % 1000) / 1000
+    local size = #target
+
+    if mode == 'pixels' then
+        local pixels = target:pixels()
+        for idx = 1, size do
+            local value = (idx / size + shift) % 1
+            pixels:set(idx, value, 0, 1 - value, 1)
+        end
+    elseif mode == 'bulk' then
+        target:gradient(keyleds.db, 'x', tocolor(shift, 0, 1 - shift, 1),
+                                         tocolor(1 - shift, 0, shift, 1))
+    else
+        for idx = 1, size do
+            local value = (idx / size + shift) % 1
+            target[idx] = tocolor(value, 0, 1 - value, 1)
+        end
+    end
+end
@@ -0,0 +1,139 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/logging.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using keyleds::logging::AsyncPolicy;
+using keyleds::logging::Policy;
+using keyleds::logging::level_t;
+namespace logging = keyleds::logging;
+
+namespace {
+
+/// Records entries, optionally blocking writes until released
+class RecordingPolicy final : public Policy
+{
+public:
+    bool canSkip(level_t level) const override { return level > logging::info::value; }
+    void write(level_t level, const std::string &, const std::string & msg) const override
+    {
+        if (canSkip(level)) { return; }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return !m_blocked; });
+        m_entries.push_back(msg);
+    }
+
+    void setBlocked(bool blocked)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blocked = blocked;
+        m_cond.notify_all();
+    }
+    std::vector<std::string> entries() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries;
+    }
+
+private:
+    mutable std::mutex                  m_mutex;
+    mutable std::condition_variable     m_cond;
+    bool                                m_blocked = false;
+    mutable std::vector<std::string>    m_entries;
+};
+
+}
+
+TEST(LoggingTest, asyncOrder) {
+    auto target = RecordingPolicy();
+    auto policy = AsyncPolicy(target, 64);
+    EXPECT_TRUE(policy.canSkip(logging::debug::value));
+    for (int idx = 0; idx < 50; ++idx) {
+        policy.write(logging::info::value, "test", std::to_string(idx));
+    }
+    policy.write(logging::debug::value, "test", "skipped");
+    policy.stop();
+
+    auto entries = target.entries();
+    ASSERT_EQ(50u, entries.size());
+    for (unsigned idx = 0; idx < 50; ++idx) { EXPECT_EQ(std::to_string(idx), entries[idx]); }
+    EXPECT_EQ(0u, policy.dropped());
+
+    policy.write(logging::info::value, "test", "after stop");
+    EXPECT_EQ("after stop", target.entries().back());
+}
+
+TEST(LoggingTest, asyncOverflow) {
+    auto target = RecordingPolicy();
+    auto policy = AsyncPolicy(target, 8);
+    target.setBlocked(true);
+    for (int idx = 0; idx < 20; ++idx) {
+        policy.write(logging::info::value, "test", std::to_string(idx));
+    }
+    EXPECT_EQ(12u, policy.dropped());   // slots are only freed once written
+    target.setBlocked(false);
+    policy.stop();
+
+    auto entries = target.entries();
+    ASSERT_EQ(9u, entries.size());
+    EXPECT_NE(entries.end(), std::find(entries.begin(), entries.end(), "12 log entries dropped"));
+    EXPECT_NE(entries.end(), std::find(entries.begin(), entries.end(), "7"));
+}
+
+TEST(LoggingTest, asyncOverflowKeepsErrors) {
+    auto target = RecordingPolicy();
+    auto policy = AsyncPolicy(target, 8);
+    target.setBlocked(true);
+    for (int idx = 0; idx < 20; ++idx) {
+        policy.write(logging::info::value, "test", std::to_string(idx));
+    }
+    // Buffer is full, error goes straight to target, which blocks its writer
+    auto writer = std::thread([&policy] { policy.write(logging::error::value, "test", "error"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    target.setBlocked(false);
+    writer.join();
+    policy.stop();
+
+    auto entries = target.entries();
+    EXPECT_EQ(12u, policy.dropped());
+    EXPECT_NE(entries.end(), std::find(entries.begin(), entries.end(), "error"));
+}
+
+TEST(LoggingTest, loggerPolicyCache) {
+    static auto logger = keyleds::logging::Logger("logging-test");
+    auto & config = logging::Configuration::instance();
+    auto first = RecordingPolicy();
+    auto second = RecordingPolicy();
+
+    config.setPolicy("logging-test", &first);
+    logger.print(logging::info::value, "one");
+    config.setPolicy("logging-test", &second);
+    logger.print(logging::info::value, "two");
+    config.setPolicy("logging-test", nullptr);
+
+    EXPECT_EQ(std::vector<std::string>{"one"}, first.entries());
+    EXPECT_EQ(std::vector<std::string>{"two"}, second.entries());
+    EXPECT_NE(&first, &logger.policy());
+}
@@ -0,0 +1,146 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/Configuration.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <regex>
+#include <sstream>
+
+using keyleds::service::Configuration;
+using string_map = std::vector<std::pair<std::string, std::string>>;
+
+namespace {
+
+const char baseConfig[] = R"(
+groups:
+    arrows: [left, right, up, down]
+effects:
+    first:
+        plugins:
+            - effect: fill
+              color: red
+    second:
+        groups:
+            wipe: [esc, home, end]
+        plugins:
+            - effect: breathe
+              color: green
+              period: 5000
+)";
+
+Configuration parse(const std::string & text)
+{
+    auto stream = std::istringstream(text);
+    return Configuration::parse(stream);
+}
+
+const Configuration::EffectGroup & group(const Configuration & conf, const std::string & name)
+{
+    auto it = std::find_if(conf.effectGroups.begin(), conf.effectGroups.end(),
+                           [&](const auto & item) { return item.name == name; });
+    if (it == conf.effectGroups.end()) { throw std::out_of_range(name); }
+    return *it;
+}
+
+}
+
+TEST(ConfigurationTest, sameEffectGroups) {
+    auto confA = parse(baseConfig);
+    auto confB = parse(baseConfig);
+    EXPECT_EQ(confA.keyGroups, confB.keyGroups);
+    EXPECT_EQ(group(confA, "first"), group(confB, "first"));
+    EXPECT_EQ(group(confA, "second"), group(confB, "second"));
+}
+
+TEST(ConfigurationTest, changedEffectGroup) {
+    auto text = std::string(baseConfig);
+    text.replace(text.find("period: 5000"), 12, "period: 4000");
+
+    auto confA = parse(baseConfig);
+    auto confB = parse(text);
+    EXPECT_EQ(group(confA, "first"), group(confB, "first"));
+    EXPECT_NE(group(confA, "second"), group(confB, "second"));
+}
+
+TEST(ConfigurationTest, changedGroupKeys) {
+    auto text = std::string(baseConfig);
+    text.replace(text.find("[esc, home, end]"), 16, "[esc, home]");
+
+    auto confA = parse(baseConfig);
+    auto confB = parse(text);
+    EXPECT_EQ(group(confA, "first"), group(confB, "first"));
+    EXPECT_NE(group(confA, "second"), group(confB, "second"));
+}
+
+TEST(ConfigurationTest, renderBudget) {
+    auto text = std::string(baseConfig);
+    text.replace(text.find("period: 5000"), 12, "period: 5000\n              render-budget: 3");
+
+    auto conf = parse(text);
+    EXPECT_EQ(std::chrono::microseconds(0), getRenderBudget(group(conf, "first").effects.at(0)));
+    EXPECT_EQ(std::chrono::microseconds(3000), getRenderBudget(group(conf, "second").effects.at(0)));
+}
+
+TEST(ConfigurationTest, renderScheduling) {
+    auto conf = parse(baseConfig);
+    EXPECT_TRUE(conf.skipMissedFrames);
+    EXPECT_EQ(0u, conf.renderPriority);
+    EXPECT_EQ(0, conf.renderNiceness);
+
+    conf = parse("missed-frames: restart\nrender-priority: 10\nrender-niceness: -5\n" +
+                 std::string(baseConfig));
+    EXPECT_FALSE(conf.skipMissedFrames);
+    EXPECT_EQ(10u, conf.renderPriority);
+    EXPECT_EQ(-5, conf.renderNiceness);
+
+    EXPECT_THROW(parse("missed-frames: drop\n"), Configuration::ParseError);
+    EXPECT_THROW(parse("render-priority: 100\n"), Configuration::ParseError);
+    EXPECT_THROW(parse("render-niceness: 20\n"), Configuration::ParseError);
+    EXPECT_THROW(parse("render-niceness: -x\n"), Configuration::ParseError);
+}
+
+TEST(ConfigurationTest, lookupMatchesRegex) {
+    const std::vector<std::string> patterns = {
+        "kate", "", "^$", ".*", ".*.*", "Gnome-terminal|konsole|XTerm", "^mpv$|vlc",
+        "firefox.*", ".*Kate", ".*mole.*", ".* [*] — Kate", "[Cc]hromium-browser",
+        ".*\\bmole\\b.*", "a|", "k.te", "kate\\.", "\\.*kate",
+    };
+    const std::vector<std::string> values = {
+        "", "kate", "Kate", "kate.", "konsole", "XTerm", "xterm", "mpv", "vlc", "mpvlc",
+        "firefox", "firefox - Mozilla", "Mozilla firefox", "my.Kate", "doc [*] — Kate",
+        "whack a mole", "molest", "Chromium-browser", "chromium-browser", "a",
+        "line\nbreak mole", "kate\n", "firefox\n",
+    };
+
+    for (const auto & pattern : patterns) {
+        auto lookup = Configuration::Profile::Lookup(string_map{{"key", pattern}});
+        auto regex = std::regex(pattern);
+        for (const auto & value : values) {
+            EXPECT_EQ(std::regex_match(value, regex), lookup.match({{"key", value}}))
+                << "pattern \"" << pattern << "\" against \"" << value << '"';
+        }
+    }
+}
+
+TEST(ConfigurationTest, lookupMultipleEntries) {
+    auto lookup = Configuration::Profile::Lookup(string_map{{"class", "[Kk]ate"}, {"title", ".*[*].*"}});
+    EXPECT_TRUE(lookup.match({{"title", "doc [*] — Kate"}, {"class", "kate"}}));
+    EXPECT_FALSE(lookup.match({{"title", "doc — Kate"}, {"class", "kate"}}));
+    EXPECT_FALSE(lookup.match({{"title", "doc [*] — Kate"}}));
+    EXPECT_TRUE(Configuration::Profile::Lookup(string_map{{"class", "^$"}}).match({}));
+}
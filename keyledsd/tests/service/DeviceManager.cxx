@@ -0,0 +1,236 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/DeviceManager.h"
+
+#include "config.h"
+#include "keyledsd/plugin/module.h"
+#include "keyledsd/tools/FileWatcher.h"
+#include "TestDevice.h"
+#include <gtest/gtest.h>
+#include <uv.h>
+#include <algorithm>
+#include <sstream>
+
+using keyleds::service::Configuration;
+using keyleds::service::DeviceManager;
+using keyleds::service::EffectManager;
+using keyleds::test::TestDevice;
+
+namespace {
+
+const char baseConfig[] = R"(
+effects:
+    first:
+        plugins:
+            - effect: test
+              color: red
+    second:
+        plugins:
+            - effect: test
+              color: green
+profiles:
+    __default__:
+        effects: [first, second]
+)";
+
+class TestEffect final : public keyleds::plugin::Effect
+{
+public:
+    void render(milliseconds, keyleds::RenderTarget &) override {}
+    void handleContextChange(const string_map &) override {}
+    void handleGenericEvent(const string_map &) override {}
+    void handleKeyEvent(const keyleds::KeyDatabase::Key &, bool) override {}
+};
+
+/// Creates test effects, counting them
+class TestPlugin final : public keyleds::plugin::Plugin
+{
+public:
+    keyleds::plugin::Effect * createEffect(const std::string & name,
+                                           keyleds::plugin::EffectService &) override
+    {
+        if (name != "test") { return nullptr; }
+        ++created;
+        ++alive;
+        return new TestEffect();
+    }
+    void destroyEffect(keyleds::plugin::Effect * effect, keyleds::plugin::EffectService &) override
+    {
+        --alive;
+        delete static_cast<TestEffect *>(effect);
+    }
+
+    unsigned created = 0;
+    unsigned alive = 0;
+};
+
+TestPlugin plugin;
+
+const keyleds::plugin::module_definition testModule = {
+    { KEYLEDSD_MODULE_SIGNATURE },
+    KEYLEDSD_ABI_VERSION, KEYLEDSD_VERSION_MAJOR, KEYLEDSD_VERSION_MINOR,
+    [](const keyleds::plugin::host_definition *) -> void * {
+        return static_cast<keyleds::plugin::Plugin *>(&plugin);
+    },
+    [](const keyleds::plugin::host_definition *, void *) { return true; }
+};
+
+Configuration parse(const std::string & text)
+{
+    auto stream = std::istringstream(text);
+    return Configuration::parse(stream);
+}
+
+class DeviceManagerTest : public ::testing::Test
+{
+protected:
+    DeviceManagerTest()
+    {
+        uv_loop_init(&m_loop);
+        m_fileWatcher = std::make_unique<keyleds::tools::FileWatcher>(m_loop);
+        m_effectManager.add("test", &testModule, nullptr);
+        plugin.created = plugin.alive = 0;
+    }
+    ~DeviceManagerTest() override
+    {
+        m_fileWatcher.reset();
+        uv_run(&m_loop, UV_RUN_DEFAULT);    // let closed handles cleanup
+        uv_loop_close(&m_loop);
+    }
+
+    std::unique_ptr<DeviceManager> makeManager(const Configuration & conf)
+    {
+        auto device = std::make_unique<TestDevice>(16);
+        auto keyDB = device->keyDatabase();
+        return std::make_unique<DeviceManager>(m_effectManager, *m_fileWatcher,
+                                               "/sys/test", "c33000000000", DeviceManager::dev_list{},
+                                               std::move(device), std::move(keyDB), &conf);
+    }
+
+    static const keyleds::plugin::Effect * effectOf(const DeviceManager & manager, const std::string & name)
+    {
+        const auto & groups = manager.effectGroups();
+        auto it = std::find_if(groups.begin(), groups.end(),
+                               [&](const auto & group) { return group.configuration.name == name; });
+        return it != groups.end() && !it->effects.empty() ? it->effects.front().get() : nullptr;
+    }
+
+private:
+    uv_loop_t       m_loop;
+    std::unique_ptr<keyleds::tools::FileWatcher> m_fileWatcher;
+    EffectManager   m_effectManager;
+};
+
+}
+
+TEST_F(DeviceManagerTest, reloadKeepsUnchangedGroups) {
+    auto text = std::string(baseConfig);
+    text.replace(text.find("green"), 5, "blue");
+    const auto confA = parse(baseConfig);
+    const auto confB = parse(text);
+
+    auto manager = makeManager(confA);
+    manager->setContext({});
+    ASSERT_EQ(2u, plugin.created);
+    const auto * first = effectOf(*manager, "first");
+    ASSERT_NE(nullptr, first);
+
+    manager->setConfiguration(&confB);
+    manager->setContext({});
+    EXPECT_EQ(first, effectOf(*manager, "first"));
+    EXPECT_NE(nullptr, effectOf(*manager, "second"));
+    EXPECT_EQ(3u, plugin.created);      // only second group was rebuilt
+    EXPECT_EQ(2u, plugin.alive);
+
+    manager->setConfiguration(&confB);
+    manager->setContext({});
+    EXPECT_EQ(3u, plugin.created);      // reloading same configuration keeps everything
+
+    manager.reset();
+    EXPECT_EQ(0u, plugin.alive);
+}
+
+TEST_F(DeviceManagerTest, reloadDropsAllOnGlobalChange) {
+    const auto confA = parse(baseConfig);
+    const auto confB = parse("groups:\n    arrows: [key0, key1]\n" + std::string(baseConfig));
+    const auto confC = parse("colors:\n    custom: 123456\n" + std::string(baseConfig));
+
+    auto manager = makeManager(confA);
+    manager->setContext({});
+    ASSERT_EQ(2u, plugin.created);
+
+    manager->setConfiguration(&confB);
+    manager->setContext({});
+    EXPECT_EQ(4u, plugin.created);      // key groups are visible to all effects
+    EXPECT_EQ(2u, plugin.alive);
+
+    manager->setConfiguration(&confC);
+    manager->setContext({});
+    EXPECT_EQ(6u, plugin.created);      // so are custom colors
+    EXPECT_EQ(2u, plugin.alive);
+}
+
+TEST_F(DeviceManagerTest, reloadClearsResolvedContexts) {
+    auto text = std::string(baseConfig);
+    text.replace(text.find("[first, second]"), 15, "[first]");
+    const auto confA = parse(text + "    editor:\n"
+                                    "        lookup: { class: kate }\n"
+                                    "        effects: [first]\n");
+    const auto confB = parse(text + "    editor:\n"
+                                    "        lookup: { class: kate }\n"
+                                    "        effects: [second]\n");
+    auto manager = makeManager(confA);
+
+    manager->setContext({{"class", "kate"}});
+    manager->setContext({});
+    EXPECT_EQ(2u, manager->resolvedContexts().size());
+    EXPECT_EQ(nullptr, effectOf(*manager, "second"));   // no profile uses it
+
+    manager->setConfiguration(&confB);
+    EXPECT_EQ(0u, manager->resolvedContexts().size());
+
+    manager->setContext({{"class", "kate"}});           // resolved against new configuration
+    EXPECT_EQ(1u, manager->resolvedContexts().size());
+    EXPECT_NE(nullptr, effectOf(*manager, "second"));
+}
+
+TEST(ResolvedContextCacheTest, evictsLeastRecentlyUsed) {
+    using keyleds::service::detail::ResolvedContextCache;
+    auto cache = ResolvedContextCache(16);
+    auto contextFor = [](unsigned idx) {
+        return ResolvedContextCache::string_map{{"class", std::to_string(idx)}};
+    };
+    const auto group = Configuration::EffectGroup{};
+
+    for (unsigned idx = 0; idx < cache.capacity(); ++idx) {
+        ASSERT_EQ(nullptr, cache.find(contextFor(idx)));
+        cache.insert(contextFor(idx), {});
+    }
+    EXPECT_EQ(16u, cache.size());
+    ASSERT_NE(nullptr, cache.find(contextFor(0)));      // makes it most recent
+
+    cache.insert(contextFor(16), {&group});
+    EXPECT_EQ(16u, cache.size());
+    EXPECT_EQ(nullptr, cache.find(contextFor(1)));      // least recently used was evicted
+    EXPECT_NE(nullptr, cache.find(contextFor(0)));
+    ASSERT_NE(nullptr, cache.find(contextFor(16)));
+    EXPECT_EQ(&group, cache.find(contextFor(16))->front());
+
+    cache.clear();
+    EXPECT_EQ(0u, cache.size());
+    EXPECT_EQ(nullptr, cache.find(contextFor(0)));
+}
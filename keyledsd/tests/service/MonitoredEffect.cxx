@@ -0,0 +1,185 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/MonitoredEffect.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using keyleds::RenderTarget;
+using keyleds::RGBAColor;
+using keyleds::service::MonitoredEffect;
+using keyleds::service::RenderTargetPool;
+using namespace std::literals::chrono_literals;
+
+namespace {
+
+class TestEffect final : public keyleds::plugin::Effect
+{
+public:
+    /// Paints its frame count into the first `keys` keys, all of them if zero
+    explicit TestEffect(std::chrono::milliseconds renderTime, std::size_t keys = 0)
+     : m_renderTime(renderTime), m_keys(keys) {}
+
+    unsigned rendered() const { return m_rendered; }
+    milliseconds elapsed() const { return m_elapsed; }
+
+    void render(milliseconds elapsed, RenderTarget & target) override
+    {
+        std::this_thread::sleep_for(m_renderTime);
+        ++m_rendered;
+        m_elapsed += elapsed;
+        auto end = m_keys > 0 ? target.begin() + m_keys : target.end();
+        std::fill(target.begin(), end, RGBAColor{uint8_t(m_rendered), 0, 0, 255});
+    }
+    void handleContextChange(const string_map &) override {}
+    void handleGenericEvent(const string_map &) override {}
+    void handleKeyEvent(const keyleds::KeyDatabase::Key &, bool) override {}
+
+private:
+    const std::chrono::milliseconds m_renderTime;
+    const std::size_t   m_keys;
+    unsigned            m_rendered = 0;
+    milliseconds        m_elapsed = milliseconds(0);
+};
+
+class BrightenEffect final : public keyleds::plugin::Effect
+{
+public:
+    /// Adds to the red channel of the first `keys` keys, reading what was drawn before it
+    BrightenEffect(std::chrono::milliseconds renderTime, std::size_t keys)
+     : m_renderTime(renderTime), m_keys(keys) {}
+
+    void render(milliseconds, RenderTarget & target) override
+    {
+        std::this_thread::sleep_for(m_renderTime);
+        std::for_each(target.begin(), target.begin() + m_keys, [](auto & color) { color.red += 10; });
+    }
+    void handleContextChange(const string_map &) override {}
+    void handleGenericEvent(const string_map &) override {}
+    void handleKeyEvent(const keyleds::KeyDatabase::Key &, bool) override {}
+
+private:
+    const std::chrono::milliseconds m_renderTime;
+    const std::size_t   m_keys;
+};
+
+}
+
+TEST(MonitoredEffectTest, statistics) {
+    auto pool = RenderTargetPool(10);
+    auto effect = TestEffect(0ms);
+    auto monitor = MonitoredEffect("test", effect, pool);
+    auto target = RenderTarget(10);
+
+    EXPECT_EQ(0u, monitor.statistics().frames);
+    for (unsigned idx = 0; idx < MonitoredEffect::sampleCount + 10; ++idx) {
+        monitor.render(std::chrono::duration<unsigned, std::milli>(16), target);
+    }
+
+    auto stats = monitor.statistics();
+    EXPECT_EQ(MonitoredEffect::sampleCount + 10, stats.frames);
+    EXPECT_EQ(effect.rendered(), stats.frames);
+    EXPECT_EQ(0u, stats.throttled);
+    EXPECT_EQ(0u, pool.statistics().inUse);     // no layer without a budget
+}
+
+TEST(MonitoredEffectTest, budget) {
+    auto pool = RenderTargetPool(10);
+    auto effect = TestEffect(5ms);
+    auto monitor = MonitoredEffect("test", effect, pool, 2ms);
+    auto target = RenderTarget(10);
+    auto frame = std::chrono::duration<unsigned, std::milli>(10);
+
+    monitor.render(frame, target);
+    ASSERT_EQ(1u, effect.rendered());
+    EXPECT_GE(monitor.statistics().lastRenderTime, 5ms);
+
+    // Effect spanned at least two budgets: it skips frames, its output is held
+    std::fill(target.begin(), target.end(), RGBAColor{0, 0, 0, 0});
+    monitor.render(frame, target);
+    EXPECT_EQ(1u, effect.rendered());
+    EXPECT_TRUE(std::all_of(target.begin(), target.end(),
+                            [](auto color) { return color == RGBAColor{1, 0, 0, 255}; }));
+
+    // Once it runs again, it gets time elapsed over skipped frames
+    for (unsigned idx = 0; idx < MonitoredEffect::maxSkippedFrames && effect.rendered() < 2; ++idx) {
+        monitor.render(frame, target);
+    }
+    ASSERT_EQ(2u, effect.rendered());
+    auto stats = monitor.statistics();
+    EXPECT_EQ(2u, stats.frames);
+    EXPECT_GE(stats.throttled, 2u);
+    EXPECT_GE(stats.p99RenderTime, 5ms);
+    EXPECT_EQ(effect.elapsed(), frame * (stats.frames + stats.throttled));
+}
+
+TEST(MonitoredEffectTest, budgetWithOtherEffects) {
+    auto pool = RenderTargetPool(10);
+    auto background = TestEffect(0ms);
+    auto slow = TestEffect(5ms, 4);
+    auto backgroundMonitor = MonitoredEffect("background", background, pool);
+    auto slowMonitor = MonitoredEffect("slow", slow, pool, 2ms);
+    auto target = RenderTarget(10);
+    auto frame = std::chrono::duration<unsigned, std::milli>(10);
+
+    auto renderFrame = [&] {
+        backgroundMonitor.render(frame, target);
+        slowMonitor.render(frame, target);
+    };
+    backgroundMonitor.render(frame, target);
+    renderFrame();
+    ASSERT_EQ(1u, slow.rendered());
+
+    // While slow effect skips frames, its output is kept over a live background
+    renderFrame();
+    ASSERT_EQ(1u, slow.rendered());
+    EXPECT_EQ(3u, background.rendered());
+    EXPECT_TRUE(std::all_of(target.begin(), target.begin() + 4,
+                            [](auto color) { return color == RGBAColor{1, 0, 0, 255}; }));
+    EXPECT_TRUE(std::all_of(target.begin() + 4, target.end(),
+                            [](auto color) { return color == RGBAColor{3, 0, 0, 255}; }));
+    EXPECT_EQ(1u, pool.statistics().inUse);
+}
+
+TEST(MonitoredEffectTest, budgetReadsTarget) {
+    auto pool = RenderTargetPool(10);
+    auto background = TestEffect(0ms);
+    auto brighten = BrightenEffect(5ms, 4);
+    auto backgroundMonitor = MonitoredEffect("background", background, pool);
+    auto brightenMonitor = MonitoredEffect("brighten", brighten, pool, 2ms);
+    auto target = RenderTarget(10);
+    auto frame = std::chrono::duration<unsigned, std::milli>(10);
+
+    // Effect draws over what is below it
+    backgroundMonitor.render(frame, target);
+    brightenMonitor.render(frame, target);
+    EXPECT_TRUE(std::all_of(target.begin(), target.begin() + 4,
+                            [](auto color) { return color == RGBAColor{11, 0, 0, 255}; }));
+    EXPECT_TRUE(std::all_of(target.begin() + 4, target.end(),
+                            [](auto color) { return color == RGBAColor{1, 0, 0, 255}; }));
+
+    // Skipped frame holds last output of changed keys only
+    backgroundMonitor.render(frame, target);
+    brightenMonitor.render(frame, target);
+    EXPECT_EQ(1u, brightenMonitor.statistics().frames);
+    EXPECT_TRUE(std::all_of(target.begin(), target.begin() + 4,
+                            [](auto color) { return color == RGBAColor{11, 0, 0, 255}; }));
+    EXPECT_TRUE(std::all_of(target.begin() + 4, target.end(),
+                            [](auto color) { return color == RGBAColor{2, 0, 0, 255}; }));
+}
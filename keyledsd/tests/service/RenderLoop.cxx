@@ -0,0 +1,130 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/RenderLoop.h"
+
+#include "TestDevice.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using keyleds::KeyDatabase;
+using keyleds::RenderTarget;
+using keyleds::service::RenderLoop;
+using keyleds::test::TestDevice;
+
+namespace {
+
+constexpr auto frame = std::chrono::duration<unsigned, std::milli>(16);
+
+/// Records key events it receives
+class EventEffect final : public keyleds::plugin::Effect
+{
+public:
+    using event_list = std::vector<std::pair<KeyDatabase::Key::index_type, bool>>;
+
+    const event_list & events() const { return m_events; }
+
+    void render(milliseconds, RenderTarget &) override {}
+    void handleContextChange(const string_map &) override {}
+    void handleGenericEvent(const string_map &) override {}
+    void handleKeyEvent(const KeyDatabase::Key & key, bool press) override
+        { m_events.emplace_back(key.index, press); }
+
+private:
+    event_list  m_events;
+};
+
+}
+
+TEST(RenderLoopTest, keyEventsInOrder) {
+    auto device = TestDevice(16);
+    auto keyDB = device.keyDatabase();
+    auto effect = EventEffect();
+    auto loop = RenderLoop(device, 60);
+    loop.setEffects({&effect}, {});
+
+    auto expected = EventEffect::event_list();
+    for (unsigned idx = 0; idx < 10; ++idx) {
+        loop.postKeyEvent(keyDB[idx], idx % 2 == 0);
+        expected.emplace_back(idx, idx % 2 == 0);
+    }
+    EXPECT_TRUE(effect.events().empty());       // delivered by the render thread only
+
+    loop.render(frame);
+    EXPECT_EQ(expected, effect.events());
+    loop.render(frame);
+    EXPECT_EQ(expected, effect.events());
+    EXPECT_EQ(0u, loop.droppedKeyEvents());
+}
+
+TEST(RenderLoopTest, keyEventsOverflow) {
+    auto device = TestDevice(16);
+    auto keyDB = device.keyDatabase();
+    auto effect = EventEffect();
+    auto loop = RenderLoop(device, 60);
+    loop.setEffects({&effect}, {});
+
+    for (unsigned idx = 0; idx < RenderLoop::keyEventCapacity + 10; ++idx) {
+        loop.postKeyEvent(keyDB[idx % keyDB.size()], true);
+    }
+    EXPECT_EQ(10u, loop.droppedKeyEvents());
+
+    // Oldest events are kept
+    loop.render(frame);
+    ASSERT_EQ(RenderLoop::keyEventCapacity, effect.events().size());
+    for (unsigned idx = 0; idx < RenderLoop::keyEventCapacity; ++idx) {
+        EXPECT_EQ(idx % keyDB.size(), effect.events()[idx].first);
+    }
+
+    // Queue has room again
+    loop.postKeyEvent(keyDB[0], false);
+    loop.render(frame);
+    EXPECT_EQ(RenderLoop::keyEventCapacity + 1, effect.events().size());
+    EXPECT_EQ(10u, loop.droppedKeyEvents());
+}
+
+TEST(RenderLoopTest, keyEventsAcrossThreads) {
+    constexpr unsigned eventCount = 100000;
+    auto device = TestDevice(64);
+    auto keyDB = device.keyDatabase();
+    auto effect = EventEffect();
+    auto loop = RenderLoop(device, 60);
+    loop.setEffects({&effect}, {});
+
+    // Drops are only counted by the producer, so it knows exactly which events were lost
+    auto expected = EventEffect::event_list();
+    auto done = std::atomic<bool>(false);
+    auto producer = std::thread([&] {
+        for (unsigned idx = 0; idx < eventCount; ++idx) {
+            auto dropped = loop.droppedKeyEvents();
+            loop.postKeyEvent(keyDB[idx % keyDB.size()], idx % 3 == 0);
+            if (loop.droppedKeyEvents() == dropped) {
+                expected.emplace_back(idx % keyDB.size(), idx % 3 == 0);
+            }
+        }
+        done = true;
+    });
+    while (!done) { loop.render(frame); }
+    producer.join();
+    loop.render(frame);
+
+    EXPECT_EQ(eventCount, effect.events().size() + loop.droppedKeyEvents());
+    EXPECT_EQ(expected, effect.events());
+}
@@ -0,0 +1,66 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/service/RenderTargetPool.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+
+using keyleds::RGBAColor;
+using keyleds::service::RenderTargetPool;
+
+TEST(RenderTargetPoolTest, recycle) {
+    auto pool = RenderTargetPool(10);
+    auto first = pool.acquire();
+    ASSERT_TRUE(first);
+    EXPECT_EQ(10u, first->size());
+    std::fill(first->begin(), first->end(), RGBAColor{1, 2, 3, 4});
+    auto * address = first.get();
+
+    pool.release(std::move(first));
+    auto second = pool.acquire();
+    EXPECT_EQ(address, second.get());
+    EXPECT_TRUE(std::all_of(second->begin(), second->end(),
+                            [](auto color) { return color == RGBAColor{0, 0, 0, 0}; }));
+
+    auto third = pool.acquire();
+    EXPECT_NE(address, third.get());
+
+    auto stats = pool.statistics();
+    EXPECT_EQ(2u, stats.allocations);
+    EXPECT_EQ(1u, stats.reuses);
+    EXPECT_EQ(2u, stats.inUse);
+    EXPECT_EQ(0u, stats.free);
+
+    pool.release(std::move(second));
+    pool.release(std::move(third));
+    EXPECT_EQ(0u, pool.statistics().inUse);
+    EXPECT_EQ(2u, pool.statistics().free);
+}
+
+TEST(RenderTargetPoolTest, maxFree) {
+    auto pool = RenderTargetPool(10, 2);
+    std::vector<RenderTargetPool::target_ptr> targets;
+    for (unsigned idx = 0; idx < 5; ++idx) { targets.push_back(pool.acquire()); }
+    for (auto & target : targets) { pool.release(std::move(target)); }
+
+    auto stats = pool.statistics();
+    EXPECT_EQ(5u, stats.allocations);
+    EXPECT_EQ(3u, stats.discards);
+    EXPECT_EQ(2u, stats.free);
+    EXPECT_EQ(0u, stats.inUse);
+}
@@ -0,0 +1,74 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_TESTS_SERVICE_TESTDEVICE_H_5B0E91C2
+#define KEYLEDSD_TESTS_SERVICE_TESTDEVICE_H_5B0E91C2
+
+#include "keyledsd/device/Device.h"
+#include "keyledsd/KeyDatabase.h"
+#include <string>
+#include <vector>
+
+namespace keyleds::test {
+
+/// Device with a single block of keys, that accepts and discards all updates
+class TestDevice final : public device::Device
+{
+public:
+    explicit TestDevice(unsigned keys, std::string path = "/dev/null")
+     : Device(std::move(path), Type::Keyboard, "test", "c33000000000", "0", "0", 2, makeBlocks(keys))
+    {}
+
+    bool        hasLayout() const override { return true; }
+    std::string resolveKey(key_block_id_type, key_id_type) const override { return {}; }
+    int         decodeKeyId(key_block_id_type, key_id_type id) const override { return id; }
+
+    void        setTimeout(unsigned) override {}
+    void        flush() override {}
+    bool        resync() noexcept override { return true; }
+    void        fillColor(const KeyBlock &, const RGBColor) override {}
+    void        setColors(const KeyBlock &, const ColorDirective[], size_type) override {}
+    void        getColors(const KeyBlock & block, ColorDirective colors[]) override
+    {
+        for (std::size_t idx = 0; idx < block.keys().size(); ++idx) { colors[idx] = {0, 0, 0, 0}; }
+    }
+    void        commitColors() override {}
+
+    /// Key database matching the device's keys, named key0, key1...
+    KeyDatabase keyDatabase() const
+    {
+        std::vector<KeyDatabase::Key> keys;
+        for (auto keyId : blocks().front().keys()) {
+            keys.push_back({KeyDatabase::Key::index_type(keys.size()), keyId,
+                            "key" + std::to_string(keyId), {0, 0, 0, 0}});
+        }
+        return KeyDatabase(std::move(keys));
+    }
+
+private:
+    static block_list makeBlocks(unsigned keys)
+    {
+        key_list ids;
+        for (unsigned idx = 0; idx < keys; ++idx) { ids.push_back(key_id_type(idx)); }
+        block_list blocks;
+        blocks.emplace_back(0, "keys", std::move(ids), RGBColor{255, 255, 255});
+        return blocks;
+    }
+};
+
+} // namespace keyleds::test
+
+#endif
@@ -0,0 +1,130 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/tools/AnimationExecutor.h"
+
+#include "keyledsd/tools/AnimationLoop.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using keyleds::tools::AnimationExecutor;
+using keyleds::tools::AnimationLoop;
+using namespace std::literals::chrono_literals;
+
+namespace {
+
+class TestLoop final : public AnimationLoop
+{
+public:
+    TestLoop(unsigned fps, std::chrono::milliseconds renderTime, unsigned maxFrames = 0)
+     : AnimationLoop(fps), m_renderTime(renderTime), m_maxFrames(maxFrames) {}
+
+    unsigned long rendered() const { return m_rendered.load(); }
+
+protected:
+    bool render(milliseconds) override
+    {
+        std::this_thread::sleep_for(m_renderTime);
+        auto count = ++m_rendered;
+        return m_maxFrames == 0 || count < m_maxFrames;
+    }
+
+private:
+    const std::chrono::milliseconds m_renderTime;
+    const unsigned                  m_maxFrames;
+    std::atomic<unsigned long>      m_rendered = 0;
+};
+
+}
+
+TEST(AnimationExecutorTest, align) {
+    using clock = std::chrono::steady_clock;
+    auto executor = AnimationExecutor(1);
+    auto period = std::chrono::duration_cast<clock::duration>(1s) / 60;
+
+    auto now = clock::now();
+    auto first = executor.align(now, period);
+    EXPECT_LE(now, first);
+    EXPECT_LT(first - now, period);
+    EXPECT_EQ(first, executor.align(first, period));
+    EXPECT_EQ(first + period, executor.align(first + 1ns, period));
+
+    auto later = executor.align(now + 123456789ns, period);
+    EXPECT_EQ(clock::duration::zero(), (later - first) % period);
+}
+
+TEST(AnimationExecutorTest, render) {
+    auto executor = AnimationExecutor(2);
+    auto loopA = TestLoop(100, 0ms);
+    auto loopB = TestLoop(100, 0ms);
+    loopA.start(&executor);
+    loopB.start(&executor);
+    loopA.setPaused(false);
+    std::this_thread::sleep_for(100ms);
+    loopB.setPaused(false);
+    std::this_thread::sleep_for(100ms);
+    loopA.stop();
+    loopB.stop();
+
+    EXPECT_GE(loopA.rendered(), 10u);
+    EXPECT_GE(loopB.rendered(), 5u);
+    EXPECT_EQ(loopA.rendered(), loopA.statistics().frames);
+}
+
+TEST(AnimationExecutorTest, stalledLoop) {
+    auto executor = AnimationExecutor(2);
+    auto stalled = TestLoop(100, 300ms);
+    auto healthy = TestLoop(100, 0ms);
+    stalled.start(&executor);
+    healthy.start(&executor);
+    stalled.setPaused(false);
+    healthy.setPaused(false);
+    std::this_thread::sleep_for(200ms);
+
+    // Stalled loop holds one worker, the other one keeps rendering
+    EXPECT_LE(stalled.rendered(), 1u);
+    EXPECT_GE(healthy.rendered(), 10u);
+
+    stalled.stop();     // waits for current frame to complete
+    healthy.stop();
+    EXPECT_GE(stalled.statistics().maxFrameTime, 300ms);
+}
+
+TEST(AnimationExecutorTest, finishedLoop) {
+    auto executor = AnimationExecutor(1);
+    auto loop = TestLoop(200, 1ms, 3);
+    loop.start(&executor);
+    loop.setPaused(false);
+    std::this_thread::sleep_for(100ms);
+    loop.stop();
+
+    auto stats = loop.statistics();
+    EXPECT_EQ(3u, loop.rendered());
+    EXPECT_EQ(2u, stats.frames);    // last render returned false
+    EXPECT_GE(stats.maxFrameTime, 1ms);
+    EXPECT_GE(stats.totalFrameTime, 3ms);
+}
+
+TEST(AnimationExecutorTest, zeroFrameRate) {
+    auto loop = TestLoop(0, 0ms);
+    EXPECT_EQ(1u, loop.frameRate());
+    loop.setFrameRate(30);
+    EXPECT_EQ(30u, loop.frameRate());
+    loop.setFrameRate(0);
+    EXPECT_EQ(1u, loop.frameRate());
+}
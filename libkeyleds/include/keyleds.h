@@ -37,11 +37,24 @@ typedef struct keyleds_device Keyleds;
 #define KEYLEDS_APP_ID_MAX  ((uint8_t)0xf)
 
 Keyleds * keyleds_open(const char * path, uint8_t app_id);
+Keyleds * keyleds_open_fd(int fd, const uint8_t * descriptor, unsigned descriptor_size,
+                          uint8_t app_id);
 void keyleds_close(Keyleds * device);
 void keyleds_set_timeout(Keyleds * device, unsigned us);
+void keyleds_set_pipeline_depth(Keyleds * device, unsigned depth);
+bool keyleds_set_nonblocking(Keyleds * device, bool enabled);
 int keyleds_device_fd(Keyleds * device);
 bool keyleds_flush_fd(Keyleds * device);
 
+struct keyleds_io_stats {
+    unsigned long   reads;      /* read() calls on device */
+    unsigned long   writes;     /* write() calls on device */
+    unsigned long   polls;      /* waits for device to become ready */
+    unsigned long   fcntls;     /* file descriptor mode changes */
+};
+void keyleds_get_io_stats(Keyleds * device, /*@out@*/ struct keyleds_io_stats * stats);
+void keyleds_reset_io_stats(Keyleds * device);
+
 /****************************************************************************/
 /* Basic device communication */
 
@@ -58,6 +71,26 @@ bool keyleds_ping(Keyleds * device, uint8_t target_id); /* re-sync with device a
 unsigned keyleds_get_feature_count(Keyleds * dev, uint8_t target_id);
 uint16_t keyleds_get_feature_id(Keyleds * dev, uint8_t target_id, uint8_t feature_idx);
 uint8_t keyleds_get_feature_index(Keyleds * dev, uint8_t target_id, uint16_t feature_id);
+void keyleds_invalidate_features(Keyleds * dev, uint8_t target_id);
+
+/****************************************************************************/
+/* Asynchronous communication */
+
+typedef struct keyleds_loop KeyledsLoop;
+
+typedef void (*keyleds_call_cb)(Keyleds * device, /*@null@*/ const uint8_t * data, size_t size,
+                                void * userdata);   /* data is NULL on failure */
+
+KeyledsLoop * keyleds_loop_new(void);
+void keyleds_loop_free(KeyledsLoop * loop);
+int keyleds_loop_fd(KeyledsLoop * loop);
+bool keyleds_loop_add(KeyledsLoop * loop, Keyleds * device);
+void keyleds_loop_remove(KeyledsLoop * loop, Keyleds * device);
+int keyleds_loop_dispatch(KeyledsLoop * loop, int timeout_ms);
+bool keyleds_call_async(Keyleds * device, uint8_t target_id, uint16_t feature_id,
+                        uint8_t function, size_t length, /*@null@*/ const uint8_t * data,
+                        keyleds_call_cb callback, void * userdata);
+unsigned keyleds_pending_calls(Keyleds * device);
 
 /****************************************************************************/
 /* Device information */
@@ -28,23 +28,52 @@ struct keyleds_device_reports {
 
 struct keyleds_device_feature {
     uint16_t    id;                             /* feature identifier from features.h */
-    uint8_t     target_id;                      /* target device for feature */
-    uint8_t     index;                          /* position of feature */
     bool        reserved:1;
     bool        hidden:1;
     bool        obsolete:1;
 };
 
+#define KEYLEDS_FEATURE_TABLE_HASH_SIZE (512)   /* power of two, at least twice max index */
+#define KEYLEDS_FEATURE_TABLES          (9)     /* targets 0 to 7, then default target */
+
+struct keyleds_feature_table {
+    bool        valid;                          /* false until loaded, or after a resync */
+    uint8_t     count;                          /* number of features, excluding root */
+    struct keyleds_device_feature by_index[UINT8_MAX + 1];  /* entry 0 (root) is unused */
+    uint8_t     by_id[KEYLEDS_FEATURE_TABLE_HASH_SIZE];     /* hashed feature id => index,
+                                                             * 0 marks an empty slot */
+};
+
+#define KEYLEDS_PENDING_CALLS_MAX       (16)    /* max asynchronous calls per device */
+
+struct keyleds_pending_call {
+    keyleds_call_cb callback;                   /* invoked on completion */
+    void *      userdata;                       /* passed to callback */
+    uint64_t    deadline;                       /* monotonic time in ns, 0 for none */
+    uint8_t     target_id;                      /* where the call was sent */
+    uint8_t     feature_idx;
+    uint8_t     function;
+};
+
 struct keyleds_device {
     int         fd;                             /* device file descriptor */
     uint8_t     app_id;                         /* our application identifier */
     uint8_t     ping_seq;                       /* using for resyncing after errors */
     unsigned    timeout;                        /* read timeout in microseconds */
+    unsigned    pipeline_depth;                 /* max unacknowledged reports in bulk writes */
+    bool        nonblocking;                    /* fd is kept in non-blocking mode */
+    struct keyleds_io_stats io_stats;           /* system call counters */
 
     struct keyleds_device_reports * reports;    /* list of device-supported hid reports */
     unsigned    max_report_size;                /* maximum number of bytes in a report */
 
-    struct keyleds_device_feature * features;   /* feature index cache */
+    struct keyleds_feature_table * features[KEYLEDS_FEATURE_TABLES]; /* feature index tables,
+                                                                      * allocated on first use */
+
+    struct keyleds_loop * loop;                 /* event loop device is attached to, if any */
+    struct keyleds_pending_call pending[KEYLEDS_PENDING_CALLS_MAX]; /* async calls, ring buffer */
+    unsigned    pending_first;                  /* oldest pending call */
+    unsigned    pending_nb;                     /* number of pending calls */
 
     keyleds_gkeys_cb gkeys_cb;                  /* callback to invoke on gkey presses */
     void *      userdata;                       /* for library user */
@@ -58,10 +87,21 @@ bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
                   uint8_t function, size_t length, const uint8_t * data);
 bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
                      uint8_t * message, size_t * size);
+bool keyleds_receive_ack(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
+                         uint8_t function);
 ssize_t keyleds_call(Keyleds * device, /*@null@*/ /*@out@*/ uint8_t * result, size_t result_len,
                      uint8_t target_id, uint16_t feature_id, uint8_t function,
                      size_t length, const uint8_t * data);
 
+bool keyleds_load_features(Keyleds * device, uint8_t target_id);
+uint8_t keyleds_peek_feature_index(const Keyleds * device, uint8_t target_id, uint16_t feature_id);
+
+uint64_t keyleds_now(void);
+uint64_t keyleds_deadline(const Keyleds * device);
+size_t keyleds_report_size(const Keyleds * device, uint8_t report_id);
+bool keyleds_report_matches(const Keyleds * device, const uint8_t * message,
+                            uint8_t target_id, uint8_t feature_idx);
+
 void keyleds_gkeys_filter(Keyleds * device, uint8_t buffer[], ssize_t buflen);
 
 /****************************************************************************/
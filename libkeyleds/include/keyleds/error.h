@@ -23,4 +23,11 @@ void keyleds_set_error_errno(void);
 void keyleds_set_error_hidpp(uint8_t code);
 void keyleds_set_error(keyleds_error_t err);
 
+struct keyleds_error_state {
+    keyleds_error_t code;
+    int             saved_errno;
+};
+void keyleds_save_error(/*@out@*/ struct keyleds_error_state * state);
+void keyleds_restore_error(const struct keyleds_error_state * state);
+
 #endif
@@ -20,10 +20,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <linux/hidraw.h>
+#include <poll.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
 
 #include "config.h"
 #include "keyleds.h"
@@ -49,40 +50,83 @@
  */
 KEYLEDS_EXPORT Keyleds * keyleds_open(const char * path, uint8_t app_id)
 {
-    Keyleds * dev = malloc(sizeof(Keyleds));
     struct hidraw_report_descriptor descriptor;
-    unsigned version;
-
-    dev->app_id = app_id;
-    do { dev->ping_seq = (uint8_t)rand(); } while (dev->ping_seq == 0);
-    dev->timeout = KEYLEDS_CALL_TIMEOUT_US;
-    dev->gkeys_cb = NULL;
-    dev->userdata = NULL;
+    Keyleds * dev;
+    int fd;
 
     /* Open device */
     KEYLEDS_LOG(DEBUG, "Opening device %s", path);
-    if ((dev->fd = open(path, O_RDWR)) < 0) {
+    if ((fd = open(path, O_RDWR)) < 0) {
         keyleds_set_error_errno();
-        goto error_free_dev;
+        return NULL;
     }
-    fcntl(dev->fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
 
     /* Read REPORT descriptor */
-    if (ioctl(dev->fd, HIDIOCGRDESCSIZE, &descriptor.size) < 0) {
+    if (ioctl(fd, HIDIOCGRDESCSIZE, &descriptor.size) < 0) {
         keyleds_set_error_errno();
-        goto error_close_fd;
+        close(fd);
+        return NULL;
     }
-    if (ioctl(dev->fd, HIDIOCGRDESC, &descriptor) < 0) {
+    if (ioctl(fd, HIDIOCGRDESC, &descriptor) < 0) {
+        keyleds_set_error_errno();
+        close(fd);
+        return NULL;
+    }
+
+    if ((dev = keyleds_open_fd(fd, descriptor.value, descriptor.size, app_id)) == NULL) {
+        return NULL;
+    }
+    KEYLEDS_LOG(INFO, "Opened device %s", path);
+    return dev;
+}
+
+/** Open a device from an already open file descriptor.
+ * Does the same as keyleds_open(), using the given report descriptor instead of querying
+ * the device node for it. This allows talking to endpoints that are not hidraw nodes,
+ * such as a simulated device on one end of a socket pair.
+ * @param fd File descriptor to communicate through. It must preserve report boundaries.
+ *           The device takes ownership of it, even on failure.
+ * @param descriptor HID report descriptor of the device.
+ * @param descriptor_size Size of `descriptor`, in bytes.
+ * @param app_id Application identifier to use for all communication with the device.
+ * @return Opaque pointer representing the device, or `NULL` on failure, in which case
+ *         the error can be retrieved with keyleds_get_errno().
+ * @sa keyleds_open
+ */
+KEYLEDS_EXPORT Keyleds * keyleds_open_fd(int fd, const uint8_t * descriptor,
+                                         unsigned descriptor_size, uint8_t app_id)
+{
+    Keyleds * dev = malloc(sizeof(Keyleds));
+    unsigned version;
+
+    assert(fd >= 0);
+    assert(descriptor != NULL);
+
+    if (dev == NULL) {
         keyleds_set_error_errno();
         goto error_close_fd;
     }
-    KEYLEDS_LOG(DEBUG, "Parsing report descriptor (%d bytes)", descriptor.size);
+    dev->fd = fd;
+    dev->app_id = app_id;
+    do { dev->ping_seq = (uint8_t)rand(); } while (dev->ping_seq == 0);
+    dev->timeout = KEYLEDS_CALL_TIMEOUT_US;
+    dev->pipeline_depth = 1;
+    dev->nonblocking = false;
+    memset(&dev->io_stats, 0, sizeof(dev->io_stats));
+    dev->loop = NULL;
+    dev->pending_first = 0;
+    dev->pending_nb = 0;
+    for (unsigned idx = 0; idx < KEYLEDS_FEATURE_TABLES; idx += 1) { dev->features[idx] = NULL; }
+    dev->gkeys_cb = NULL;
+    dev->userdata = NULL;
 
     /* Parse report descriptor */
-    if (!keyleds_parse_hid(descriptor.value, descriptor.size,
+    KEYLEDS_LOG(DEBUG, "Parsing report descriptor (%d bytes)", descriptor_size);
+    if (!keyleds_parse_hid(descriptor, descriptor_size,
                            &dev->reports, &dev->max_report_size)) {
         keyleds_set_error(KEYLEDS_ERROR_HIDREPORT);
-        goto error_close_fd;
+        goto error_free_dev;
     }
     if (dev->max_report_size == 0) {
         keyleds_set_error(KEYLEDS_ERROR_HIDNOPP);
@@ -104,19 +148,22 @@ KEYLEDS_EXPORT Keyleds * keyleds_open(const char * path, uint8_t app_id)
         goto error_free_reports;
     }
 
-    /* Setup feature table cache */
-    dev->features = malloc(sizeof(struct keyleds_device_feature));
-    dev->features[0].id = 0;
+    /* Load feature table, so calls never have to look features up */
+    if (!keyleds_load_features(dev, KEYLEDS_TARGET_DEFAULT)) {
+        goto error_free_features;
+    }
 
-    KEYLEDS_LOG(INFO, "Opened device %s protocol version %d", path, version);
+    KEYLEDS_LOG(DEBUG, "Device on fd %d has protocol version %d", fd, version);
     return dev;
 
+error_free_features:
+    for (unsigned idx = 0; idx < KEYLEDS_FEATURE_TABLES; idx += 1) { free(dev->features[idx]); }
 error_free_reports:
     free(dev->reports);
-error_close_fd:
-    close(dev->fd);
 error_free_dev:
     free(dev);
+error_close_fd:
+    close(fd);
     return NULL;
 }
 
@@ -127,9 +174,10 @@ error_free_dev:
 KEYLEDS_EXPORT void keyleds_close(Keyleds * device)
 {
     assert(device != NULL);
+    if (device->loop != NULL) { keyleds_loop_remove(device->loop, device); }
     close(device->fd);
     free(device->reports);
-    free(device->features);
+    for (unsigned idx = 0; idx < KEYLEDS_FEATURE_TABLES; idx += 1) { free(device->features[idx]); }
     free(device);
 }
 
@@ -143,6 +191,46 @@ KEYLEDS_EXPORT void keyleds_set_timeout(Keyleds * device, unsigned us)
     device->timeout = us;
 }
 
+/** Set how many reports bulk writes may queue before waiting for acknowledgements.
+ * Functions that split their payload across several reports, such as keyleds_set_leds(),
+ * normally wait for the device to acknowledge each report before sending the next one.
+ * With a depth greater than 1, they send up to `depth` reports back to back, collecting
+ * acknowledgements as the window fills up.
+ * @param device Open device as returned by keyleds_open().
+ * @param depth Maximum number of unacknowledged reports. 0 and 1 disable pipelining.
+ *              Values above KEYLEDS_PIPELINE_DEPTH_MAX are clamped.
+ */
+KEYLEDS_EXPORT void keyleds_set_pipeline_depth(Keyleds * device, unsigned depth)
+{
+    assert(device != NULL);
+    if (depth == 0) { depth = 1; }
+    if (depth > KEYLEDS_PIPELINE_DEPTH_MAX) { depth = KEYLEDS_PIPELINE_DEPTH_MAX; }
+    device->pipeline_depth = depth;
+}
+
+/** Set whether the device file descriptor is kept in non-blocking mode.
+ * In non-blocking mode, the mode is set once and for all, and reads wait for reports
+ * using poll(). Otherwise, keyleds_flush_fd() must switch modes back and forth on
+ * every call, which costs two extra system calls each time.
+ * @param device Open device as returned by keyleds_open().
+ * @param enabled `true` to keep the descriptor non-blocking.
+ * @return `true` on success, `false` on error.
+ */
+KEYLEDS_EXPORT bool keyleds_set_nonblocking(Keyleds * device, bool enabled)
+{
+    assert(device != NULL);
+    int flags;
+
+    device->io_stats.fcntls += 2;
+    if ((flags = fcntl(device->fd, F_GETFL)) < 0 ||
+        fcntl(device->fd, F_SETFL, enabled ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0) {
+        keyleds_set_error_errno();
+        return false;
+    }
+    device->nonblocking = enabled;
+    return true;
+}
+
 /** Get underlying device file descriptor.
  * @param device Open device as returned by keyleds_open().
  */
@@ -164,18 +252,143 @@ KEYLEDS_EXPORT bool keyleds_flush_fd(Keyleds * device)
     uint8_t buffer[device->max_report_size + 1];
     ssize_t nread;
 
-    fcntl(device->fd, F_SETFL, O_NONBLOCK);
-    while ((nread = read(device->fd, buffer, device->max_report_size + 1)) > 0) {
-        keyleds_gkeys_filter(device, buffer, nread);
+    if (!device->nonblocking) {
+        device->io_stats.fcntls += 1;
+        fcntl(device->fd, F_SETFL, O_NONBLOCK);
     }
+    do {
+        device->io_stats.reads += 1;
+        if ((nread = read(device->fd, buffer, device->max_report_size + 1)) > 0) {
+            keyleds_gkeys_filter(device, buffer, nread);
+        }
+    } while (nread > 0);
     if (errno != EAGAIN) {
         keyleds_set_error_errno();
         return false;
     }
-    fcntl(device->fd, F_SETFL, 0);
+    if (!device->nonblocking) {
+        device->io_stats.fcntls += 1;
+        fcntl(device->fd, F_SETFL, 0);
+    }
     return true;
 }
 
+/** Read system call counters.
+ * Counters accumulate from device opening or last call to keyleds_reset_io_stats(),
+ * they are meant for debugging and measuring communication overhead.
+ * @param device Open device as returned by keyleds_open().
+ * @param [out] stats Current counter values.
+ */
+KEYLEDS_EXPORT void keyleds_get_io_stats(Keyleds * device, struct keyleds_io_stats * stats)
+{
+    assert(device != NULL);
+    assert(stats != NULL);
+    *stats = device->io_stats;
+}
+
+/** Reset system call counters.
+ * @param device Open device as returned by keyleds_open().
+ */
+KEYLEDS_EXPORT void keyleds_reset_io_stats(Keyleds * device)
+{
+    assert(device != NULL);
+    memset(&device->io_stats, 0, sizeof(device->io_stats));
+}
+
+/** Current time, for computing deadlines.
+ * @return Monotonic time in nanoseconds.
+ */
+uint64_t keyleds_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+}
+
+/** Deadline for a reply to a report sent now.
+ * @param device Open device as returned by keyleds_open().
+ * @return Monotonic time in nanoseconds, or 0 if device has no timeout.
+ */
+uint64_t keyleds_deadline(const Keyleds * device)
+{
+    if (device->timeout == 0) { return 0; }
+    return keyleds_now() + (uint64_t)device->timeout * UINT64_C(1000);
+}
+
+/** Wait for the device to become ready.
+ * @param device Open device as returned by keyleds_open().
+ * @param events Either `POLLIN` or `POLLOUT`.
+ * @param deadline When to give up, as returned by keyleds_deadline(). 0 waits forever.
+ * @return `true` once device is ready, `false` on error or timeout.
+ */
+static bool keyleds_wait(Keyleds * device, short events, uint64_t deadline)
+{
+    struct pollfd pfd = { .fd = device->fd, .events = events, .revents = 0 };
+    int err;
+
+    do {
+        int timeout = -1;
+        if (deadline != 0) {
+            uint64_t now = keyleds_now();
+            if (now >= deadline) {
+                KEYLEDS_LOG(INFO, "Device timeout while waiting on fd %d", device->fd);
+                keyleds_set_error(KEYLEDS_ERROR_TIMEDOUT);
+                return false;
+            }
+            /* Round up, waking up early would only cost another poll */
+            timeout = (int)((deadline - now + 999999) / 1000000);
+        }
+        device->io_stats.polls += 1;
+        err = poll(&pfd, 1, timeout);
+    } while (err == 0 || (err < 0 && errno == EINTR));
+
+    if (err < 0) {
+        keyleds_set_error_errno();
+        return false;
+    }
+    return true;
+}
+
+/** Expected size of reports of a given type.
+ * @param device Open device as returned by keyleds_open().
+ * @param report_id First byte of the report.
+ * @return Size of the report, not counting its identifier, or 0 if it is not
+ *         an HID++ report.
+ */
+size_t keyleds_report_size(const Keyleds * device, uint8_t report_id)
+{
+    for (unsigned idx = 0; device->reports[idx].id != DEVICE_REPORT_INVALID; idx += 1) {
+        if (device->reports[idx].id == report_id) { return device->reports[idx].size; }
+    }
+    return 0;
+}
+
+/** Check whether a report is a reply to us.
+ * @param device Open device as returned by keyleds_open().
+ * @param message A valid HID++ report.
+ * @param target_id The device's target identifier the request was sent to.
+ * @param feature_idx Address of the feature the request was sent to.
+ * @return `true` if report is the reply or an error reply for given feature.
+ */
+bool keyleds_report_matches(const Keyleds * device, const uint8_t * message,
+                            uint8_t target_id, uint8_t feature_idx)
+{
+    return message[1] == target_id && (             /* message is from this device */
+        (
+            message[2] == feature_idx &&            /* message is for correct feature */
+            (message[3] & 0xf) == device->app_id    /* message is for our application */
+        ) || (
+            message[2] == 0xff &&                   /* message is an error */
+            message[3] == feature_idx &&            /* message if for correct feature */
+            (message[4] & 0xf) == device->app_id    /* message is for our application */
+        ) || (                                          /* special handling for getprotocol */
+            message[2] == 0x8f &&                       /* message is HIDPP1 error */
+            message[3] == KEYLEDS_FEATURE_IDX_ROOT &&   /* feature is root feature */
+            (message[4] & 0xf) == device->app_id        /* message is for our application */
+        )
+    );
+}
+
 /****************************************************************************/
 
 #ifndef NDEBUG
@@ -233,7 +446,15 @@ bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
 #endif
 
     /* Send the report to the device */
-    ssize_t nwritten = write(device->fd, buffer, 1 + report_size);
+    uint64_t deadline = keyleds_deadline(device);
+    ssize_t nwritten;
+    for (;;) {
+        device->io_stats.writes += 1;
+        if ((nwritten = write(device->fd, buffer, 1 + report_size)) >= 0 || errno != EAGAIN) {
+            break;
+        }
+        if (!keyleds_wait(device, POLLOUT, deadline)) { return false; }
+    }
     if (nwritten < 0) {
         keyleds_set_error_errno();
         return false;
@@ -258,43 +479,37 @@ bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
  *                      hold `device->max_report_size + 1` bytes.
  * @param [out] size The number of bytes actually written into `message`. May be NULL.
  * @return `true` on success, `false` on failure.
- * @bug Timeout countdown restarts everytime a report is received.
  */
 bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
                      uint8_t * message, size_t * size)
 {
-    int err, idx;
     ssize_t nread;
+    bool ready = false;     /* whether a report is likely queued already */
 
     assert(device != NULL);
     assert(message != NULL);
 
-    do {
-        /* If a timeout is defined, use select() call to wakeup even if no report comes */
-        if (device->timeout > 0) {
-            fd_set set;
-            struct timeval timeout;
-
-            FD_ZERO(&set);
-            FD_SET(device->fd, &set);
-            timeout.tv_sec = KEYLEDS_CALL_TIMEOUT_US / 1000000;
-            timeout.tv_usec = KEYLEDS_CALL_TIMEOUT_US % 1000000;
-            if ((err = select(device->fd + 1, &set, NULL, NULL, &timeout)) < 0) {
-                keyleds_set_error_errno();
-                return false;
-            }
-            if (err == 0) {
-                KEYLEDS_LOG(INFO, "Device timeout while reading fd %d", device->fd);
-                keyleds_set_error(KEYLEDS_ERROR_TIMEDOUT);
-                return false;
-            }
+    /* Timeout covers the whole exchange, including reports we skip */
+    const uint64_t deadline = keyleds_deadline(device);
+
+    for (;;) {
+        /* Wait for a report, unless the descriptor is non-blocking and a report
+         * was just received, in which case more are likely queued already */
+        if (!ready && (device->nonblocking || deadline != 0)) {
+            if (!keyleds_wait(device, POLLIN, deadline)) { return false; }
         }
 
         /* Read a report from the device */
+        device->io_stats.reads += 1;
         if ((nread = read(device->fd, message, device->max_report_size + 1)) < 0) {
+            if (errno == EAGAIN && device->nonblocking) {
+                ready = false;
+                continue;
+            }
             keyleds_set_error_errno();
             return false;
         }
+        ready = device->nonblocking;
 #ifndef NDEBUG
         if (g_keyleds_debug_level >= KEYLEDS_LOG_DEBUG) {
             char debug_buffer[3 * nread + 1];
@@ -303,14 +518,11 @@ bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
         }
 #endif
         /* Check the received report type against our known report types */
-        for (idx = 0; device->reports[idx].id != DEVICE_REPORT_INVALID; idx += 1)
-        {
-            if (device->reports[idx].id == message[0]) { break; }
-        }
-        if (device->reports[idx].id == DEVICE_REPORT_INVALID) { continue; }
+        size_t report_size = keyleds_report_size(device, message[0]);
+        if (report_size == 0) { continue; }
 
         /* Double-check that received report matches the expected size */
-        if (nread != 1 + device->reports[idx].size) {
+        if ((size_t)nread != 1 + report_size) {
             KEYLEDS_LOG(DEBUG, "Unexpected read size %zd on fd %d", nread, device->fd);
             keyleds_set_error(KEYLEDS_ERROR_IO_LENGTH);
             return false;
@@ -318,21 +530,8 @@ bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
 
         keyleds_gkeys_filter(device, message, nread);
 
-    } while(!(
-        message[1] == target_id && (                /* message is from this device */
-        (
-            message[2] == feature_idx &&            /* message is for correct feature */
-            (message[3] & 0xf) == device->app_id    /* message is for our application */
-        ) || (
-            message[2] == 0xff &&                   /* message is an error */
-            message[3] == feature_idx &&            /* message if for correct feature */
-            (message[4] & 0xf) == device->app_id    /* message is for our application */
-        ) || (                                          /* special handling for getprotocol */
-            message[2] == 0x8f &&                       /* message is HIDPP1 error */
-            message[3] == KEYLEDS_FEATURE_IDX_ROOT &&   /* feature is root feature */
-            (message[4] & 0xf) == device->app_id        /* message is for our application */
-        )
-    )));
+        if (keyleds_report_matches(device, message, target_id, feature_idx)) { break; }
+    }
     /* All good, we got a valid report */
 
     if (message[2] == 0xff) {
@@ -346,6 +545,30 @@ bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
 }
 
 
+/** Wait for the acknowledgement of a function call.
+ * Works like keyleds_receive(), but also matches the function code of the reply,
+ * discarding replies to other functions of the same feature. This allows sending
+ * several reports with keyleds_send() before collecting their replies, in order.
+ * @param device Open device as returned by keyleds_open().
+ * @param target_id Device's target identifier. See keyleds_receive().
+ * @param feature_idx Address of the feature the report was sent to.
+ * @param function Code of the function the report invoked.
+ * @return `true` on success, `false` on failure, including an error reply from the device.
+ */
+bool keyleds_receive_ack(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
+                         uint8_t function)
+{
+    assert(device != NULL);
+    assert(function <= 0xf);
+
+    uint8_t buffer[1 + device->max_report_size];
+    do {
+        if (!keyleds_receive(device, target_id, feature_idx, buffer, NULL)) { return false; }
+    } while ((buffer[3] >> 4) != function);
+    return true;
+}
+
+
 /** Call a function on the device.
  * Send a report to the device, request a function to be run and wait for the result.
  * This is a wrapper for the most common use of keyleds_send() and keyleds_receive().
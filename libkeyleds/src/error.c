@@ -129,3 +129,26 @@ void keyleds_set_error(keyleds_error_t err)
     keyleds_errno = err;
     KEYLEDS_LOG(DEBUG, "%s", error_strings[err]);
 }
+
+
+/** Save current error condition.
+ * Lets cleanup code that calls into the library report the original error.
+ * @param [out] state Where to save the error condition.
+ */
+void keyleds_save_error(struct keyleds_error_state * state)
+{
+    assert(state != NULL);
+    state->code = keyleds_errno;
+    state->saved_errno = keyleds_saved_errno;
+}
+
+
+/** Restore an error condition saved with keyleds_save_error().
+ * @param state Saved error condition.
+ */
+void keyleds_restore_error(const struct keyleds_error_state * state)
+{
+    assert(state != NULL);
+    keyleds_errno = state->code;
+    keyleds_saved_errno = state->saved_errno;
+}
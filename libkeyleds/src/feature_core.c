@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "config.h"
 #include "keyleds.h"
@@ -35,6 +36,68 @@ enum feature_feature_function { /* Function table for KEYLEDS_FEATURE_FEATURE */
 };
 
 
+/** Feature table slot for a target.
+ * @return Slot number, or KEYLEDS_FEATURE_TABLES if target cannot have a table.
+ */
+static unsigned feature_table_slot(uint8_t target_id)
+{
+    if (target_id == KEYLEDS_TARGET_DEFAULT) { return KEYLEDS_FEATURE_TABLES - 1; }
+    if (target_id < KEYLEDS_FEATURE_TABLES - 1) { return target_id; }
+    return KEYLEDS_FEATURE_TABLES;
+}
+
+/** Get the feature table of a target, allocating it if needed.
+ * @return Feature table, possibly not loaded yet, or `NULL` if target cannot have one.
+ */
+static struct keyleds_feature_table * feature_table(Keyleds * device, uint8_t target_id)
+{
+    unsigned slot = feature_table_slot(target_id);
+    if (slot >= KEYLEDS_FEATURE_TABLES) { return NULL; }
+    if (device->features[slot] == NULL) {
+        device->features[slot] = calloc(1, sizeof(*device->features[slot]));
+    }
+    return device->features[slot];  /* on allocation failure, just run without a table */
+}
+
+/** Hash a feature identifier into a feature table slot (fibonacci hashing). */
+static inline unsigned feature_hash(uint16_t feature_id)
+{
+    return ((feature_id * 40503u) & 0xffffu) >> 7;
+}
+
+/** Find the index of a feature in a feature table, or 0 if it is not there. */
+static uint8_t table_find(const struct keyleds_feature_table * table, uint16_t feature_id)
+{
+    /* Linear probing, the table is at most half full so this ends quickly */
+    unsigned slot = feature_hash(feature_id);
+    uint8_t feature_idx;
+    while ((feature_idx = table->by_id[slot]) != 0 &&
+           table->by_index[feature_idx].id != feature_id) {
+        slot = (slot + 1) & (KEYLEDS_FEATURE_TABLE_HASH_SIZE - 1);
+    }
+    return feature_idx;
+}
+
+/** Query the identifier of the feature at given index from the device. */
+static bool query_feature_id(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
+                             /*@out@*/ struct keyleds_device_feature * feature)
+{
+    uint8_t data[3];
+    if (keyleds_call(device, data, sizeof(data),
+                     target_id, KEYLEDS_FEATURE_FEATURE, F_GET_FEATURE_ID,
+                     1, (uint8_t[]){feature_idx}) < 0) {
+        KEYLEDS_LOG(ERROR, "get_feature_id failed");
+        return false;
+    }
+    feature->id = (uint16_t)((data[0] << 8) | data[1]);
+    feature->reserved = (data[2] & (1<<5)) != 0;
+    feature->hidden = (data[2] & (1<<6)) != 0;
+    feature->obsolete = (data[2] & (1<<7)) != 0;
+    KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]", feature->id, feature_idx, data[2]);
+    return true;
+}
+
+
 /** Retrieve device protocol version and recommended use.
  * @param device Open device as returned by keyleds_open().
  * @param target_id Device's target identifier. See keyleds_open().
@@ -80,6 +143,9 @@ KEYLEDS_EXPORT bool keyleds_get_protocol(struct keyleds_device * device, uint8_t
  */
 KEYLEDS_EXPORT bool keyleds_ping(Keyleds * device, uint8_t target_id)
 {
+    /* Device may have been reset or replaced, feature indices are not reliable anymore */
+    keyleds_invalidate_features(device, target_id);
+
     /* Increment ping sequence number, wrapping within range [1..255] */
     uint8_t payload = device->ping_seq;
     device->ping_seq = (uint8_t)(payload == UINT8_MAX ? 1 : payload + 1);
@@ -107,6 +173,14 @@ KEYLEDS_EXPORT bool keyleds_ping(Keyleds * device, uint8_t target_id)
  */
 KEYLEDS_EXPORT unsigned keyleds_get_feature_count(struct keyleds_device * device, uint8_t target_id)
 {
+    assert(device != NULL);
+
+    struct keyleds_feature_table * table = feature_table(device, target_id);
+    if (table != NULL) {
+        if (!table->valid && !keyleds_load_features(device, target_id)) { return 0; }
+        return table->count;
+    }
+
     uint8_t data[1];
     if (keyleds_call(device, data, sizeof(data),
                      target_id, KEYLEDS_FEATURE_FEATURE, F_GET_FEATURE_COUNT, 0, NULL) < 0) {
@@ -129,42 +203,22 @@ KEYLEDS_EXPORT uint16_t keyleds_get_feature_id(struct keyleds_device * device,
     assert(device != NULL);
     assert(feature_idx != KEYLEDS_FEATURE_IDX_ROOT);
 
-    size_t idx;
-    uint16_t feature_id;
-    uint8_t data[3];
-
     /* This one is hardcoded at a specific slot */
     if (feature_idx == KEYLEDS_FEATURE_IDX_FEATURE) { return KEYLEDS_FEATURE_FEATURE; }
 
-    /* See whether we have it cached alread */
-    for (idx = 0; device->features[idx].id != 0; idx += 1) {
-        if (device->features[idx].target_id == target_id &&
-            device->features[idx].index == feature_idx) {
-            return device->features[idx].id;
+    struct keyleds_feature_table * table = feature_table(device, target_id);
+    if (table != NULL) {
+        if (!table->valid && !keyleds_load_features(device, target_id)) { return 0; }
+        if (feature_idx > table->count) {
+            keyleds_set_error(KEYLEDS_ERROR_FEATURE_NOT_FOUND);
+            return 0;
         }
+        return table->by_index[feature_idx].id;
     }
 
-    /* Nope, request it */
-    if (keyleds_call(device, data, sizeof(data),
-                     target_id, KEYLEDS_FEATURE_FEATURE, F_GET_FEATURE_ID,
-                     1, (uint8_t[]){feature_idx}) < 0) {
-        KEYLEDS_LOG(ERROR, "get_feature_id failed");
-        return 0;
-    }
-
-    /* Add it to the cache for next time */
-    feature_id = (uint16_t)((data[0] << 8) | data[1]);
-    device->features = realloc(device->features, (idx + 2) * sizeof(device->features[0]));
-    device->features[idx].target_id = target_id;
-    device->features[idx].id = feature_id;
-    device->features[idx].index = feature_idx;
-    device->features[idx].reserved = (data[2] & (1<<5)) != 0;
-    device->features[idx].hidden = (data[2] & (1<<6)) != 0;
-    device->features[idx].obsolete = (data[2] & (1<<7)) != 0;
-    device->features[idx + 1].id = 0;
-    KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]",
-                       feature_id, feature_idx, data[2]);
-    return feature_id;
+    struct keyleds_device_feature feature;
+    if (!query_feature_id(device, target_id, feature_idx, &feature)) { return 0; }
+    return feature.id;
 }
 
 
@@ -181,49 +235,106 @@ KEYLEDS_EXPORT uint8_t keyleds_get_feature_index(struct keyleds_device * device,
     assert(device != NULL);
     assert(feature_id != KEYLEDS_FEATURE_ROOT);
 
-    size_t idx;
-    uint8_t feature_idx;
-    uint8_t data[2];
-
     /* This one is hardcoded at a specific slot */
     if (feature_id == KEYLEDS_FEATURE_FEATURE) { return KEYLEDS_FEATURE_IDX_FEATURE; }
 
-    /* See whether we have it cached already */
-    for (idx = 0; device->features[idx].id != 0; idx += 1) {
-        if (device->features[idx].target_id == target_id &&
-            device->features[idx].id == feature_id) {
-            feature_idx = device->features[idx].index;
-            if (feature_idx == 0) { keyleds_set_error(KEYLEDS_ERROR_FEATURE_NOT_FOUND); }
-            return feature_idx;
+    uint8_t feature_idx;
+    struct keyleds_feature_table * table = feature_table(device, target_id);
+    if (table != NULL) {
+        if (!table->valid && !keyleds_load_features(device, target_id)) { return 0; }
+        feature_idx = table_find(table, feature_id);
+    } else {
+        /* Target has no table, ask the device every time */
+        uint8_t data[2];
+        if (keyleds_call(device, data, sizeof(data),
+                         target_id, KEYLEDS_FEATURE_ROOT, F_GET_FEATURE,
+                         2, (uint8_t[]){(uint8_t)(feature_id >> 8), (uint8_t)feature_id}) < 0) {
+            KEYLEDS_LOG(ERROR, "get_feature_index failed");
+            return 0;
         }
+        feature_idx = data[0];
     }
 
-    /* Nope, request it */
-    if (keyleds_call(device, data, sizeof(data),
-                     target_id, KEYLEDS_FEATURE_ROOT, F_GET_FEATURE,
-                     2, (uint8_t[]){(uint8_t)(feature_id >> 8), (uint8_t)feature_id}) < 0) {
-        KEYLEDS_LOG(ERROR, "get_feature_index failed");
-        return 0;
+    if (feature_idx == 0) {
+        keyleds_set_error(KEYLEDS_ERROR_FEATURE_NOT_FOUND);
+        KEYLEDS_LOG(DEBUG, "feature %04x unavailable", feature_id);
     }
+    return feature_idx;
+}
 
-    feature_idx = data[0];
 
-    /* Add it to the cache for next time */
-    device->features = realloc(device->features, (idx + 2) * sizeof(device->features[0]));
-    device->features[idx].target_id = target_id;
-    device->features[idx].id = feature_id;
-    device->features[idx].index = feature_idx;
-    device->features[idx].reserved = (data[1] & (1<<5)) != 0;
-    device->features[idx].hidden = (data[1] & (1<<6)) != 0;
-    device->features[idx].obsolete = (data[1] & (1<<7)) != 0;
-    device->features[idx + 1].id = 0;
+/** Load the feature table of a target.
+ * Enumerates all features of the target in one pass, so that further lookups
+ * never have to query the device.
+ * @param device Open device as returned by keyleds_open().
+ * @param target_id Device's target identifier. See keyleds_open().
+ * @return `true` on success, `false` on error. Targets without a table always succeed.
+ */
+bool keyleds_load_features(Keyleds * device, uint8_t target_id)
+{
+    assert(device != NULL);
 
-    if (feature_idx == 0) {
-        keyleds_set_error(KEYLEDS_ERROR_FEATURE_NOT_FOUND);
-        KEYLEDS_LOG(DEBUG, "feature %04x unavailable", feature_id);
-    } else {
-        KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]", feature_id, feature_idx, data[1]);
+    struct keyleds_feature_table * table = feature_table(device, target_id);
+    if (table == NULL) { return true; }
+
+    /* Build the table aside, so reports received meanwhile can still use the old one */
+    struct keyleds_feature_table loaded;
+    uint8_t data[1];
+    if (keyleds_call(device, data, sizeof(data),
+                     target_id, KEYLEDS_FEATURE_FEATURE, F_GET_FEATURE_COUNT, 0, NULL) < 0) {
+        KEYLEDS_LOG(ERROR, "get_feature_count failed");
+        return false;
     }
+    loaded.count = data[0];
 
-    return feature_idx;
+    memset(loaded.by_id, 0, sizeof(loaded.by_id));
+    loaded.by_index[KEYLEDS_FEATURE_IDX_ROOT].id = KEYLEDS_FEATURE_ROOT;
+    for (unsigned idx = 1; idx <= loaded.count; idx += 1) {
+        struct keyleds_device_feature * feature = &loaded.by_index[idx];
+        if (!query_feature_id(device, target_id, (uint8_t)idx, feature)) { return false; }
+
+        unsigned slot = feature_hash(feature->id);
+        while (loaded.by_id[slot] != 0) {
+            slot = (slot + 1) & (KEYLEDS_FEATURE_TABLE_HASH_SIZE - 1);
+        }
+        loaded.by_id[slot] = (uint8_t)idx;
+    }
+
+    loaded.valid = true;
+    *table = loaded;
+    KEYLEDS_LOG(DEBUG, "loaded %u features for target %02x", loaded.count, target_id);
+    return true;
+}
+
+
+/** Get the feature slot index for a feature identifier, without talking to the device.
+ * For use while receiving reports, where calling the device is not possible. Uses
+ * the feature table even if it was invalidated.
+ * @param device Open device as returned by keyleds_open().
+ * @param target_id Device's target identifier. See keyleds_open().
+ * @param feature_id Identifier of the feature, from one of the `KEYLEDS_FEATURE_*` values.
+ * @return Feature slot index, or 0 if not known.
+ */
+uint8_t keyleds_peek_feature_index(const Keyleds * device, uint8_t target_id, uint16_t feature_id)
+{
+    assert(device != NULL);
+    unsigned slot = feature_table_slot(target_id);
+    if (slot >= KEYLEDS_FEATURE_TABLES || device->features[slot] == NULL) { return 0; }
+    return table_find(device->features[slot], feature_id);
+}
+
+
+/** Forget the feature table of a target.
+ * It will be loaded again from the device on next use. This happens automatically
+ * when resynchronizing with keyleds_ping().
+ * @param device Open device as returned by keyleds_open().
+ * @param target_id Device's target identifier. See keyleds_open().
+ */
+KEYLEDS_EXPORT void keyleds_invalidate_features(Keyleds * device, uint8_t target_id)
+{
+    assert(device != NULL);
+    unsigned slot = feature_table_slot(target_id);
+    if (slot < KEYLEDS_FEATURE_TABLES && device->features[slot] != NULL) {
+        device->features[slot]->valid = false;
+    }
 }
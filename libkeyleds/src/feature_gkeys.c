@@ -141,11 +141,13 @@ void keyleds_gkeys_filter(Keyleds * device, uint8_t message[], ssize_t buflen)
     uint8_t feature_idx = message[2];
     keyleds_gkeys_type_t key_type;
 
-    if (feature_idx == keyleds_get_feature_index(device, target_id, KEYLEDS_FEATURE_GKEYS)) {
+    if (feature_idx == KEYLEDS_FEATURE_IDX_ROOT) {
+        return;
+    } else if (feature_idx == keyleds_peek_feature_index(device, target_id, KEYLEDS_FEATURE_GKEYS)) {
         key_type = KEYLEDS_GKEYS_GKEY;
-    } else if (feature_idx == keyleds_get_feature_index(device, target_id, KEYLEDS_FEATURE_MKEYS)) {
+    } else if (feature_idx == keyleds_peek_feature_index(device, target_id, KEYLEDS_FEATURE_MKEYS)) {
         key_type = KEYLEDS_GKEYS_MKEY;
-    } else if (feature_idx == keyleds_get_feature_index(device, target_id, KEYLEDS_FEATURE_MRKEYS)) {
+    } else if (feature_idx == keyleds_peek_feature_index(device, target_id, KEYLEDS_FEATURE_MRKEYS)) {
         key_type = KEYLEDS_GKEYS_MRKEY;
     } else {
         return;
@@ -156,6 +156,26 @@ KEYLEDS_EXPORT bool keyleds_get_leds(Keyleds * device, uint8_t target_id,
 }
 
 
+/** Collect acknowledgements left in flight by a failed keyleds_set_leds().
+ * Otherwise, they would be mistaken for replies to later calls. Error replies
+ * are skipped, other errors stop collection, as remaining acknowledgements
+ * would not arrive either. The error the caller is about to report is kept.
+ */
+static void drain_acks(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
+                       unsigned count)
+{
+    struct keyleds_error_state error;
+    keyleds_save_error(&error);
+    for (; count > 0; count -= 1) {
+        if (!keyleds_receive_ack(device, target_id, feature_idx, F_SET_LEDS) &&
+            keyleds_get_errno() != KEYLEDS_ERROR_DEVICE) {
+            break;
+        }
+    }
+    keyleds_restore_error(&error);
+}
+
+
 /** Set the color of a set of LEDs.
  * Updates an internal buffer on the device. Actual lights are not updated until
  * keyleds_commit_leds() is called.
@@ -176,13 +196,18 @@ KEYLEDS_EXPORT bool keyleds_set_leds(Keyleds * device, uint8_t target_id,
     assert(keys_nb <= UINT16_MAX);
 
     unsigned per_call = (device->max_report_size - 3 - 4) / 4;  /* 4 bytes per key, mins headers */
+    unsigned window = device->pipeline_depth > 0 ? device->pipeline_depth : 1;
+    unsigned inflight = 0;
     unsigned offset, idx;
 
+    uint8_t feature_idx = keyleds_get_feature_index(device, target_id, KEYLEDS_FEATURE_LEDS);
+    if (feature_idx == 0) { return false; }
+
     uint8_t data[4 + per_call * 4];
     data[0] = (uint8_t)(block_id >> 8);
     data[1] = (uint8_t)(block_id >> 0);
 
-    /* Send keys in chunks */
+    /* Send keys in chunks, keeping at most window reports unacknowledged */
     for (offset = 0; offset < keys_nb; offset += per_call) {
         unsigned batch_length = offset + per_call > keys_nb ? keys_nb - offset : per_call;
         data[2] = (uint8_t)(batch_length >> 8);
@@ -194,9 +219,26 @@ KEYLEDS_EXPORT bool keyleds_set_leds(Keyleds * device, uint8_t target_id,
             data[4 + idx * 4 + 3] = keys[offset + idx].blue;
         }
 
-        if (keyleds_call(device, NULL, 0,
-                         target_id, KEYLEDS_FEATURE_LEDS, F_SET_LEDS,
-                         4 + batch_length * 4, data) < 0) {
+        if (inflight == window) {
+            inflight -= 1;      /* failure consumes the reply, if any */
+            if (!keyleds_receive_ack(device, target_id, feature_idx, F_SET_LEDS)) {
+                drain_acks(device, target_id, feature_idx, inflight);
+                return false;
+            }
+        }
+        if (!keyleds_send(device, target_id, feature_idx, F_SET_LEDS,
+                          4 + batch_length * 4, data)) {
+            drain_acks(device, target_id, feature_idx, inflight);
+            return false;
+        }
+        inflight += 1;
+    }
+
+    /* Collect remaining acknowledgements */
+    while (inflight > 0) {
+        inflight -= 1;
+        if (!keyleds_receive_ack(device, target_id, feature_idx, F_SET_LEDS)) {
+            drain_acks(device, target_id, feature_idx, inflight);
             return false;
         }
     }
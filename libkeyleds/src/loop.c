@@ -0,0 +1,450 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "config.h"
+#include "keyleds.h"
+#include "keyleds/device.h"
+#include "keyleds/error.h"
+#include "keyleds/features.h"
+#include "keyleds/logging.h"
+
+#define LOOP_MAX_EVENTS (16)            /* epoll events handled per wait */
+
+struct keyleds_loop {
+    int         epoll_fd;               /* multiplexes devices and timer */
+    int         timer_fd;               /* fires on earliest call deadline */
+    uint64_t    timer_deadline;         /* deadline timer is armed for, 0 if disarmed */
+    Keyleds **  devices;                /* attached devices */
+    unsigned    devices_nb;
+};
+
+/****************************************************************************/
+/* Pending call queue */
+
+static struct keyleds_pending_call * pending_head(Keyleds * device)
+{
+    return device->pending_nb > 0 ? &device->pending[device->pending_first] : NULL;
+}
+
+static struct keyleds_pending_call pending_pop(Keyleds * device)
+{
+    struct keyleds_pending_call call = device->pending[device->pending_first];
+    device->pending_first = (device->pending_first + 1) % KEYLEDS_PENDING_CALLS_MAX;
+    device->pending_nb -= 1;
+    return call;
+}
+
+/** Fail all pending calls of a device.
+ * @param device Device to fail calls of.
+ * @param err System error code to report to callbacks.
+ * @return Number of calls that were completed.
+ */
+static int fail_calls(Keyleds * device, int err)
+{
+    int completed = 0;
+    while (device->pending_nb > 0) {
+        struct keyleds_pending_call call = pending_pop(device);
+        errno = err;
+        keyleds_set_error_errno();
+        call.callback(device, NULL, 0, call.userdata);
+        completed += 1;
+    }
+    return completed;
+}
+
+/** Arm loop timer on the earliest deadline of all pending calls.
+ * @return `true` on success, `false` on error.
+ */
+static bool arm_timer(KeyledsLoop * loop)
+{
+    uint64_t deadline = 0;
+    for (unsigned idx = 0; idx < loop->devices_nb; idx += 1) {
+        const Keyleds * device = loop->devices[idx];
+        for (unsigned pos = 0; pos < device->pending_nb; pos += 1) {
+            uint64_t call_deadline =
+                device->pending[(device->pending_first + pos) % KEYLEDS_PENDING_CALLS_MAX].deadline;
+            if (call_deadline != 0 && (deadline == 0 || call_deadline < deadline)) {
+                deadline = call_deadline;
+            }
+        }
+    }
+    if (deadline == loop->timer_deadline) { return true; }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));     /* zero value disarms the timer */
+    spec.it_value.tv_sec = (time_t)(deadline / UINT64_C(1000000000));
+    spec.it_value.tv_nsec = (long)(deadline % UINT64_C(1000000000));
+    if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        keyleds_set_error_errno();
+        return false;
+    }
+    loop->timer_deadline = deadline;
+    return true;
+}
+
+/** Stop watching a device, leaving its pending calls alone. */
+static void detach(KeyledsLoop * loop, Keyleds * device)
+{
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+    for (unsigned idx = 0; idx < loop->devices_nb; idx += 1) {
+        if (loop->devices[idx] == device) {
+            loop->devices[idx] = loop->devices[loop->devices_nb - 1];
+            loop->devices_nb -= 1;
+            break;
+        }
+    }
+    device->loop = NULL;
+}
+
+/****************************************************************************/
+/* Dispatching */
+
+/** Read all queued reports of a device, completing matching calls.
+ * @return Number of calls that were completed, or -1 if device failed.
+ */
+static int service_device(Keyleds * device)
+{
+    uint8_t buffer[1 + device->max_report_size];
+    ssize_t nread;
+    int completed = 0;
+
+    for (;;) {
+        device->io_stats.reads += 1;
+        if ((nread = read(device->fd, buffer, device->max_report_size + 1)) <= 0) {
+            if (nread < 0 && errno == EAGAIN) { break; }
+            if (nread == 0) { errno = ENODEV; }
+            return -1;
+        }
+
+        size_t report_size = keyleds_report_size(device, buffer[0]);
+        if (report_size == 0) { continue; }
+        if ((size_t)nread != 1 + report_size) {
+            KEYLEDS_LOG(DEBUG, "Unexpected read size %zd on fd %d", nread, device->fd);
+            continue;
+        }
+
+        keyleds_gkeys_filter(device, buffer, nread);
+
+        /* Devices reply in order, so only the oldest call can match */
+        const struct keyleds_pending_call * head = pending_head(device);
+        if (head == NULL ||
+            !keyleds_report_matches(device, buffer, head->target_id, head->feature_idx)) {
+            continue;
+        }
+        const bool is_error = buffer[2] == 0xff || buffer[2] == 0x8f;
+        if ((buffer[is_error ? 4 : 3] >> 4) != head->function) { continue; }
+
+        struct keyleds_pending_call call = pending_pop(device);
+        if (is_error) {
+            keyleds_set_error_hidpp(buffer[5]);
+            call.callback(device, NULL, 0, call.userdata);
+        } else {
+            const uint8_t * data = keyleds_response_data(device, buffer);
+            call.callback(device, data, (size_t)nread - (size_t)(data - buffer), call.userdata);
+        }
+        completed += 1;
+    }
+    return completed;
+}
+
+/** Fail pending calls whose deadline has passed.
+ * @return Number of calls that were completed.
+ */
+static int expire_calls(KeyledsLoop * loop)
+{
+    const uint64_t now = keyleds_now();
+    int completed = 0;
+
+    for (unsigned idx = 0; idx < loop->devices_nb; idx += 1) {
+        Keyleds * device = loop->devices[idx];
+        const struct keyleds_pending_call * head;
+        while ((head = pending_head(device)) != NULL &&
+               head->deadline != 0 && head->deadline <= now) {
+            struct keyleds_pending_call call = pending_pop(device);
+            KEYLEDS_LOG(INFO, "Device timeout while waiting on fd %d", device->fd);
+            keyleds_set_error(KEYLEDS_ERROR_TIMEDOUT);
+            call.callback(device, NULL, 0, call.userdata);
+            completed += 1;
+        }
+    }
+    return completed;
+}
+
+/****************************************************************************/
+/* Public API */
+
+/** Create an event loop.
+ * An event loop services several devices from a single thread, using asynchronous
+ * calls (see keyleds_call_async()). It can either be run directly, by invoking
+ * keyleds_loop_dispatch() repeatedly, or integrated into another event loop by
+ * watching the descriptor returned by keyleds_loop_fd().
+ * @return New event loop, or `NULL` on error.
+ */
+KEYLEDS_EXPORT KeyledsLoop * keyleds_loop_new(void)
+{
+    KeyledsLoop * loop = malloc(sizeof(*loop));
+    if (loop == NULL) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    loop->timer_deadline = 0;
+    loop->devices = NULL;
+    loop->devices_nb = 0;
+
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        keyleds_set_error_errno();
+        goto error_free_loop;
+    }
+    if ((loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        keyleds_set_error_errno();
+        goto error_close_epoll;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data = { .ptr = NULL } };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->timer_fd, &event) < 0) {
+        keyleds_set_error_errno();
+        goto error_close_timer;
+    }
+    return loop;
+
+error_close_timer:
+    close(loop->timer_fd);
+error_close_epoll:
+    close(loop->epoll_fd);
+error_free_loop:
+    free(loop);
+    return NULL;
+}
+
+/** Destroy an event loop.
+ * Attached devices are removed from the loop, and their pending calls fail.
+ * @param loop Event loop returned by keyleds_loop_new().
+ */
+KEYLEDS_EXPORT void keyleds_loop_free(KeyledsLoop * loop)
+{
+    assert(loop != NULL);
+    while (loop->devices_nb > 0) {
+        keyleds_loop_remove(loop, loop->devices[loop->devices_nb - 1]);
+    }
+    close(loop->timer_fd);
+    close(loop->epoll_fd);
+    free(loop->devices);
+    free(loop);
+}
+
+/** Get a file descriptor for integrating the loop into another event loop.
+ * The descriptor becomes readable whenever keyleds_loop_dispatch() has work to do.
+ * @param loop Event loop returned by keyleds_loop_new().
+ * @return File descriptor. It belongs to the loop and must not be closed.
+ */
+KEYLEDS_EXPORT int keyleds_loop_fd(KeyledsLoop * loop)
+{
+    assert(loop != NULL);
+    return loop->epoll_fd;
+}
+
+/** Attach a device to an event loop.
+ * This makes the device descriptor non-blocking. Reports it sends are read by the
+ * loop, and gkey callbacks are invoked from keyleds_loop_dispatch().
+ * Synchronous functions can still be used on the device, as long as it has no
+ * asynchronous calls pending.
+ * @param loop Event loop returned by keyleds_loop_new().
+ * @param device Open device as returned by keyleds_open(). It must not be attached
+ *               to another loop.
+ * @return `true` on success, `false` on error.
+ */
+KEYLEDS_EXPORT bool keyleds_loop_add(KeyledsLoop * loop, Keyleds * device)
+{
+    assert(loop != NULL);
+    assert(device != NULL);
+
+    if (device->loop != NULL) {
+        keyleds_set_error(KEYLEDS_ERROR_INVAL);
+        return false;
+    }
+    if (!keyleds_set_nonblocking(device, true)) { return false; }
+
+    Keyleds ** devices = realloc(loop->devices, (loop->devices_nb + 1) * sizeof(*devices));
+    if (devices == NULL) {
+        keyleds_set_error_errno();
+        return false;
+    }
+    loop->devices = devices;
+
+    struct epoll_event event = { .events = EPOLLIN, .data = { .ptr = device } };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, device->fd, &event) < 0) {
+        keyleds_set_error_errno();
+        return false;
+    }
+    loop->devices[loop->devices_nb] = device;
+    loop->devices_nb += 1;
+    device->loop = loop;
+    return true;
+}
+
+/** Detach a device from an event loop.
+ * Pending calls of the device fail with `ECANCELED`. The device is left in
+ * non-blocking mode. Closing a device detaches it automatically.
+ * @param loop Event loop returned by keyleds_loop_new().
+ * @param device Device attached to the loop with keyleds_loop_add().
+ */
+KEYLEDS_EXPORT void keyleds_loop_remove(KeyledsLoop * loop, Keyleds * device)
+{
+    assert(loop != NULL);
+    assert(device != NULL);
+    assert(device->loop == loop);
+
+    detach(loop, device);
+    fail_calls(device, ECANCELED);
+    arm_timer(loop);
+}
+
+/** Run one iteration of the event loop.
+ * Waits for at least one device to send a report or for a call to time out, then
+ * invokes callbacks for all completed calls. Callbacks may start new calls, but
+ * must not close devices or remove them from the loop.
+ * A device whose descriptor fails is removed from the loop, failing its pending calls.
+ * @param loop Event loop returned by keyleds_loop_new().
+ * @param timeout_ms Maximum time to wait for something to happen. 0 does not wait,
+ *                   which is what integration into another event loop needs. -1
+ *                   waits forever.
+ * @return Number of completed calls, or -1 on error.
+ */
+KEYLEDS_EXPORT int keyleds_loop_dispatch(KeyledsLoop * loop, int timeout_ms)
+{
+    assert(loop != NULL);
+
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    int nevents, completed = 0;
+
+    if ((nevents = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, timeout_ms)) < 0) {
+        if (errno == EINTR) { return 0; }
+        keyleds_set_error_errno();
+        return -1;
+    }
+
+    for (int idx = 0; idx < nevents; idx += 1) {
+        Keyleds * device = events[idx].data.ptr;
+        if (device == NULL) {
+            /* Acknowledge timer, expired calls are handled below */
+            uint64_t expirations;
+            if (read(loop->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                keyleds_set_error_errno();
+                return -1;
+            }
+            loop->timer_deadline = 0;
+            continue;
+        }
+        int result = service_device(device);
+        if (result < 0) {
+            int err = errno;
+            KEYLEDS_LOG(WARNING, "Removing failed device on fd %d from loop", device->fd);
+            detach(loop, device);
+            result = fail_calls(device, err);
+        }
+        completed += result;
+    }
+    completed += expire_calls(loop);
+
+    if (!arm_timer(loop)) { return -1; }
+    return completed;
+}
+
+/** Call a function on a device, without waiting for the result.
+ * Sends the request and returns immediately. The callback is invoked from
+ * keyleds_loop_dispatch() when the reply arrives, when the device reports an
+ * error, or when the timeout set with keyleds_set_timeout() expires. On failure,
+ * the callback receives `NULL` data and keyleds_get_errno() tells the reason.
+ * @param device Open device, attached to a loop with keyleds_loop_add().
+ * @param target_id Device's target identifier. See keyleds_open().
+ * @param feature_id Identifier of the feature to call.
+ * @param function Code of the function. Meaning depends on specific feature.
+ * @param length Size of the payload, pointed to by `data`.
+ * @param [in] data Payload to send in report. Unused if `length` is 0.
+ * @param callback Function to invoke on completion.
+ * @param userdata Passed to `callback`.
+ * @return `true` if request was sent, `false` on error, in which case callback
+ *         will not be invoked. Error is `EAGAIN` when too many calls are pending.
+ */
+KEYLEDS_EXPORT bool keyleds_call_async(Keyleds * device, uint8_t target_id, uint16_t feature_id,
+                                       uint8_t function, size_t length, const uint8_t * data,
+                                       keyleds_call_cb callback, void * userdata)
+{
+    assert(device != NULL);
+    assert(function <= 0xf);
+    assert(callback != NULL);
+
+    if (device->loop == NULL) {
+        keyleds_set_error(KEYLEDS_ERROR_INVAL);
+        return false;
+    }
+    if (device->pending_nb == KEYLEDS_PENDING_CALLS_MAX) {
+        errno = EAGAIN;
+        keyleds_set_error_errno();
+        return false;
+    }
+
+    /* Resolve feature code into feature index. Reloading the feature table would
+     * consume replies to pending calls, use the current one in that case. */
+    uint8_t feature_idx;
+    if (feature_id == KEYLEDS_FEATURE_ROOT) {
+        feature_idx = KEYLEDS_FEATURE_IDX_ROOT;
+    } else if (device->pending_nb > 0) {
+        feature_idx = keyleds_peek_feature_index(device, target_id, feature_id);
+        if (feature_idx == 0) {
+            keyleds_set_error(KEYLEDS_ERROR_FEATURE_NOT_FOUND);
+            return false;
+        }
+    } else {
+        feature_idx = keyleds_get_feature_index(device, target_id, feature_id);
+        if (feature_idx == 0) { return false; }
+    }
+
+    if (!keyleds_send(device, target_id, feature_idx, function, length, data)) { return false; }
+
+    struct keyleds_pending_call * call =
+        &device->pending[(device->pending_first + device->pending_nb) % KEYLEDS_PENDING_CALLS_MAX];
+    call->callback = callback;
+    call->userdata = userdata;
+    call->deadline = keyleds_deadline(device);
+    call->target_id = target_id;
+    call->feature_idx = feature_idx;
+    call->function = function;
+    device->pending_nb += 1;
+
+    if (!arm_timer(device->loop)) {
+        KEYLEDS_LOG(ERROR, "Could not arm timer: %s", keyleds_get_error_str());
+    }
+    return true;
+}
+
+/** Get the number of asynchronous calls waiting for a reply.
+ * @param device Open device as returned by keyleds_open().
+ */
+KEYLEDS_EXPORT unsigned keyleds_pending_calls(Keyleds * device)
+{
+    assert(device != NULL);
+    return device->pending_nb;
+}
@@ -0,0 +1,248 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <string>
+
+#include "keyleds.h"
+#include "simulator.h"
+extern "C" {
+#include "keyleds/features.h"
+}
+
+static constexpr uint8_t appId = 0x4;
+
+
+TEST(DeviceTest, open) {
+    auto sim = keyleds_sim_new(nullptr);
+    auto device = keyleds_sim_open(sim, appId);
+    ASSERT_NE(nullptr, device);
+
+    unsigned version;
+    EXPECT_TRUE(keyleds_get_protocol(device, KEYLEDS_TARGET_DEFAULT, &version, nullptr));
+    EXPECT_EQ(4u, version);
+
+    keyleds_close(device);
+    keyleds_sim_free(sim);
+}
+
+TEST(DeviceTest, openHidpp1) {
+    keyleds_sim_config config = {};
+    config.protocol = 1;
+    auto sim = keyleds_sim_new(&config);
+    EXPECT_EQ(nullptr, keyleds_sim_open(sim, appId));
+    EXPECT_EQ(KEYLEDS_ERROR_HIDVERSION, keyleds_get_errno());
+    keyleds_sim_free(sim);
+}
+
+TEST(DeviceTest, openNotHidpp) {
+    static const uint8_t descriptor[] = {       // mouse-like, no vendor reports
+        0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x02, 0x95, 0x03,
+        0x75, 0x08, 0x09, 0x30, 0x81, 0x06, 0xc0
+    };
+    keyleds_sim_config config = {};
+    config.descriptor = descriptor;
+    config.descriptor_size = sizeof(descriptor);
+    auto sim = keyleds_sim_new(&config);
+    EXPECT_EQ(nullptr, keyleds_sim_open(sim, appId));
+    EXPECT_EQ(KEYLEDS_ERROR_HIDNOPP, keyleds_get_errno());
+    keyleds_sim_free(sim);
+}
+
+/****************************************************************************/
+
+class SimulatedDeviceTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        keyleds_sim_config config = {};
+        config.name = "G410 Simulated Keyboard";
+        config.layout = KEYLEDS_KEYBOARD_LAYOUT_FRA;
+        config.gkeys = 6;
+        m_sim = keyleds_sim_new(&config);
+        ASSERT_NE(nullptr, m_sim);
+        m_device = keyleds_sim_open(m_sim, appId);
+        ASSERT_NE(nullptr, m_device);
+    }
+
+    void TearDown() override
+    {
+        if (m_device) { keyleds_close(m_device); }
+        if (m_sim) { keyleds_sim_free(m_sim); }
+    }
+
+protected:
+    KeyledsSim *    m_sim = nullptr;
+    Keyleds *       m_device = nullptr;
+};
+
+
+TEST_F(SimulatedDeviceTest, features) {
+    EXPECT_EQ(9u, keyleds_get_feature_count(m_device, KEYLEDS_TARGET_DEFAULT));
+    auto ledsIdx = keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS);
+    EXPECT_NE(0, ledsIdx);
+    EXPECT_EQ(KEYLEDS_FEATURE_LEDS, keyleds_get_feature_id(m_device, KEYLEDS_TARGET_DEFAULT, ledsIdx));
+
+    EXPECT_EQ(0, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_BATTERY));
+    EXPECT_EQ(KEYLEDS_ERROR_FEATURE_NOT_FOUND, keyleds_get_errno());
+}
+
+TEST_F(SimulatedDeviceTest, featureTable) {
+    keyleds_sim_stats stats;
+    keyleds_sim_reset_stats(m_sim);
+
+    // Table is loaded on open, lookups do not talk to the device
+    auto ledsIdx = keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS);
+    EXPECT_NE(0, ledsIdx);
+    EXPECT_EQ(0, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_BATTERY));
+    EXPECT_EQ(KEYLEDS_FEATURE_LEDS, keyleds_get_feature_id(m_device, KEYLEDS_TARGET_DEFAULT, ledsIdx));
+    EXPECT_EQ(0, keyleds_get_feature_id(m_device, KEYLEDS_TARGET_DEFAULT, 200));
+    EXPECT_EQ(KEYLEDS_ERROR_FEATURE_NOT_FOUND, keyleds_get_errno());
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(0u, stats.reports);
+
+    // Invalidated table is enumerated again in one pass, on next use
+    keyleds_invalidate_features(m_device, KEYLEDS_TARGET_DEFAULT);
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(0u, stats.reports);
+    EXPECT_EQ(ledsIdx, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(1u + 9u, stats.reports);
+
+    // Resynchronizing invalidates it too
+    keyleds_sim_reset_stats(m_sim);
+    ASSERT_TRUE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_EQ(9u, keyleds_get_feature_count(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_EQ(ledsIdx, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(1u + 1u + 9u, stats.reports);
+}
+
+TEST_F(SimulatedDeviceTest, featureTablePerTarget) {
+    keyleds_sim_stats stats;
+    auto ledsIdx = keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS);
+    EXPECT_EQ(ledsIdx, keyleds_get_feature_index(m_device, 0, KEYLEDS_FEATURE_LEDS));
+
+    // Target 0 has its own table, distinct from the default target's
+    keyleds_sim_reset_stats(m_sim);
+    keyleds_invalidate_features(m_device, 0);
+    EXPECT_EQ(ledsIdx, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(0u, stats.reports);
+    EXPECT_EQ(ledsIdx, keyleds_get_feature_index(m_device, 0, KEYLEDS_FEATURE_LEDS));
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(1u + 9u, stats.reports);
+}
+
+TEST_F(SimulatedDeviceTest, information) {
+    char * name;
+    ASSERT_TRUE(keyleds_get_device_name(m_device, KEYLEDS_TARGET_DEFAULT, &name));
+    EXPECT_EQ(std::string("G410 Simulated Keyboard"), name);
+    keyleds_free_device_name(name);
+
+    keyleds_device_type_t type;
+    ASSERT_TRUE(keyleds_get_device_type(m_device, KEYLEDS_TARGET_DEFAULT, &type));
+    EXPECT_EQ(KEYLEDS_DEVICE_TYPE_KEYBOARD, type);
+
+    keyleds_device_version * version;
+    ASSERT_TRUE(keyleds_get_device_version(m_device, KEYLEDS_TARGET_DEFAULT, &version));
+    EXPECT_EQ(1u, version->length);
+    EXPECT_EQ(std::string("SIM"), version->protocols[0].prefix);
+    keyleds_free_device_version(version);
+
+    EXPECT_EQ(KEYLEDS_KEYBOARD_LAYOUT_FRA, keyleds_keyboard_layout(m_device, KEYLEDS_TARGET_DEFAULT));
+}
+
+TEST_F(SimulatedDeviceTest, gkeys) {
+    struct Received { unsigned count; keyleds_gkeys_type_t type; uint16_t mask; } received = {};
+    auto callback = [](Keyleds *, uint8_t, keyleds_gkeys_type_t type, uint16_t mask, void * data) {
+        auto & result = *static_cast<Received *>(data);
+        result.count += 1;
+        result.type = type;
+        result.mask = mask;
+    };
+
+    unsigned count;
+    ASSERT_TRUE(keyleds_gkeys_count(m_device, KEYLEDS_TARGET_DEFAULT, &count));
+    EXPECT_EQ(6u, count);
+    ASSERT_TRUE(keyleds_gkeys_enable(m_device, KEYLEDS_TARGET_DEFAULT, true));
+    keyleds_gkeys_set_cb(m_device, KEYLEDS_TARGET_DEFAULT, callback, &received);
+
+    ASSERT_TRUE(keyleds_sim_press_gkeys(m_sim, KEYLEDS_GKEYS_MKEY, 0x0102));
+    ASSERT_TRUE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));  // event arrives before reply
+    EXPECT_EQ(1u, received.count);
+    EXPECT_EQ(KEYLEDS_GKEYS_MKEY, received.type);
+    EXPECT_EQ(0x0102, received.mask);
+}
+
+TEST_F(SimulatedDeviceTest, errorReply) {
+    ASSERT_NE(0, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    keyleds_sim_fail_report(m_sim, 1, KEYLEDS_SIM_ERROR_HARDWARE);
+    EXPECT_FALSE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_EQ(KEYLEDS_ERROR_DEVICE, keyleds_get_errno());
+    EXPECT_TRUE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+}
+
+TEST_F(SimulatedDeviceTest, timeout) {
+    ASSERT_NE(0, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    keyleds_set_timeout(m_device, 20000);
+    keyleds_sim_drop_report(m_sim, 1);
+    EXPECT_FALSE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_EQ(KEYLEDS_ERROR_TIMEDOUT, keyleds_get_errno());
+
+    keyleds_sim_stats stats;
+    keyleds_sim_get_stats(m_sim, &stats);
+    EXPECT_EQ(1u, stats.dropped);
+    EXPECT_TRUE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));
+}
+
+TEST_F(SimulatedDeviceTest, nonBlocking) {
+    keyleds_io_stats stats;
+    ASSERT_NE(0, keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+
+    // Blocking mode switches descriptor mode around each flush
+    keyleds_reset_io_stats(m_device);
+    EXPECT_TRUE(keyleds_flush_fd(m_device));
+    keyleds_get_io_stats(m_device, &stats);
+    EXPECT_EQ(2u, stats.fcntls);
+    EXPECT_EQ(1u, stats.reads);
+
+    // Non-blocking mode does not
+    ASSERT_TRUE(keyleds_set_nonblocking(m_device, true));
+    keyleds_reset_io_stats(m_device);
+    EXPECT_TRUE(keyleds_flush_fd(m_device));
+    EXPECT_TRUE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+    keyleds_get_io_stats(m_device, &stats);
+    EXPECT_EQ(0u, stats.fcntls);
+    EXPECT_EQ(1u, stats.writes);
+    EXPECT_EQ(1u, stats.polls);
+    EXPECT_EQ(2u, stats.reads);
+
+    // Timeouts still apply
+    keyleds_set_timeout(m_device, 20000);
+    keyleds_sim_drop_report(m_sim, 1);
+    EXPECT_FALSE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_EQ(KEYLEDS_ERROR_TIMEDOUT, keyleds_get_errno());
+    EXPECT_TRUE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));
+}
+
+TEST_F(SimulatedDeviceTest, closedEndpoint) {
+    keyleds_sim_free(m_sim);
+    m_sim = nullptr;
+    EXPECT_FALSE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));
+}
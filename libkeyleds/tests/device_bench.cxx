@@ -0,0 +1,164 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+
+#include "keyleds.h"
+#include "simulator.h"
+extern "C" {
+#include "keyleds/features.h"
+}
+
+static constexpr uint8_t appId = 0x4;
+
+static const uint16_t lookedUpFeatures[] = {
+    KEYLEDS_FEATURE_VERSION, KEYLEDS_FEATURE_NAME, KEYLEDS_FEATURE_LEDS,
+    KEYLEDS_FEATURE_GKEYS, KEYLEDS_FEATURE_REPORTRATE, KEYLEDS_FEATURE_BATTERY
+};
+
+/****************************************************************************/
+// Feature resolution alone, as done by every call
+
+static void BM_featureIndex(benchmark::State & state)
+{
+    auto sim = keyleds_sim_new(nullptr);
+    auto device = keyleds_sim_open(sim, appId);
+    for (auto _ : state) {
+        for (auto feature : lookedUpFeatures) {
+            benchmark::DoNotOptimize(keyleds_get_feature_index(device, KEYLEDS_TARGET_DEFAULT, feature));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(sizeof(lookedUpFeatures) / sizeof(lookedUpFeatures[0])));
+    keyleds_close(device);
+    keyleds_sim_free(sim);
+}
+BENCHMARK(BM_featureIndex);
+
+// Reloading the feature table, as happens on first call after a resync
+
+static void BM_loadFeatures(benchmark::State & state)
+{
+    auto sim = keyleds_sim_new(nullptr);
+    auto device = keyleds_sim_open(sim, appId);
+    for (auto _ : state) {
+        keyleds_invalidate_features(device, KEYLEDS_TARGET_DEFAULT);
+        benchmark::DoNotOptimize(
+            keyleds_get_feature_index(device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS));
+    }
+    keyleds_close(device);
+    keyleds_sim_free(sim);
+}
+BENCHMARK(BM_loadFeatures)->UseRealTime();
+
+/****************************************************************************/
+// Full call overhead: a LED commit is a single report exchange with no payload
+
+static void BM_call(benchmark::State & state)
+{
+    auto sim = keyleds_sim_new(nullptr);
+    auto device = keyleds_sim_open(sim, appId);
+    for (auto _ : state) {
+        if (!keyleds_commit_leds(device, KEYLEDS_TARGET_DEFAULT)) {
+            state.SkipWithError(keyleds_get_error_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    keyleds_close(device);
+    keyleds_sim_free(sim);
+}
+BENCHMARK(BM_call)->UseRealTime();
+
+// A typical animation frame: flush, update a dozen keys, commit.
+// Argument selects non-blocking mode. Counters are system calls per frame.
+
+static void BM_frame(benchmark::State & state)
+{
+    auto sim = keyleds_sim_new(nullptr);
+    auto device = keyleds_sim_open(sim, appId);
+    keyleds_set_pipeline_depth(device, 4);
+    keyleds_set_nonblocking(device, state.range(0) != 0);
+
+    std::vector<keyleds_key_color> keys;
+    for (unsigned idx = 0; idx < 12; ++idx) { keys.push_back({ uint8_t(idx + 1), 0, 0, 0 }); }
+
+    keyleds_reset_io_stats(device);
+    for (auto _ : state) {
+        if (!keyleds_flush_fd(device) ||
+            !keyleds_set_leds(device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                              keys.data(), unsigned(keys.size())) ||
+            !keyleds_commit_leds(device, KEYLEDS_TARGET_DEFAULT)) {
+            state.SkipWithError(keyleds_get_error_str());
+            break;
+        }
+    }
+
+    keyleds_io_stats stats;
+    keyleds_get_io_stats(device, &stats);
+    const auto frames = double(state.iterations());
+    state.counters["reads"] = double(stats.reads) / frames;
+    state.counters["writes"] = double(stats.writes) / frames;
+    state.counters["polls"] = double(stats.polls) / frames;
+    state.counters["fcntls"] = double(stats.fcntls) / frames;
+    keyleds_close(device);
+    keyleds_sim_free(sim);
+}
+BENCHMARK(BM_frame)->Arg(0)->Arg(1)->UseRealTime();
+
+// Several devices serviced from one thread: each iteration commits on all of them
+// and waits for all replies. Argument is the number of devices.
+
+static void BM_loopCommit(benchmark::State & state)
+{
+    static constexpr uint8_t ledsCommit = 5;
+    auto loop = keyleds_loop_new();
+    std::vector<KeyledsSim *> sims;
+    std::vector<Keyleds *> devices;
+    for (int64_t idx = 0; idx < state.range(0); ++idx) {
+        sims.push_back(keyleds_sim_new(nullptr));
+        devices.push_back(keyleds_sim_open(sims.back(), appId));
+        keyleds_loop_add(loop, devices.back());
+    }
+    auto onDone = [](Keyleds *, const uint8_t *, size_t, void * data) {
+        *static_cast<unsigned *>(data) += 1;
+    };
+
+    for (auto _ : state) {
+        unsigned done = 0;
+        for (auto * device : devices) {
+            keyleds_call_async(device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS, ledsCommit,
+                               0, nullptr, onDone, &done);
+        }
+        while (done < devices.size()) {
+            if (keyleds_loop_dispatch(loop, -1) < 0) {
+                state.SkipWithError(keyleds_get_error_str());
+                break;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+
+    for (auto * device : devices) { keyleds_close(device); }
+    for (auto * sim : sims) { keyleds_sim_free(sim); }
+    keyleds_loop_free(loop);
+}
+BENCHMARK(BM_loopCommit)->Arg(1)->Arg(4)->UseRealTime();
+
+/****************************************************************************/
+
+BENCHMARK_MAIN();
@@ -0,0 +1,194 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+#include "keyleds.h"
+#include "simulator.h"
+extern "C" {
+#include "keyleds/device.h"
+#include "keyleds/features.h"
+}
+
+static constexpr uint8_t    appId = 0x4;
+static constexpr unsigned   keysPerReport = 3;      // (19 - 3 - 4) / 4
+
+
+class FeatureLedsTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_sim = keyleds_sim_new(nullptr);
+        ASSERT_NE(nullptr, m_sim);
+        m_device = keyleds_sim_open(m_sim, appId);
+        ASSERT_NE(nullptr, m_device);
+        keyleds_sim_reset_stats(m_sim);
+    }
+
+    void TearDown() override
+    {
+        if (m_device) { keyleds_close(m_device); }
+        if (m_sim) { keyleds_sim_free(m_sim); }
+    }
+
+    static std::vector<keyleds_key_color> makeKeys(unsigned count)
+    {
+        std::vector<keyleds_key_color> keys;
+        for (unsigned idx = 0; idx < count; ++idx) {
+            keys.push_back({ uint8_t(idx + 1), uint8_t(idx * 3), uint8_t(idx * 5), uint8_t(idx * 7) });
+        }
+        return keys;
+    }
+
+    void expectStaged(const std::vector<keyleds_key_color> & expected)
+    {
+        for (const auto & key : expected) {
+            keyleds_key_color actual;
+            ASSERT_TRUE(keyleds_sim_get_led(m_sim, KEYLEDS_BLOCK_KEYS, key.id, false, &actual));
+            EXPECT_EQ(key.red, actual.red);
+            EXPECT_EQ(key.green, actual.green);
+            EXPECT_EQ(key.blue, actual.blue);
+        }
+    }
+
+    keyleds_sim_stats stats()
+    {
+        keyleds_sim_stats result;
+        keyleds_sim_get_stats(m_sim, &result);
+        return result;
+    }
+
+protected:
+    KeyledsSim *    m_sim = nullptr;
+    Keyleds *       m_device = nullptr;
+};
+
+
+TEST_F(FeatureLedsTest, synchronous) {
+    auto keys = makeKeys(10 * keysPerReport + 1);
+    keyleds_get_feature_index(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS);
+    keyleds_sim_reset_stats(m_sim);
+    keyleds_sim_set_latency(m_sim, 200);
+
+    EXPECT_TRUE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 keys.data(), unsigned(keys.size())));
+    expectStaged(keys);
+    EXPECT_EQ(11u, stats().reports);
+    EXPECT_EQ(1u, stats().max_inflight);
+}
+
+TEST_F(FeatureLedsTest, pipelined) {
+    auto keys = makeKeys(16 * keysPerReport + 2);
+    keyleds_set_pipeline_depth(m_device, 4);
+    keyleds_sim_set_latency(m_sim, 500);
+
+    EXPECT_TRUE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 keys.data(), unsigned(keys.size())));
+    expectStaged(keys);
+    EXPECT_LE(stats().max_inflight, 4u);
+    EXPECT_GT(stats().max_inflight, 1u);
+}
+
+TEST_F(FeatureLedsTest, pipelinedError) {
+    auto keys = makeKeys(16 * keysPerReport);
+    keyleds_set_pipeline_depth(m_device, 4);
+    keyleds_sim_set_latency(m_sim, 200);
+    keyleds_sim_fail_report(m_sim, 5, KEYLEDS_SIM_ERROR_BUSY);
+
+    EXPECT_FALSE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                  keys.data(), unsigned(keys.size())));
+    EXPECT_EQ(KEYLEDS_ERROR_DEVICE, keyleds_get_errno());
+
+    // Device is usable again after resync
+    EXPECT_TRUE(keyleds_ping(m_device, KEYLEDS_TARGET_DEFAULT));
+    EXPECT_TRUE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 keys.data(), unsigned(keys.size())));
+    expectStaged(keys);
+}
+
+TEST_F(FeatureLedsTest, pipelinedErrorThenCall) {
+    auto keys = makeKeys(16 * keysPerReport);
+    keyleds_set_pipeline_depth(m_device, 4);
+    keyleds_sim_set_latency(m_sim, 200);
+    keyleds_sim_fail_report(m_sim, 2, KEYLEDS_SIM_ERROR_BUSY);
+
+    EXPECT_FALSE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                  keys.data(), unsigned(keys.size())));
+    EXPECT_EQ(KEYLEDS_ERROR_DEVICE, keyleds_get_errno());
+
+    // Acknowledgements still in flight must not be taken as replies to next call
+    std::vector<keyleds_key_color> actual(keysPerReport);
+    ASSERT_TRUE(keyleds_get_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 actual.data(), 0, unsigned(actual.size())));
+    for (std::size_t idx = 0; idx < actual.size(); ++idx) {
+        EXPECT_EQ(keys[idx].id, actual[idx].id);
+        EXPECT_EQ(keys[idx].red, actual[idx].red);
+        EXPECT_EQ(keys[idx].green, actual[idx].green);
+        EXPECT_EQ(keys[idx].blue, actual[idx].blue);
+    }
+}
+
+TEST_F(FeatureLedsTest, depthClamping) {
+    keyleds_set_pipeline_depth(m_device, 0);
+    EXPECT_EQ(1u, m_device->pipeline_depth);
+    keyleds_set_pipeline_depth(m_device, 1000);
+    EXPECT_EQ(unsigned(KEYLEDS_PIPELINE_DEPTH_MAX), m_device->pipeline_depth);
+}
+
+TEST_F(FeatureLedsTest, readBack) {
+    auto keys = makeKeys(8);
+    ASSERT_TRUE(keyleds_set_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 keys.data(), unsigned(keys.size())));
+
+    std::vector<keyleds_key_color> actual(keys.size());
+    ASSERT_TRUE(keyleds_get_leds(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_KEYS,
+                                 actual.data(), 0, unsigned(actual.size())));
+    for (std::size_t idx = 0; idx < keys.size(); ++idx) {
+        EXPECT_EQ(keys[idx].id, actual[idx].id);
+        EXPECT_EQ(keys[idx].red, actual[idx].red);
+        EXPECT_EQ(keys[idx].green, actual[idx].green);
+        EXPECT_EQ(keys[idx].blue, actual[idx].blue);
+    }
+}
+
+TEST_F(FeatureLedsTest, blockAndCommit) {
+    keyleds_key_color color;
+    ASSERT_TRUE(keyleds_set_led_block(m_device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_BLOCK_LOGO,
+                                      10, 20, 30));
+    ASSERT_TRUE(keyleds_sim_get_led(m_sim, KEYLEDS_BLOCK_LOGO, 1, true, &color));
+    EXPECT_EQ(0, color.red);
+
+    ASSERT_TRUE(keyleds_commit_leds(m_device, KEYLEDS_TARGET_DEFAULT));
+    ASSERT_TRUE(keyleds_sim_get_led(m_sim, KEYLEDS_BLOCK_LOGO, 1, true, &color));
+    EXPECT_EQ(10, color.red);
+    EXPECT_EQ(20, color.green);
+    EXPECT_EQ(30, color.blue);
+    EXPECT_EQ(1u, stats().commits);
+}
+
+TEST_F(FeatureLedsTest, blockInfo) {
+    keyleds_keyblocks_info * info;
+    ASSERT_TRUE(keyleds_get_block_info(m_device, KEYLEDS_TARGET_DEFAULT, &info));
+    ASSERT_EQ(3u, info->length);
+    EXPECT_EQ(KEYLEDS_BLOCK_KEYS, info->blocks[0].block_id);
+    EXPECT_EQ(106, info->blocks[0].nb_keys);
+    EXPECT_EQ(KEYLEDS_BLOCK_LOGO, info->blocks[2].block_id);
+    keyleds_free_block_info(info);
+}
@@ -0,0 +1,213 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "keyleds.h"
+#include "simulator.h"
+extern "C" {
+#include "keyleds/features.h"
+}
+
+static constexpr uint8_t appId = 0x4;
+static constexpr uint8_t ledsCommit = 5;        // function of KEYLEDS_FEATURE_LEDS
+
+using clock_type = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+
+class LoopTest : public ::testing::Test
+{
+protected:
+    struct Result
+    {
+        unsigned        count = 0;
+        unsigned        failures = 0;
+        keyleds_error_t error = KEYLEDS_NO_ERROR;
+        int             oserror = 0;
+    };
+
+    void SetUp() override
+    {
+        m_loop = keyleds_loop_new();
+        ASSERT_NE(nullptr, m_loop);
+    }
+
+    void TearDown() override
+    {
+        for (auto * device : m_devices) { keyleds_close(device); }
+        for (auto * sim : m_sims) { keyleds_sim_free(sim); }
+        if (m_loop) { keyleds_loop_free(m_loop); }
+    }
+
+    Keyleds * addDevice()
+    {
+        m_sims.push_back(keyleds_sim_new(nullptr));
+        auto * device = keyleds_sim_open(m_sims.back(), appId);
+        if (device) {
+            m_devices.push_back(device);
+            if (!keyleds_loop_add(m_loop, device)) { return nullptr; }
+        }
+        return device;
+    }
+
+    static void onDone(Keyleds *, const uint8_t * data, size_t, void * userdata)
+    {
+        auto & result = *static_cast<Result *>(userdata);
+        result.count += 1;
+        if (data == nullptr) {
+            result.failures += 1;
+            result.error = keyleds_get_errno();
+            result.oserror = errno;
+        }
+    }
+
+    bool commit(Keyleds * device, Result & result)
+    {
+        return keyleds_call_async(device, KEYLEDS_TARGET_DEFAULT, KEYLEDS_FEATURE_LEDS, ledsCommit,
+                                  0, nullptr, onDone, &result);
+    }
+
+    void dispatchUntil(const Result & result, unsigned count)
+    {
+        const auto limit = clock_type::now() + std::chrono::seconds(2);
+        while (result.count < count && clock_type::now() < limit) {
+            ASSERT_LE(0, keyleds_loop_dispatch(m_loop, 100));
+        }
+    }
+
+protected:
+    KeyledsLoop *               m_loop = nullptr;
+    std::vector<KeyledsSim *>   m_sims;
+    std::vector<Keyleds *>      m_devices;
+};
+
+
+TEST_F(LoopTest, call) {
+    auto * device = addDevice();
+    ASSERT_NE(nullptr, device);
+
+    Result result;
+    ASSERT_TRUE(commit(device, result));
+    EXPECT_EQ(1u, keyleds_pending_calls(device));
+    dispatchUntil(result, 1);
+    EXPECT_EQ(1u, result.count);
+    EXPECT_EQ(0u, result.failures);
+    EXPECT_EQ(0u, keyleds_pending_calls(device));
+
+    keyleds_sim_stats stats;
+    keyleds_sim_get_stats(m_sims[0], &stats);
+    EXPECT_EQ(1u, stats.commits);
+}
+
+TEST_F(LoopTest, concurrentDevices) {
+    static constexpr auto latency = milliseconds(30);
+    static constexpr unsigned nbDevices = 3;
+
+    std::vector<Result> results(nbDevices);
+    for (unsigned idx = 0; idx < nbDevices; ++idx) { ASSERT_NE(nullptr, addDevice()); }
+    for (auto * sim : m_sims) { keyleds_sim_set_latency(sim, unsigned(latency.count() * 1000)); }
+
+    Result result;
+    const auto start = clock_type::now();
+    for (auto * device : m_devices) {
+        keyleds_set_timeout(device, 1000000);
+        ASSERT_TRUE(commit(device, result));
+    }
+    dispatchUntil(result, nbDevices);
+    const auto elapsed = clock_type::now() - start;
+
+    EXPECT_EQ(nbDevices, result.count);
+    EXPECT_EQ(0u, result.failures);
+    EXPECT_LT(elapsed, nbDevices * latency);   // devices answered in parallel
+}
+
+TEST_F(LoopTest, timeout) {
+    static constexpr auto timeout = milliseconds(30);
+    auto * device = addDevice();
+    ASSERT_NE(nullptr, device);
+    keyleds_set_timeout(device, unsigned(timeout.count() * 1000));
+    keyleds_sim_drop_report(m_sims[0], 1);
+
+    Result result;
+    const auto start = clock_type::now();
+    ASSERT_TRUE(commit(device, result));
+    dispatchUntil(result, 1);
+    const auto elapsed = clock_type::now() - start;
+
+    EXPECT_EQ(1u, result.failures);
+    EXPECT_EQ(KEYLEDS_ERROR_TIMEDOUT, result.error);
+    EXPECT_GE(elapsed, timeout);
+    EXPECT_LT(elapsed, timeout + milliseconds(25));
+}
+
+TEST_F(LoopTest, errorReply) {
+    auto * device = addDevice();
+    ASSERT_NE(nullptr, device);
+    keyleds_sim_fail_report(m_sims[0], 1, KEYLEDS_SIM_ERROR_HARDWARE);
+
+    Result first, second;
+    ASSERT_TRUE(commit(device, first));
+    ASSERT_TRUE(commit(device, second));
+    dispatchUntil(second, 1);
+    EXPECT_EQ(1u, first.failures);
+    EXPECT_EQ(KEYLEDS_ERROR_DEVICE, first.error);
+    EXPECT_EQ(1u, second.count);
+    EXPECT_EQ(0u, second.failures);
+}
+
+TEST_F(LoopTest, gkeys) {
+    auto * device = addDevice();
+    ASSERT_NE(nullptr, device);
+
+    unsigned presses = 0;
+    ASSERT_TRUE(keyleds_gkeys_enable(device, KEYLEDS_TARGET_DEFAULT, true));
+    keyleds_gkeys_set_cb(device, KEYLEDS_TARGET_DEFAULT,
+                         [](Keyleds *, uint8_t, keyleds_gkeys_type_t, uint16_t, void * data) {
+                             *static_cast<unsigned *>(data) += 1;
+                         }, &presses);
+
+    ASSERT_TRUE(keyleds_sim_press_gkeys(m_sims[0], KEYLEDS_GKEYS_GKEY, 0x1));
+    const auto limit = clock_type::now() + std::chrono::seconds(2);
+    while (presses == 0 && clock_type::now() < limit) {
+        ASSERT_LE(0, keyleds_loop_dispatch(m_loop, 100));
+    }
+    EXPECT_EQ(1u, presses);
+}
+
+TEST_F(LoopTest, limits) {
+    auto * device = addDevice();
+    ASSERT_NE(nullptr, device);
+    keyleds_sim_set_latency(m_sims[0], 5000);
+
+    Result result;
+    unsigned sent = 0;
+    while (commit(device, result)) { ++sent; }
+    EXPECT_EQ(KEYLEDS_ERROR_ERRNO, keyleds_get_errno());
+    EXPECT_EQ(EAGAIN, errno);
+    EXPECT_EQ(sent, keyleds_pending_calls(device));
+
+    // Removing the device cancels everything
+    keyleds_loop_remove(m_loop, device);
+    EXPECT_EQ(sent, result.failures);
+    EXPECT_EQ(ECANCELED, result.oserror);
+    EXPECT_FALSE(commit(device, result));
+    EXPECT_EQ(KEYLEDS_ERROR_INVAL, keyleds_get_errno());
+}
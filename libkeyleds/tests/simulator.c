@@ -0,0 +1,675 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "simulator.h"
+#include "keyleds/features.h"
+
+#define SIM_MAX_FEATURES    (32)
+#define SIM_MAX_BLOCKS      (16)
+#define SIM_MAX_NAME        (64)
+#define SIM_QUEUE_SIZE      (64)
+#define SIM_REPORT_MAX      (64)
+
+#define SIM_REPORT_SHORT    (0x10)  /* report id and payload size the simulator replies with */
+#define SIM_REPORT_SHORT_SIZE   (6)
+#define SIM_REPORT_LONG     (0x11)
+#define SIM_REPORT_LONG_SIZE    (19)
+
+/* Standard descriptor of Logitech HID++ interfaces: short and long vendor reports */
+static const uint8_t default_descriptor[] = {
+    0x06, 0x00, 0xff,   /* Usage Page (Vendor 0xff00) */
+    0x09, 0x01,         /* Usage (0x01) */
+    0xa1, 0x01,         /* Collection (Application) */
+    0x85, 0x10,         /*   Report ID (0x10) */
+    0x95, 0x06,         /*   Report Count (6) */
+    0x75, 0x08,         /*   Report Size (8) */
+    0x15, 0x00,         /*   Logical Minimum (0) */
+    0x26, 0xff, 0x00,   /*   Logical Maximum (255) */
+    0x09, 0x01,         /*   Usage (0x01) */
+    0x81, 0x00,         /*   Input (Data, Array, Absolute) */
+    0x09, 0x01,         /*   Usage (0x01) */
+    0x91, 0x00,         /*   Output (Data, Array, Absolute) */
+    0xc0,               /* End Collection */
+    0x06, 0x00, 0xff,   /* Usage Page (Vendor 0xff00) */
+    0x09, 0x02,         /* Usage (0x02) */
+    0xa1, 0x01,         /* Collection (Application) */
+    0x85, 0x11,         /*   Report ID (0x11) */
+    0x95, 0x13,         /*   Report Count (19) */
+    0x75, 0x08,         /*   Report Size (8) */
+    0x15, 0x00,         /*   Logical Minimum (0) */
+    0x26, 0xff, 0x00,   /*   Logical Maximum (255) */
+    0x09, 0x02,         /*   Usage (0x02) */
+    0x81, 0x00,         /*   Input (Data, Array, Absolute) */
+    0x09, 0x02,         /*   Usage (0x02) */
+    0x91, 0x00,         /*   Output (Data, Array, Absolute) */
+    0xc0                /* End Collection */
+};
+
+static const uint16_t default_features[] = {
+    KEYLEDS_FEATURE_VERSION, KEYLEDS_FEATURE_NAME, KEYLEDS_FEATURE_KEYBOARD_LAYOUT_2,
+    KEYLEDS_FEATURE_GKEYS, KEYLEDS_FEATURE_MKEYS, KEYLEDS_FEATURE_MRKEYS,
+    KEYLEDS_FEATURE_REPORTRATE, KEYLEDS_FEATURE_LEDS, 0
+};
+
+static const struct keyleds_sim_block default_blocks[] = {
+    { KEYLEDS_BLOCK_KEYS, 106 },
+    { KEYLEDS_BLOCK_MULTIMEDIA, 4 },
+    { KEYLEDS_BLOCK_LOGO, 1 },
+    { 0, 0 }
+};
+
+struct sim_block {
+    uint16_t    block_id;
+    uint16_t    nb_keys;
+    struct keyleds_key_color staged[256];       /* indexed by key id */
+    struct keyleds_key_color committed[256];    /* indexed by key id */
+};
+
+struct keyleds_sim {
+    int         fd;                             /* simulator end of the socket pair */
+    int         client_fd;                      /* library end, until keyleds_sim_open() */
+    uint8_t *   descriptor;
+    unsigned    descriptor_size;
+    unsigned    protocol;
+
+    uint16_t    features[SIM_MAX_FEATURES];     /* feature ids, by feature index */
+    unsigned    features_nb;
+    struct sim_block blocks[SIM_MAX_BLOCKS];
+    unsigned    blocks_nb;
+    char        name[SIM_MAX_NAME];
+    uint8_t     type;
+    uint8_t     layout;
+    uint8_t     gkeys;
+    uint8_t     reportrate;
+
+    pthread_t   thread;
+    pthread_mutex_t lock;                       /* protects everything below and writes to fd */
+    unsigned    latency_us;                     /* delay before processing each report */
+    unsigned    fail_at;                        /* report number to reply an error to, or 0 */
+    uint8_t     fail_code;
+    unsigned    drop_at;                        /* report number to ignore, or 0 */
+    struct keyleds_sim_stats stats;
+
+    uint8_t     queue[SIM_QUEUE_SIZE][SIM_REPORT_MAX];  /* received reports awaiting processing */
+    size_t      queue_size[SIM_QUEUE_SIZE];
+    unsigned    queue_head;
+    unsigned    queue_nb;
+};
+
+enum sim_function {
+    F_ROOT_GET_FEATURE = 0, F_ROOT_PING = 1,
+    F_FEATURE_GET_COUNT = 0, F_FEATURE_GET_ID = 1,
+    F_VERSION_GET_DEVICE_INFO = 0, F_VERSION_GET_FIRMWARE_INFO = 1,
+    F_NAME_GET_LENGTH = 0, F_NAME_GET_NAME = 1, F_NAME_GET_TYPE = 2,
+    F_LAYOUT_GET = 0,
+    F_GKEYS_GET_COUNT = 0, F_GKEYS_ENABLE = 2,
+    F_MKEYS_SET = 1,
+    F_MRKEYS_SET = 0,
+    F_REPORTRATE_GET_SUPPORTED = 0, F_REPORTRATE_GET = 1, F_REPORTRATE_SET = 2,
+    F_LEDS_GET_KEYBLOCKS = 0, F_LEDS_GET_BLOCK_INFO = 1, F_LEDS_GET_LEDS = 2,
+    F_LEDS_SET_LEDS = 3, F_LEDS_SET_BLOCK_LEDS = 4, F_LEDS_COMMIT = 5
+};
+
+/****************************************************************************/
+/* Helpers */
+
+static uint8_t sim_feature_index(const KeyledsSim * sim, uint16_t feature_id)
+{
+    unsigned idx;
+    for (idx = 0; idx < sim->features_nb; idx += 1) {
+        if (sim->features[idx] == feature_id) { return (uint8_t)idx; }
+    }
+    return 0;
+}
+
+static struct sim_block * sim_find_block(KeyledsSim * sim, const uint8_t * data)
+{
+    uint16_t block_id = (uint16_t)(data[0] << 8 | data[1]);
+    unsigned idx;
+    for (idx = 0; idx < sim->blocks_nb; idx += 1) {
+        if (sim->blocks[idx].block_id == block_id) { return &sim->blocks[idx]; }
+    }
+    return NULL;
+}
+
+static void sim_send(KeyledsSim * sim, const uint8_t * report, size_t size)
+{
+    (void)send(sim->fd, report, size, MSG_NOSIGNAL);
+}
+
+static void sim_send_error(KeyledsSim * sim, const uint8_t * request, uint8_t code)
+{
+    uint8_t report[1 + SIM_REPORT_SHORT_SIZE] = {
+        SIM_REPORT_SHORT, request[1], 0xff, request[2], request[3], code, 0
+    };
+    sim_send(sim, report, sizeof(report));
+    sim->stats.errors += 1;
+}
+
+static void sim_sleep(unsigned us)
+{
+    struct timespec delay;
+    if (us == 0) { return; }
+    delay.tv_sec = (time_t)(us / 1000000);
+    delay.tv_nsec = (long)(us % 1000000) * 1000;
+    while (nanosleep(&delay, &delay) != 0) {}
+}
+
+/****************************************************************************/
+/* Feature implementations
+ * Each takes the request payload and fills the reply payload, returning 0 on
+ * success or a HID++ error code.
+ */
+
+static uint8_t sim_root(KeyledsSim * sim, unsigned function, const uint8_t * in, uint8_t * out)
+{
+    switch (function) {
+    case F_ROOT_GET_FEATURE:
+        out[0] = sim_feature_index(sim, (uint16_t)(in[0] << 8 | in[1]));
+        return 0;
+    case F_ROOT_PING:
+        out[0] = (uint8_t)sim->protocol;
+        out[1] = 0;
+        out[2] = in[2];
+        return 0;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+static uint8_t sim_feature(KeyledsSim * sim, unsigned function, const uint8_t * in, uint8_t * out)
+{
+    switch (function) {
+    case F_FEATURE_GET_COUNT:
+        out[0] = (uint8_t)(sim->features_nb - 1);   /* root feature is not counted */
+        return 0;
+    case F_FEATURE_GET_ID:
+        if (in[0] >= sim->features_nb) { return KEYLEDS_SIM_ERROR_OUT_OF_RANGE; }
+        out[0] = (uint8_t)(sim->features[in[0]] >> 8);
+        out[1] = (uint8_t)sim->features[in[0]];
+        return 0;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+static uint8_t sim_version(KeyledsSim * sim, unsigned function, const uint8_t * in, uint8_t * out)
+{
+    (void)sim;
+    switch (function) {
+    case F_VERSION_GET_DEVICE_INFO:
+        out[0] = 1;                                 /* one firmware entity */
+        memcpy(&out[1], "\x12\x34\x56\x78", 4);     /* serial */
+        memcpy(&out[7], "\xc3\x30\x00\x00\x00\x00", 6);     /* model */
+        return 0;
+    case F_VERSION_GET_FIRMWARE_INFO:
+        if (in[0] != 0) { return KEYLEDS_SIM_ERROR_OUT_OF_RANGE; }
+        out[0] = 0;                                 /* main application */
+        memcpy(&out[1], "SIM", 3);
+        out[4] = 0x01;                              /* version 1.0 in BCD */
+        out[8] = 1;                                 /* active */
+        return 0;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+static uint8_t sim_name(KeyledsSim * sim, unsigned function, const uint8_t * in, uint8_t * out)
+{
+    size_t length = strlen(sim->name);
+    switch (function) {
+    case F_NAME_GET_LENGTH:
+        out[0] = (uint8_t)length;
+        return 0;
+    case F_NAME_GET_NAME:
+        if (in[0] >= length) { return KEYLEDS_SIM_ERROR_OUT_OF_RANGE; }
+        memcpy(out, &sim->name[in[0]],
+               length - in[0] < SIM_REPORT_LONG_SIZE - 3 ? length - in[0] : SIM_REPORT_LONG_SIZE - 3);
+        return 0;
+    case F_NAME_GET_TYPE:
+        out[0] = sim->type;
+        return 0;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+static uint8_t sim_leds(KeyledsSim * sim, unsigned function, const uint8_t * in, uint8_t * out)
+{
+    struct sim_block * block;
+    unsigned idx, count, offset;
+    uint16_t mask;
+
+    if (function == F_LEDS_GET_KEYBLOCKS) {
+        mask = 0;
+        for (idx = 0; idx < sim->blocks_nb; idx += 1) { mask |= sim->blocks[idx].block_id; }
+        out[0] = (uint8_t)(mask >> 8);
+        out[1] = (uint8_t)mask;
+        return 0;
+    }
+    if (function == F_LEDS_COMMIT) {
+        for (idx = 0; idx < sim->blocks_nb; idx += 1) {
+            memcpy(sim->blocks[idx].committed, sim->blocks[idx].staged,
+                   sizeof(sim->blocks[idx].committed));
+        }
+        sim->stats.commits += 1;
+        return 0;
+    }
+
+    if ((block = sim_find_block(sim, in)) == NULL) { return KEYLEDS_SIM_ERROR_INVALID_ARGUMENT; }
+
+    switch (function) {
+    case F_LEDS_GET_BLOCK_INFO:
+        out[0] = (uint8_t)(block->nb_keys >> 8);
+        out[1] = (uint8_t)block->nb_keys;
+        out[2] = out[3] = out[4] = 0xff;
+        return 0;
+    case F_LEDS_GET_LEDS:
+        offset = (unsigned)(in[2] << 8 | in[3]);
+        memcpy(out, in, 4);
+        for (idx = 0; idx < (SIM_REPORT_LONG_SIZE - 3 - 4) / 4; idx += 1) {
+            unsigned key_id = offset + idx + 1;
+            if (key_id > block->nb_keys || key_id > 255) { break; }
+            out[4 + 4 * idx + 0] = (uint8_t)key_id;
+            out[4 + 4 * idx + 1] = block->staged[key_id].red;
+            out[4 + 4 * idx + 2] = block->staged[key_id].green;
+            out[4 + 4 * idx + 3] = block->staged[key_id].blue;
+        }
+        return 0;
+    case F_LEDS_SET_LEDS:
+        count = (unsigned)(in[2] << 8 | in[3]);
+        if (count > (SIM_REPORT_LONG_SIZE - 3 - 4) / 4) { return KEYLEDS_SIM_ERROR_INVALID_ARGUMENT; }
+        for (idx = 0; idx < count; idx += 1) {
+            const uint8_t * key = &in[4 + 4 * idx];
+            block->staged[key[0]].id = key[0];
+            block->staged[key[0]].red = key[1];
+            block->staged[key[0]].green = key[2];
+            block->staged[key[0]].blue = key[3];
+        }
+        return 0;
+    case F_LEDS_SET_BLOCK_LEDS:
+        for (idx = 0; idx < 256; idx += 1) {
+            block->staged[idx].id = (uint8_t)idx;
+            block->staged[idx].red = in[2];
+            block->staged[idx].green = in[3];
+            block->staged[idx].blue = in[4];
+        }
+        return 0;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+static uint8_t sim_dispatch(KeyledsSim * sim, uint16_t feature_id, unsigned function,
+                            const uint8_t * in, uint8_t * out)
+{
+    switch (feature_id) {
+    case KEYLEDS_FEATURE_ROOT:      return sim_root(sim, function, in, out);
+    case KEYLEDS_FEATURE_FEATURE:   return sim_feature(sim, function, in, out);
+    case KEYLEDS_FEATURE_VERSION:   return sim_version(sim, function, in, out);
+    case KEYLEDS_FEATURE_NAME:      return sim_name(sim, function, in, out);
+    case KEYLEDS_FEATURE_LEDS:      return sim_leds(sim, function, in, out);
+    case KEYLEDS_FEATURE_KEYBOARD_LAYOUT_2:
+        if (function != F_LAYOUT_GET) { break; }
+        out[0] = sim->layout;
+        return 0;
+    case KEYLEDS_FEATURE_GKEYS:
+        if (function == F_GKEYS_GET_COUNT) { out[0] = sim->gkeys; return 0; }
+        if (function == F_GKEYS_ENABLE) { return 0; }
+        break;
+    case KEYLEDS_FEATURE_MKEYS:
+        if (function == F_MKEYS_SET) { return 0; }
+        break;
+    case KEYLEDS_FEATURE_MRKEYS:
+        if (function == F_MRKEYS_SET) { return 0; }
+        break;
+    case KEYLEDS_FEATURE_REPORTRATE:
+        switch (function) {
+        case F_REPORTRATE_GET_SUPPORTED: out[0] = 0x8b; return 0;  /* 1, 2, 4 and 8ms */
+        case F_REPORTRATE_GET: out[0] = sim->reportrate; return 0;
+        case F_REPORTRATE_SET: sim->reportrate = in[0]; return 0;
+        }
+        break;
+    }
+    return KEYLEDS_SIM_ERROR_INVALID_FUNCTION;
+}
+
+/****************************************************************************/
+/* Device thread */
+
+static void sim_handle(KeyledsSim * sim, const uint8_t * request, size_t size)
+{
+    uint8_t reply[1 + SIM_REPORT_LONG_SIZE];
+    uint8_t payload[SIM_REPORT_LONG_SIZE];
+    uint8_t feature_idx, error;
+    unsigned function;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->stats.reports += 1;
+
+    if (sim->stats.reports == sim->drop_at) {
+        sim->drop_at = 0;
+        sim->stats.dropped += 1;
+        goto done;
+    }
+    if (!((request[0] == SIM_REPORT_SHORT && size == 1 + SIM_REPORT_SHORT_SIZE) ||
+          (request[0] == SIM_REPORT_LONG && size == 1 + SIM_REPORT_LONG_SIZE))) {
+        goto done;  /* real devices ignore malformed reports */
+    }
+    if (sim->stats.reports == sim->fail_at) {
+        sim->fail_at = 0;
+        sim_send_error(sim, request, sim->fail_code);
+        goto done;
+    }
+
+    feature_idx = request[2];
+    function = (unsigned)(request[3] >> 4);
+
+    if (sim->protocol < 2) {
+        /* HID++ 1.0 devices reply an error to protocol version queries */
+        if (feature_idx == KEYLEDS_FEATURE_IDX_ROOT && function == F_ROOT_PING) {
+            uint8_t hidpp1[1 + SIM_REPORT_SHORT_SIZE] = {
+                SIM_REPORT_SHORT, request[1], 0x8f, request[2], request[3], 0x01, 0
+            };
+            sim_send(sim, hidpp1, sizeof(hidpp1));
+        }
+        goto done;
+    }
+    if (feature_idx >= sim->features_nb) {
+        sim_send_error(sim, request, KEYLEDS_SIM_ERROR_INVALID_FEATURE_INDEX);
+        goto done;
+    }
+
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, &request[4], size - 4);
+    memset(reply, 0, sizeof(reply));
+    error = sim_dispatch(sim, sim->features[feature_idx], function, payload, &reply[4]);
+    if (error != 0) {
+        sim_send_error(sim, request, error);
+        goto done;
+    }
+    reply[0] = SIM_REPORT_LONG;
+    memcpy(&reply[1], &request[1], 3);
+    sim_send(sim, reply, sizeof(reply));
+
+done:
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static bool sim_read(KeyledsSim * sim, bool block)
+{
+    struct pollfd pfd = { sim->fd, POLLIN, 0 };
+    unsigned slot;
+    ssize_t nread;
+
+    if (sim->queue_nb == SIM_QUEUE_SIZE) { return false; }
+    if (poll(&pfd, 1, block ? -1 : 0) <= 0) { return false; }
+
+    slot = (sim->queue_head + sim->queue_nb) % SIM_QUEUE_SIZE;
+    nread = recv(sim->fd, sim->queue[slot], SIM_REPORT_MAX, 0);
+    if (nread <= 0) { return false; }
+    sim->queue_size[slot] = (size_t)nread;
+    sim->queue_nb += 1;
+    return true;
+}
+
+static void * sim_run(void * arg)
+{
+    KeyledsSim * sim = arg;
+    unsigned latency;
+
+    for (;;) {
+        if (sim->queue_nb == 0 && !sim_read(sim, true)) { break; }
+
+        pthread_mutex_lock(&sim->lock);
+        latency = sim->latency_us;
+        pthread_mutex_unlock(&sim->lock);
+        sim_sleep(latency);
+
+        /* Pick up whatever was sent while we were busy, to track pipelining */
+        while (sim_read(sim, false)) {}
+        pthread_mutex_lock(&sim->lock);
+        if (sim->queue_nb > sim->stats.max_inflight) { sim->stats.max_inflight = sim->queue_nb; }
+        pthread_mutex_unlock(&sim->lock);
+
+        sim_handle(sim, sim->queue[sim->queue_head], sim->queue_size[sim->queue_head]);
+        sim->queue_head = (sim->queue_head + 1) % SIM_QUEUE_SIZE;
+        sim->queue_nb -= 1;
+    }
+    return NULL;
+}
+
+/****************************************************************************/
+/* Public interface */
+
+/** Create a simulated device.
+ * Starts a thread serving the device. It runs until keyleds_sim_free() is called.
+ * @param config Device configuration. NULL or zero fields select defaults: a keyboard
+ *               speaking HID++ 4.2 with the usual features and LED blocks.
+ * @return Simulator instance, or `NULL` on failure.
+ */
+KeyledsSim * keyleds_sim_new(const struct keyleds_sim_config * config)
+{
+    static const struct keyleds_sim_config defaults = { NULL, 0, 0, NULL, NULL, NULL, 0, 0, 0 };
+    const uint16_t * features;
+    const struct keyleds_sim_block * blocks;
+    KeyledsSim * sim;
+    int fds[2];
+
+    if (config == NULL) { config = &defaults; }
+    if ((sim = calloc(1, sizeof(*sim))) == NULL) { return NULL; }
+
+    if (config->descriptor != NULL) {
+        sim->descriptor_size = config->descriptor_size;
+        sim->descriptor = malloc(config->descriptor_size > 0 ? config->descriptor_size : 1);
+        if (sim->descriptor == NULL) { goto error_free_sim; }
+        memcpy(sim->descriptor, config->descriptor, config->descriptor_size);
+    } else {
+        sim->descriptor_size = sizeof(default_descriptor);
+        if ((sim->descriptor = malloc(sizeof(default_descriptor))) == NULL) { goto error_free_sim; }
+        memcpy(sim->descriptor, default_descriptor, sizeof(default_descriptor));
+    }
+    sim->protocol = config->protocol > 0 ? config->protocol : 4;
+
+    sim->features[0] = KEYLEDS_FEATURE_ROOT;
+    sim->features[1] = KEYLEDS_FEATURE_FEATURE;
+    sim->features_nb = 2;
+    for (features = config->features ? config->features : default_features;
+         *features != 0 && sim->features_nb < SIM_MAX_FEATURES; features += 1) {
+        sim->features[sim->features_nb++] = *features;
+    }
+    for (blocks = config->blocks ? config->blocks : default_blocks;
+         blocks->block_id != 0 && sim->blocks_nb < SIM_MAX_BLOCKS; blocks += 1) {
+        sim->blocks[sim->blocks_nb].block_id = blocks->block_id;
+        sim->blocks[sim->blocks_nb].nb_keys = blocks->nb_keys;
+        sim->blocks_nb += 1;
+    }
+    strncpy(sim->name, config->name ? config->name : "Simulated Keyboard", SIM_MAX_NAME - 1);
+    sim->type = config->type;
+    sim->layout = config->layout;
+    sim->gkeys = config->gkeys;
+    sim->reportrate = 1;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) { goto error_free_descriptor; }
+    sim->client_fd = fds[0];
+    sim->fd = fds[1];
+
+    if (pthread_mutex_init(&sim->lock, NULL) != 0) { goto error_close_fds; }
+    if (pthread_create(&sim->thread, NULL, sim_run, sim) != 0) { goto error_destroy_lock; }
+    return sim;
+
+error_destroy_lock:
+    pthread_mutex_destroy(&sim->lock);
+error_close_fds:
+    close(fds[0]);
+    close(fds[1]);
+error_free_descriptor:
+    free(sim->descriptor);
+error_free_sim:
+    free(sim);
+    return NULL;
+}
+
+/** Stop and destroy a simulated device.
+ * Devices opened on it will fail all further communication, but must still be closed.
+ * @param sim Simulator returned by keyleds_sim_new().
+ */
+void keyleds_sim_free(KeyledsSim * sim)
+{
+    assert(sim != NULL);
+    shutdown(sim->fd, SHUT_RDWR);
+    pthread_join(sim->thread, NULL);
+    pthread_mutex_destroy(&sim->lock);
+    if (sim->client_fd >= 0) { close(sim->client_fd); }
+    close(sim->fd);
+    free(sim->descriptor);
+    free(sim);
+}
+
+/** Open the simulated device with libkeyleds.
+ * Can only be called once per simulator.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param app_id Application identifier, as passed to keyleds_open().
+ * @return Device as returned by keyleds_open(), or `NULL` on failure.
+ */
+Keyleds * keyleds_sim_open(KeyledsSim * sim, uint8_t app_id)
+{
+    int fd;
+    assert(sim != NULL);
+    if ((fd = sim->client_fd) < 0) { return NULL; }
+    sim->client_fd = -1;
+    return keyleds_open_fd(fd, sim->descriptor, sim->descriptor_size, app_id);
+}
+
+/** Set how long the simulator waits before processing each report.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param us Delay in microseconds, 0 to answer immediately.
+ */
+void keyleds_sim_set_latency(KeyledsSim * sim, unsigned us)
+{
+    pthread_mutex_lock(&sim->lock);
+    sim->latency_us = us;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/** Reply an error to an upcoming report.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param nth Which report to fail, counting from 1 for the next one. 0 cancels.
+ * @param error_code HID++ error code, such as KEYLEDS_SIM_ERROR_BUSY.
+ */
+void keyleds_sim_fail_report(KeyledsSim * sim, unsigned nth, uint8_t error_code)
+{
+    pthread_mutex_lock(&sim->lock);
+    sim->fail_at = nth > 0 ? sim->stats.reports + nth : 0;
+    sim->fail_code = error_code;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/** Silently ignore an upcoming report, causing a timeout on the library side.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param nth Which report to drop, counting from 1 for the next one. 0 cancels.
+ */
+void keyleds_sim_drop_report(KeyledsSim * sim, unsigned nth)
+{
+    pthread_mutex_lock(&sim->lock);
+    sim->drop_at = nth > 0 ? sim->stats.reports + nth : 0;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/** Send a gkeys event, as if the user pressed some keys.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param type Which feature the event comes from.
+ * @param mask Bitmask of pressed keys.
+ * @return `true` on success, `false` if the simulated device lacks the feature.
+ */
+bool keyleds_sim_press_gkeys(KeyledsSim * sim, keyleds_gkeys_type_t type, uint16_t mask)
+{
+    uint8_t report[1 + SIM_REPORT_LONG_SIZE];
+    uint16_t feature_id;
+    uint8_t feature_idx;
+
+    switch (type) {
+    case KEYLEDS_GKEYS_GKEY:    feature_id = KEYLEDS_FEATURE_GKEYS; break;
+    case KEYLEDS_GKEYS_MKEY:    feature_id = KEYLEDS_FEATURE_MKEYS; break;
+    case KEYLEDS_GKEYS_MRKEY:   feature_id = KEYLEDS_FEATURE_MRKEYS; break;
+    default:                    return false;
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    if ((feature_idx = sim_feature_index(sim, feature_id)) != 0) {
+        memset(report, 0, sizeof(report));
+        report[0] = SIM_REPORT_LONG;
+        report[1] = KEYLEDS_TARGET_DEFAULT;
+        report[2] = feature_idx;
+        report[4] = (uint8_t)mask;
+        report[5] = (uint8_t)(mask >> 8);
+        sim_send(sim, report, sizeof(report));
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return feature_idx != 0;
+}
+
+/** Read traffic statistics.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param [out] stats Filled with current statistics.
+ */
+void keyleds_sim_get_stats(KeyledsSim * sim, struct keyleds_sim_stats * stats)
+{
+    pthread_mutex_lock(&sim->lock);
+    *stats = sim->stats;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/** Reset traffic statistics.
+ * Pending error injections are cancelled.
+ * @param sim Simulator returned by keyleds_sim_new().
+ */
+void keyleds_sim_reset_stats(KeyledsSim * sim)
+{
+    pthread_mutex_lock(&sim->lock);
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    sim->fail_at = 0;
+    sim->drop_at = 0;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/** Read the color of a simulated LED.
+ * @param sim Simulator returned by keyleds_sim_new().
+ * @param block_id Block the key belongs to.
+ * @param key_id Key identifier.
+ * @param committed Whether to read the committed color, or the one pending commit.
+ * @param [out] color Filled with key color on success.
+ * @return `true` on success, `false` if the block does not exist.
+ */
+bool keyleds_sim_get_led(KeyledsSim * sim, uint16_t block_id, uint8_t key_id, bool committed,
+                         struct keyleds_key_color * color)
+{
+    const uint8_t block_data[2] = { (uint8_t)(block_id >> 8), (uint8_t)block_id };
+    const struct sim_block * block;
+
+    pthread_mutex_lock(&sim->lock);
+    if ((block = sim_find_block(sim, block_data)) != NULL) {
+        *color = committed ? block->committed[key_id] : block->staged[key_id];
+        color->id = key_id;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return block != NULL;
+}
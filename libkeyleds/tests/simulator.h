@@ -0,0 +1,88 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDS_SIMULATOR_H
+#define KEYLEDS_SIMULATOR_H
+
+/* Simulated HID++ 2.0 device.
+ *
+ * Serves a keyboard over one end of a socket pair, from a background thread. The
+ * other end is handed to keyleds_open_fd(), so the whole library runs unmodified
+ * against it. Supports feature discovery, device information, gkeys and LED
+ * get/set/commit, with optional per-report latency and error injection.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "keyleds.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct keyleds_sim KeyledsSim;
+
+struct keyleds_sim_block {
+    uint16_t    block_id;           /* block identifier, 0 terminates the list */
+    uint16_t    nb_keys;            /* number of keys, key ids are 1..nb_keys */
+};
+
+struct keyleds_sim_config {
+    const uint8_t * descriptor;     /* HID report descriptor, NULL for standard HID++ */
+    unsigned    descriptor_size;
+    unsigned    protocol;           /* protocol version, 1 simulates a HID++ 1.0 device */
+    const uint16_t * features;      /* supported features, 0-terminated, NULL for default */
+    const struct keyleds_sim_block * blocks;    /* LED blocks, NULL for default */
+    const char * name;              /* device name, NULL for default */
+    uint8_t     type;               /* keyleds_device_type_t */
+    uint8_t     layout;             /* keyleds_keyboard_layout_t */
+    uint8_t     gkeys;              /* number of gkeys */
+};
+
+struct keyleds_sim_stats {
+    unsigned    reports;            /* reports received */
+    unsigned    errors;             /* error replies sent */
+    unsigned    dropped;            /* reports dropped on purpose */
+    unsigned    commits;            /* LED commits */
+    unsigned    max_inflight;       /* max reports waiting for a reply at once */
+};
+
+KeyledsSim * keyleds_sim_new(/*@null@*/ const struct keyleds_sim_config * config);
+void keyleds_sim_free(KeyledsSim * sim);
+Keyleds * keyleds_sim_open(KeyledsSim * sim, uint8_t app_id);
+
+void keyleds_sim_set_latency(KeyledsSim * sim, unsigned us);
+void keyleds_sim_fail_report(KeyledsSim * sim, unsigned nth, uint8_t error_code);
+void keyleds_sim_drop_report(KeyledsSim * sim, unsigned nth);
+bool keyleds_sim_press_gkeys(KeyledsSim * sim, keyleds_gkeys_type_t type, uint16_t mask);
+
+void keyleds_sim_get_stats(KeyledsSim * sim, /*@out@*/ struct keyleds_sim_stats * stats);
+void keyleds_sim_reset_stats(KeyledsSim * sim);
+bool keyleds_sim_get_led(KeyledsSim * sim, uint16_t block_id, uint8_t key_id, bool committed,
+                         /*@out@*/ struct keyleds_key_color * color);
+
+#define KEYLEDS_SIM_ERROR_INVALID_ARGUMENT      (0x02)
+#define KEYLEDS_SIM_ERROR_OUT_OF_RANGE          (0x03)
+#define KEYLEDS_SIM_ERROR_HARDWARE              (0x04)
+#define KEYLEDS_SIM_ERROR_INVALID_FEATURE_INDEX (0x06)
+#define KEYLEDS_SIM_ERROR_INVALID_FUNCTION      (0x07)
+#define KEYLEDS_SIM_ERROR_BUSY                  (0x08)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif